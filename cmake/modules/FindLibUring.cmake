@@ -0,0 +1,18 @@
+# Redistribution and use is allowed according to the terms of the BSD license.
+# For details see the accompanying COPYING* file.
+
+# This module defines
+#  LIBURING_INCLUDE_DIR, where to find liburing.h.
+#  LIBURING_LIBRARY, the liburing library.
+#  LIBURING_FOUND, If false, do not try to use io_uring.
+
+find_path(LIBURING_INCLUDE_DIR liburing.h)
+mark_as_advanced(LIBURING_INCLUDE_DIR)
+
+find_library(LIBURING_LIBRARY uring)
+mark_as_advanced(LIBURING_LIBRARY)
+
+# handle the QUIETLY and REQUIRED arguments and set LIBURING_FOUND to TRUE if
+# all listed variables are TRUE
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(LIBURING DEFAULT_MSG LIBURING_INCLUDE_DIR LIBURING_LIBRARY)
@@ -18,9 +18,28 @@
 #include "config.h"
 #include "filesystembase.h"
 #include "common/checksums.h"
-
+#include "common/syncjournaldb.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QFutureInterface>
 #include <QLoggingCategory>
-#include <qtconcurrentrun.h>
+#include <QThread>
+
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define OC_CHECKSUMS_X86
+#define OC_TARGET(features) __attribute__((target(features)))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define OC_CHECKSUMS_X86
+#define OC_TARGET(features)
+#include <intrin.h>
+#endif
 
 /** \file checksums.cpp
  *
@@ -67,13 +86,36 @@
  *
  * Content checksums are not sent to the server.
  *
+ * Checksum Cache
+ * --------------
+ *
+ * Local files are often checksummed more than once, e.g. when a rename is
+ * verified in every sync until it could be propagated. The journal caches
+ * the checksums of local files by inode together with the size, mtime and
+ * ctime. Any change of these values makes the cached checksum unusable.
+ *
+ * Block Checksums
+ * ---------------
+ *
+ * For large files the journal can also store a MD5 digest of each block
+ * of the version on the server. When the file changes only the blocks
+ * whose digest differs are transferred.
+ *
  * Checksum Algorithms
  * -------------------
  *
- * - Adler32 (requires zlib)
+ * - Adler32
+ * - CRC32C
  * - MD5
  * - SHA1
  *
+ * Adler32 and CRC32C are much cheaper to compute than the cryptographic
+ * hashes, they are good enough to detect transmission errors but not to
+ * tell apart files with different content. Adler32 uses SSSE3 or AVX2
+ * and CRC32C the crc32 instruction of SSE 4.2 when the CPU has them, this
+ * is detected at runtime. Setting OWNCLOUD_DISABLE_CHECKSUM_SIMD uses the
+ * portable implementations.
+ *
  */
 
 namespace OCC {
@@ -96,6 +138,7 @@ QByteArray findBestChecksum(const QByteArray &checksums)
     // The order of the searches here defines the preference ordering.
     if (-1 != (i = checksums.indexOf("SHA1:"))
         || -1 != (i = checksums.indexOf("MD5:"))
+        || -1 != (i = checksums.indexOf("CRC32C:"))
         || -1 != (i = checksums.indexOf("Adler32:"))) {
         // Now i is the start of the best checksum
         // Grab it until the next space or end of string.
@@ -133,6 +176,322 @@ QByteArray parseChecksumHeaderType(const QByteArray &header)
     return header.left(idx);
 }
 
+QByteArray computeBlockChecksums(const QString &filePath, qint64 blockSize)
+{
+    QFile file(filePath);
+    QString error;
+    if (!FileSystem::openAndSeekFileSharedRead(&file, &error, 0)) {
+        qCWarning(lcChecksums) << "Could not open" << filePath << error;
+        return QByteArray();
+    }
+    FileSystem::adviseSequentialRead(&file);
+
+    QByteArray checksums;
+    checksums.reserve((file.size() / blockSize + 1) * 16);
+    QByteArray block(blockSize, Qt::Uninitialized);
+    while (true) {
+        const qint64 r = file.read(block.data(), blockSize);
+        if (r < 0) {
+            qCWarning(lcChecksums) << "Error reading" << filePath << file.errorString();
+            return QByteArray();
+        }
+        if (r == 0)
+            break;
+        checksums += QCryptographicHash::hash(QByteArray::fromRawData(block.constData(), r), QCryptographicHash::Md5);
+    }
+    return checksums;
+}
+
+QVector<QPair<qint64, qint64>> changedBlockRanges(const QByteArray &checksums,
+    const QByteArray &baseChecksums, qint64 size, qint64 blockSize)
+{
+    const int digestSize = 16;
+    QVector<QPair<qint64, qint64>> ranges;
+    for (int i = 0; i * digestSize < checksums.size(); ++i) {
+        const int pos = i * digestSize;
+        if (pos + digestSize <= baseChecksums.size()
+            && memcmp(checksums.constData() + pos, baseChecksums.constData() + pos, digestSize) == 0) {
+            continue;
+        }
+        const qint64 offset = i * blockSize;
+        const qint64 length = qMin(blockSize, size - offset);
+        if (!ranges.isEmpty() && ranges.last().first + ranges.last().second == offset) {
+            ranges.last().second += length;
+        } else {
+            ranges.append(qMakePair(offset, length));
+        }
+    }
+    return ranges;
+}
+
+static const quint32 adlerBase = 65521;
+// The largest number of bytes for which s2 can't overflow before the modulo
+static const size_t adlerNMax = 5552;
+
+static quint32 adler32Generic(quint32 adler, const uchar *data, size_t len)
+{
+    quint32 s1 = adler & 0xffff;
+    quint32 s2 = adler >> 16;
+    while (len > 0) {
+        size_t n = qMin(len, adlerNMax);
+        len -= n;
+        while (n--) {
+            s1 += *data++;
+            s2 += s1;
+        }
+        s1 %= adlerBase;
+        s2 %= adlerBase;
+    }
+    return s1 | (s2 << 16);
+}
+
+static const quint32 *crc32cTable()
+{
+    static quint32 table[256];
+    static bool initialized = [] {
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 crc = i;
+            for (int bit = 0; bit < 8; ++bit)
+                crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+            table[i] = crc;
+        }
+        return true;
+    }();
+    Q_UNUSED(initialized);
+    return table;
+}
+
+static quint32 crc32cGeneric(quint32 crc, const uchar *data, size_t len)
+{
+    const quint32 *table = crc32cTable();
+    crc = ~crc;
+    while (len--)
+        crc = table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#ifdef OC_CHECKSUMS_X86
+static bool checksumSimdEnabled()
+{
+    static bool enabled = qEnvironmentVariableIsEmpty("OWNCLOUD_DISABLE_CHECKSUM_SIMD");
+    return enabled;
+}
+
+OC_TARGET("ssse3")
+static inline quint32 horizontalSum(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    return quint32(_mm_cvtsi128_si32(v));
+}
+
+/*
+ * Processes the data in blocks of 32 bytes: s1 grows by the sum of the
+ * bytes, s2 by 32 times the s1 from before the block plus the bytes
+ * weighted with their distance to the end of the block.
+ */
+OC_TARGET("ssse3")
+static quint32 adler32Ssse3(quint32 adler, const uchar *data, size_t len)
+{
+    quint32 s1 = adler & 0xffff;
+    quint32 s2 = adler >> 16;
+    const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+
+    size_t blocks = len / 32;
+    len -= blocks * 32;
+    while (blocks > 0) {
+        size_t n = qMin(blocks, adlerNMax / 32);
+        blocks -= n;
+
+        __m128i vPreviousS1 = _mm_set_epi32(0, 0, 0, int(s1 * n));
+        __m128i vS1 = zero;
+        __m128i vS2 = _mm_set_epi32(0, 0, 0, int(s2));
+        do {
+            const __m128i bytes1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+            const __m128i bytes2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16));
+            vPreviousS1 = _mm_add_epi32(vPreviousS1, vS1);
+            vS1 = _mm_add_epi32(vS1, _mm_sad_epu8(bytes1, zero));
+            vS1 = _mm_add_epi32(vS1, _mm_sad_epu8(bytes2, zero));
+            vS2 = _mm_add_epi32(vS2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+            vS2 = _mm_add_epi32(vS2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+            data += 32;
+        } while (--n);
+        vS2 = _mm_add_epi32(vS2, _mm_slli_epi32(vPreviousS1, 5));
+
+        s1 = (s1 + horizontalSum(vS1)) % adlerBase;
+        s2 = horizontalSum(vS2) % adlerBase;
+    }
+    return adler32Generic(s1 | (s2 << 16), data, len);
+}
+
+/// Like adler32Ssse3() with one 32 byte register per block
+OC_TARGET("avx2")
+static quint32 adler32Avx2(quint32 adler, const uchar *data, size_t len)
+{
+    quint32 s1 = adler & 0xffff;
+    quint32 s2 = adler >> 16;
+    const __m256i tap = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+
+    size_t blocks = len / 32;
+    len -= blocks * 32;
+    while (blocks > 0) {
+        size_t n = qMin(blocks, adlerNMax / 32);
+        blocks -= n;
+
+        __m256i vPreviousS1 = _mm256_setr_epi32(int(s1 * n), 0, 0, 0, 0, 0, 0, 0);
+        __m256i vS1 = zero;
+        __m256i vS2 = _mm256_setr_epi32(int(s2), 0, 0, 0, 0, 0, 0, 0);
+        do {
+            const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+            vPreviousS1 = _mm256_add_epi32(vPreviousS1, vS1);
+            vS1 = _mm256_add_epi32(vS1, _mm256_sad_epu8(bytes, zero));
+            vS2 = _mm256_add_epi32(vS2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, tap), ones));
+            data += 32;
+        } while (--n);
+        vS2 = _mm256_add_epi32(vS2, _mm256_slli_epi32(vPreviousS1, 5));
+
+        const __m128i sumS1 = _mm_add_epi32(_mm256_castsi256_si128(vS1), _mm256_extracti128_si256(vS1, 1));
+        const __m128i sumS2 = _mm_add_epi32(_mm256_castsi256_si128(vS2), _mm256_extracti128_si256(vS2, 1));
+        s1 = (s1 + horizontalSum(sumS1)) % adlerBase;
+        s2 = horizontalSum(sumS2) % adlerBase;
+    }
+    return adler32Generic(s1 | (s2 << 16), data, len);
+}
+
+OC_TARGET("sse4.2")
+static quint32 crc32cSse42(quint32 crc, const uchar *data, size_t len)
+{
+    crc = ~crc;
+    for (; len > 0 && (quintptr(data) & 7); --len)
+        crc = _mm_crc32_u8(crc, *data++);
+#if defined(__x86_64__) || defined(_M_X64)
+    quint64 crc64 = crc;
+    for (; len >= 8; len -= 8, data += 8) {
+        quint64 value;
+        memcpy(&value, data, 8);
+        crc64 = _mm_crc32_u64(crc64, value);
+    }
+    crc = quint32(crc64);
+#endif
+    for (; len >= 4; len -= 4, data += 4) {
+        quint32 value;
+        memcpy(&value, data, 4);
+        crc = _mm_crc32_u32(crc, value);
+    }
+    for (; len > 0; --len)
+        crc = _mm_crc32_u8(crc, *data++);
+    return ~crc;
+}
+
+#if defined(_MSC_VER)
+static bool cpuHasSsse3()
+{
+    int info[4];
+    __cpuid(info, 1);
+    return info[2] & (1 << 9);
+}
+
+static bool cpuHasSse42()
+{
+    int info[4];
+    __cpuid(info, 1);
+    return info[2] & (1 << 20);
+}
+
+static bool cpuHasAvx2()
+{
+    int info[4];
+    __cpuid(info, 1);
+    // The OS has to save the AVX registers too
+    if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+}
+#else
+static bool cpuHasSsse3() { return __builtin_cpu_supports("ssse3"); }
+static bool cpuHasSse42() { return __builtin_cpu_supports("sse4.2"); }
+static bool cpuHasAvx2() { return __builtin_cpu_supports("avx2"); }
+#endif
+#endif // OC_CHECKSUMS_X86
+
+quint32 adler32Update(quint32 adler, const char *data, qint64 len)
+{
+    typedef quint32 (*Implementation)(quint32, const uchar *, size_t);
+    static const Implementation implementation = []() -> Implementation {
+#ifdef OC_CHECKSUMS_X86
+        if (checksumSimdEnabled() && cpuHasAvx2()) {
+            qCInfo(lcChecksums) << "Using AVX2 for Adler32";
+            return adler32Avx2;
+        }
+        if (checksumSimdEnabled() && cpuHasSsse3()) {
+            qCInfo(lcChecksums) << "Using SSSE3 for Adler32";
+            return adler32Ssse3;
+        }
+#endif
+        return adler32Generic;
+    }();
+    return implementation(adler, reinterpret_cast<const uchar *>(data), size_t(len));
+}
+
+quint32 crc32cUpdate(quint32 crc, const char *data, qint64 len)
+{
+    typedef quint32 (*Implementation)(quint32, const uchar *, size_t);
+    static const Implementation implementation = []() -> Implementation {
+#ifdef OC_CHECKSUMS_X86
+        if (checksumSimdEnabled() && cpuHasSse42()) {
+            qCInfo(lcChecksums) << "Using SSE 4.2 for CRC32C";
+            return crc32cSse42;
+        }
+#endif
+        return crc32cGeneric;
+    }();
+    return implementation(crc, reinterpret_cast<const uchar *>(data), size_t(len));
+}
+
+/// Feeds the content of the file to \a update, false if it can't be read
+template <typename Update>
+static bool readWith(const QString &filePath, quint32 *checksum, Update update)
+{
+    QString error;
+    if (!FileSystem::readFileBlocks(filePath, [&](const char *data, qint64 size) { *checksum = update(*checksum, data, size); }, &error)) {
+        qCWarning(lcChecksums) << "Could not read" << filePath << error;
+        return false;
+    }
+    return true;
+}
+
+QByteArray calcAdler32(const QString &filePath)
+{
+    quint32 adler = 1;
+    if (!readWith(filePath, &adler, adler32Update))
+        return QByteArray();
+    return QByteArray::number(adler, 16);
+}
+
+QByteArray calcCrc32c(const QString &filePath)
+{
+    quint32 crc = 0;
+    if (!readWith(filePath, &crc, crc32cUpdate))
+        return QByteArray();
+    return QByteArray::number(crc, 16).rightJustified(8, '0');
+}
+
+QByteArray calcFastChecksum(const QByteArray &checksumType, const QByteArray &data)
+{
+    if (checksumType == checkSumAdlerC)
+        return QByteArray::number(adler32Update(1, data.constData(), data.size()), 16);
+    if (checksumType == checkSumCrc32cC)
+        return QByteArray::number(crc32cUpdate(0, data.constData(), data.size()), 16).rightJustified(8, '0');
+    return QByteArray();
+}
+
 bool uploadChecksumEnabled()
 {
     static bool enabled = qEnvironmentVariableIsEmpty("OWNCLOUD_DISABLE_CHECKSUM_UPLOAD");
@@ -154,11 +513,116 @@ static bool checksumComputationEnabled()
     return enabled;
 }
 
+class ChecksumThreadPool::Task : public QRunnable
+{
+public:
+    Task(ChecksumThreadPool *pool, const QString &filePath, const QByteArray &checksumType, qint64 size)
+        : _pool(pool)
+        , _filePath(filePath)
+        , _checksumType(checksumType)
+        , _size(size)
+    {
+        _interface.reportStarted();
+    }
+
+    QFuture<QByteArray> future() { return _interface.future(); }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        {
+            QMutexLocker locker(&_pool->_statsMutex);
+            _pool->_stats.queued--;
+            if (_interface.isCanceled()) {
+                _interface.reportFinished();
+                return;
+            }
+            _pool->_stats.active++;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        const QByteArray checksum = ComputeChecksum::computeNow(_filePath, _checksumType);
+        const qint64 msecs = timer.elapsed();
+
+        {
+            QMutexLocker locker(&_pool->_statsMutex);
+            _pool->_stats.active--;
+            _pool->_stats.files++;
+            _pool->_stats.bytes += _size;
+            _pool->_stats.msecs += msecs;
+        }
+        if (msecs > 1000) {
+            qCInfo(lcChecksums) << "Computed" << _checksumType << "checksum of" << _filePath << "with"
+                                << _size / 1000 / msecs << "MB/s";
+        }
+
+        _interface.reportResult(checksum);
+        _interface.reportFinished();
+    }
+
+private:
+    ChecksumThreadPool *_pool;
+    QString _filePath;
+    QByteArray _checksumType;
+    qint64 _size;
+    QFutureInterface<QByteArray> _interface;
+};
+
+ChecksumThreadPool::ChecksumThreadPool()
+{
+    _pool.setMaxThreadCount(maximumThreadCount());
+}
+
+ChecksumThreadPool *ChecksumThreadPool::instance()
+{
+    static ChecksumThreadPool pool;
+    return &pool;
+}
+
+int ChecksumThreadPool::maximumThreadCount()
+{
+    static int max = [] {
+        int env = qgetenv("OWNCLOUD_MAX_CHECKSUM_THREADS").toInt();
+        if (env > 0)
+            return env;
+        return qBound(1, QThread::idealThreadCount(), 2);
+    }();
+    return max;
+}
+
+QFuture<QByteArray> ChecksumThreadPool::start(const QString &filePath, const QByteArray &checksumType)
+{
+    const qint64 size = QFileInfo(filePath).size();
+    auto task = new Task(this, filePath, checksumType, size);
+    auto future = task->future();
+    {
+        QMutexLocker locker(&_statsMutex);
+        _stats.queued++;
+    }
+
+    // Files below one megabyte take a few milliseconds
+    const int priority = size < 1024 * 1024 ? 1 : 0;
+    _pool.start(task, priority);
+    return future;
+}
+
+ChecksumThreadPool::Stats ChecksumThreadPool::stats() const
+{
+    QMutexLocker locker(&_statsMutex);
+    return _stats;
+}
+
 ComputeChecksum::ComputeChecksum(QObject *parent)
     : QObject(parent)
 {
 }
 
+ComputeChecksum::~ComputeChecksum()
+{
+    // Nobody waits for the result anymore
+    _watcher.cancel();
+}
+
 void ComputeChecksum::setChecksumType(const QByteArray &type)
 {
     _checksumType = type;
@@ -171,32 +635,42 @@ QByteArray ComputeChecksum::checksumType() const
 
 void ComputeChecksum::start(const QString &filePath)
 {
+    // The checksum cache is only used from this thread: the journal may be
+    // gone by the time the pool gets to the file
+    _filePath = filePath;
+    _identityValid = _journal && !_checksumType.isEmpty() && checksumComputationEnabled()
+        && FileSystem::getFileIdentity(filePath, &_identity);
+    if (_identityValid) {
+        const QByteArray checksum = _journal->getCachedChecksum(_identity, _checksumType);
+        if (!checksum.isEmpty()) {
+            qCDebug(lcChecksums) << "Using the cached" << _checksumType << "checksum of" << filePath;
+            QMetaObject::invokeMethod(this, "done", Qt::QueuedConnection,
+                Q_ARG(QByteArray, _checksumType), Q_ARG(QByteArray, checksum));
+            return;
+        }
+    }
+
     qCInfo(lcChecksums) << "Computing" << checksumType() << "checksum of" << filePath << "in a thread";
 
     // Calculate the checksum in a different thread first.
     connect(&_watcher, &QFutureWatcherBase::finished,
         this, &ComputeChecksum::slotCalculationDone,
         Qt::UniqueConnection);
-    _watcher.setFuture(QtConcurrent::run(ComputeChecksum::computeNow, filePath, checksumType()));
+    _watcher.setFuture(ChecksumThreadPool::instance()->start(filePath, checksumType()));
 }
 
-QByteArray ComputeChecksum::computeNow(const QString &filePath, const QByteArray &checksumType)
+static QByteArray computeChecksumOfFile(const QString &filePath, const QByteArray &checksumType)
 {
-    if (!checksumComputationEnabled()) {
-        qCWarning(lcChecksums) << "Checksum computation disabled by environment variable";
-        return QByteArray();
-    }
-
     if (checksumType == checkSumMD5C) {
         return FileSystem::calcMd5(filePath);
     } else if (checksumType == checkSumSHA1C) {
         return FileSystem::calcSha1(filePath);
     }
-#ifdef ZLIB_FOUND
     else if (checksumType == checkSumAdlerC) {
-        return FileSystem::calcAdler32(filePath);
+        return calcAdler32(filePath);
+    } else if (checksumType == checkSumCrc32cC) {
+        return calcCrc32c(filePath);
     }
-#endif
     // for an unknown checksum or no checksum, we're done right now
     if (!checksumType.isEmpty()) {
         qCWarning(lcChecksums) << "Unknown checksum type:" << checksumType;
@@ -204,9 +678,51 @@ QByteArray ComputeChecksum::computeNow(const QString &filePath, const QByteArray
     return QByteArray();
 }
 
+/* Whether the checksum of a file read since it had \a identity can be cached:
+ * only if the file didn't change while it was read. With time stamps of whole
+ * seconds (maybe a file system with coarse ones) a change right after the read
+ * could go unnoticed, so the file must be older. */
+static bool isCacheable(const QString &filePath, const FileSystem::FileIdentity &identity)
+{
+    FileSystem::FileIdentity after;
+    const qint64 second = 1000000000LL;
+    const qint64 now = QDateTime::currentMSecsSinceEpoch() * 1000000;
+    return FileSystem::getFileIdentity(filePath, &after) && after == identity
+        && (identity.ctime % second != 0 || now - identity.ctime > 2 * second);
+}
+
+QByteArray ComputeChecksum::computeNow(const QString &filePath, const QByteArray &checksumType,
+    SyncJournalDb *journal)
+{
+    if (!checksumComputationEnabled()) {
+        qCWarning(lcChecksums) << "Checksum computation disabled by environment variable";
+        return QByteArray();
+    }
+
+    FileSystem::FileIdentity identity;
+    if (!journal || checksumType.isEmpty() || !FileSystem::getFileIdentity(filePath, &identity)) {
+        return computeChecksumOfFile(filePath, checksumType);
+    }
+
+    QByteArray checksum = journal->getCachedChecksum(identity, checksumType);
+    if (!checksum.isEmpty()) {
+        qCDebug(lcChecksums) << "Using the cached" << checksumType << "checksum of" << filePath;
+        return checksum;
+    }
+
+    checksum = computeChecksumOfFile(filePath, checksumType);
+    if (!checksum.isEmpty() && isCacheable(filePath, identity)) {
+        journal->setCachedChecksum(identity, checksumType, checksum);
+    }
+    return checksum;
+}
+
 void ComputeChecksum::slotCalculationDone()
 {
     QByteArray checksum = _watcher.future().result();
+    if (_identityValid && !checksum.isEmpty() && isCacheable(_filePath, _identity)) {
+        _journal->setCachedChecksum(_identity, _checksumType, checksum);
+    }
     if (!checksum.isNull()) {
         emit done(_checksumType, checksum);
     } else {
@@ -255,18 +771,20 @@ void ValidateChecksumHeader::slotChecksumCalculated(const QByteArray &checksumTy
     emit validated(checksumType, checksum);
 }
 
-CSyncChecksumHook::CSyncChecksumHook()
+CSyncChecksumHook::CSyncChecksumHook(SyncJournalDb *journal)
+    : _journal(journal)
 {
 }
 
-QByteArray CSyncChecksumHook::hook(const QByteArray &path, const QByteArray &otherChecksumHeader, void * /*this_obj*/)
+QByteArray CSyncChecksumHook::hook(const QByteArray &path, const QByteArray &otherChecksumHeader, void *this_obj)
 {
+    auto self = static_cast<CSyncChecksumHook *>(this_obj);
     QByteArray type = parseChecksumHeaderType(QByteArray(otherChecksumHeader));
     if (type.isEmpty())
         return NULL;
 
     qCInfo(lcChecksums) << "Computing" << type << "checksum of" << path << "in the csync hook";
-    QByteArray checksum = ComputeChecksum::computeNow(QString::fromUtf8(path), type);
+    QByteArray checksum = ComputeChecksum::computeNow(QString::fromUtf8(path), type, self->_journal);
     if (checksum.isNull()) {
         qCWarning(lcChecksums) << "Failed to compute checksum" << type << "for" << path;
         return NULL;
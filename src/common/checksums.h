@@ -19,10 +19,15 @@
 #pragma once
 
 #include "ocsynclib.h"
+#include "common/filesystembase.h"
 
 #include <QObject>
 #include <QByteArray>
 #include <QFutureWatcher>
+#include <QMutex>
+#include <QPair>
+#include <QThreadPool>
+#include <QVector>
 
 namespace OCC {
 
@@ -33,6 +38,7 @@ namespace OCC {
 static const char checkSumMD5C[] = "MD5";
 static const char checkSumSHA1C[] = "SHA1";
 static const char checkSumAdlerC[] = "Adler32";
+static const char checkSumCrc32cC[] = "CRC32C";
 
 class SyncJournalDb;
 
@@ -40,6 +46,8 @@ class SyncJournalDb;
  * Returns the highest-quality checksum in a 'checksums'
  * property retrieved from the server.
  *
+ * The preference ordering is SHA1, MD5, CRC32C, Adler32.
+ *
  * Example: "ADLER32:1231 SHA1:ab124124 MD5:2131affa21"
  *       -> "SHA1:ab124124"
  */
@@ -61,6 +69,93 @@ OCSYNC_EXPORT bool uploadChecksumEnabled();
 /// Checks OWNCLOUD_CONTENT_CHECKSUM_TYPE (default: SHA1)
 OCSYNC_EXPORT QByteArray contentChecksumType();
 
+/**
+ * Continues the Adler32 checksum \a adler (1 for no data) with \a len bytes
+ * of \a data. Vectorized with AVX2 or SSSE3 if the CPU supports it.
+ */
+OCSYNC_EXPORT quint32 adler32Update(quint32 adler, const char *data, qint64 len);
+
+/**
+ * Continues the CRC32C (Castagnoli) checksum \a crc (0 for no data) with
+ * \a len bytes of \a data. Uses the crc32 instruction of SSE 4.2 if the
+ * CPU supports it.
+ */
+OCSYNC_EXPORT quint32 crc32cUpdate(quint32 crc, const char *data, qint64 len);
+
+/// The Adler32 checksum of a file in hex, empty if it can't be read
+OCSYNC_EXPORT QByteArray calcAdler32(const QString &filePath);
+
+/// The CRC32C checksum of a file as 8 hex digits, empty if it can't be read
+OCSYNC_EXPORT QByteArray calcCrc32c(const QString &filePath);
+
+/**
+ * The Adler32 or CRC32C checksum of \a data, in the same format as the
+ * file checksums above. Empty for other types.
+ */
+OCSYNC_EXPORT QByteArray calcFastChecksum(const QByteArray &checksumType, const QByteArray &data);
+
+/// The size of the blocks of the block checksums
+static const qint64 blockChecksumSize = 1024 * 1024;
+
+/**
+ * Computes the MD5 digests of the blocks of a file, one after the other.
+ *
+ * Returns an empty array if the file can't be read.
+ */
+OCSYNC_EXPORT QByteArray computeBlockChecksums(const QString &filePath, qint64 blockSize = blockChecksumSize);
+
+/**
+ * Returns the ranges (offset, length) of a file of \a size bytes with the
+ * blocks that differ between \a checksums and \a baseChecksums, adjacent
+ * blocks are merged into one range.
+ */
+OCSYNC_EXPORT QVector<QPair<qint64, qint64>> changedBlockRanges(const QByteArray &checksums,
+    const QByteArray &baseChecksums, qint64 size, qint64 blockSize = blockChecksumSize);
+
+
+/**
+ * The threads that compute the checksums of ComputeChecksum::start().
+ *
+ * They are separate from the global thread pool and limit the number of
+ * files that are read at the same time: more readers mostly make the disk
+ * seek back and forth. Small files are queued ahead of large ones, so they
+ * don't wait for the large files to finish.
+ *
+ * \ingroup libsync
+ */
+class OCSYNC_EXPORT ChecksumThreadPool
+{
+public:
+    static ChecksumThreadPool *instance();
+
+    /** The number of threads (env OWNCLOUD_MAX_CHECKSUM_THREADS) */
+    static int maximumThreadCount();
+
+    /**
+     * Queues the computation, see ComputeChecksum::computeNow().
+     *
+     * Canceling the future skips the computation if it didn't start yet.
+     */
+    QFuture<QByteArray> start(const QString &filePath, const QByteArray &checksumType);
+
+    struct Stats
+    {
+        int queued = 0; ///< files waiting for a thread
+        int active = 0; ///< files being read
+        qint64 files = 0; ///< files done so far
+        qint64 bytes = 0; ///< bytes of these files
+        qint64 msecs = 0; ///< time the threads spent on them, together
+    };
+    Stats stats() const;
+
+private:
+    ChecksumThreadPool();
+    class Task;
+
+    QThreadPool _pool;
+    mutable QMutex _statsMutex;
+    Stats _stats;
+};
 
 /**
  * Computes the checksum of a file.
@@ -71,6 +166,7 @@ class OCSYNC_EXPORT ComputeChecksum : public QObject
     Q_OBJECT
 public:
     explicit ComputeChecksum(QObject *parent = 0);
+    ~ComputeChecksum();
 
     /**
      * Sets the checksum type to be used. The default is empty.
@@ -80,7 +176,13 @@ public:
     QByteArray checksumType() const;
 
     /**
-     * Computes the checksum for the given file path.
+     * Uses the checksum cache of \a journal, see computeNow(). The cache is
+     * only accessed from the thread of this object.
+     */
+    void setJournal(SyncJournalDb *journal) { _journal = journal; }
+
+    /**
+     * Computes the checksum for the given file path in the ChecksumThreadPool.
      *
      * done() is emitted when the calculation finishes.
      */
@@ -88,8 +190,12 @@ public:
 
     /**
      * Computes the checksum synchronously.
+     *
+     * With a \a journal the checksum is taken from its checksum cache if the
+     * file didn't change since it was last computed, and stored there otherwise.
      */
-    static QByteArray computeNow(const QString &filePath, const QByteArray &checksumType);
+    static QByteArray computeNow(const QString &filePath, const QByteArray &checksumType,
+        SyncJournalDb *journal = 0);
 
 signals:
     void done(const QByteArray &checksumType, const QByteArray &checksum);
@@ -99,6 +205,12 @@ private slots:
 
 private:
     QByteArray _checksumType;
+    SyncJournalDb *_journal = 0;
+
+    // The file and its identity when start() looked into the checksum cache
+    QString _filePath;
+    FileSystem::FileIdentity _identity;
+    bool _identityValid = false;
 
     // watcher for the checksum calculation thread
     QFutureWatcher<QByteArray> _watcher;
@@ -143,7 +255,7 @@ class OCSYNC_EXPORT CSyncChecksumHook : public QObject
 {
     Q_OBJECT
 public:
-    explicit CSyncChecksumHook();
+    explicit CSyncChecksumHook(SyncJournalDb *journal = 0);
 
     /**
      * Returns the checksum value for \a path that is comparable to \a otherChecksum.
@@ -153,5 +265,9 @@ public:
      * The return value will be owned by csync.
      */
     static QByteArray hook(const QByteArray &path, const QByteArray &otherChecksumHeader, void *this_obj);
+
+private:
+    /// For the checksum cache
+    SyncJournalDb *_journal;
 };
 }
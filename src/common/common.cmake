@@ -9,4 +9,6 @@ set(common_SOURCES
     ${CMAKE_CURRENT_LIST_DIR}/syncjournalfilerecord.cpp
     ${CMAKE_CURRENT_LIST_DIR}/utility.cpp
     ${CMAKE_CURRENT_LIST_DIR}/remotepermissions.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/pathtrie.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/expiringpathset.cpp
 )
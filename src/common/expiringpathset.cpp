@@ -0,0 +1,83 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "expiringpathset.h"
+#include "common/asserts.h"
+
+namespace OCC {
+
+ExpiringPathSet::ExpiringPathSet(qint64 maxAgeMs, int bucketCount)
+    : _maxAgeMs(maxAgeMs)
+{
+    ASSERT(bucketCount >= 2);
+    // Whatever is in a bucket has expired by the time it comes around again
+    _bucketMs = qMax(qint64(1), (maxAgeMs + bucketCount - 2) / (bucketCount - 1));
+    _buckets.resize(bucketCount);
+}
+
+void ExpiringPathSet::insert(const QString &path, qint64 nowMs)
+{
+    expire(nowMs);
+
+    auto it = _insertTimes.find(path);
+    if (it == _insertTimes.end()) {
+        _insertTimes.insert(path, nowMs);
+    } else {
+        bool inCurrentBucket = it.value() / _bucketMs == _currentSlice;
+        it.value() = nowMs;
+        if (inCurrentBucket)
+            return;
+        // The older bucket keeps it too, see expire()
+    }
+    _buckets[_currentSlice % _buckets.size()].append(path);
+}
+
+bool ExpiringPathSet::contains(const QString &path, qint64 nowMs) const
+{
+    auto it = _insertTimes.constFind(path);
+    return it != _insertTimes.constEnd() && nowMs - it.value() <= _maxAgeMs;
+}
+
+void ExpiringPathSet::clear()
+{
+    _insertTimes.clear();
+    for (auto &bucket : _buckets)
+        bucket.clear();
+    _currentSlice = -1;
+}
+
+void ExpiringPathSet::expire(qint64 nowMs)
+{
+    const qint64 slice = nowMs / _bucketMs;
+    if (slice <= _currentSlice)
+        return;
+
+    // Empty the buckets the new slices take over, at most all of them
+    const int bucketCount = _buckets.size();
+    for (qint64 s = qMax(_currentSlice + 1, slice - bucketCount + 1); s <= slice; ++s) {
+        auto &bucket = _buckets[s % bucketCount];
+        const qint64 expiredSlice = s - bucketCount;
+        for (const auto &path : bucket) {
+            auto it = _insertTimes.find(path);
+            // Unless it was inserted again since
+            if (it != _insertTimes.end() && it.value() / _bucketMs <= expiredSlice)
+                _insertTimes.erase(it);
+        }
+        bucket.clear();
+    }
+    _currentSlice = slice;
+}
+}
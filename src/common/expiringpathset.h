@@ -0,0 +1,70 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "ocsynclib.h"
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+namespace OCC {
+
+/**
+ * @brief A set of paths that each stay in it for a limited time
+ * @ingroup libsync
+ *
+ * Used for the files the sync touched itself, so the notifications of the
+ * file watcher about them can be told apart from the user's changes.
+ *
+ * Lookups go to a hash of the paths with the time they were last inserted.
+ * The paths are also kept in a wheel of buckets, one per slice of maxAge()
+ * divided by the bucket count: when the time moves past a slice, its bucket
+ * is emptied and the paths in it that weren't inserted again are dropped.
+ * Inserting, looking up and expiring a path therefore take constant time.
+ *
+ * The times are milliseconds of a monotonic clock, like
+ * QElapsedTimer::msecsSinceReference(). They must not go backwards.
+ */
+class OCSYNC_EXPORT ExpiringPathSet
+{
+public:
+    explicit ExpiringPathSet(qint64 maxAgeMs, int bucketCount = 16);
+
+    /** Adds the path, or restarts its time if it is in the set already */
+    void insert(const QString &path, qint64 nowMs);
+
+    /** Whether the path was inserted within the last maxAge() milliseconds */
+    bool contains(const QString &path, qint64 nowMs) const;
+
+    void clear();
+
+    /** The number of paths stored, some of them may have expired already */
+    int size() const { return _insertTimes.size(); }
+
+    qint64 maxAge() const { return _maxAgeMs; }
+
+private:
+    void expire(qint64 nowMs);
+
+    qint64 _maxAgeMs;
+    qint64 _bucketMs;
+    QHash<QString, qint64> _insertTimes;
+    QVector<QVector<QString>> _buckets;
+    qint64 _currentSlice = -1;
+};
+}
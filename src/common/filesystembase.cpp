@@ -25,8 +25,8 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
-#ifdef ZLIB_FOUND
-#include <zlib.h>
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
 #endif
 
 #ifdef Q_OS_WIN
@@ -225,6 +225,52 @@ bool FileSystem::uncheckedRenameReplace(const QString &originFileName,
     return true;
 }
 
+bool FileSystem::getFileIdentity(const QString &filename, FileIdentity *identity)
+{
+#ifdef Q_OS_WIN
+    const QString fName = longWinPath(filename);
+    // FILE_FLAG_BACKUP_SEMANTICS is needed to open directories
+    HANDLE h = CreateFileW((const wchar_t *)fName.utf16(), FILE_READ_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (h == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    BY_HANDLE_FILE_INFORMATION fileInfo;
+    FILE_BASIC_INFO basicInfo;
+    const bool ok = GetFileInformationByHandle(h, &fileInfo)
+        && GetFileInformationByHandleEx(h, FileBasicInfo, &basicInfo, sizeof(basicInfo));
+    CloseHandle(h);
+    if (!ok) {
+        return false;
+    }
+    // The times are in 100 ns intervals since 1601
+    const qint64 epochOffset = 116444736000000000LL;
+    identity->inode = (quint64(fileInfo.nFileIndexHigh) << 32) | fileInfo.nFileIndexLow;
+    identity->size = (qint64(fileInfo.nFileSizeHigh) << 32) | fileInfo.nFileSizeLow;
+    identity->modtime = (basicInfo.LastWriteTime.QuadPart - epochOffset) * 100;
+    identity->ctime = (basicInfo.ChangeTime.QuadPart - epochOffset) * 100;
+    return true;
+#else
+    struct stat sb;
+    if (stat(QFile::encodeName(filename).constData(), &sb) != 0) {
+        return false;
+    }
+    identity->inode = sb.st_ino;
+    identity->size = sb.st_size;
+#if defined(Q_OS_MAC)
+    identity->modtime = qint64(sb.st_mtimespec.tv_sec) * 1000000000 + sb.st_mtimespec.tv_nsec;
+    identity->ctime = qint64(sb.st_ctimespec.tv_sec) * 1000000000 + sb.st_ctimespec.tv_nsec;
+#elif defined(Q_OS_LINUX)
+    identity->modtime = qint64(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+    identity->ctime = qint64(sb.st_ctim.tv_sec) * 1000000000 + sb.st_ctim.tv_nsec;
+#else
+    identity->modtime = qint64(sb.st_mtime) * 1000000000;
+    identity->ctime = qint64(sb.st_ctime) * 1000000000;
+#endif
+    return true;
+#endif
+}
+
 bool FileSystem::openAndSeekFileSharedRead(QFile *file, QString *errorOrNull, qint64 seek)
 {
     QString errorDummy;
@@ -358,50 +404,92 @@ QString FileSystem::fileSystemForPath(const QString &path)
 
 #define BUFSIZE qint64(500 * 1024) // 500 KiB
 
-static QByteArray readToCrypto( const QString& filename, QCryptographicHash::Algorithm algo )
- {
-     QFile file(filename);
-     QByteArray arr;
-     QCryptographicHash crypto( algo );
+void FileSystem::adviseSequentialRead(QFile *file)
+{
+    // Small files are read in a few system calls anyway
+    if (file->size() < 4 * BUFSIZE) {
+        return;
+    }
+#if defined(Q_OS_UNIX) && defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(file->handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#elif defined(Q_OS_MAC)
+    fcntl(file->handle(), F_RDAHEAD, 1);
+#endif
+}
 
-     if (file.open(QIODevice::ReadOnly)) {
-         if (crypto.addData(&file)) {
-             arr = crypto.result().toHex();
-         }
-     }
-     return arr;
- }
+// From this size on files are mapped or read ahead, in blocks of this size
+static const qint64 largeFileSize = 8 * 1024 * 1024;
 
-QByteArray FileSystem::calcMd5(const QString &filename)
+bool FileSystem::readFileBlocks(const QString &fileName,
+    const std::function<void(const char *data, qint64 size)> &consume,
+    QString *errorString)
 {
-    return readToCrypto(filename, QCryptographicHash::Md5);
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+    const qint64 size = file.size();
+
+#ifdef Q_OS_WIN
+    qint64 offset = 0;
+    for (; size >= largeFileSize && offset < size; offset += largeFileSize) {
+        const qint64 length = qMin(largeFileSize, size - offset);
+        uchar *data = file.map(offset, length);
+        if (!data) {
+            // e.g. on some network drives, read the rest
+            qCDebug(lcFileSystem) << "Could not map" << fileName << file.errorString();
+            break;
+        }
+        consume(reinterpret_cast<const char *>(data), length);
+        file.unmap(data);
+    }
+    if (offset >= size && size > 0)
+        return true;
+    file.seek(offset);
+#endif
+
+    adviseSequentialRead(&file);
+    const qint64 bufSize = size >= largeFileSize ? largeFileSize : qMin(BUFSIZE, size + 1);
+    QByteArray buf(bufSize, Qt::Uninitialized);
+    while (true) {
+#if defined(Q_OS_UNIX) && defined(POSIX_FADV_WILLNEED)
+        if (size >= largeFileSize)
+            posix_fadvise(file.handle(), file.pos() + bufSize, bufSize, POSIX_FADV_WILLNEED);
+#endif
+        const qint64 r = file.read(buf.data(), bufSize);
+        if (r < 0) {
+            if (errorString)
+                *errorString = file.errorString();
+            return false;
+        }
+        if (r == 0)
+            return true;
+        consume(buf.constData(), r);
+    }
 }
 
-QByteArray FileSystem::calcSha1(const QString &filename)
+static QByteArray readToCrypto(const QString &filename, QCryptographicHash::Algorithm algo)
 {
-    return readToCrypto(filename, QCryptographicHash::Sha1);
+    QCryptographicHash crypto(algo);
+    QString error;
+    if (!FileSystem::readFileBlocks(filename, [&](const char *data, qint64 size) { crypto.addData(data, int(size)); }, &error)) {
+        qCWarning(lcFileSystem) << "Could not read" << filename << error;
+        return QByteArray();
+    }
+    return crypto.result().toHex();
 }
 
-#ifdef ZLIB_FOUND
-QByteArray FileSystem::calcAdler32(const QString &filename)
+QByteArray FileSystem::calcMd5(const QString &filename)
 {
-    QFile file(filename);
-    const qint64 bufSize = qMin(BUFSIZE, file.size() + 1);
-    QByteArray buf(bufSize, Qt::Uninitialized);
-
-    unsigned int adler = adler32(0L, Z_NULL, 0);
-    if (file.open(QIODevice::ReadOnly)) {
-        qint64 size;
-        while (!file.atEnd()) {
-            size = file.read(buf.data(), bufSize);
-            if (size > 0)
-                adler = adler32(adler, (const Bytef *)buf.data(), size);
-        }
-    }
+    return readToCrypto(filename, QCryptographicHash::Md5);
+}
 
-    return QByteArray::number(adler, 16);
+QByteArray FileSystem::calcSha1(const QString &filename)
+{
+    return readToCrypto(filename, QCryptographicHash::Sha1);
 }
-#endif
 
 QString FileSystem::makeConflictFileName(const QString &fn, const QDateTime &dt)
 {
@@ -27,6 +27,8 @@
 
 #include <ocsynclib.h>
 
+#include <functional>
+
 class QFile;
 
 namespace OCC {
@@ -118,6 +120,32 @@ namespace FileSystem {
      */
     bool OCSYNC_EXPORT openAndSeekFileSharedRead(QFile *file, QString *error, qint64 seek);
 
+    /**
+     * What tells whether the content of a file may have changed: as long as
+     * none of these values change the content is assumed to be the same.
+     *
+     * The times are in nanoseconds since the epoch, as precise as the file system has them.
+     */
+    struct FileIdentity
+    {
+        quint64 inode = 0;
+        qint64 size = 0;
+        qint64 modtime = 0;
+        qint64 ctime = 0; ///< The change time of the inode, not the creation time
+
+        bool operator==(const FileIdentity &other) const
+        {
+            return inode == other.inode && size == other.size
+                && modtime == other.modtime && ctime == other.ctime;
+        }
+        bool operator!=(const FileIdentity &other) const { return !(*this == other); }
+    };
+
+    /**
+     * Gets the FileIdentity of a file or directory, returns false if it can't be determined.
+     */
+    bool OCSYNC_EXPORT getFileIdentity(const QString &filename, FileIdentity *identity);
+
 #ifdef Q_OS_WIN
     /**
      * Returns the file system used at the given path.
@@ -125,11 +153,30 @@ namespace FileSystem {
     QString fileSystemForPath(const QString &path);
 #endif
 
+    /**
+     * Tells the OS that the open \a file will be read from start to end, so
+     * it reads ahead more aggressively. Only done for large files.
+     */
+    void OCSYNC_EXPORT adviseSequentialRead(QFile *file);
+
+    /**
+     * Passes the content of a file to \a consume, one block after the
+     * other from start to end. Returns false if it can't be read.
+     *
+     * Large files are mapped into memory on Windows, which refuses to
+     * truncate a file while a view of it exists. Elsewhere a truncation
+     * would crash the access to the mapping with SIGBUS, so they are read
+     * in large blocks and the kernel is asked to read the following block
+     * while the current one is processed. That read-ahead already keeps a
+     * single sequential stream busy, so unlike the many small statx calls
+     * of the discovery, these reads don't go through io_uring.
+     */
+    bool OCSYNC_EXPORT readFileBlocks(const QString &fileName,
+        const std::function<void(const char *data, qint64 size)> &consume,
+        QString *errorString = 0);
+
     QByteArray OCSYNC_EXPORT calcMd5(const QString &fileName);
     QByteArray OCSYNC_EXPORT calcSha1(const QString &fileName);
-#ifdef ZLIB_FOUND
-    QByteArray OCSYNC_EXPORT calcAdler32(const QString &fileName);
-#endif
 
     /**
      * Returns a file name based on \a fn that's suitable for a conflict.
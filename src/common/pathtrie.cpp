@@ -0,0 +1,302 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "pathtrie.h"
+
+#include <vector>
+
+namespace OCC {
+
+/* The components of the path, "a//b/" gives "a" and "b" */
+static QList<QByteArray> components(const QByteArray &path)
+{
+    QList<QByteArray> result;
+    for (const auto &component : path.split('/')) {
+        if (!component.isEmpty())
+            result.append(component);
+    }
+    return result;
+}
+
+PathTrie::PathTrie()
+    : _root(new Node)
+    , _maximumNodeCount(100000)
+{
+}
+
+PathTrie::PathTrie(std::initializer_list<QByteArray> paths)
+    : PathTrie()
+{
+    for (const auto &path : paths)
+        insert(path);
+}
+
+PathTrie::PathTrie(const PathTrie &other)
+    : _root(copyNode(*other._root))
+    , _nodeCount(other._nodeCount)
+    , _markedCount(other._markedCount)
+    , _maximumNodeCount(other._maximumNodeCount)
+{
+}
+
+PathTrie::PathTrie(PathTrie &&other)
+    : PathTrie()
+{
+    *this = std::move(other);
+}
+
+PathTrie::~PathTrie()
+{
+}
+
+PathTrie &PathTrie::operator=(const PathTrie &other)
+{
+    if (this != &other) {
+        _root = copyNode(*other._root);
+        _nodeCount = other._nodeCount;
+        _markedCount = other._markedCount;
+        _maximumNodeCount = other._maximumNodeCount;
+    }
+    return *this;
+}
+
+PathTrie &PathTrie::operator=(PathTrie &&other)
+{
+    if (this != &other) {
+        // The moved-from trie is left empty, not without a root
+        std::swap(_root, other._root);
+        _nodeCount = other._nodeCount;
+        _markedCount = other._markedCount;
+        _maximumNodeCount = other._maximumNodeCount;
+        other.clear();
+    }
+    return *this;
+}
+
+std::unique_ptr<PathTrie::Node> PathTrie::copyNode(const Node &node)
+{
+    std::unique_ptr<Node> copy(new Node);
+    copy->marked = node.marked;
+    copy->listed = node.listed;
+    for (const auto &child : node.children)
+        copy->children[child.first] = copyNode(*child.second);
+    return copy;
+}
+
+void PathTrie::dropChildren(Node *node)
+{
+    for (auto &child : node->children) {
+        dropChildren(child.second.get());
+        --_nodeCount;
+        if (child.second->marked || child.second->listed)
+            --_markedCount;
+    }
+    node->children.clear();
+}
+
+void PathTrie::mark(Node *node)
+{
+    if (node->marked)
+        return;
+    dropChildren(node);
+    node->marked = true;
+    if (node->listed)
+        node->listed = false;
+    else
+        ++_markedCount;
+}
+
+bool PathTrie::insert(const QByteArray &path)
+{
+    std::vector<Node *> chain{ _root.get() };
+    for (const auto &component : components(path)) {
+        Node *node = chain.back();
+        if (node->marked)
+            return false;
+        auto &child = node->children[component];
+        if (!child) {
+            child.reset(new Node);
+            ++_nodeCount;
+        }
+        chain.push_back(child.get());
+    }
+    if (chain.back()->marked)
+        return false;
+    mark(chain.back());
+
+    // Too many nodes: look at the parent directories instead
+    for (int i = int(chain.size()) - 2; i >= 0 && _nodeCount > _maximumNodeCount; --i)
+        mark(chain[i]);
+    return true;
+}
+
+bool PathTrie::insertDirectory(const QByteArray &path)
+{
+    std::vector<Node *> chain{ _root.get() };
+    for (const auto &component : components(path)) {
+        Node *node = chain.back();
+        if (node->marked)
+            return false;
+        auto &child = node->children[component];
+        if (!child) {
+            child.reset(new Node);
+            ++_nodeCount;
+        }
+        chain.push_back(child.get());
+    }
+    Node *node = chain.back();
+    if (node->marked || node->listed)
+        return false;
+    node->listed = true;
+    ++_markedCount;
+
+    for (int i = int(chain.size()) - 1; i >= 0 && _nodeCount > _maximumNodeCount; --i)
+        mark(chain[i]);
+    return true;
+}
+
+void PathTrie::merge(const PathTrie &other)
+{
+    std::vector<std::pair<const Node *, QByteArray>> stack{ { other._root.get(), QByteArray() } };
+    while (!stack.empty()) {
+        auto current = std::move(stack.back());
+        stack.pop_back();
+        if (current.first->marked) {
+            insert(current.second);
+            continue;
+        }
+        if (current.first->listed)
+            insertDirectory(current.second);
+        for (const auto &child : current.first->children)
+            stack.emplace_back(child.second.get(), current.second + '/' + child.first);
+    }
+}
+
+bool PathTrie::remove(const QByteArray &path)
+{
+    std::vector<std::pair<Node *, QByteArray>> chain{ { _root.get(), QByteArray() } };
+    for (const auto &component : components(path)) {
+        auto it = chain.back().first->children.find(component);
+        if (it == chain.back().first->children.end())
+            return false;
+        chain.emplace_back(it->second.get(), component);
+    }
+    Node *last = chain.back().first;
+    if (!last->marked && !last->listed)
+        return false;
+    last->marked = false;
+    last->listed = false;
+    --_markedCount;
+
+    // Remove the nodes that don't lead to a marked path anymore
+    for (int i = int(chain.size()) - 1; i > 0; --i) {
+        Node *node = chain[i].first;
+        if (node->marked || node->listed || !node->children.empty())
+            break;
+        chain[i - 1].first->children.erase(chain[i].second);
+        --_nodeCount;
+    }
+    return true;
+}
+
+void PathTrie::clear()
+{
+    _root.reset(new Node);
+    _nodeCount = 0;
+    _markedCount = 0;
+}
+
+void PathTrie::setMaximumNodeCount(int count)
+{
+    _maximumNodeCount = count;
+}
+
+bool PathTrie::contains(const QByteArray &path) const
+{
+    const Node *node = _root.get();
+    for (const auto &component : components(path)) {
+        if (node->marked)
+            return true;
+        auto it = node->children.find(component);
+        if (it == node->children.end())
+            return false;
+        node = it->second.get();
+    }
+    return node->marked;
+}
+
+bool PathTrie::intersects(const QByteArray &path) const
+{
+    return intersects(path, true);
+}
+
+bool PathTrie::needsEntriesOf(const QByteArray &dir) const
+{
+    return intersects(dir, false);
+}
+
+bool PathTrie::intersects(const QByteArray &path, bool listedEntries) const
+{
+    const Node *node = _root.get();
+    const auto pathComponents = components(path);
+    for (int i = 0; i < pathComponents.size(); ++i) {
+        if (node->marked)
+            return true;
+        auto it = node->children.find(pathComponents.at(i));
+        if (it == node->children.end()) {
+            // The direct entries of a listed directory are looked at
+            return listedEntries && node->listed && i == pathComponents.size() - 1;
+        }
+        node = it->second.get();
+    }
+    // Unmarked nodes only exist on the way to marked ones
+    return node->marked || node->listed || !node->children.empty();
+}
+
+QList<QByteArray> PathTrie::paths(const QByteArray &dir) const
+{
+    QList<QByteArray> result;
+    const Node *node = _root.get();
+    QByteArray prefix;
+    for (const auto &component : components(dir)) {
+        if (node->marked)
+            return result; // only a parent is marked
+        auto it = node->children.find(component);
+        if (it == node->children.end())
+            return result;
+        node = it->second.get();
+        prefix += component;
+        prefix += '/';
+    }
+
+    std::vector<std::pair<const Node *, QByteArray>> stack{ { node, prefix } };
+    while (!stack.empty()) {
+        auto current = std::move(stack.back());
+        stack.pop_back();
+        if (current.first->marked || current.first->listed) {
+            QByteArray path = current.second;
+            path.chop(1);
+            result.append(path);
+            if (current.first->marked)
+                continue;
+        }
+        // Reverse, so the children come out in order
+        for (auto it = current.first->children.rbegin(); it != current.first->children.rend(); ++it)
+            stack.emplace_back(it->second.get(), current.second + it->first + '/');
+    }
+    return result;
+}
+}
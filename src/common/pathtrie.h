@@ -0,0 +1,128 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "ocsynclib.h"
+
+#include <QByteArray>
+#include <QList>
+
+#include <initializer_list>
+#include <map>
+#include <memory>
+
+namespace OCC {
+
+/**
+ * @brief A set of folder-relative paths whose subtrees need to be looked at
+ * @ingroup libsync
+ *
+ * Used for the paths reported by the file watcher: a marked path stands for
+ * itself and everything below it. Marking a path therefore drops the marked
+ * paths below it, and paths below a marked one are not stored at all. This
+ * keeps the set small when a tool touches many files in a few directories.
+ *
+ * The number of stored nodes is limited by maximumNodeCount(). When an
+ * insertion exceeds it, the parent directories of the new path are marked
+ * instead, one level at a time, until the trie is small enough. In the worst
+ * case the root gets marked, which means the whole folder is looked at.
+ *
+ * A directory can also be marked on its own with insertDirectory(): then only
+ * its direct entries need to be looked at, and the directories below it only
+ * if they are marked themselves. Such marks don't drop anything below them.
+ *
+ * Paths don't start with a '/'. The root is the empty path.
+ */
+class OCSYNC_EXPORT PathTrie
+{
+public:
+    PathTrie();
+    PathTrie(std::initializer_list<QByteArray> paths);
+    PathTrie(const PathTrie &other);
+    PathTrie(PathTrie &&other);
+    ~PathTrie();
+    PathTrie &operator=(const PathTrie &other);
+    PathTrie &operator=(PathTrie &&other);
+
+    /** Marks the path, returns false if it or a parent was already marked */
+    bool insert(const QByteArray &path);
+
+    /**
+     * Marks the entries directly inside the directory, returns false if it was
+     * already marked or a parent covers it
+     */
+    bool insertDirectory(const QByteArray &path);
+
+    /** Marks all the paths of the other trie */
+    void merge(const PathTrie &other);
+
+    /** Unmarks the path if it is marked itself, returns whether it was */
+    bool remove(const QByteArray &path);
+
+    void clear();
+
+    bool isEmpty() const { return _markedCount == 0; }
+
+    /** The number of marked paths */
+    int size() const { return _markedCount; }
+
+    /** The number of stored nodes, not counting the root */
+    int nodeCount() const { return _nodeCount; }
+
+    int maximumNodeCount() const { return _maximumNodeCount; }
+    void setMaximumNodeCount(int count);
+
+    /** Whether the root is marked, so the whole folder needs to be looked at */
+    bool isFullRescan() const { return _root->marked; }
+
+    /** Whether the path or one of its parents is marked with its subtree */
+    bool contains(const QByteArray &path) const;
+
+    /**
+     * Whether the path, one of its parents or something below it is marked,
+     * or the path is a direct entry of a directory marked with insertDirectory()
+     */
+    bool intersects(const QByteArray &path) const;
+
+    /**
+     * Whether the entries inside the directory need to be looked at: like
+     * intersects(), but being an entry of a marked directory is not enough
+     */
+    bool needsEntriesOf(const QByteArray &dir) const;
+
+    /** The marked paths at or below dir, parents before their children */
+    QList<QByteArray> paths(const QByteArray &dir = QByteArray()) const;
+
+private:
+    struct Node
+    {
+        std::map<QByteArray, std::unique_ptr<Node>> children;
+        bool marked = false; // the whole subtree
+        bool listed = false; // only the direct entries
+    };
+
+    bool intersects(const QByteArray &path, bool listedEntries) const;
+    static std::unique_ptr<Node> copyNode(const Node &node);
+    void dropChildren(Node *node);
+    void mark(Node *node);
+
+    std::unique_ptr<Node> _root;
+    int _nodeCount = 0;
+    int _markedCount = 0;
+    int _maximumNodeCount;
+};
+}
@@ -396,6 +396,32 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("Create table uploadinfo", createQuery);
     }
 
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS blockchecksums("
+                        "path VARCHAR(4096),"
+                        "etag VARCHAR(32),"
+                        "blocksize INTEGER(8),"
+                        "checksums BLOB,"
+                        "PRIMARY KEY(path)"
+                        ");");
+
+    if (!createQuery.exec()) {
+        return sqlFail("Create table blockchecksums", createQuery);
+    }
+
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS checksumcache("
+                        "inode INTEGER,"
+                        "checksumtype VARCHAR(32),"
+                        "size INTEGER(8),"
+                        "modtime INTEGER(8),"
+                        "ctime INTEGER(8),"
+                        "checksum VARCHAR(128),"
+                        "PRIMARY KEY(inode, checksumtype)"
+                        ");");
+
+    if (!createQuery.exec()) {
+        return sqlFail("Create table checksumcache", createQuery);
+    }
+
     // create the blacklist table.
     createQuery.prepare("CREATE TABLE IF NOT EXISTS blacklist ("
                         "path VARCHAR(4096),"
@@ -418,6 +444,28 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("Create table poll", createQuery);
     }
 
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS localdirstate("
+                        "path VARCHAR(4096),"
+                        "inode INTEGER,"
+                        "modtime INTEGER(8),"
+                        "PRIMARY KEY(path)"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail("Create table localdirstate", createQuery);
+    }
+
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS localdirlisting("
+                        "path VARCHAR(4096),"
+                        "inode INTEGER,"
+                        "modtime INTEGER(8),"
+                        "ctime INTEGER(8),"
+                        "entries INTEGER,"
+                        "PRIMARY KEY(path)"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail("Create table localdirlisting", createQuery);
+    }
+
     // create the selectivesync table.
     createQuery.prepare("CREATE TABLE IF NOT EXISTS selectivesync ("
                         "path VARCHAR(4096),"
@@ -547,6 +595,13 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("prepare _getFileRecordQueryByFileId", *_getFileRecordQueryByFileId);
     }
 
+    _getFileRecordQueryByChecksum.reset(new SqlQuery(_db));
+    if (_getFileRecordQueryByChecksum->prepare(
+            GET_FILE_RECORD_QUERY
+            " WHERE contentChecksum=?1 AND contentchecksumtype.name=?2")) {
+        return sqlFail("prepare _getFileRecordQueryByChecksum", *_getFileRecordQueryByChecksum);
+    }
+
     // This query is used to skip discovery and fill the tree from the
     // database instead
     _getFilesBelowPathQuery.reset(new SqlQuery(_db));
@@ -562,6 +617,15 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("prepare _getFilesBelowPathQuery", *_getFilesBelowPathQuery);
     }
 
+    // The direct entries of a directory other than the root
+    _getDirectoryEntryNamesQuery.reset(new SqlQuery(_db));
+    if (_getDirectoryEntryNamesQuery->prepare(
+            "SELECT substr(path, length(?1)+2) FROM metadata"
+            " WHERE path > (?1||'/') AND path < (?1||'0')"
+            " AND instr(substr(path, length(?1)+2), '/') == 0")) {
+        return sqlFail("prepare _getDirectoryEntryNamesQuery", *_getDirectoryEntryNamesQuery);
+    }
+
     _getAllFilesQuery.reset(new SqlQuery(_db));
     if (_getAllFilesQuery->prepare(
             GET_FILE_RECORD_QUERY
@@ -628,6 +692,43 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("prepare _deleteUploadInfoQuery", *_deleteUploadInfoQuery);
     }
 
+    _getBlockChecksumsQuery.reset(new SqlQuery(_db));
+    if (_getBlockChecksumsQuery->prepare("SELECT etag, blocksize, checksums FROM "
+                                         "blockchecksums WHERE path=?1")) {
+        return sqlFail("prepare _getBlockChecksumsQuery", *_getBlockChecksumsQuery);
+    }
+
+    _setBlockChecksumsQuery.reset(new SqlQuery(_db));
+    if (_setBlockChecksumsQuery->prepare("INSERT OR REPLACE INTO blockchecksums "
+                                         "(path, etag, blocksize, checksums) "
+                                         "VALUES ( ?1 , ?2, ?3, ?4 )")) {
+        return sqlFail("prepare _setBlockChecksumsQuery", *_setBlockChecksumsQuery);
+    }
+
+    // ?2 removes the entries of the files below the path as well
+    _deleteBlockChecksumsQuery.reset(new SqlQuery(_db));
+    if (_deleteBlockChecksumsQuery->prepare("DELETE FROM blockchecksums WHERE path=?1 OR (?2 AND path LIKE(?1||'/%'))")) {
+        return sqlFail("prepare _deleteBlockChecksumsQuery", *_deleteBlockChecksumsQuery);
+    }
+
+    _deleteLocalDirListingsQuery.reset(new SqlQuery(_db));
+    if (_deleteLocalDirListingsQuery->prepare("DELETE FROM localdirlisting WHERE path=?1 OR (?2 AND path LIKE(?1||'/%'))")) {
+        return sqlFail("prepare _deleteLocalDirListingsQuery", *_deleteLocalDirListingsQuery);
+    }
+
+    _getCachedChecksumQuery.reset(new SqlQuery(_db));
+    if (_getCachedChecksumQuery->prepare("SELECT checksum FROM checksumcache WHERE inode=?1 AND checksumtype=?2 "
+                                         "AND size=?3 AND modtime=?4 AND ctime=?5")) {
+        return sqlFail("prepare _getCachedChecksumQuery", *_getCachedChecksumQuery);
+    }
+
+    _setCachedChecksumQuery.reset(new SqlQuery(_db));
+    if (_setCachedChecksumQuery->prepare("INSERT OR REPLACE INTO checksumcache "
+                                         "(inode, checksumtype, size, modtime, ctime, checksum) "
+                                         "VALUES ( ?1 , ?2, ?3, ?4, ?5, ?6 )")) {
+        return sqlFail("prepare _setCachedChecksumQuery", *_setCachedChecksumQuery);
+    }
+
 
     _deleteFileRecordPhash.reset(new SqlQuery(_db));
     if (_deleteFileRecordPhash->prepare("DELETE FROM metadata WHERE phash=?1")) {
@@ -718,7 +819,9 @@ void SyncJournalDb::close()
     _getFileRecordQuery.reset(0);
     _getFileRecordQueryByInode.reset(0);
     _getFileRecordQueryByFileId.reset(0);
+    _getFileRecordQueryByChecksum.reset(0);
     _getFilesBelowPathQuery.reset(0);
+    _getDirectoryEntryNamesQuery.reset(0);
     _getAllFilesQuery.reset(0);
     _setFileRecordQuery.reset(0);
     _setFileRecordChecksumQuery.reset(0);
@@ -729,6 +832,12 @@ void SyncJournalDb::close()
     _getUploadInfoQuery.reset(0);
     _setUploadInfoQuery.reset(0);
     _deleteUploadInfoQuery.reset(0);
+    _getBlockChecksumsQuery.reset(0);
+    _setBlockChecksumsQuery.reset(0);
+    _deleteBlockChecksumsQuery.reset(0);
+    _deleteLocalDirListingsQuery.reset(0);
+    _getCachedChecksumQuery.reset(0);
+    _setCachedChecksumQuery.reset(0);
     _deleteFileRecordPhash.reset(0);
     _deleteFileRecordRecursively.reset(0);
     _getErrorBlacklistQuery.reset(0);
@@ -849,6 +958,16 @@ bool SyncJournalDb::updateMetadataTableStructure()
         commitInternal("update database structure: add contentChecksumTypeId col");
     }
 
+    if (1) {
+        SqlQuery query(_db);
+        query.prepare("CREATE INDEX IF NOT EXISTS metadata_content_checksum ON metadata(contentChecksum);");
+        if (!query.exec()) {
+            sqlFail("updateMetadataTableStructure: create index contentChecksum", query);
+            re = false;
+        }
+        commitInternal("update database structure: add contentChecksum index");
+    }
+
 
     return re;
 }
@@ -1035,6 +1154,16 @@ bool SyncJournalDb::deleteFileRecord(const QString &filename, bool recursively)
                 return false;
             }
         }
+
+        _deleteBlockChecksumsQuery->reset_and_clear_bindings();
+        _deleteBlockChecksumsQuery->bindValue(1, filename);
+        _deleteBlockChecksumsQuery->bindValue(2, recursively);
+        _deleteBlockChecksumsQuery->exec();
+
+        _deleteLocalDirListingsQuery->reset_and_clear_bindings();
+        _deleteLocalDirListingsQuery->bindValue(1, filename);
+        _deleteLocalDirListingsQuery->bindValue(2, recursively);
+        _deleteLocalDirListingsQuery->exec();
         return true;
     } else {
         qCWarning(lcDb) << "Failed to connect database.";
@@ -1136,6 +1265,35 @@ bool SyncJournalDb::getFileRecordsByFileId(const QByteArray &fileId, const std::
     return true;
 }
 
+bool SyncJournalDb::getFileRecordsByChecksum(const QByteArray &checksumHeader, const std::function<void(const SyncJournalFileRecord &)> &rowCallback)
+{
+    QMutexLocker locker(&_mutex);
+
+    QByteArray checksumType;
+    QByteArray checksum;
+    if (!parseChecksumHeader(checksumHeader, &checksumType, &checksum) || checksum.isEmpty() || _metadataTableIsEmpty)
+        return true; // no error, yet nothing found
+
+    if (!checkConnect())
+        return false;
+
+    _getFileRecordQueryByChecksum->reset_and_clear_bindings();
+    _getFileRecordQueryByChecksum->bindValue(1, checksum);
+    _getFileRecordQueryByChecksum->bindValue(2, checksumType);
+
+    if (!_getFileRecordQueryByChecksum->exec()) {
+        return false;
+    }
+
+    while (_getFileRecordQueryByChecksum->next()) {
+        SyncJournalFileRecord rec;
+        fillFileRecordFromGetQuery(rec, *_getFileRecordQueryByChecksum);
+        rowCallback(rec);
+    }
+
+    return true;
+}
+
 bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback)
 {
     QMutexLocker locker(&_mutex);
@@ -1169,6 +1327,38 @@ bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::functio
     return true;
 }
 
+bool SyncJournalDb::getDirectoryEntryNames(const QByteArray &path, std::vector<QByteArray> *names)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (_metadataTableIsEmpty)
+        return true; // no error, yet nothing found
+
+    if (!checkConnect())
+        return false;
+
+    // Like in getFilesBelowPath() the range doesn't work for the root
+    SqlQuery rootQuery(_db);
+    SqlQuery *query = _getDirectoryEntryNamesQuery.data();
+    if (path.isEmpty()) {
+        rootQuery.prepare("SELECT path FROM metadata WHERE instr(path, '/') == 0");
+        query = &rootQuery;
+    } else {
+        query->reset_and_clear_bindings();
+        query->bindValue(1, path);
+    }
+
+    if (!query->exec()) {
+        return false;
+    }
+
+    while (query->next()) {
+        names->push_back(query->baValue(0));
+    }
+
+    return true;
+}
+
 bool SyncJournalDb::postSyncCleanup(const QSet<QString> &filepathsToKeep,
     const QSet<QString> &prefixesToKeep)
 {
@@ -1213,6 +1403,13 @@ bool SyncJournalDb::postSyncCleanup(const QSet<QString> &filepathsToKeep,
         }
     }
 
+    // The cached checksums of files that are gone are of no use anymore
+    SqlQuery cacheQuery(_db);
+    cacheQuery.prepare("DELETE FROM checksumcache WHERE inode NOT IN (SELECT inode FROM metadata)");
+    if (!cacheQuery.exec()) {
+        return false;
+    }
+
     // Incorporate results back into main DB
     walCheckpoint();
 
@@ -1538,6 +1735,92 @@ QVector<uint> SyncJournalDb::deleteStaleUploadInfos(const QSet<QString> &keep)
     return ids;
 }
 
+SyncJournalDb::BlockChecksums SyncJournalDb::getBlockChecksums(const QString &file)
+{
+    QMutexLocker locker(&_mutex);
+
+    BlockChecksums res;
+
+    if (checkConnect()) {
+        _getBlockChecksumsQuery->reset_and_clear_bindings();
+        _getBlockChecksumsQuery->bindValue(1, file);
+
+        if (!_getBlockChecksumsQuery->exec()) {
+            return res;
+        }
+
+        if (_getBlockChecksumsQuery->next()) {
+            res._etag = _getBlockChecksumsQuery->baValue(0);
+            res._blockSize = _getBlockChecksumsQuery->int64Value(1);
+            res._checksums = _getBlockChecksumsQuery->baValue(2);
+            res._valid = res._blockSize > 0;
+        }
+    }
+    return res;
+}
+
+void SyncJournalDb::setBlockChecksums(const QString &file, const SyncJournalDb::BlockChecksums &checksums)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!checkConnect()) {
+        return;
+    }
+
+    if (checksums._valid) {
+        _setBlockChecksumsQuery->reset_and_clear_bindings();
+        _setBlockChecksumsQuery->bindValue(1, file);
+        _setBlockChecksumsQuery->bindValue(2, checksums._etag);
+        _setBlockChecksumsQuery->bindValue(3, checksums._blockSize);
+        _setBlockChecksumsQuery->bindValue(4, checksums._checksums);
+        _setBlockChecksumsQuery->exec();
+    } else {
+        _deleteBlockChecksumsQuery->reset_and_clear_bindings();
+        _deleteBlockChecksumsQuery->bindValue(1, file);
+        _deleteBlockChecksumsQuery->bindValue(2, false);
+        _deleteBlockChecksumsQuery->exec();
+    }
+}
+
+QByteArray SyncJournalDb::getCachedChecksum(const FileSystem::FileIdentity &identity, const QByteArray &checksumType)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!checkConnect()) {
+        return QByteArray();
+    }
+
+    _getCachedChecksumQuery->reset_and_clear_bindings();
+    _getCachedChecksumQuery->bindValue(1, identity.inode);
+    _getCachedChecksumQuery->bindValue(2, checksumType);
+    _getCachedChecksumQuery->bindValue(3, identity.size);
+    _getCachedChecksumQuery->bindValue(4, identity.modtime);
+    _getCachedChecksumQuery->bindValue(5, identity.ctime);
+    if (!_getCachedChecksumQuery->exec() || !_getCachedChecksumQuery->next()) {
+        return QByteArray();
+    }
+    return _getCachedChecksumQuery->baValue(0);
+}
+
+void SyncJournalDb::setCachedChecksum(const FileSystem::FileIdentity &identity, const QByteArray &checksumType,
+    const QByteArray &checksum)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!checkConnect()) {
+        return;
+    }
+
+    _setCachedChecksumQuery->reset_and_clear_bindings();
+    _setCachedChecksumQuery->bindValue(1, identity.inode);
+    _setCachedChecksumQuery->bindValue(2, checksumType);
+    _setCachedChecksumQuery->bindValue(3, identity.size);
+    _setCachedChecksumQuery->bindValue(4, identity.modtime);
+    _setCachedChecksumQuery->bindValue(5, identity.ctime);
+    _setCachedChecksumQuery->bindValue(6, checksum);
+    _setCachedChecksumQuery->exec();
+}
+
 SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry(const QString &file)
 {
     QMutexLocker locker(&_mutex);
@@ -1740,6 +2023,142 @@ void SyncJournalDb::setPollInfo(const SyncJournalDb::PollInfo &info)
     }
 }
 
+QVector<QByteArray> SyncJournalDb::getDirectoryPaths()
+{
+    QMutexLocker locker(&_mutex);
+
+    QVector<QByteArray> res;
+
+    if (!checkConnect())
+        return res;
+
+    SqlQuery query("SELECT path FROM metadata WHERE type == 2", _db);
+
+    if (!query.exec()) {
+        return res;
+    }
+
+    while (query.next()) {
+        res.append(query.baValue(0));
+    }
+    return res;
+}
+
+void SyncJournalDb::setLocalDirStates(const QVector<LocalDirState> &states)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return;
+    }
+
+    SqlQuery delQuery("DELETE FROM localdirstate", _db);
+    if (!delQuery.exec()) {
+        sqlFail("Delete local dir states", delQuery);
+        return;
+    }
+
+    SqlQuery insQuery("INSERT OR REPLACE INTO localdirstate (path, inode, modtime) VALUES (?1, ?2, ?3)", _db);
+    foreach (const auto &state, states) {
+        insQuery.reset_and_clear_bindings();
+        insQuery.bindValue(1, state._path);
+        insQuery.bindValue(2, state._inode);
+        insQuery.bindValue(3, state._modtime);
+        if (!insQuery.exec()) {
+            sqlFail("Insert local dir state", insQuery);
+            return;
+        }
+    }
+    commitInternal(QStringLiteral("setLocalDirStates"));
+}
+
+QVector<SyncJournalDb::LocalDirState> SyncJournalDb::getAndDeleteLocalDirStates()
+{
+    QMutexLocker locker(&_mutex);
+
+    QVector<LocalDirState> res;
+
+    if (!checkConnect())
+        return res;
+
+    SqlQuery query("SELECT path, inode, modtime FROM localdirstate", _db);
+
+    if (!query.exec()) {
+        return res;
+    }
+
+    while (query.next()) {
+        LocalDirState state;
+        state._path = query.baValue(0);
+        state._inode = query.int64Value(1);
+        state._modtime = query.int64Value(2);
+        res.append(state);
+    }
+    query.finish();
+
+    SqlQuery delQuery("DELETE FROM localdirstate", _db);
+    if (!delQuery.exec()) {
+        // Using them again on the next start would not be safe
+        sqlFail("Delete local dir states", delQuery);
+        return QVector<LocalDirState>();
+    }
+    commitInternal(QStringLiteral("getAndDeleteLocalDirStates"));
+    return res;
+}
+
+QHash<QByteArray, SyncJournalDb::LocalDirListing> SyncJournalDb::getLocalDirListings()
+{
+    QMutexLocker locker(&_mutex);
+
+    QHash<QByteArray, LocalDirListing> res;
+
+    if (!checkConnect())
+        return res;
+
+    SqlQuery query("SELECT path, inode, modtime, ctime, entries FROM localdirlisting", _db);
+
+    if (!query.exec()) {
+        return res;
+    }
+
+    while (query.next()) {
+        LocalDirListing listing;
+        listing._path = query.baValue(0);
+        listing._inode = query.int64Value(1);
+        listing._modtime = query.int64Value(2);
+        listing._ctime = query.int64Value(3);
+        listing._entryCount = query.intValue(4);
+        res.insert(listing._path, listing);
+    }
+    return res;
+}
+
+void SyncJournalDb::setLocalDirListings(const QVector<LocalDirListing> &listings)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return;
+    }
+
+    SqlQuery insQuery("INSERT OR REPLACE INTO localdirlisting (path, inode, modtime, ctime, entries) VALUES (?1, ?2, ?3, ?4, ?5)", _db);
+    SqlQuery delQuery("DELETE FROM localdirlisting WHERE path=?1", _db);
+    foreach (const auto &listing, listings) {
+        auto &query = listing._inode == 0 ? delQuery : insQuery;
+        query.reset_and_clear_bindings();
+        query.bindValue(1, listing._path);
+        if (listing._inode != 0) {
+            query.bindValue(2, listing._inode);
+            query.bindValue(3, listing._modtime);
+            query.bindValue(4, listing._ctime);
+            query.bindValue(5, listing._entryCount);
+        }
+        if (!query.exec()) {
+            sqlFail("Set local dir listing", query);
+            return;
+        }
+    }
+    commitInternal(QStringLiteral("setLocalDirListings"));
+}
+
 QStringList SyncJournalDb::getSelectiveSyncList(SyncJournalDb::SelectiveSyncListType type, bool *ok)
 {
     QStringList result;
@@ -1944,6 +2363,10 @@ void SyncJournalDb::clearFileTable()
     SqlQuery query(_db);
     query.prepare("DELETE FROM metadata;");
     query.exec();
+
+    // The listings are only used together with the metadata
+    query.prepare("DELETE FROM localdirlisting;");
+    query.exec();
 }
 
 void SyncJournalDb::commit(const QString &context, bool startTrans)
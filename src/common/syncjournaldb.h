@@ -24,10 +24,12 @@
 #include <QDateTime>
 #include <QHash>
 #include <functional>
+#include <vector>
 
 #include "common/utility.h"
 #include "common/ownsql.h"
 #include "common/syncjournalfilerecord.h"
+#include "common/filesystembase.h"
 
 namespace OCC {
 class SyncJournalFileRecord;
@@ -60,6 +62,10 @@ public:
     bool getFileRecordByInode(quint64 inode, SyncJournalFileRecord *rec);
     bool getFileRecordsByFileId(const QByteArray &fileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback);
     bool getFilesBelowPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback);
+    /// Appends the names of the direct entries of the directory at \a path, "" being the root
+    bool getDirectoryEntryNames(const QByteArray &path, std::vector<QByteArray> *names);
+    /// Finds the records with the given content checksum header, like "SHA1:abc"
+    bool getFileRecordsByChecksum(const QByteArray &checksumHeader, const std::function<void(const SyncJournalFileRecord &)> &rowCallback);
     bool setFileRecord(const SyncJournalFileRecord &record);
 
     /// Like setFileRecord, but preserves checksums
@@ -114,6 +120,18 @@ public:
         bool _valid;
     };
 
+    /**
+     * The checksums of the blocks of a file as it was on the server at _etag,
+     * used to transfer only the blocks that differ.
+     */
+    struct BlockChecksums
+    {
+        QByteArray _etag;
+        qint64 _blockSize = 0;
+        QByteArray _checksums; /// The digests of all blocks, one after the other
+        bool _valid = false;
+    };
+
     struct PollInfo
     {
         QString _file;
@@ -121,6 +139,39 @@ public:
         qint64 _modtime;
     };
 
+    /**
+     * The inode and modification time of a local directory, saved when the
+     * client shuts down so the next start can tell which directories changed
+     * while it wasn't running.
+     *
+     * An _inode of 0 stands for a path that was already known to be changed,
+     * it needs to be looked at with everything below it.
+     */
+    struct LocalDirState
+    {
+        QByteArray _path;
+        quint64 _inode = 0;
+        qint64 _modtime = 0; ///< in nanoseconds, see FileSystem::FileIdentity
+    };
+
+    /**
+     * The inode, modification and change time of a local directory at the
+     * time its entries were last read, and how many of them there were.
+     *
+     * While these stay the same, a discovery with
+     * LocalDiscoveryStyle::DirectoryModtimes takes the entries from the
+     * metadata table instead of reading the directory. An _inode of 0 asks
+     * setLocalDirListings() to forget the directory.
+     */
+    struct LocalDirListing
+    {
+        QByteArray _path;
+        quint64 _inode = 0;
+        qint64 _modtime = 0; ///< in seconds, like SyncJournalFileRecord::_modtime
+        qint64 _ctime = 0; ///< in nanoseconds, see FileSystem::FileIdentity
+        int _entryCount = 0;
+    };
+
     DownloadInfo getDownloadInfo(const QString &file);
     void setDownloadInfo(const QString &file, const DownloadInfo &i);
     QVector<DownloadInfo> getAndDeleteStaleDownloadInfos(const QSet<QString> &keep);
@@ -131,6 +182,20 @@ public:
     // Return the list of transfer ids that were removed.
     QVector<uint> deleteStaleUploadInfos(const QSet<QString> &keep);
 
+    BlockChecksums getBlockChecksums(const QString &file);
+    /// Sets the entry of the file, or removes it if \a checksums is not valid
+    void setBlockChecksums(const QString &file, const BlockChecksums &checksums);
+
+    /**
+     * The checksum cache has the checksums of local files for as long as
+     * their FileSystem::FileIdentity doesn't change, see ComputeChecksum::computeNow().
+     *
+     * Returns an empty array if the checksum is not known.
+     */
+    QByteArray getCachedChecksum(const FileSystem::FileIdentity &identity, const QByteArray &checksumType);
+    void setCachedChecksum(const FileSystem::FileIdentity &identity, const QByteArray &checksumType,
+        const QByteArray &checksum);
+
     SyncJournalErrorBlacklistRecord errorBlacklistEntry(const QString &);
     bool deleteStaleErrorBlacklistEntries(const QSet<QString> &keep);
 
@@ -139,6 +204,19 @@ public:
     void setPollInfo(const PollInfo &);
     QVector<PollInfo> getPollInfos();
 
+    /// The paths of all the directories in the metadata table
+    QVector<QByteArray> getDirectoryPaths();
+
+    /// Replaces the saved local directory states
+    void setLocalDirStates(const QVector<LocalDirState> &states);
+    /// Returns the saved local directory states and deletes them, they are only good for one start
+    QVector<LocalDirState> getAndDeleteLocalDirStates();
+
+    /// The saved local directory listings, by path
+    QHash<QByteArray, LocalDirListing> getLocalDirListings();
+    /// Saves the given listings, and deletes the ones that have no inode
+    void setLocalDirListings(const QVector<LocalDirListing> &listings);
+
     enum SelectiveSyncListType {
         /** The black list is the list of folders that are unselected in the selective sync dialog.
          * For the sync engine, those folders are considered as if they were not there, so the local
@@ -244,6 +322,8 @@ private:
     QScopedPointer<SqlQuery> _getFileRecordQueryByInode;
     QScopedPointer<SqlQuery> _getFileRecordQueryByFileId;
     QScopedPointer<SqlQuery> _getFilesBelowPathQuery;
+    QScopedPointer<SqlQuery> _getDirectoryEntryNamesQuery;
+    QScopedPointer<SqlQuery> _getFileRecordQueryByChecksum;
     QScopedPointer<SqlQuery> _getAllFilesQuery;
     QScopedPointer<SqlQuery> _setFileRecordQuery;
     QScopedPointer<SqlQuery> _setFileRecordChecksumQuery;
@@ -254,6 +334,12 @@ private:
     QScopedPointer<SqlQuery> _getUploadInfoQuery;
     QScopedPointer<SqlQuery> _setUploadInfoQuery;
     QScopedPointer<SqlQuery> _deleteUploadInfoQuery;
+    QScopedPointer<SqlQuery> _getBlockChecksumsQuery;
+    QScopedPointer<SqlQuery> _setBlockChecksumsQuery;
+    QScopedPointer<SqlQuery> _deleteBlockChecksumsQuery;
+    QScopedPointer<SqlQuery> _deleteLocalDirListingsQuery;
+    QScopedPointer<SqlQuery> _getCachedChecksumQuery;
+    QScopedPointer<SqlQuery> _setCachedChecksumQuery;
     QScopedPointer<SqlQuery> _deleteFileRecordPhash;
     QScopedPointer<SqlQuery> _deleteFileRecordRecursively;
     QScopedPointer<SqlQuery> _getErrorBlacklistQuery;
@@ -62,4 +62,11 @@ if (WIN32)
   check_function_exists(__mingw_asprintf HAVE___MINGW_ASPRINTF)
 endif(WIN32)
 
+if (LINUX AND WITH_IO_URING)
+    find_package(LibUring)
+    if (LIBURING_FOUND)
+        set(HAVE_LIBURING 1)
+    endif (LIBURING_FOUND)
+endif (LINUX AND WITH_IO_URING)
+
 set(CSYNC_REQUIRED_LIBRARIES ${CMAKE_REQUIRED_LIBRARIES} CACHE INTERNAL "csync required system libraries")
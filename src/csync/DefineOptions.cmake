@@ -1,2 +1,3 @@
 option(UNIT_TESTING "Build with unit tests" OFF)
 option(MEM_NULL_TESTS "Enable NULL memory testing" OFF)
+option(WITH_IO_URING "Stat local files with io_uring where the kernel supports it (Linux)" ON)
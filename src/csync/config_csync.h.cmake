@@ -17,6 +17,7 @@
 #cmakedefine HAVE_UTIMES 1
 #cmakedefine HAVE_LSTAT 1
 #cmakedefine HAVE_FNMATCH 1
+#cmakedefine HAVE_LIBURING 1
 
 #cmakedefine HAVE___MINGW_ASPRINTF 1
 #cmakedefine HAVE_ASPRINTF 1
@@ -85,6 +85,10 @@ int csync_update(CSYNC *ctx) {
   csync_gettime(&start);
   ctx->current = LOCAL_REPLICA;
 
+  if (ctx->local_discovery_style == LocalDiscoveryStyle::DirectoryModtimes) {
+      ctx->local_dir_listings = ctx->statedb->getLocalDirListings();
+  }
+
   rc = csync_ftw(ctx, ctx->local.uri, csync_walker, MAX_DEPTH);
   if (rc < 0) {
     if(ctx->status_code == CSYNC_STATUS_OK) {
@@ -316,6 +320,9 @@ int csync_s::reinitialize() {
 
   local_discovery_style = LocalDiscoveryStyle::FilesystemOnly;
   locally_touched_dirs.clear();
+  partial_discovery = false;
+  local_dir_listings.clear();
+  new_local_dir_listings.clear();
 
   status = CSYNC_STATUS_INIT;
   SAFE_FREE(error_string);
@@ -39,8 +39,10 @@
 #include <sqlite3.h>
 #include <map>
 #include <set>
+#include <vector>
 
 #include "common/syncjournaldb.h"
+#include "common/pathtrie.h"
 #include "config_csync.h"
 #include "std/c_lib.h"
 #include "std/c_private.h"
@@ -74,6 +76,7 @@ enum csync_replica_e {
 enum class LocalDiscoveryStyle {
     FilesystemOnly, //< read all local data from the filesystem
     DatabaseAndFilesystem, //< read from the db, except for listed paths
+    DirectoryModtimes, //< stat everything, but only read the directories that changed
 };
 
 
@@ -199,12 +202,35 @@ struct OCSYNC_EXPORT csync_s {
   LocalDiscoveryStyle local_discovery_style = LocalDiscoveryStyle::FilesystemOnly;
 
   /**
-   * List of folder-relative directory paths that should be scanned on the
-   * filesystem if the local_discovery_style suggests it.
+   * Folder-relative paths that should be scanned on the filesystem if the
+   * local_discovery_style suggests it.
    *
-   * Their parents will be scanned too. The paths don't start with a /.
+   * Their parents and everything below them will be scanned too, except
+   * below the directories that only have their direct entries marked.
    */
-  std::set<QByteArray> locally_touched_dirs;
+  OCC::PathTrie locally_touched_dirs;
+
+  /**
+   * Whether the discovery is restricted to locally_touched_dirs.
+   *
+   * Only the touched paths, their parent directories and everything below
+   * them are discovered, locally and remotely. Everything else is left out of
+   * both trees, so it is neither reconciled nor propagated.
+   */
+  bool partial_discovery = false;
+
+  /**
+   * The local directory listings saved by earlier discoveries, used with
+   * LocalDiscoveryStyle::DirectoryModtimes.
+   *
+   * A directory whose inode, modification time and number of entries in
+   * the database are unchanged isn't read: the entries the database knows
+   * of are stat'ed instead, see csync_vio_local_stat_entries().
+   */
+  QHash<QByteArray, OCC::SyncJournalDb::LocalDirListing> local_dir_listings;
+
+  /// The listings of the directories that were read, to be saved after the sync
+  QVector<OCC::SyncJournalDb::LocalDirListing> new_local_dir_listings;
 
   bool ignore_hidden_files = true;
 
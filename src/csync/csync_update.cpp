@@ -40,10 +40,12 @@
 #include "csync_misc.h"
 
 #include "vio/csync_vio.h"
+#include "vio/csync_vio_local.h"
 
 #include "csync_rename.h"
 
 #include "common/utility.h"
+#include "common/filesystembase.h"
 #include "common/asserts.h"
 
 // Needed for PRIu64 on MinGW in C++ mode.
@@ -450,6 +452,12 @@ int csync_walker(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> fs) {
   return rc;
 }
 
+/* Whether a partial discovery has to look at the path, see csync_s::partial_discovery */
+static bool is_in_partial_discovery(CSYNC *ctx, const QByteArray &path)
+{
+    return !ctx->partial_discovery || ctx->locally_touched_dirs.intersects(path);
+}
+
 static bool fill_tree_from_db(CSYNC *ctx, const char *uri)
 {
     int64_t count = 0;
@@ -503,7 +511,30 @@ static bool fill_tree_from_db(CSYNC *ctx, const char *uri)
         ++count;
     };
 
-    if (!ctx->statedb->getFilesBelowPath(uri, rowCallback)) {
+    const QByteArray dir(uri);
+    if (ctx->partial_discovery && !ctx->locally_touched_dirs.contains(dir)) {
+        // Only a parent of touched paths: read the touched subtrees and the
+        // directories leading to them instead of everything below the directory.
+        const QByteArray prefix = dir.isEmpty() ? dir : dir + '/';
+        const auto touched = ctx->locally_touched_dirs.paths(dir);
+        for (auto it = touched.begin(); it != touched.end(); ++it) {
+            for (int i = it->indexOf('/', prefix.size()); ; i = it->indexOf('/', i + 1)) {
+                OCC::SyncJournalFileRecord rec;
+                if (!ctx->statedb->getFileRecord(i < 0 ? *it : it->left(i), &rec)) {
+                    ctx->status_code = CSYNC_STATUS_STATEDB_LOAD_ERROR;
+                    return false;
+                }
+                if (rec.isValid())
+                    rowCallback(rec);
+                if (i < 0)
+                    break;
+            }
+            if (!ctx->statedb->getFilesBelowPath(*it, rowCallback)) {
+                ctx->status_code = CSYNC_STATUS_STATEDB_LOAD_ERROR;
+                return false;
+            }
+        }
+    } else if (!ctx->statedb->getFilesBelowPath(dir, rowCallback)) {
         ctx->status_code = CSYNC_STATUS_STATEDB_LOAD_ERROR;
         return false;
     }
@@ -532,6 +563,38 @@ static bool mark_current_item_ignored( CSYNC *ctx, csync_file_stat_t *previous_f
     return false;
 }
 
+/* With LocalDiscoveryStyle::DirectoryModtimes: if the directory is unchanged since its
+ * listing was saved, stat the entries the database knows of instead of reading it. */
+static bool stat_known_local_entries(CSYNC *ctx, const char *uri, const QByteArray &path,
+    uint64_t inode, time_t modtime, qint64 ctime, std::vector<std::unique_ptr<csync_file_stat_t>> *entries)
+{
+    auto listing = ctx->local_dir_listings.constFind(path);
+    if (listing == ctx->local_dir_listings.constEnd()
+        || listing->_inode != inode || listing->_modtime != modtime || listing->_ctime != ctime) {
+        return false;
+    }
+
+    // An entry that is not in the database, or no longer is, was added or
+    // removed without changing the modification time
+    std::vector<QByteArray> names;
+    if (!ctx->statedb->getDirectoryEntryNames(path, &names)
+        || int(names.size()) != listing->_entryCount) {
+        return false;
+    }
+    if (!names.empty() && !csync_vio_local_stat_entries(uri, names, entries)) {
+        entries->clear();
+        return false;
+    }
+    return true;
+}
+
+static std::unique_ptr<csync_file_stat_t> next_known_entry(std::vector<std::unique_ptr<csync_file_stat_t>> *entries, size_t *index)
+{
+    if (*index >= entries->size())
+        return {};
+    return std::move((*entries)[(*index)++]);
+}
+
 /* File tree walker */
 int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     unsigned int depth) {
@@ -543,6 +606,19 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
   int read_from_db = 0;
   int rc = 0;
 
+  /* with LocalDiscoveryStyle::DirectoryModtimes */
+  QByteArray local_path;
+  uint64_t dir_inode = 0;
+  time_t dir_modtime = 0;
+  qint64 dir_ctime = 0;
+  OCC::FileSystem::FileIdentity dir_identity;
+  std::vector<std::unique_ptr<csync_file_stat_t>> known_entries;
+  size_t known_entry_index = 0;
+  bool use_known_entries = false;
+  bool save_listing = false;
+  time_t listing_start = 0;
+  int entry_count = 0;
+
   bool do_read_from_db = (ctx->current == REMOTE_REPLICA && ctx->remote.read_from_db);
   const char *db_uri = uri;
 
@@ -552,15 +628,13 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
       if (*local_uri == '/')
           ++local_uri;
       db_uri = local_uri;
-      do_read_from_db = true;
-
-      // Minor bug: local_uri doesn't have a trailing /. Example: Assume it's "d/foo"
-      // and we want to check whether we should read from the db. Assume "d/foo a" is
-      // in locally_touched_dirs. Then this check will say no, don't read from the db!
-      // (because "d/foo" < "d/foo a" < "d/foo/bar")
-      // C++14: Could skip the conversion to QByteArray here.
-      auto it = ctx->locally_touched_dirs.lower_bound(QByteArray(local_uri));
-      if (it != ctx->locally_touched_dirs.end() && it->startsWith(local_uri)) {
+      do_read_from_db = !ctx->locally_touched_dirs.needsEntriesOf(QByteArray(local_uri));
+
+      // A directory that isn't in the database under this path, because it is
+      // new or was moved here, has nothing there to read.
+      if (do_read_from_db && ctx->current_fs
+          && (ctx->current_fs->instruction == CSYNC_INSTRUCTION_NEW
+              || ctx->current_fs->instruction == CSYNC_INSTRUCTION_EVAL_RENAME)) {
           do_read_from_db = false;
       }
   }
@@ -583,7 +657,40 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
       return 0;
   }
 
-  if ((dh = csync_vio_opendir(ctx, uri)) == NULL) {
+  if (ctx->current == LOCAL_REPLICA
+      && ctx->local_discovery_style == LocalDiscoveryStyle::DirectoryModtimes) {
+      local_path = uri + strlen(ctx->local.uri);
+      if (local_path.startsWith('/'))
+          local_path.remove(0, 1);
+      if (local_path.isEmpty()) {
+          csync_file_stat_t root;
+          if (csync_vio_local_stat(ctx->local.uri, &root) == 0) {
+              dir_inode = root.inode;
+              dir_modtime = root.modtime;
+          }
+      } else if (ctx->current_fs) {
+          dir_inode = ctx->current_fs->inode;
+          dir_modtime = ctx->current_fs->modtime;
+      }
+
+      // Adding or removing entries also changes the ctime, which tools
+      // like rsync or tar can't set back like they do with the mtime
+      if (dir_inode != 0
+          && OCC::FileSystem::getFileIdentity(QString::fromUtf8(uri), &dir_identity)
+          && dir_identity.inode == dir_inode) {
+          dir_ctime = dir_identity.ctime;
+      }
+      if (dir_ctime != 0) {
+          use_known_entries = stat_known_local_entries(ctx, uri, local_path, dir_inode, dir_modtime, dir_ctime, &known_entries);
+          save_listing = !use_known_entries;
+          listing_start = time(NULL);
+      }
+      if (use_known_entries) {
+          qCDebug(lcUpdate, "%s is unchanged, not reading it", uri);
+      }
+  }
+
+  if (!use_known_entries && (dh = csync_vio_opendir(ctx, uri)) == NULL) {
       if (ctx->abort) {
           qCDebug(lcUpdate, "Aborted!");
           ctx->status_code = CSYNC_STATUS_ABORTED;
@@ -626,7 +733,8 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
       goto error;
   }
 
-  while ((dirent = csync_vio_readdir(ctx, dh))) {
+  while ((dirent = use_known_entries ? next_known_entry(&known_entries, &known_entry_index)
+                                     : csync_vio_readdir(ctx, dh))) {
     /* Conversion error */
     if (dirent->path.isEmpty() && !dirent->original_path.isEmpty()) {
         ctx->status_code = CSYNC_STATUS_INVALID_CHARACTERS;
@@ -674,6 +782,11 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
         dirent->path = dirent->path.mid(strlen(ctx->local.uri) + 1);
     }
 
+    if (!is_in_partial_discovery(ctx, dirent->path)) {
+        save_listing = false;
+        continue;
+    }
+
     previous_fs = ctx->current_fs;
     bool recurse = dirent->type == CSYNC_FTW_TYPE_DIR;
 
@@ -681,6 +794,11 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     rc = fn(ctx, std::move(dirent));
     /* this function may update ctx->current and ctx->read_from_db */
 
+    /* only a listing of entries that all go to the database is worth saving */
+    if (save_listing && (rc != 0 || ctx->current_fs == previous_fs)) {
+        save_listing = false;
+    }
+
     if (rc < 0) {
       if (CSYNC_STATUS_IS_OK(ctx->status_code)) {
           ctx->status_code = CSYNC_STATUS_UPDATE_ERROR;
@@ -718,13 +836,40 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
         previous_fs->child_modified = ctx->current_fs->child_modified;
     }
 
+    if (save_listing) {
+        if (ctx->current_fs->instruction == CSYNC_INSTRUCTION_IGNORE) {
+            save_listing = false;
+        } else {
+            ++entry_count;
+        }
+    }
+
     ctx->current_fs = previous_fs;
     ctx->remote.read_from_db = read_from_db;
   }
 
-  csync_vio_closedir(ctx, dh);
+  if (dh != NULL) {
+    csync_vio_closedir(ctx, dh);
+  }
   qCDebug(lcUpdate, " <= Closing walk for %s with read_from_db %d", uri, read_from_db);
 
+  /* The modification time only has a resolution of seconds: a change in the
+   * same second as the one before it would go unnoticed. */
+  if (save_listing && dir_modtime < listing_start - 1) {
+      OCC::SyncJournalDb::LocalDirListing listing;
+      listing._path = local_path;
+      listing._inode = dir_inode;
+      listing._modtime = dir_modtime;
+      listing._ctime = dir_ctime;
+      listing._entryCount = entry_count;
+      ctx->new_local_dir_listings.append(listing);
+  } else if (!use_known_entries && ctx->local_dir_listings.contains(local_path)) {
+      // The saved listing is outdated
+      OCC::SyncJournalDb::LocalDirListing listing;
+      listing._path = local_path;
+      ctx->new_local_dir_listings.append(listing);
+  }
+
   return rc;
 
 error:
@@ -27,4 +27,14 @@ std::unique_ptr<csync_file_stat_t> OCSYNC_EXPORT csync_vio_local_readdir(csync_v
 
 int OCSYNC_EXPORT csync_vio_local_stat(const char *uri, csync_file_stat_t *buf);
 
+/**
+ * Stats the given entries of a directory, filling \a entries like
+ * csync_vio_local_readdir() would.
+ *
+ * Returns false if any of them can't be stat'ed, the directory has to be
+ * read then.
+ */
+bool OCSYNC_EXPORT csync_vio_local_stat_entries(const char *dir, const std::vector<QByteArray> &names,
+    std::vector<std::unique_ptr<csync_file_stat_t>> *entries);
+
 #endif /* _CSYNC_VIO_LOCAL_H */
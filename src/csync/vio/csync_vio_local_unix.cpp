@@ -26,6 +26,10 @@
 #include <dirent.h>
 #include <stdio.h>
 
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+
 #include "c_private.h"
 #include "c_lib.h"
 #include "c_string.h"
@@ -35,6 +39,11 @@
 #include "csync_vio.h"
 
 #include "vio/csync_vio_local.h"
+#ifdef HAVE_LIBURING
+#include "vio/csync_vio_local_uring.h"
+#endif
+
+#include <QtConcurrent>
 
 /*
  * directory functions
@@ -43,27 +52,34 @@
 typedef struct dhandle_s {
   DIR *dh;
   char *path;
+  /* Read and stat'ed all at once by the first csync_vio_local_readdir() */
+  std::vector<std::unique_ptr<csync_file_stat_t>> entries;
+  size_t next_entry;
+  bool read;
 } dhandle_t;
 
 static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf);
+static void _csync_vio_local_fill_stat(const csync_stat_t &sb, csync_file_stat_t *buf);
+static int _csync_vio_local_stat_batch(const std::vector<QByteArray> &paths,
+    const std::vector<csync_file_stat_t *> &entries);
 
 csync_vio_handle_t *csync_vio_local_opendir(const char *name) {
   dhandle_t *handle = NULL;
   mbchar_t *dirname = NULL;
 
-  handle = (dhandle_t*)c_malloc(sizeof(dhandle_t));
-
   dirname = c_utf8_path_to_locale(name);
 
-  handle->dh = _topendir( dirname );
-  if (handle->dh == NULL) {
-    c_free_locale_string(dirname);
-    SAFE_FREE(handle);
+  DIR *dh = _topendir( dirname );
+  c_free_locale_string(dirname);
+  if (dh == NULL) {
     return NULL;
   }
 
+  handle = new dhandle_t;
+  handle->dh = dh;
   handle->path = c_strdup(name);
-  c_free_locale_string(dirname);
+  handle->next_entry = 0;
+  handle->read = false;
 
   return (csync_vio_handle_t *) handle;
 }
@@ -81,63 +97,72 @@ int csync_vio_local_closedir(csync_vio_handle_t *dhandle) {
   rc = _tclosedir(handle->dh);
 
   SAFE_FREE(handle->path);
-  SAFE_FREE(handle);
+  delete handle;
 
   return rc;
 }
 
-std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *dhandle) {
-
-  dhandle_t *handle = NULL;
-
-  handle = (dhandle_t *) dhandle;
+/* Reads all entries of the directory, then stats them in one batch */
+static void _csync_vio_local_read_entries(dhandle_t *handle) {
   struct _tdirent *dirent = NULL;
-  std::unique_ptr<csync_file_stat_t> file_stat;
-
-  do {
-      dirent = _treaddir(handle->dh);
-      if (dirent == NULL)
-          return {};
-  } while (qstrcmp(dirent->d_name, ".") == 0 || qstrcmp(dirent->d_name, "..") == 0);
-
-  file_stat.reset(new csync_file_stat_t);
-  file_stat->path = c_utf8_from_locale(dirent->d_name);
-  QByteArray fullPath = QByteArray() % const_cast<const char *>(handle->path) % '/' % QByteArray() % const_cast<const char *>(dirent->d_name);
-  if (file_stat->path.isNull()) {
-      file_stat->original_path = fullPath;
-      CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "Invalid characters in file/directory name, please rename: \"%s\" (%s)",
-                dirent->d_name, handle->path);
-  }
+  std::vector<QByteArray> fullPaths;
+  std::vector<csync_file_stat_t *> toStat;
+
+  while ((dirent = _treaddir(handle->dh))) {
+      if (qstrcmp(dirent->d_name, ".") == 0 || qstrcmp(dirent->d_name, "..") == 0)
+          continue;
+
+      std::unique_ptr<csync_file_stat_t> file_stat(new csync_file_stat_t);
+      file_stat->path = c_utf8_from_locale(dirent->d_name);
+      QByteArray fullPath = QByteArray() % const_cast<const char *>(handle->path) % '/' % QByteArray() % const_cast<const char *>(dirent->d_name);
+      if (file_stat->path.isNull()) {
+          file_stat->original_path = fullPath;
+          CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "Invalid characters in file/directory name, please rename: \"%s\" (%s)",
+                    dirent->d_name, handle->path);
+      }
 
-  /* Check for availability of d_type, see manpage. */
+      /* Check for availability of d_type, see manpage. */
 #if defined(_DIRENT_HAVE_D_TYPE) || defined(__APPLE__)
-  switch (dirent->d_type) {
-    case DT_FIFO:
-    case DT_SOCK:
-    case DT_CHR:
-    case DT_BLK:
-      break;
-    case DT_DIR:
-    case DT_REG:
-      if (dirent->d_type == DT_DIR) {
-        file_stat->type = CSYNC_FTW_TYPE_DIR;
-      } else {
-        file_stat->type = CSYNC_FTW_TYPE_FILE;
+      switch (dirent->d_type) {
+        case DT_FIFO:
+        case DT_SOCK:
+        case DT_CHR:
+        case DT_BLK:
+          break;
+        case DT_DIR:
+        case DT_REG:
+          if (dirent->d_type == DT_DIR) {
+            file_stat->type = CSYNC_FTW_TYPE_DIR;
+          } else {
+            file_stat->type = CSYNC_FTW_TYPE_FILE;
+          }
+          break;
+        default:
+          break;
       }
-      break;
-    default:
-      break;
-  }
 #endif
 
-  if (file_stat->path.isNull())
-      return file_stat;
+      if (!file_stat->path.isNull()) {
+          fullPaths.push_back(std::move(fullPath));
+          toStat.push_back(file_stat.get());
+      }
+      handle->entries.push_back(std::move(file_stat));
+  }
 
-  if (_csync_vio_local_stat_mb(fullPath.constData(), file_stat.get()) < 0) {
-      // Will get excluded by _csync_detect_update.
-      file_stat->type = CSYNC_FTW_TYPE_SKIP;
+  // The ones that fail will get excluded by _csync_detect_update.
+  _csync_vio_local_stat_batch(fullPaths, toStat);
+}
+
+std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *dhandle) {
+  dhandle_t *handle = (dhandle_t *) dhandle;
+
+  if (!handle->read) {
+      _csync_vio_local_read_entries(handle);
+      handle->read = true;
   }
-  return file_stat;
+  if (handle->next_entry >= handle->entries.size())
+      return {};
+  return std::move(handle->entries[handle->next_entry++]);
 }
 
 
@@ -150,6 +175,73 @@ int csync_vio_local_stat(const char *uri, csync_file_stat_t *buf)
     return rc;
 }
 
+bool csync_vio_local_stat_entries(const char *dir, const std::vector<QByteArray> &names,
+    std::vector<std::unique_ptr<csync_file_stat_t>> *entries)
+{
+    std::vector<QByteArray> fullPaths;
+    std::vector<csync_file_stat_t *> toStat;
+    entries->clear();
+    entries->reserve(names.size());
+    fullPaths.reserve(names.size());
+    toStat.reserve(names.size());
+    for (const auto &name : names) {
+        std::unique_ptr<csync_file_stat_t> file_stat(new csync_file_stat_t);
+        file_stat->path = name;
+        QByteArray fullPath = QByteArray() % dir % '/' % name;
+        mbchar_t *wuri = c_utf8_path_to_locale(fullPath.constData());
+        fullPaths.push_back(wuri);
+        c_free_locale_string(wuri);
+        toStat.push_back(file_stat.get());
+        entries->push_back(std::move(file_stat));
+    }
+    return _csync_vio_local_stat_batch(fullPaths, toStat) == 0;
+}
+
+/*
+ * Stats the entries at the given paths, the ones that fail get
+ * CSYNC_FTW_TYPE_SKIP. Returns how many failed.
+ *
+ * Most of the time of a stat call of a large directory is spent waiting for
+ * the disk: the calls are handed to io_uring, or else made in parallel, for
+ * the disk to reorder them.
+ */
+static int _csync_vio_local_stat_batch(const std::vector<QByteArray> &paths,
+    const std::vector<csync_file_stat_t *> &entries)
+{
+    std::atomic<int> failed(0);
+
+#ifdef HAVE_LIBURING
+    std::vector<csync_stat_t> results;
+    std::vector<int> errors;
+    if (paths.size() > 1 && csync_vio_local_uring_lstat(paths, &results, &errors)) {
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (errors[i] == 0) {
+                _csync_vio_local_fill_stat(results[i], entries[i]);
+            } else {
+                entries[i]->type = CSYNC_FTW_TYPE_SKIP;
+                ++failed;
+            }
+        }
+        return failed;
+    }
+#endif
+
+    std::vector<size_t> indexes(entries.size());
+    std::iota(indexes.begin(), indexes.end(), 0);
+    auto statEntry = [&](size_t i) {
+        if (_csync_vio_local_stat_mb(paths[i].constData(), entries[i]) < 0) {
+            entries[i]->type = CSYNC_FTW_TYPE_SKIP;
+            ++failed;
+        }
+    };
+    if (indexes.size() < 32) {
+        std::for_each(indexes.begin(), indexes.end(), statEntry);
+    } else {
+        QtConcurrent::blockingMap(indexes, statEntry);
+    }
+    return failed;
+}
+
 static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf)
 {
     csync_stat_t sb;
@@ -158,6 +250,18 @@ static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf
         return -1;
     }
 
+    _csync_vio_local_fill_stat(sb, buf);
+
+#ifdef __APPLE__
+  if (sb.st_flags & UF_HIDDEN) {
+      buf->is_hidden = true;
+  }
+#endif
+    return 0;
+}
+
+static void _csync_vio_local_fill_stat(const csync_stat_t &sb, csync_file_stat_t *buf)
+{
     switch (sb.st_mode & S_IFMT) {
     case S_IFDIR:
       buf->type = CSYNC_FTW_TYPE_DIR;
@@ -174,14 +278,7 @@ static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf
       break;
   }
 
-#ifdef __APPLE__
-  if (sb.st_flags & UF_HIDDEN) {
-      buf->is_hidden = true;
-  }
-#endif
-
   buf->inode = sb.st_ino;
   buf->modtime = sb.st_mtime;
   buf->size = sb.st_size;
-  return 0;
 }
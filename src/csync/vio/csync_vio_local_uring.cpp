@@ -0,0 +1,198 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include <atomic>
+#include <memory>
+
+#include <liburing.h>
+
+#include <QLoggingCategory>
+
+#include "vio/csync_vio_local_uring.h"
+
+Q_LOGGING_CATEGORY(lcUring, "sync.csync.vio_local_uring", QtInfoMsg)
+
+namespace {
+
+/* How many requests are in flight at most */
+const unsigned ringSize = 256;
+
+/* How often in a row the kernel may take no request before giving up */
+const int maximumStalledSubmits = 100;
+
+/* One ring per discovery thread, set up on first use */
+struct Ring
+{
+    io_uring ring;
+    bool usable = false;
+
+    Ring()
+    {
+        int rc = io_uring_queue_init(ringSize, &ring, 0);
+        if (rc < 0) {
+            qCInfo(lcUring) << "io_uring is not available:" << strerror(-rc);
+            return;
+        }
+        io_uring_probe *probe = io_uring_get_probe_ring(&ring);
+        usable = probe && io_uring_opcode_supported(probe, IORING_OP_STATX);
+        if (probe)
+            io_uring_free_probe(probe);
+        if (!usable) {
+            qCInfo(lcUring) << "io_uring does not support statx";
+            io_uring_queue_exit(&ring);
+        }
+    }
+
+    ~Ring()
+    {
+        if (usable)
+            io_uring_queue_exit(&ring);
+    }
+
+    Ring(const Ring &) = delete;
+    Ring &operator=(const Ring &) = delete;
+};
+
+bool isTransient(int rc)
+{
+    return rc == -EINTR || rc == -EAGAIN || rc == -EBUSY;
+}
+
+/* What the kernel reads and writes while the requests are in flight */
+struct Requests
+{
+    std::vector<QByteArray> paths;
+    std::vector<struct statx> buffers;
+};
+
+void statxToStat(const struct statx &stx, csync_stat_t *sb)
+{
+    memset(sb, 0, sizeof(*sb));
+    sb->st_mode = stx.stx_mode;
+    sb->st_ino = stx.stx_ino;
+    sb->st_nlink = stx.stx_nlink;
+    sb->st_uid = stx.stx_uid;
+    sb->st_gid = stx.stx_gid;
+    sb->st_size = stx.stx_size;
+    sb->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    sb->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+    sb->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+    sb->st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+    sb->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+}
+
+}
+
+bool csync_vio_local_uring_lstat(const std::vector<QByteArray> &paths,
+    std::vector<csync_stat_t> *results, std::vector<int> *errors)
+{
+    static std::atomic<bool> enabled(qgetenv("OWNCLOUD_IO_URING") != "0");
+    if (!enabled)
+        return false;
+    static thread_local Ring ring;
+    if (!ring.usable)
+        return false;
+
+    const size_t count = paths.size();
+    std::unique_ptr<Requests> requests(new Requests);
+    requests->paths = paths; // shared, keeps the data alive along with the buffers
+    requests->buffers.resize(count);
+    errors->assign(count, 0);
+
+    size_t queued = 0; // prepared, not yet taken by the kernel
+    size_t inFlight = 0;
+    size_t next = 0;
+    size_t done = 0;
+    int failure = 0;
+    int stalledSubmits = 0;
+    while (done < count) {
+        while (failure == 0 && next < count && queued + inFlight < ringSize) {
+            io_uring_sqe *sqe = io_uring_get_sqe(&ring.ring);
+            if (!sqe)
+                break;
+            io_uring_prep_statx(sqe, AT_FDCWD, requests->paths[next].constData(), AT_SYMLINK_NOFOLLOW,
+                STATX_BASIC_STATS, &requests->buffers[next]);
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(next));
+            ++next;
+            ++queued;
+        }
+        if (failure == 0 && queued > 0) {
+            int rc = io_uring_submit(&ring.ring);
+            if (rc > 0) {
+                queued -= rc;
+                inFlight += rc;
+                stalledSubmits = 0;
+            } else if (rc < 0 && !isTransient(rc)) {
+                failure = rc;
+            }
+        }
+        if (inFlight == 0) {
+            // Nothing to wait for: retrying a submit that takes nothing would spin
+            if (failure == 0 && ++stalledSubmits > maximumStalledSubmits)
+                failure = -EAGAIN;
+            if (failure != 0)
+                break;
+            continue;
+        }
+
+        io_uring_cqe *cqe = nullptr;
+        int rc = io_uring_wait_cqe(&ring.ring, &cqe);
+        if (rc < 0) {
+            if (isTransient(rc))
+                continue;
+            // The kernel may still write to the buffers of the requests in flight,
+            // so they are leaked rather than freed
+            qCWarning(lcUring) << "io_uring_wait_cqe failed with" << inFlight << "requests in flight,"
+                               << "no longer using io_uring:" << strerror(-rc);
+            requests.release();
+            enabled = false;
+            return false;
+        }
+        unsigned head;
+        unsigned seen = 0;
+        io_uring_for_each_cqe(&ring.ring, head, cqe)
+        {
+            size_t index = reinterpret_cast<size_t>(io_uring_cqe_get_data(cqe));
+            (*errors)[index] = cqe->res < 0 ? -cqe->res : 0;
+            ++seen;
+        }
+        io_uring_cq_advance(&ring.ring, seen);
+        inFlight -= seen;
+        done += seen;
+    }
+
+    if (failure != 0) {
+        // Unlikely to get better, the callers stat on their own from now on
+        qCWarning(lcUring) << "io_uring_submit failed, no longer using io_uring:" << strerror(-failure);
+        enabled = false;
+        return false;
+    }
+
+    results->resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        if ((*errors)[i] == 0)
+            statxToStat(requests->buffers[i], &(*results)[i]);
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _CSYNC_VIO_LOCAL_URING_H
+#define _CSYNC_VIO_LOCAL_URING_H
+
+#include <QByteArray>
+#include <vector>
+
+#include "c_private.h"
+
+/**
+ * Stats \a paths like lstat() does, with batches of io_uring statx requests
+ * that the kernel works on concurrently instead of one blocking call after
+ * the other.
+ *
+ * Fills \a results and \a errors, the errno of each path or 0. Returns false
+ * if io_uring can't be used: the kernel doesn't support it, it failed, or it
+ * was turned off with OWNCLOUD_IO_URING=0. The caller stats on its own then.
+ */
+bool csync_vio_local_uring_lstat(const std::vector<QByteArray> &paths,
+    std::vector<csync_stat_t> *results, std::vector<int> *errors);
+
+#endif /* _CSYNC_VIO_LOCAL_URING_H */
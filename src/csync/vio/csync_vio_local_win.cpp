@@ -219,6 +219,13 @@ int csync_vio_local_stat(const char *uri, csync_file_stat_t *buf)
     return rc;
 }
 
+bool csync_vio_local_stat_entries(const char *, const std::vector<QByteArray> &,
+    std::vector<std::unique_ptr<csync_file_stat_t>> *)
+{
+    /* The type and modification time come from FindNextFile, the directory is read instead */
+    return false;
+}
+
 static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf)
 {
     /* Almost nothing to do since csync_vio_local_readdir already filled up most of the information
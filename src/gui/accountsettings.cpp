@@ -304,7 +304,7 @@ void AccountSettings::slotCustomContextMenuRequested(const QPoint &pos)
 
     if (!folderPaused) {
         ac = menu->addAction(tr("Force sync now"));
-        if (folderMan->currentSyncFolder() == folderMan->folder(alias)) {
+        if (folderMan->currentSyncFolders().contains(folderMan->folder(alias))) {
             ac->setText(tr("Restart sync"));
         }
         ac->setEnabled(folderConnected);
@@ -576,9 +576,17 @@ void AccountSettings::slotForceSyncCurrentFolder()
 {
     FolderMan *folderMan = FolderMan::instance();
     if (auto selectedFolder = folderMan->folder(selectedFolderAlias())) {
-        // Terminate and reschedule any running sync
-        if (Folder *current = folderMan->currentSyncFolder()) {
-            folderMan->terminateSyncProcess();
+        // Terminate and reschedule the sync of the folder, or one that
+        // occupies the slot the folder needs
+        const auto currentFolders = folderMan->currentSyncFolders();
+        Folder *current = 0;
+        if (currentFolders.contains(selectedFolder)) {
+            current = selectedFolder;
+        } else if (currentFolders.size() >= FolderMan::maximumConcurrentSyncs()) {
+            current = currentFolders.first();
+        }
+        if (current) {
+            folderMan->terminateSyncProcess(current);
             folderMan->scheduleFolder(current);
         }
 
@@ -35,6 +35,7 @@
 #include "creds/abstractcredentials.h"
 
 #include <QTimer>
+#include <QtConcurrent>
 #include <QUrl>
 #include <QDir>
 #include <QSettings>
@@ -108,11 +109,31 @@ Folder::Folder(const FolderDefinition &definition,
     _scheduleSelfTimer.setInterval(SyncEngine::minimumFileAgeForUpload);
     connect(&_scheduleSelfTimer, &QTimer::timeout,
         this, &Folder::slotScheduleThisFolder);
+
+    // Collect the bursts of watcher notifications before checking them
+    _pendingWatchedPathsTimer.setSingleShot(true);
+    _pendingWatchedPathsTimer.setInterval(100);
+    connect(&_pendingWatchedPathsTimer, &QTimer::timeout,
+        this, &Folder::slotCheckWatchedPaths);
+    connect(&_watchedPathsWatcher, &QFutureWatcherBase::finished,
+        this, &Folder::slotWatchedPathsChecked);
+    connect(&_warmStartWatcher, &QFutureWatcherBase::finished,
+        this, &Folder::slotWarmStartChecked);
+    connect(&_localDirStatesWatcher, &QFutureWatcherBase::finished,
+        this, &Folder::slotLocalDirStatesRead);
 }
 
 Folder::~Folder()
 {
-    // Reset then engine first as it will abort and try to access members of the Folder
+    // The check uses the journal
+    _watchedPathsWatcher.waitForFinished();
+    _warmStartCanceled.storeRelease(1);
+    _warmStartWatcher.waitForFinished();
+
+    // The watcher may still be registering folders, asking whether they are excluded
+    _folderWatcher.reset();
+
+    // Reset the engine before the other members as it will abort and try to access members of the Folder
     _engine.reset();
 }
 
@@ -285,14 +306,37 @@ void Folder::slotRunEtagJob()
     // Do the ordinary etag check for the root folder and schedule a
     // sync if it's different.
 
-    _requestEtagJob = new RequestEtagJob(account, remotePath(), this);
-    _requestEtagJob->setTimeout(60 * 1000);
+    auto job = new RequestEtagJob(account, remotePath(), this);
+    job->setTimeout(60 * 1000);
     // check if the etag is different when retrieved
-    QObject::connect(_requestEtagJob.data(), &RequestEtagJob::etagRetreived, this, &Folder::etagRetreived);
-    FolderMan::instance()->slotScheduleETagJob(alias(), _requestEtagJob);
+    QObject::connect(job, &RequestEtagJob::etagRetreived, this, &Folder::etagRetreived);
+    _requestEtagJob = job;
+    FolderMan::instance()->slotScheduleETagJob(alias(), job);
     // The _requestEtagJob is auto deleting itself on finish. Our guard pointer _requestEtagJob will then be null.
 }
 
+void Folder::setCoalescedEtagJob(LsColJob *job)
+{
+    if (_requestEtagJob) {
+        return;
+    }
+    qCInfo(lcFolder) << "Checking" << remoteUrl().toString() << "for changes via a shared ETag check. (time since last sync:" << (_timeSinceLastSyncDone.elapsed() / 1000) << "s)";
+
+    // The hrefs in the listing are decoded and have no trailing slash
+    QString davPath = remoteUrl().path(QUrl::FullyDecoded);
+    if (davPath.endsWith(QLatin1Char('/'))) {
+        davPath.chop(1);
+    }
+
+    _requestEtagJob = job;
+    QObject::connect(job, &LsColJob::directoryListingIterated, this,
+        [this, davPath](const QString &href, const QMap<QString, QString> &properties) {
+            if (href == davPath && properties.contains(QLatin1String("getetag"))) {
+                etagRetreived(properties.value(QLatin1String("getetag")));
+            }
+        });
+}
+
 void Folder::etagRetreived(const QString &etag)
 {
     // re-enable sync if it was disabled because network was down
@@ -301,6 +345,7 @@ void Folder::etagRetreived(const QString &etag)
     if (_lastEtag != etag) {
         qCInfo(lcFolder) << "Compare etag with previous etag: last:" << _lastEtag << ", received:" << etag << "-> CHANGED";
         _lastEtag = etag;
+        setNextSyncFull();
         slotScheduleThisFolder();
     }
 
@@ -460,8 +505,13 @@ void Folder::slotWatchedPathChanged(const QString &path)
     // We do this before checking for our own sync-related changes to make
     // extra sure to not miss relevant changes.
     auto relativePathBytes = relativePath.toUtf8();
-    _localDiscoveryPaths.insert(relativePathBytes);
-    qCDebug(lcFolder) << "local discovery: inserted" << relativePath << "due to file watcher";
+    const bool wasFullRescan = _localDiscoveryPaths.isFullRescan();
+    if (_localDiscoveryPaths.insert(relativePathBytes)) {
+        qCDebug(lcFolder) << "local discovery: inserted" << relativePath << "due to file watcher";
+        if (!wasFullRescan && _localDiscoveryPaths.isFullRescan()) {
+            qCInfo(lcFolder) << "local discovery: too many paths changed, the whole folder will be scanned";
+        }
+    }
 
 // The folder watcher fires a lot of bogus notifications during
 // a sync operation, both for actual user files and the database
@@ -478,20 +528,269 @@ void Folder::slotWatchedPathChanged(const QString &path)
     }
 #endif
 
-    // Check that the mtime actually changed.
-    SyncJournalFileRecord record;
-    if (_journal.getFileRecord(relativePathBytes, &record)
-        && record.isValid()
-        && !FileSystem::fileChanged(path, record._fileSize, record._modtime)) {
-        qCInfo(lcFolder) << "Ignoring spurious notification for file" << relativePath;
-        return; // probably a spurious notification
+    // Check that the mtime actually changed, see slotCheckWatchedPaths()
+    _pendingWatchedPaths.append(path);
+    if (!_pendingWatchedPathsTimer.isActive() && !_watchedPathsWatcher.isRunning())
+        _pendingWatchedPathsTimer.start();
+}
+
+/* Returns the paths whose size or mtime differ from the journal. Runs in a worker thread. */
+static QStringList changedWatchedPaths(SyncJournalDb *journal, const QString &folderPath, const QStringList &paths)
+{
+    QStringList changed;
+    for (const auto &path : paths) {
+        SyncJournalFileRecord record;
+        if (journal->getFileRecord(path.midRef(folderPath.size()).toUtf8(), &record)
+            && record.isValid()
+            && !FileSystem::fileChanged(path, record._fileSize, record._modtime)) {
+            qCDebug(lcFolder) << "Ignoring spurious notification for file" << path;
+            continue; // probably a spurious notification
+        }
+        changed.append(path);
+    }
+    return changed;
+}
+
+void Folder::slotCheckWatchedPaths()
+{
+    if (_pendingWatchedPaths.isEmpty() || _watchedPathsWatcher.isRunning())
+        return;
+
+    // Bound the batches so the first real changes are seen early
+    const int batchSize = 1000;
+    QStringList batch;
+    if (_pendingWatchedPaths.size() <= batchSize) {
+        batch.swap(_pendingWatchedPaths);
+    } else {
+        batch = _pendingWatchedPaths.mid(0, batchSize);
+        _pendingWatchedPaths.erase(_pendingWatchedPaths.begin(), _pendingWatchedPaths.begin() + batchSize);
+    }
+    _watchedPathsWatcher.setFuture(QtConcurrent::run(&changedWatchedPaths, &_journal, path(), batch));
+}
+
+void Folder::slotWatchedPathsChecked()
+{
+    const QStringList changed = _watchedPathsWatcher.result();
+    if (!changed.isEmpty()) {
+        foreach (const QString &path, changed) {
+            emit watchedFileChangedExternally(path);
+        }
+
+        // The user just changed the files, the upload should not wait for background syncs
+        setNextSyncInteractive();
+
+        // Also schedule this folder for a sync, but only after some delay:
+        // The sync will not upload files that were changed too recently.
+        scheduleThisFolderSoon();
+    }
+
+    if (!_pendingWatchedPaths.isEmpty())
+        slotCheckWatchedPaths();
+}
+
+namespace {
+/* Reads the current state of a local directory. Runs in worker threads. */
+struct LocalDirStateReader
+{
+    typedef SyncJournalDb::LocalDirState result_type;
+
+    QString folderPath;
+    qint64 recentModtime; // in nanoseconds since the epoch
+
+    SyncJournalDb::LocalDirState operator()(const QByteArray &path) const
+    {
+        SyncJournalDb::LocalDirState state;
+        state._path = path;
+        FileSystem::FileIdentity identity;
+        if (FileSystem::getFileIdentity(folderPath + QString::fromUtf8(path), &identity)) {
+            state._inode = identity.inode;
+            // The watcher may not have reported a very recent change yet:
+            // a modtime that can't match makes the next start look at it
+            state._modtime = identity.modtime < recentModtime ? identity.modtime : 0;
+        }
+        return state;
+    }
+};
+
+/* Whether a local directory differs from its saved state. Runs in worker threads. */
+struct LocalDirChanged
+{
+    typedef bool result_type;
+
+    QString folderPath;
+
+    const QAtomicInt *canceled;
+
+    bool operator()(const SyncJournalDb::LocalDirState &state) const
+    {
+        if (canceled->loadAcquire())
+            return false;
+        if (state._inode == 0)
+            return true;
+        FileSystem::FileIdentity identity;
+        return !FileSystem::getFileIdentity(folderPath + QString::fromUtf8(state._path), &identity)
+            || identity.inode != state._inode
+            || identity.modtime != state._modtime;
+    }
+};
+
+/* Whether a file in the database differs from the disk. Runs in worker threads. */
+struct KnownFileChanged
+{
+    typedef bool result_type;
+
+    QString folderPath;
+    const QAtomicInt *canceled;
+
+    bool operator()(const SyncJournalFileRecord &record) const
+    {
+        if (canceled->loadAcquire())
+            return false;
+        return FileSystem::fileChanged(folderPath + QString::fromUtf8(record._path), record._fileSize, record._modtime);
+    }
+};
+}
+
+/* The local directory states of the given directories. Runs in a worker thread. */
+static QVector<SyncJournalDb::LocalDirState> readLocalDirStates(const QString &folderPath, const QVector<QByteArray> &dirs)
+{
+    const qint64 recentModtime = (QDateTime::currentMSecsSinceEpoch() - 5000) * 1000000;
+    return QtConcurrent::blockingMapped<QVector<SyncJournalDb::LocalDirState>>(
+        dirs, LocalDirStateReader{ folderPath, recentModtime });
+}
+
+/* The directories and files that changed since their states were saved. Runs in a worker thread.
+ * Stops early once *canceled is set, the result doesn't matter then. */
+static QVector<SyncJournalDb::LocalDirState> warmStartChanges(SyncJournalDb *journal, const QString &folderPath,
+    const QVector<SyncJournalDb::LocalDirState> &states, const QAtomicInt *canceled)
+{
+    auto changed = QtConcurrent::blockingFiltered(states, LocalDirChanged{ folderPath, canceled });
+    if (canceled->loadAcquire())
+        return changed;
+
+    // Files edited in place don't change the modtime of their directory,
+    // the known files of the unchanged directories are checked one by one
+    QSet<QByteArray> unchangedDirs;
+    foreach (const auto &state, states) {
+        if (state._inode != 0)
+            unchangedDirs.insert(state._path);
+    }
+    foreach (const auto &state, changed) {
+        unchangedDirs.remove(state._path);
+    }
+    QVector<SyncJournalFileRecord> files;
+    journal->getFilesBelowPath(QByteArray(), [&](const SyncJournalFileRecord &record) {
+        if (record._type != CSYNC_FTW_TYPE_FILE)
+            return;
+        int slash = record._path.lastIndexOf('/');
+        if (unchangedDirs.contains(slash < 0 ? QByteArray() : record._path.left(slash)))
+            files.append(record);
+    });
+    foreach (const auto &record, QtConcurrent::blockingFiltered(files, KnownFileChanged{ folderPath, canceled })) {
+        SyncJournalDb::LocalDirState state;
+        state._path = record._path; // like a path the user touched
+        changed.append(state);
+    }
+    return changed;
+}
+
+void Folder::startReadingLocalDirStates()
+{
+    _localDirStates.clear();
+    if (_localDirStatesWatcher.isRunning()) {
+        // They may have changed since that reading started
+        _localDirStatesOutdated = true;
+        return;
+    }
+    if (!_folderWatcher || !_folderWatcher->isReliable())
+        return;
+
+    QVector<QByteArray> dirs = _journal.getDirectoryPaths();
+    dirs.prepend(QByteArray()); // the root
+    _localDirStatesWatcher.setFuture(QtConcurrent::run(&readLocalDirStates, path(), dirs));
+}
+
+void Folder::slotLocalDirStatesRead()
+{
+    if (_localDirStatesOutdated) {
+        _localDirStatesOutdated = false;
+        startReadingLocalDirStates();
+        return;
+    }
+    // The sync that started meanwhile reads them again when it is done
+    if (isBusy())
+        return;
+    _localDirStates = _localDirStatesWatcher.result();
+}
+
+void Folder::saveLocalDirStates()
+{
+    // The states vouch for everything the watcher didn't report
+    if (isBusy() || !_folderWatcher || !_folderWatcher->isReliable()
+        || !_timeSinceLastFullLocalDiscovery.isValid()
+        || _localDiscoveryPaths.isFullRescan()) {
+        return;
+    }
+    if (_localDirStates.isEmpty()) {
+        qCInfo(lcFolder) << "The local directories of" << alias() << "weren't read since the last sync";
+        return;
+    }
+
+    // The watcher reported everything that changed after they were read:
+    // the changes that weren't synced yet replace the directory states
+    auto states = _localDirStates;
+    foreach (const QByteArray &touched, _localDiscoveryPaths.paths()) {
+        SyncJournalDb::LocalDirState state;
+        state._path = touched;
+        states.append(state);
+    }
+    _journal.setLocalDirStates(states);
+    qCInfo(lcFolder) << "Saved the state of" << _localDirStates.size() << "local directories of" << alias();
+}
+
+bool Folder::isPreparingWarmStart() const
+{
+    // Registering the watches of a huge tree can take a while, don't wait forever
+    return !_warmStartDirStates.isEmpty() && _timeSinceWarmStartLoaded.elapsed() < 2 * 60 * 1000;
+}
+
+void Folder::slotCheckWarmStart()
+{
+    if (_warmStartDirStates.isEmpty() || _warmStartWatcher.isRunning())
+        return;
+
+    qCInfo(lcFolder) << "Checking" << _warmStartDirStates.size() << "local directories saved by the last run";
+    _warmStartCanceled.storeRelease(0);
+    _warmStartWatcher.setFuture(QtConcurrent::run(&warmStartChanges, &_journal, path(), _warmStartDirStates,
+        &_warmStartCanceled));
+}
+
+void Folder::slotWarmStartChecked()
+{
+    if (_warmStartCanceled.loadAcquire() || _warmStartDirStates.isEmpty())
+        return;
+
+    const auto changed = _warmStartWatcher.result();
+    foreach (const auto &state, changed) {
+        if (state._inode == 0) {
+            _localDiscoveryPaths.insert(state._path);
+        } else {
+            _localDiscoveryPaths.insertDirectory(state._path);
+        }
     }
+    qCInfo(lcFolder) << "local discovery:" << changed.size() << "directories and files of"
+                     << _warmStartDirStates.size() << "directories changed since the last run";
+    _warmStartDirStates.clear();
 
-    emit watchedFileChangedExternally(path);
+    // Every known file was checked, and the watcher reports everything
+    // that happened after the check
+    _timeSinceLastFullLocalDiscovery.start();
+}
 
-    // Also schedule this folder for a sync, but only after some delay:
-    // The sync will not upload files that were changed too recently.
-    scheduleThisFolderSoon();
+void Folder::cancelWarmStart()
+{
+    _warmStartCanceled.storeRelease(1);
+    _warmStartDirStates.clear();
 }
 
 void Folder::saveToSettings() const
@@ -655,6 +954,14 @@ void Folder::startSync(const QStringList &pathList)
 
     setDirtyNetworkLimits();
     setSyncOptions();
+    _nextSyncInteractive = false;
+    _partialSync = false;
+    _localDirStates.clear();
+
+    if (!_warmStartDirStates.isEmpty()) {
+        qCInfo(lcFolder) << "The local directories saved by the last run weren't checked in time";
+        cancelWarmStart();
+    }
 
     static qint64 fullLocalDiscoveryInterval = []() {
         auto interval = ConfigFile().fullLocalDiscoveryInterval();
@@ -664,24 +971,58 @@ void Folder::startSync(const QStringList &pathList)
         }
         return interval;
     }();
-    if (_folderWatcher && _folderWatcher->isReliable()
+    _folderWatcherReliable = _folderWatcher && _folderWatcher->isReliable();
+    if (_folderWatcherReliable
         && _timeSinceLastFullLocalDiscovery.isValid()
         && (fullLocalDiscoveryInterval < 0
                || _timeSinceLastFullLocalDiscovery.elapsed() < fullLocalDiscoveryInterval)) {
         qCInfo(lcFolder) << "Allowing local discovery to read from the database";
         _engine->setLocalDiscoveryOptions(LocalDiscoveryStyle::DatabaseAndFilesystem, _localDiscoveryPaths);
 
+        // If the server didn't change since the last full sync, only the paths
+        // the user touched need to be looked at.
+        static int maxPartialSyncPaths = []() {
+            QByteArray env = qgetenv("OWNCLOUD_MAX_PARTIAL_SYNC_PATHS");
+            if (!env.isEmpty())
+                return env.toInt();
+            return 1000;
+        }();
+        if (!_localDiscoveryPaths.isEmpty()
+            && !_localDiscoveryPaths.isFullRescan()
+            && _localDiscoveryPaths.size() <= maxPartialSyncPaths
+            && _timeSinceLastFullSync.isValid()
+            && quint64(_timeSinceLastFullSync.elapsed()) < ConfigFile().forceSyncInterval()
+            && !_lastEtag.isEmpty()
+            && _accountState->account()->rootEtagChangesNotOnlySubFolderEtags()) {
+            qCInfo(lcFolder) << "Only syncing the locally touched paths";
+            _engine->setPartialSync(_lastEtag);
+            _partialSync = true;
+        }
+
         if (lcFolder().isDebugEnabled()) {
-            QByteArrayList paths;
-            for (auto &path : _localDiscoveryPaths)
-                paths.append(path);
-            qCDebug(lcFolder) << "local discovery paths: " << paths;
+            qCDebug(lcFolder) << "local discovery paths: " << _localDiscoveryPaths.paths();
         }
 
         _previousLocalDiscoveryPaths = std::move(_localDiscoveryPaths);
     } else {
+        // Directories that didn't change since they were last read are
+        // not read again, all entries are still stat'ed.
+        static bool directoryModtimes = []() {
+#ifdef Q_OS_WIN
+            // FindNextFile gives the entries' data with the directory listing
+            return false;
+#else
+            return qgetenv("OWNCLOUD_DIRECTORY_MODTIMES_DISCOVERY") != "0";
+#endif
+        }();
+        // Still read everything once per run and then daily, in case a
+        // directory changed in a way its listing doesn't notice
+        const qint64 filesystemOnlyInterval = 24 * 3600 * 1000;
+        const bool readEverything = !_timeSinceLastFilesystemOnlyDiscovery.isValid()
+            || _timeSinceLastFilesystemOnlyDiscovery.elapsed() >= filesystemOnlyInterval;
         qCInfo(lcFolder) << "Forbidding local discovery to read from the database";
-        _engine->setLocalDiscoveryOptions(LocalDiscoveryStyle::FilesystemOnly);
+        _engine->setLocalDiscoveryOptions(directoryModtimes && !readEverything ? LocalDiscoveryStyle::DirectoryModtimes
+                                                                               : LocalDiscoveryStyle::FilesystemOnly);
         _previousLocalDiscoveryPaths.clear();
     }
     _localDiscoveryPaths.clear();
@@ -735,6 +1076,17 @@ void Folder::setSyncOptions()
         opt._targetChunkUploadDuration = cfgFile.targetChunkUploadDuration();
     }
 
+    // Get the many small files the user is waiting for done first
+    opt._schedulingPolicy = SyncOptions::SchedulingPolicy::SmallestFirst;
+    QByteArray schedulingPolicyEnv = qgetenv("OWNCLOUD_SCHEDULING_POLICY");
+    if (schedulingPolicyEnv == "path") {
+        opt._schedulingPolicy = SyncOptions::SchedulingPolicy::PathOrder;
+    } else if (schedulingPolicyEnv == "recent") {
+        opt._schedulingPolicy = SyncOptions::SchedulingPolicy::RecentlyModifiedFirst;
+    }
+    opt._smallFileLane = qgetenv("OWNCLOUD_SMALL_FILE_LANE") != "0";
+    opt._interactive = _nextSyncInteractive;
+
     _engine->setSyncOptions(opt);
 }
 
@@ -828,20 +1180,35 @@ void Folder::slotSyncFinished(bool success)
     if ((_syncResult.status() == SyncResult::Success
             || _syncResult.status() == SyncResult::Problem)
         && success) {
-        if (_engine->lastLocalDiscoveryStyle() == LocalDiscoveryStyle::FilesystemOnly) {
+        // Changes made while the watcher wasn't reliable may have been missed
+        // by this discovery as well
+        if (_engine->lastLocalDiscoveryStyle() != LocalDiscoveryStyle::DatabaseAndFilesystem
+            && _folderWatcherReliable) {
             _timeSinceLastFullLocalDiscovery.start();
         }
+        if (_engine->lastLocalDiscoveryStyle() == LocalDiscoveryStyle::FilesystemOnly) {
+            _timeSinceLastFilesystemOnlyDiscovery.start();
+        }
+        if (!_partialSync) {
+            _timeSinceLastFullSync.start();
+        }
         qCDebug(lcFolder) << "Sync success, forgetting last sync's local discovery path list";
     } else {
         // On overall-failure we can't forget about last sync's local discovery
         // paths yet, reuse them for the next sync again.
-        // C++17: Could use std::set::merge().
-        _localDiscoveryPaths.insert(
-            _previousLocalDiscoveryPaths.begin(), _previousLocalDiscoveryPaths.end());
+        _localDiscoveryPaths.merge(_previousLocalDiscoveryPaths);
         qCDebug(lcFolder) << "Sync failed, keeping last sync's local discovery path list";
+        setNextSyncFull();
+    }
+    if (anotherSyncNeeded == ImmediateFollowUp) {
+        // e.g. the server changed during a partial sync
+        setNextSyncFull();
     }
     _previousLocalDiscoveryPaths.clear();
 
+    // Read now, in case the client quits before the next sync
+    startReadingLocalDirStates();
+
     emit syncStateChange();
 
     // The syncFinished result that is to be triggered here makes the folderman
@@ -927,7 +1294,7 @@ void Folder::slotItemCompleted(const SyncFileItemPtr &item)
         || item->_status == SyncFileItem::FileIgnored
         || item->_status == SyncFileItem::Restoration
         || item->_status == SyncFileItem::Conflict) {
-        if (_previousLocalDiscoveryPaths.erase(item->_file.toUtf8()))
+        if (_previousLocalDiscoveryPaths.remove(item->_file.toUtf8()))
             qCDebug(lcFolder) << "local discovery: wiped" << item->_file;
     } else {
         _localDiscoveryPaths.insert(item->_file.toUtf8());
@@ -1015,6 +1382,27 @@ void Folder::registerFolderWatcher()
         this, &Folder::slotWatchedPathChanged);
     connect(_folderWatcher.data(), &FolderWatcher::lostChanges,
         this, &Folder::slotNextSyncFullLocalDiscovery);
+    connect(_folderWatcher.data(), &FolderWatcher::becameUnreliable,
+        this, &Folder::slotWatcherUnreliable);
+    connect(_folderWatcher.data(), &FolderWatcher::becameReliable,
+        this, &Folder::slotCheckWarmStart);
+
+    // Directories that changed before the watcher was set up will be found
+    // by comparing them with the states saved at the last shutdown
+    _warmStartDirStates = _journal.getAndDeleteLocalDirStates();
+    if (!_warmStartDirStates.isEmpty()) {
+        _timeSinceWarmStartLoaded.start();
+        if (_folderWatcher->isReliable())
+            slotCheckWarmStart();
+    }
+}
+
+void Folder::slotWatcherUnreliable(const QString &message)
+{
+    qCWarning(lcFolder) << "Folder watcher for" << path() << "became unreliable";
+    cancelWarmStart();
+    auto logger = Logger::instance();
+    logger->postOptionalGuiLog(Theme::instance()->appNameGUI(), message);
 }
 
 void Folder::slotAboutToRemoveAllFiles(SyncFileItem::Direction dir, bool *cancel)
@@ -20,6 +20,7 @@
 #include "syncresult.h"
 #include "progressdispatcher.h"
 #include "common/syncjournaldb.h"
+#include "common/pathtrie.h"
 #include "clientproxy.h"
 #include "networkjobs.h"
 
@@ -28,7 +29,8 @@
 #include <QObject>
 #include <QStringList>
 #include <QUuid>
-#include <set>
+#include <QFutureWatcher>
+#include <QAtomicInt>
 
 class QThread;
 class QSettings;
@@ -160,6 +162,16 @@ public:
 
     void prepareToSync();
 
+    /** Marks the next sync as one the user is waiting for
+     *
+     * Its transfers get a larger share of the account's parallel jobs,
+     * see SyncOptions::_interactive.
+     */
+    void setNextSyncInteractive() { _nextSyncInteractive = true; }
+
+    /** Ensures that the next sync is not restricted to the locally touched paths */
+    void setNextSyncFull() { _timeSinceLastFullSync.invalidate(); }
+
     /**
      * True if the folder is busy and can't initiate
      * a synchronization
@@ -197,7 +209,17 @@ public:
     SyncJournalDb *journalDb() { return &_journal; }
     SyncEngine &syncEngine() { return *_engine; }
 
-    RequestEtagJob *etagJob() { return _requestEtagJob; }
+    /** The running etag check, shared with other folders if it is coalesced */
+    AbstractNetworkJob *etagJob() { return _requestEtagJob; }
+
+    /** The etag of the remote folder from the last check or sync */
+    QString lastEtag() const { return _lastEtag; }
+
+    /**
+     * Checks the etag with \a job, a listing of the remote folder this
+     * folder is in that FolderMan runs for several folders at once.
+     */
+    void setCoalescedEtagJob(LsColJob *job);
     qint64 msecSinceLastSync() const { return _timeSinceLastSyncDone.elapsed(); }
     qint64 msecLastSyncDuration() const { return _lastSyncDuration; }
     int consecutiveFollowUpSyncs() const { return _consecutiveFollowUpSyncs; }
@@ -242,6 +264,24 @@ public:
      */
     void registerFolderWatcher();
 
+    /**
+     * Saves the state of the local directories, so the next start doesn't
+     * need a full local discovery, see _warmStartDirStates.
+     *
+     * Does nothing unless the watcher reported all changes since the last
+     * full local discovery. The directories aren't read here, that would
+     * delay the shutdown: the states read after the last sync are saved,
+     * together with the changes the watcher reported since.
+     */
+    void saveLocalDirStates();
+
+    /**
+     * Whether the local directories saved by the last run are still to be
+     * checked. The first sync should wait for that, otherwise it has to look
+     * at the whole local folder.
+     */
+    bool isPreparingWarmStart() const;
+
 signals:
     void syncStateChange();
     void syncStarted();
@@ -322,6 +362,19 @@ private slots:
     /** Ensures that the next sync performs a full local discovery. */
     void slotNextSyncFullLocalDiscovery();
 
+    /** Tells the user that changes will only be found by full local discoveries */
+    void slotWatcherUnreliable(const QString &message);
+
+    /** Compares the saved local directories with the disk, see _warmStartDirStates */
+    void slotCheckWarmStart();
+    void slotWarmStartChecked();
+
+    void slotLocalDirStatesRead();
+
+    /** Starts checking the next batch of watched paths, see _pendingWatchedPaths */
+    void slotCheckWatchedPaths();
+    void slotWatchedPathsChecked();
+
 private:
     bool setIgnoredFiles();
 
@@ -331,6 +384,12 @@ private:
 
     void setSyncOptions();
 
+    /// Forgets the saved local directories, a full local discovery will be needed
+    void cancelWarmStart();
+
+    /// Reads the states of the local directories in a worker thread, see _localDirStates
+    void startReadingLocalDirStates();
+
     enum LogStatus {
         LogStatusRemove,
         LogStatusRename,
@@ -352,11 +411,19 @@ private:
     QScopedPointer<SyncEngine> _engine;
     bool _csyncUnavail;
     bool _proxyDirty;
-    QPointer<RequestEtagJob> _requestEtagJob;
+    QPointer<AbstractNetworkJob> _requestEtagJob;
     QString _lastEtag;
     QElapsedTimer _timeSinceLastSyncDone;
     QElapsedTimer _timeSinceLastSyncStart;
     QElapsedTimer _timeSinceLastFullLocalDiscovery;
+    QElapsedTimer _timeSinceLastFilesystemOnlyDiscovery;
+
+    /**
+     * Time since the last successful sync that was not restricted to the
+     * locally touched paths. Invalid if the next one must not be restricted.
+     */
+    QElapsedTimer _timeSinceLastFullSync;
+    bool _partialSync = false; // whether the running sync is restricted to the touched paths
     qint64 _lastSyncDuration;
 
     /// The number of syncs that failed in a row.
@@ -385,6 +452,9 @@ private:
      */
     bool _saveBackwardsCompatible;
 
+    /// See setNextSyncInteractive(), reset when the sync starts
+    bool _nextSyncInteractive = false;
+
     /**
      * Watches this folder's local directory for changes.
      *
@@ -392,13 +462,16 @@ private:
      */
     QScopedPointer<FolderWatcher> _folderWatcher;
 
+    /// Whether _folderWatcher was reliable when the running sync started
+    bool _folderWatcherReliable = false;
+
     /**
      * The paths that should be checked by the next local discovery.
      *
      * Mostly a collection of files the filewatchers have reported as touched.
      * Also includes files that have had errors in the last sync run.
      */
-    std::set<QByteArray> _localDiscoveryPaths;
+    PathTrie _localDiscoveryPaths;
 
     /**
      * The paths that the current sync run used for local discovery.
@@ -406,7 +479,42 @@ private:
      * For failing syncs, this list will be merged into _localDiscoveryPaths
      * again when the sync is done to make sure everything is retried.
      */
-    std::set<QByteArray> _previousLocalDiscoveryPaths;
+    PathTrie _previousLocalDiscoveryPaths;
+
+    /**
+     * Changed paths reported by the file watcher whose mtime must still be
+     * compared with the journal to tell real changes from spurious ones.
+     *
+     * They are checked in batches in a worker thread, as the watcher can
+     * report hundreds of thousands of paths when a tool rewrites a tree.
+     */
+    QStringList _pendingWatchedPaths;
+    QTimer _pendingWatchedPathsTimer;
+    QFutureWatcher<QStringList> _watchedPathsWatcher;
+
+    /**
+     * The local directories saved by the last run, see saveLocalDirStates().
+     *
+     * Once the watcher is reliable they are compared with the disk in worker
+     * threads. The directories that changed while the client wasn't running
+     * are then read by the first sync, everything else comes from the
+     * database. Files edited in place don't change their directory, so the
+     * known files of the unchanged directories are compared too.
+     */
+    QVector<SyncJournalDb::LocalDirState> _warmStartDirStates;
+    QElapsedTimer _timeSinceWarmStartLoaded;
+    QFutureWatcher<QVector<SyncJournalDb::LocalDirState>> _warmStartWatcher;
+    QAtomicInt _warmStartCanceled; ///< makes the worker thread of _warmStartWatcher stop early
+
+    /**
+     * The states of the local directories, read after the last sync.
+     *
+     * Empty while they are being read and while a sync is running.
+     * saveLocalDirStates() writes them at shutdown.
+     */
+    QVector<SyncJournalDb::LocalDirState> _localDirStates;
+    QFutureWatcher<QVector<SyncJournalDb::LocalDirState>> _localDirStatesWatcher;
+    bool _localDirStatesOutdated = false;
 };
 }
 
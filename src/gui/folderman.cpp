@@ -46,7 +46,6 @@ FolderMan *FolderMan::_instance = 0;
 
 FolderMan::FolderMan(QObject *parent)
     : QObject(parent)
-    , _currentSyncFolder(0)
     , _syncEnabled(true)
     , _lockWatcher(new LockWatcher)
     , _navigationPaneHelper(this)
@@ -130,14 +129,14 @@ int FolderMan::unloadAndDeleteAllFolders()
     while (i.hasNext()) {
         i.next();
         Folder *f = i.value();
+        f->saveLocalDirStates();
         unloadFolder(f);
         delete f;
         cnt++;
     }
     ASSERT(_folderMap.isEmpty());
 
-    _lastSyncFolder = 0;
-    _currentSyncFolder = 0;
+    _currentSyncFolders.clear();
     _scheduledFolders.clear();
     emit folderListChanged(_folderMap);
     emit scheduleQueueChanged();
@@ -453,13 +452,14 @@ void FolderMan::slotFolderCanSyncChanged()
 // this really terminates the current sync process
 // ie. no questions, no prisoners
 // csync still remains in a stable state, regardless of that.
-void FolderMan::terminateSyncProcess()
+void FolderMan::terminateSyncProcess(Folder *folder)
 {
-    Folder *f = _currentSyncFolder;
-    if (f) {
-        // This will, indirectly and eventually, call slotFolderSyncFinished
-        // and thereby clear _currentSyncFolder.
-        f->slotTerminateSync();
+    foreach (Folder *f, _currentSyncFolders) {
+        if (!folder || f == folder) {
+            // This will, indirectly and eventually, call slotFolderSyncFinished
+            // and thereby remove it from _currentSyncFolders.
+            f->slotTerminateSync();
+        }
     }
 }
 
@@ -537,6 +537,8 @@ void FolderMan::scheduleFolderNext(Folder *f)
     _scheduledFolders.removeAll(f);
 
     f->prepareToSync();
+    f->setNextSyncInteractive();
+    f->setNextSyncFull();
     emit folderSyncStateChange(f);
     _scheduledFolders.prepend(f);
     emit scheduleQueueChanged();
@@ -544,7 +546,7 @@ void FolderMan::scheduleFolderNext(Folder *f)
     startScheduledSyncSoon();
 }
 
-void FolderMan::slotScheduleETagJob(const QString & /*alias*/, RequestEtagJob *job)
+void FolderMan::slotScheduleETagJob(const QString & /*alias*/, AbstractNetworkJob *job)
 {
     QObject::connect(job, &QObject::destroyed, this, &FolderMan::slotEtagJobDestroyed);
     QMetaObject::invokeMethod(this, "slotRunOneEtagJob", Qt::QueuedConnection);
@@ -574,7 +576,7 @@ void FolderMan::slotRunOneEtagJob()
             //qCDebug(lcFolderMan) << "No more remote ETag check jobs to schedule.";
 
             /* now it might be a good time to check for restarting... */
-            if (_currentSyncFolder == NULL && _appRestartRequired) {
+            if (_currentSyncFolders.isEmpty() && _appRestartRequired) {
                 restartApplication();
             }
         } else {
@@ -606,9 +608,10 @@ void FolderMan::slotAccountStateChanged()
         qCInfo(lcFolderMan) << "Account" << accountName << "disconnected or paused, "
                                                            "terminating or descheduling sync folders";
 
-        if (_currentSyncFolder
-            && _currentSyncFolder->accountState() == accountState) {
-            _currentSyncFolder->slotTerminateSync();
+        foreach (Folder *f, _currentSyncFolders) {
+            if (f->accountState() == accountState) {
+                f->slotTerminateSync();
+            }
         }
 
         QMutableListIterator<Folder *> it(_scheduledFolders);
@@ -635,32 +638,28 @@ void FolderMan::setSyncEnabled(bool enabled)
     emit(folderSyncStateChange(0));
 }
 
-void FolderMan::startScheduledSyncSoon()
+int FolderMan::maximumConcurrentSyncs()
 {
-    if (_startScheduledSyncTimer.isActive()) {
-        return;
-    }
-    if (_scheduledFolders.empty()) {
-        return;
-    }
-    if (_currentSyncFolder) {
-        return;
-    }
+    static int max = [] {
+        int env = qgetenv("OWNCLOUD_MAX_PARALLEL_SYNCS").toInt();
+        if (env > 0)
+            return env;
+        return 3;
+    }();
+    return max;
+}
 
+qint64 FolderMan::msecUntilSyncAllowed(Folder *f)
+{
     qint64 msDelay = 100; // 100ms minimum delay
-    qint64 msSinceLastSync = 0;
-
-    // Require a pause based on the duration of the last sync run.
-    if (Folder *lastFolder = _lastSyncFolder) {
-        msSinceLastSync = lastFolder->msecSinceLastSync();
 
-        //  1s   -> 1.5s pause
-        // 10s   -> 5s pause
-        //  1min -> 12s pause
-        //  1h   -> 90s pause
-        qint64 pause = qSqrt(lastFolder->msecLastSyncDuration()) / 20.0 * 1000.0;
-        msDelay = qMax(msDelay, pause);
-    }
+    // Require a pause based on the duration of the folder's last sync run.
+    //  1s   -> 1.5s pause
+    // 10s   -> 5s pause
+    //  1min -> 12s pause
+    //  1h   -> 90s pause
+    qint64 pause = qSqrt(f->msecLastSyncDuration()) / 20.0 * 1000.0;
+    msDelay = qMax(msDelay, pause);
 
     // Delays beyond one minute seem too big, particularly since there
     // could be things later in the queue that shouldn't be punished by a
@@ -668,7 +667,42 @@ void FolderMan::startScheduledSyncSoon()
     msDelay = qMin(msDelay, 60 * 1000ll);
 
     // Time since the last sync run counts against the delay
-    msDelay = qMax(1ll, msDelay - msSinceLastSync);
+    msDelay = qMax(0ll, msDelay - f->msecSinceLastSync());
+
+    // Give the folder a chance to find out which local directories changed
+    // since the last run, instead of looking at all of them
+    if (f->isPreparingWarmStart())
+        msDelay = qMax(msDelay, 1000ll);
+
+    return msDelay;
+}
+
+void FolderMan::startScheduledSyncSoon()
+{
+    if (_scheduledFolders.empty()) {
+        return;
+    }
+    if (_currentSyncFolders.size() >= maximumConcurrentSyncs()) {
+        return;
+    }
+
+    // The folder that may start first decides
+    qint64 msDelay = -1;
+    foreach (Folder *f, _scheduledFolders) {
+        if (_currentSyncFolders.contains(f))
+            continue;
+        const qint64 folderDelay = msecUntilSyncAllowed(f);
+        if (msDelay < 0 || folderDelay < msDelay)
+            msDelay = folderDelay;
+    }
+    if (msDelay < 0) {
+        return;
+    }
+    msDelay = qMax(1ll, msDelay);
+
+    if (_startScheduledSyncTimer.isActive() && _startScheduledSyncTimer.remainingTime() <= msDelay) {
+        return;
+    }
 
     qCInfo(lcFolderMan) << "Starting the next scheduled sync in" << (msDelay / 1000) << "seconds";
     _startScheduledSyncTimer.start(msDelay);
@@ -681,8 +715,8 @@ void FolderMan::startScheduledSyncSoon()
   */
 void FolderMan::slotStartScheduledFolderSync()
 {
-    if (_currentSyncFolder) {
-        qCInfo(lcFolderMan) << "Currently folder " << _currentSyncFolder->remoteUrl().toString() << " is running, wait for finish!";
+    if (_currentSyncFolders.size() >= maximumConcurrentSyncs()) {
+        qCInfo(lcFolderMan) << "Currently" << _currentSyncFolders.size() << "folders are running, wait for one to finish!";
         return;
     }
 
@@ -696,28 +730,49 @@ void FolderMan::slotStartScheduledFolderSync()
         return;
     }
 
-    // Find the first folder in the queue that can be synced.
-    Folder *folder = 0;
-    while (!_scheduledFolders.isEmpty()) {
-        Folder *g = _scheduledFolders.dequeue();
-        if (g->canSync()) {
-            folder = g;
-            break;
+    // Start the first folders in the queue that can be synced, aren't
+    // syncing already and whose pause after the last sync is over.
+    QList<Folder *> foldersToStart;
+    QMutableListIterator<Folder *> it(_scheduledFolders);
+    while (it.hasNext() && _currentSyncFolders.size() + foldersToStart.size() < maximumConcurrentSyncs()) {
+        Folder *g = it.next();
+        if (!g->canSync()) {
+            it.remove();
+            continue;
+        }
+        if (_currentSyncFolders.contains(g) || msecUntilSyncAllowed(g) > 0) {
+            continue;
         }
+        it.remove();
+        foldersToStart.append(g);
     }
 
     emit scheduleQueueChanged();
 
-    // Start syncing this folder!
-    if (folder) {
+    // Start syncing these folders!
+    foreach (Folder *folder, foldersToStart) {
         // Safe to call several times, and necessary to try again if
         // the folder path didn't exist previously.
         folder->registerFolderWatcher();
         registerFolderWithSocketApi(folder);
 
-        _currentSyncFolder = folder;
+        _currentSyncFolders.append(folder);
         folder->startSync(QStringList());
     }
+
+    // Wait for the pause of the remaining ones
+    startScheduledSyncSoon();
+}
+
+// The remote folder \a path is in, or "/" for the root itself
+static QString parentRemotePath(const QString &path)
+{
+    QString parent = path;
+    if (parent.endsWith(QLatin1Char('/'))) {
+        parent.chop(1);
+    }
+    int slash = parent.lastIndexOf(QLatin1Char('/'));
+    return slash <= 0 ? QString(QLatin1Char('/')) : parent.left(slash);
 }
 
 void FolderMan::slotEtagPollTimerTimeout()
@@ -725,11 +780,12 @@ void FolderMan::slotEtagPollTimerTimeout()
     ConfigFile cfg;
     int polltime = cfg.remotePollInterval();
 
+    QVector<Folder *> dueFolders;
     foreach (Folder *f, _folderMap) {
         if (!f) {
             continue;
         }
-        if (_currentSyncFolder == f) {
+        if (_currentSyncFolders.contains(f)) {
             continue;
         }
         if (_scheduledFolders.contains(f)) {
@@ -744,7 +800,54 @@ void FolderMan::slotEtagPollTimerTimeout()
         if (f->msecSinceLastSync() < polltime) {
             continue;
         }
-        QMetaObject::invokeMethod(f, "slotRunEtagJob", Qt::QueuedConnection);
+        dueFolders.append(f);
+    }
+    startEtagJobs(dueFolders);
+}
+
+void FolderMan::startEtagJobs(const QVector<Folder *> &dueFolders)
+{
+    // Group the folders by account and the remote folder they are in. A
+    // folder that other folders are in goes with them: a Depth 1 listing
+    // has the etag of the folder it lists too.
+    typedef QPair<AccountState *, QString> EtagGroup;
+    QSet<EtagGroup> parents;
+    foreach (Folder *f, dueFolders) {
+        parents.insert(qMakePair(f->accountState(), parentRemotePath(f->remotePath())));
+    }
+    QMap<EtagGroup, QVector<Folder *>> groups;
+    foreach (Folder *f, dueFolders) {
+        QString path = f->remotePath();
+        if (path.size() > 1 && path.endsWith(QLatin1Char('/'))) {
+            path.chop(1);
+        }
+        EtagGroup group = qMakePair(f->accountState(), path);
+        if (!parents.contains(group)) {
+            group.second = parentRemotePath(path);
+        }
+        groups[group].append(f);
+    }
+
+    for (auto it = groups.constBegin(); it != groups.constEnd(); ++it) {
+        const QVector<Folder *> &folders = it.value();
+        AccountPtr account = it.key().first->account();
+        // Older servers don't update the etag of a folder for changes deep
+        // inside it, the folders check the etags of their contents then.
+        if (folders.size() < 2 || !account->rootEtagChangesNotOnlySubFolderEtags()) {
+            foreach (Folder *f, folders) {
+                QMetaObject::invokeMethod(f, "slotRunEtagJob", Qt::QueuedConnection);
+            }
+            continue;
+        }
+
+        // One PROPFIND gets the etags of all of them
+        auto job = new LsColJob(account, it.key().second, this);
+        job->setProperties(QList<QByteArray>() << "getetag");
+        job->setTimeout(60 * 1000);
+        foreach (Folder *f, folders) {
+            f->setCoalescedEtagJob(job);
+        }
+        slotScheduleETagJob(it.key().second, job);
     }
 }
 
@@ -842,10 +945,13 @@ void FolderMan::slotScheduleFolderByTime()
 
 void FolderMan::slotFolderSyncStarted()
 {
-    qCInfo(lcFolderMan, ">========== Sync started for folder [%s] of account [%s] with remote [%s]",
-        qPrintable(_currentSyncFolder->shortGuiLocalPath()),
-        qPrintable(_currentSyncFolder->accountState()->account()->displayName()),
-        qPrintable(_currentSyncFolder->remoteUrl().toString()));
+    Folder *f = qobject_cast<Folder *>(sender());
+    ASSERT(f);
+    qCInfo(lcFolderMan, ">========== Sync started for folder [%s] of account [%s] with remote [%s], %d running",
+        qPrintable(f->shortGuiLocalPath()),
+        qPrintable(f->accountState()->account()->displayName()),
+        qPrintable(f->remoteUrl().toString()),
+        _currentSyncFolders.size());
 }
 
 /*
@@ -856,13 +962,14 @@ void FolderMan::slotFolderSyncStarted()
   */
 void FolderMan::slotFolderSyncFinished(const SyncResult &)
 {
+    Folder *f = qobject_cast<Folder *>(sender());
+    ASSERT(f);
     qCInfo(lcFolderMan, "<========== Sync finished for folder [%s] of account [%s] with remote [%s]",
-        qPrintable(_currentSyncFolder->shortGuiLocalPath()),
-        qPrintable(_currentSyncFolder->accountState()->account()->displayName()),
-        qPrintable(_currentSyncFolder->remoteUrl().toString()));
+        qPrintable(f->shortGuiLocalPath()),
+        qPrintable(f->accountState()->account()->displayName()),
+        qPrintable(f->remoteUrl().toString()));
 
-    _lastSyncFolder = _currentSyncFolder;
-    _currentSyncFolder = 0;
+    _currentSyncFolders.removeAll(f);
 
     startScheduledSyncSoon();
 }
@@ -980,10 +1087,10 @@ void FolderMan::removeFolder(Folder *f)
 
     qCInfo(lcFolderMan) << "Removing " << f->alias();
 
-    const bool currentlyRunning = (_currentSyncFolder == f);
+    const bool currentlyRunning = _currentSyncFolders.contains(f);
     if (currentlyRunning) {
         // abort the sync now
-        terminateSyncProcess();
+        terminateSyncProcess(f);
     }
 
     if (_scheduledFolders.removeAll(f) > 0) {
@@ -1418,9 +1525,9 @@ QQueue<Folder *> FolderMan::scheduleQueue() const
     return _scheduledFolders;
 }
 
-Folder *FolderMan::currentSyncFolder() const
+QList<Folder *> FolderMan::currentSyncFolders() const
 {
-    return _currentSyncFolder;
+    return _currentSyncFolders;
 }
 
 void FolderMan::restartApplication()
@@ -49,7 +49,8 @@ class LockWatcher;
  *   (_folderWatchers and Folder::slotWatchedPathChanged())
  *
  * - The folder etag on the server has changed
- *   (_etagPollTimer)
+ *   (_etagPollTimer, the folders of an account that are in the same
+ *    remote folder are checked with one listing of it)
  *
  * - The locks of a monitored file are released
  *   (_lockWatcher and slotWatchedFileUnlocked())
@@ -57,6 +58,12 @@ class LockWatcher;
  * - There was a sync error or a follow-up sync is requested
  *   (_timeScheduler and slotScheduleFolderByTime()
  *    and Folder::slotSyncFinished())
+ *
+ * Up to maximumConcurrentSyncs() folders sync at the same time, so a
+ * small change in one folder doesn't wait for a long sync of another.
+ * Their propagators share the budget of parallel network jobs. After a
+ * sync a folder pauses for a while before it syncs again, depending on
+ * how long its last sync took.
  */
 class FolderMan : public QObject
 {
@@ -156,16 +163,19 @@ public:
     QQueue<Folder *> scheduleQueue() const;
 
     /**
-     * Access to the currently syncing folder.
+     * Access to the currently syncing folders.
      */
-    Folder *currentSyncFolder() const;
+    QList<Folder *> currentSyncFolders() const;
+
+    /** The number of folders that may sync at the same time (env OWNCLOUD_MAX_PARALLEL_SYNCS) */
+    static int maximumConcurrentSyncs();
 
     /** Removes all folders */
     int unloadAndDeleteAllFolders();
 
     /**
      * If enabled is set to false, no new folders will start to sync.
-     * The current one will finish.
+     * The current ones will finish.
      */
     void setSyncEnabled(bool);
 
@@ -182,11 +192,12 @@ public:
     void setDirtyNetworkLimits();
 
     /**
-     * Terminates the current folder sync.
+     * Terminates the sync of \a folder, or of all currently syncing
+     * folders if it is null.
      *
      * It does not switch the folder to paused state.
      */
-    void terminateSyncProcess();
+    void terminateSyncProcess(Folder *folder = 0);
 
 signals:
     /**
@@ -227,8 +238,8 @@ public slots:
      */
     void slotSyncOnceFileUnlocks(const QString &path);
 
-    // slot to schedule an ETag job (from Folder only)
-    void slotScheduleETagJob(const QString &alias, RequestEtagJob *job);
+    // slot to schedule an ETag job (from Folder and the coalesced etag poll)
+    void slotScheduleETagJob(const QString &alias, AbstractNetworkJob *job);
 
 private slots:
     void slotFolderSyncPaused(Folder *, bool paused);
@@ -280,6 +291,12 @@ private:
     /** Will start a sync after a bit of delay. */
     void startScheduledSyncSoon();
 
+    /** Checks the etags of \a dueFolders, with one listing for the folders in the same remote folder */
+    void startEtagJobs(const QVector<Folder *> &dueFolders);
+
+    /** How long \a f has to wait before it may sync again, 0 if it may sync now */
+    static qint64 msecUntilSyncAllowed(Folder *f);
+
     // finds all folder configuration files
     // and create the folders
     QString getBackupName(QString fullPathName) const;
@@ -295,14 +312,13 @@ private:
     QSet<Folder *> _disabledFolders;
     Folder::Map _folderMap;
     QString _folderConfigPath;
-    Folder *_currentSyncFolder;
-    QPointer<Folder> _lastSyncFolder;
+    QList<Folder *> _currentSyncFolders;
     bool _syncEnabled;
 
     /// Starts regular etag query jobs
     QTimer _etagPollTimer;
     /// The currently running etag query
-    QPointer<RequestEtagJob> _currentEtagJob;
+    QPointer<AbstractNetworkJob> _currentEtagJob;
 
     /// Watches files that couldn't be synced due to locks
     QScopedPointer<LockWatcher> _lockWatcher;
@@ -1047,10 +1047,9 @@ void FolderStatusModel::slotFolderSyncStateChange(Folder *f)
     } else if (state == SyncResult::NotYetStarted) {
         FolderMan *folderMan = FolderMan::instance();
         int pos = folderMan->scheduleQueue().indexOf(f);
-        if (folderMan->currentSyncFolder()
-            && folderMan->currentSyncFolder() != f) {
-            pos += 1;
-        }
+        // The folders ahead in the queue may start in the free sync slots
+        const auto currentFolders = folderMan->currentSyncFolders();
+        pos += 1 - qMax(0, FolderMan::maximumConcurrentSyncs() - currentFolders.size() + currentFolders.contains(f));
         QString message;
         if (pos <= 0) {
             message = tr("Waiting...");
@@ -50,6 +50,8 @@ FolderWatcher::FolderWatcher(const QString &root, Folder *folder)
 
 FolderWatcher::~FolderWatcher()
 {
+    // The backend may still be registering folders and use this object
+    _d.reset();
 }
 
 bool FolderWatcher::pathIsIgnored(const QString &path)
@@ -70,7 +72,7 @@ bool FolderWatcher::pathIsIgnored(const QString &path)
 
 bool FolderWatcher::isReliable() const
 {
-    return _isReliable;
+    return _isReliable && !_isRegistering;
 }
 
 void FolderWatcher::changeDetected(const QString &path)
@@ -77,7 +77,8 @@ public:
      * notifications.
      *
      * For example, this can happen on linux if the inotify user limit from
-     * /proc/sys/fs/inotify/max_user_watches is exceeded.
+     * /proc/sys/fs/inotify/max_user_watches is exceeded. It is also the case
+     * while the folders of a large tree are still being registered.
      */
     bool isReliable() const;
 
@@ -96,6 +97,18 @@ signals:
      */
     void lostChanges();
 
+    /**
+     * Emitted when the watcher becomes reliable once all the folders are
+     * registered, see isReliable().
+     */
+    void becameReliable();
+
+    /**
+     * Emitted when the watcher stops being reliable for good, with a
+     * message for the user explaining why.
+     */
+    void becameUnreliable(const QString &message);
+
 protected slots:
     // called from the implementations to indicate a change in path
     void changeDetected(const QString &path);
@@ -110,6 +123,7 @@ private:
     QSet<QString> _lastPaths;
     Folder *_folder;
     bool _isReliable = true;
+    bool _isRegistering = false;
 
     friend class FolderWatcherPrivate;
 };
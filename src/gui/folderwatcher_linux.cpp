@@ -18,11 +18,14 @@
 
 #include "folder.h"
 #include "folderwatcher_linux.h"
+#include "syncengine.h"
 
 #include <cerrno>
 #include <QStringList>
 #include <QObject>
+#include <QFile>
 #include <QVarLengthArray>
+#include <QtConcurrent>
 
 namespace OCC {
 
@@ -39,88 +42,173 @@ FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString &path
         qCWarning(lcFolderWatcher) << "notify_init() failed: " << strerror(errno);
     }
 
-    QMetaObject::invokeMethod(this, "slotAddFolderRecursive", Q_ARG(QString, path));
+    // Changes in folders that are not registered yet would be missed
+    _parent->_isRegistering = true;
+    slotAddFolderRecursive(path);
 }
 
 FolderWatcherPrivate::~FolderWatcherPrivate()
 {
+    {
+        QMutexLocker locker(&_mutex);
+        _abortRegistration = true;
+    }
+    _registration.waitForFinished();
 }
 
-// attention: result list passed by reference!
-bool FolderWatcherPrivate::findFoldersBelow(const QDir &dir, QStringList &fullList)
+QStringList FolderWatcherPrivate::subfolders(const QDir &dir)
 {
-    bool ok = true;
+    QStringList result;
     if (!(dir.exists() && dir.isReadable())) {
         qCDebug(lcFolderWatcher) << "Non existing path coming in: " << dir.absolutePath();
-        ok = false;
-    } else {
-        QStringList nameFilter;
-        nameFilter << QLatin1String("*");
-        QDir::Filters filter = QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks | QDir::Hidden;
-        const QStringList pathes = dir.entryList(nameFilter, filter);
-
-        QStringList::const_iterator constIterator;
-        for (constIterator = pathes.constBegin(); constIterator != pathes.constEnd();
-             ++constIterator) {
-            const QString fullPath(dir.path() + QLatin1String("/") + (*constIterator));
-            fullList.append(fullPath);
-            ok = findFoldersBelow(QDir(fullPath), fullList);
-        }
+        return result;
+    }
+    QDir::Filters filter = QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks | QDir::Hidden;
+    foreach (const QString &name, dir.entryList(filter)) {
+        result.append(dir.path() + QLatin1Char('/') + name);
+    }
+    return result;
+}
+
+bool FolderWatcherPrivate::inotifyRegisterPath(const QString &path)
+{
+    if (path.isEmpty())
+        return true;
+    {
+        QMutexLocker locker(&_mutex);
+        if (_pathToWatch.contains(path))
+            return true;
+    }
+
+    int wd = inotify_add_watch(_fd, path.toUtf8().constData(),
+        IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_ONLYDIR);
+    if (wd > -1) {
+        QMutexLocker locker(&_mutex);
+        // The same folder may have been watched under another path
+        auto it = _watches.find(wd);
+        if (it != _watches.end())
+            _pathToWatch.remove(*it);
+        _watches.insert(wd, path);
+        _pathToWatch.insert(path, wd);
+        return true;
     }
 
-    return ok;
+    // If we're running out of memory or inotify watches, become
+    // unreliable.
+    return errno != ENOMEM && errno != ENOSPC;
 }
 
-void FolderWatcherPrivate::inotifyRegisterPath(const QString &path)
+void FolderWatcherPrivate::registerQueuedFolders()
 {
-    if (!path.isEmpty()) {
-        int wd = inotify_add_watch(_fd, path.toUtf8().constData(),
-            IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_ONLYDIR);
-        if (wd > -1) {
-            _watches.insert(wd, path);
-        } else {
-            // If we're running out of memory or inotify watches, become
-            // unreliable.
-            if (errno == ENOMEM || errno == ENOSPC) {
-                _parent->_isReliable = false;
+    forever {
+        QString path;
+        {
+            QMutexLocker locker(&_mutex);
+            if (_registrationQueue.isEmpty() || _abortRegistration) {
+                _registrationQueue.clear();
+                _registrationRunning = false;
+                QMetaObject::invokeMethod(this, "slotRegistrationFinished", Qt::QueuedConnection);
+                return;
+            }
+            path = _registrationQueue.dequeue();
+        }
+
+        if (!inotifyRegisterPath(path)) {
+            QMutexLocker locker(&_mutex);
+            _registrationQueue.clear();
+            _registrationRunning = false;
+            QMetaObject::invokeMethod(this, "slotWatchesExhausted", Qt::QueuedConnection);
+            return;
+        }
+
+        QStringList below;
+        foreach (const QString &subfolder, subfolders(QDir(path))) {
+            // Nothing below an ignored folder gets synced
+            if (isExcludedFromRegistration(subfolder)) {
+                qCDebug(lcFolderWatcher) << "* Not adding" << subfolder;
+                continue;
             }
+            below.append(subfolder);
         }
+
+        QMutexLocker locker(&_mutex);
+        _registrationQueue.append(below);
     }
 }
 
+void FolderWatcherPrivate::snapshotExcludes()
+{
+#ifndef OWNCLOUD_TEST
+    Folder *folder = _parent->_folder;
+    if (!folder)
+        return;
+    if (!_excludedFiles)
+        _excludedFiles.reset(new ExcludedFiles(&_excludes));
+    foreach (const QString &file, folder->syncEngine().excludedFiles().excludeFilePaths())
+        _excludedFiles->addExcludeFilePath(file);
+    _excludedFiles->reloadExcludes();
+    _excludesBasePath = folder->path();
+    _excludeHidden = folder->ignoreHiddenFiles();
+#endif
+}
+
+bool FolderWatcherPrivate::isExcludedFromRegistration(const QString &path) const
+{
+    return _excludedFiles && _excludedFiles->isExcluded(path, _excludesBasePath, _excludeHidden);
+}
+
 void FolderWatcherPrivate::slotAddFolderRecursive(const QString &path)
 {
-    int subdirs = 0;
     qCDebug(lcFolderWatcher) << "(+) Watcher:" << path;
 
-    QDir inPath(path);
-    inotifyRegisterPath(inPath.absolutePath());
-
-    const QStringList watchedFolders = _watches.values();
+    QMutexLocker locker(&_mutex);
+    _registrationQueue.enqueue(QDir(path).absolutePath());
+    if (_registrationRunning)
+        return;
+    _registrationRunning = true;
+    snapshotExcludes();
+    _registration = QtConcurrent::run(this, &FolderWatcherPrivate::registerQueuedFolders);
+}
 
-    QStringList allSubfolders;
-    if (!findFoldersBelow(QDir(path), allSubfolders)) {
-        qCWarning(lcFolderWatcher) << "Could not traverse all sub folders";
+void FolderWatcherPrivate::slotRegistrationFinished()
+{
+    int count = 0;
+    {
+        QMutexLocker locker(&_mutex);
+        count = _watches.size();
     }
-    QStringListIterator subfoldersIt(allSubfolders);
-    while (subfoldersIt.hasNext()) {
-        QString subfolder = subfoldersIt.next();
-        QDir folder(subfolder);
-        if (folder.exists() && !watchedFolders.contains(folder.absolutePath())) {
-            subdirs++;
-            if (_parent->pathIsIgnored(subfolder)) {
-                qCDebug(lcFolderWatcher) << "* Not adding" << folder.path();
-                continue;
-            }
-            inotifyRegisterPath(folder.absolutePath());
-        } else {
-            qCDebug(lcFolderWatcher) << "    `-> discarded:" << folder.path();
-        }
+    if (_parent->_isRegistering) {
+        qCInfo(lcFolderWatcher) << "Watching" << count << "folders in" << _folder;
+        _parent->_isRegistering = false;
+        if (_parent->_isReliable)
+            emit _parent->becameReliable();
     }
+}
+
+void FolderWatcherPrivate::slotWatchesExhausted()
+{
+    QFile limitFile(QStringLiteral("/proc/sys/fs/inotify/max_user_watches"));
+    QByteArray limit;
+    if (limitFile.open(QIODevice::ReadOnly))
+        limit = limitFile.readAll().trimmed();
 
-    if (subdirs > 0) {
-        qCDebug(lcFolderWatcher) << "    `-> and" << subdirs << "subdirectories";
+    int count = 0;
+    {
+        QMutexLocker locker(&_mutex);
+        count = _watches.size();
     }
+    qCWarning(lcFolderWatcher) << "Could not watch all folders in" << _folder << "after" << count
+                               << "folders, fs.inotify.max_user_watches is" << limit;
+
+    _parent->_isRegistering = false;
+    if (!_parent->_isReliable)
+        return;
+    _parent->_isReliable = false;
+    emit _parent->becameUnreliable(
+        tr("The folder %1 has more subfolders than the system allows to watch "
+           "(fs.inotify.max_user_watches is %2). Changes will only be found by "
+           "the periodic full scans. Raise the limit to have them synced right away.")
+            .arg(_folder, QString::fromLatin1(limit)));
 }
 
 void FolderWatcherPrivate::slotReceivedNotification(int fd)
@@ -163,6 +251,12 @@ void FolderWatcherPrivate::slotReceivedNotification(int fd)
             continue;
         }
 
+        // The watch is gone, e.g. because its folder was removed
+        if (event->mask & IN_IGNORED) {
+            QMutexLocker locker(&_mutex);
+            _pathToWatch.remove(_watches.take(event->wd));
+        }
+
         // Fire event for the path that was changed.
         if (event->len > 0 && event->wd > -1) {
             QByteArray fileName(event->name);
@@ -171,8 +265,13 @@ void FolderWatcherPrivate::slotReceivedNotification(int fd)
                 || fileName.startsWith(".owncloudsync.log")
                 || fileName.startsWith(".sync_")) {
             } else {
-                const QString p = _watches[event->wd] + '/' + fileName;
-                _parent->changeDetected(p);
+                QString folder;
+                {
+                    QMutexLocker locker(&_mutex);
+                    folder = _watches.value(event->wd);
+                }
+                if (!folder.isEmpty())
+                    _parent->changeDetected(folder + '/' + fileName);
             }
         }
 
@@ -188,20 +287,13 @@ void FolderWatcherPrivate::addPath(const QString &path)
 
 void FolderWatcherPrivate::removePath(const QString &path)
 {
-    int wid = -1;
     // Remove the inotify watch.
-    QHash<int, QString>::const_iterator i = _watches.constBegin();
-
-    while (i != _watches.constEnd()) {
-        if (i.value() == path) {
-            wid = i.key();
-            break;
-        }
-        ++i;
-    }
-    if (wid > -1) {
-        inotify_rm_watch(_fd, wid);
-        _watches.remove(wid);
+    QMutexLocker locker(&_mutex);
+    auto it = _pathToWatch.find(path);
+    if (it != _pathToWatch.end()) {
+        inotify_rm_watch(_fd, *it);
+        _watches.remove(*it);
+        _pathToWatch.erase(it);
     }
 }
 
@@ -20,14 +20,23 @@
 #include <QSocketNotifier>
 #include <QHash>
 #include <QDir>
+#include <QFuture>
+#include <QMutex>
+#include <QQueue>
 
 #include "folderwatcher.h"
+#include "excludedfiles.h"
 
 namespace OCC {
 
 /**
  * @brief Linux (inotify) API implementation of FolderWatcher
  * @ingroup gui
+ *
+ * inotify is not recursive, every folder needs its own watch. Trees can have
+ * hundreds of thousands of folders, so they are walked and registered in a
+ * worker thread, breadth first: the top of the tree, where most changes
+ * happen, is watched first.
  */
 class FolderWatcherPrivate : public QObject
 {
@@ -43,18 +52,49 @@ public:
 protected slots:
     void slotReceivedNotification(int fd);
     void slotAddFolderRecursive(const QString &path);
+    void slotRegistrationFinished();
+    void slotWatchesExhausted();
 
 protected:
-    bool findFoldersBelow(const QDir &dir, QStringList &fullList);
-    void inotifyRegisterPath(const QString &path);
+    /** The folders directly inside dir */
+    static QStringList subfolders(const QDir &dir);
+
+    /** Returns false if no more watches can be added */
+    bool inotifyRegisterPath(const QString &path);
+
+    /** Runs in a worker thread until _registrationQueue is empty */
+    void registerQueuedFolders();
+
+    /** Copies the exclude patterns of the folder for the registration */
+    void snapshotExcludes();
+
+    /** Whether the registration skips \a path, see snapshotExcludes() */
+    bool isExcludedFromRegistration(const QString &path) const;
 
 private:
-    FolderWatcher *_parent;
+    FolderWatcher *_parent = 0;
 
     QString _folder;
+
+    // Guards the members below, the registration runs in a worker thread
+    QMutex _mutex;
     QHash<int, QString> _watches;
+    QHash<QString, int> _pathToWatch;
+    QQueue<QString> _registrationQueue;
+    bool _registrationRunning = false;
+    bool _abortRegistration = false;
+
+    // The folder reloads its exclude list before each sync while the
+    // registration may be using it, so the worker checks a copy. It is only
+    // reloaded while no registration runs.
+    c_strlist_t *_excludes = nullptr;
+    QScopedPointer<ExcludedFiles> _excludedFiles;
+    QString _excludesBasePath;
+    bool _excludeHidden = false;
+
+    QFuture<void> _registration;
     QScopedPointer<QSocketNotifier> _socket;
-    int _fd;
+    int _fd = -1;
 };
 }
 
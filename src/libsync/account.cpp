@@ -20,6 +20,7 @@
 #include "creds/abstractcredentials.h"
 #include "capabilities.h"
 #include "theme.h"
+#include "transferscheduler.h"
 #include "common/asserts.h"
 
 #include <QSettings>
@@ -481,6 +482,13 @@ bool Account::rootEtagChangesNotOnlySubFolderEtags()
     return (serverVersionInt() >= makeServerVersion(8, 1, 0));
 }
 
+TransferScheduler *Account::transferScheduler()
+{
+    if (!_transferScheduler)
+        _transferScheduler = new TransferScheduler(this);
+    return _transferScheduler;
+}
+
 void Account::setNonShib(bool nonShib)
 {
     if (nonShib) {
@@ -45,6 +45,7 @@ typedef QSharedPointer<Account> AccountPtr;
 class QuotaInfo;
 class AccessManager;
 class SimpleNetworkJob;
+class TransferScheduler;
 
 
 /**
@@ -217,6 +218,9 @@ public:
     bool isHttp2Supported() { return _http2Supported; }
     void setHttp2Supported(bool value) { _http2Supported = value; }
 
+    /** Shares the parallel network jobs between the syncs of this account */
+    TransferScheduler *transferScheduler();
+
     void clearCookieJar();
     void lendCookieJarTo(QNetworkAccessManager *guest);
     QString cookieJarPath();
@@ -287,6 +291,7 @@ private:
     QSharedPointer<QNetworkAccessManager> _am;
     QScopedPointer<AbstractCredentials> _credentials;
     bool _http2Supported = false;
+    TransferScheduler *_transferScheduler = 0;
 
     /// Certificates that were explicitly rejected by the user
     QList<QSslCertificate> _rejectedCertificates;
@@ -17,379 +17,265 @@
 #include "propagateupload.h"
 #include "propagatorjobs.h"
 #include "common/utility.h"
-
-#ifdef Q_OS_WIN
-#include <windef.h>
-#include <winbase.h>
-#endif
+#include "common/asserts.h"
 
 #include <QLoggingCategory>
 #include <QTimer>
 #include <QObject>
 
+#include <memory>
+
 namespace OCC {
 
 Q_LOGGING_CATEGORY(lcBandwidthManager, "sync.bandwidthmanager", QtInfoMsg)
 
+// The buckets are refilled at this interval while they throttle transfers.
+static const int refillIntervalMsec = 50;
+
+// Never hand out less than this at once, so that a lot of consumers
+// don't end up with tiny network reads and writes.
+static const qint64 minimumGrant = 1024;
+
 // Because of the many layers of buffering inside Qt (and probably the OS and the network)
 // we cannot lower this value much more. If we do, the estimated bw will be very high
 // because the buffers fill fast while the actual network algorithms are not relevant yet.
-static qint64 relativeLimitMeasuringTimerIntervalMsec = 1000 * 2;
+static const int relativeLimitMeasuringIntervalMsec = 1000 * 2;
 // See also WritingState in http://code.woboq.org/qt5/qtbase/src/network/access/qhttpprotocolhandler.cpp.html#_ZN20QHttpProtocolHandler11sendRequestEv
 
-// FIXME At some point:
-//  * Register device only after the QNR received its metaDataChanged() signal
-//  * Incorporate Qt buffer fill state (it's a negative absolute delta).
-//  * Incorporate SSL overhead (percentage)
-//  * For relative limiting, do less measuring and more delaying+giving quota
-//  * For relative limiting, smoothen measurements
+// Below this, too little was transferred during the measurement to tell the bandwidth.
+static const qint64 relativeLimitMinimumMeasuredBytes = 64 * 1024;
 
-BandwidthManager::BandwidthManager(OwncloudPropagator *p)
-    : QObject()
-    , _propagator(p)
-    , _relativeLimitCurrentMeasuredDevice(0)
-    , _relativeUploadLimitProgressAtMeasuringRestart(0)
-    , _currentUploadLimit(0)
-    , _relativeLimitCurrentMeasuredJob(0)
-    , _currentDownloadLimit(0)
+BandwidthBucket::BandwidthBucket()
 {
-    _currentUploadLimit = _propagator->_uploadLimit.fetchAndAddAcquire(0);
-    _currentDownloadLimit = _propagator->_downloadLimit.fetchAndAddAcquire(0);
-
-    QObject::connect(&_switchingTimer, &QTimer::timeout, this, &BandwidthManager::switchingTimerExpired);
-    _switchingTimer.setInterval(10 * 1000);
-    _switchingTimer.start();
-    QMetaObject::invokeMethod(this, "switchingTimerExpired", Qt::QueuedConnection);
+    auto timer = std::make_shared<QElapsedTimer>();
+    timer->start();
+    _clock = [timer] { return timer->elapsed(); };
+
+    _refillTimer.setInterval(refillIntervalMsec);
+    connect(&_refillTimer, &QTimer::timeout, this, &BandwidthBucket::refill);
+    _relativeTimer.setSingleShot(true);
+    connect(&_relativeTimer, &QTimer::timeout, this, &BandwidthBucket::relativeTimerExpired);
+}
 
-    // absolute uploads/downloads
-    QObject::connect(&_absoluteLimitTimer, &QTimer::timeout, this, &BandwidthManager::absoluteLimitTimerExpired);
-    _absoluteLimitTimer.setInterval(1000);
-    _absoluteLimitTimer.start();
-
-    // Relative uploads
-    QObject::connect(&_relativeUploadMeasuringTimer, &QTimer::timeout,
-        this, &BandwidthManager::relativeUploadMeasuringTimerExpired);
-    _relativeUploadMeasuringTimer.setInterval(relativeLimitMeasuringTimerIntervalMsec);
-    _relativeUploadMeasuringTimer.start();
-    _relativeUploadMeasuringTimer.setSingleShot(true); // will be restarted from the delay timer
-    QObject::connect(&_relativeUploadDelayTimer, &QTimer::timeout,
-        this, &BandwidthManager::relativeUploadDelayTimerExpired);
-    _relativeUploadDelayTimer.setSingleShot(true); // will be restarted from the measuring timer
-
-    // Relative downloads
-    QObject::connect(&_relativeDownloadMeasuringTimer, &QTimer::timeout,
-        this, &BandwidthManager::relativeDownloadMeasuringTimerExpired);
-    _relativeDownloadMeasuringTimer.setInterval(relativeLimitMeasuringTimerIntervalMsec);
-    _relativeDownloadMeasuringTimer.start();
-    _relativeDownloadMeasuringTimer.setSingleShot(true); // will be restarted from the delay timer
-    QObject::connect(&_relativeDownloadDelayTimer, &QTimer::timeout,
-        this, &BandwidthManager::relativeDownloadDelayTimerExpired);
-    _relativeDownloadDelayTimer.setSingleShot(true); // will be restarted from the measuring timer
+// The buckets are shared by all the propagators. They are never deleted since
+// they must not outlive the application object.
+BandwidthBucket *BandwidthBucket::upload()
+{
+    static BandwidthBucket *bucket = new BandwidthBucket;
+    return bucket;
 }
 
-BandwidthManager::~BandwidthManager()
+BandwidthBucket *BandwidthBucket::download()
 {
+    static BandwidthBucket *bucket = new BandwidthBucket;
+    return bucket;
 }
 
-void BandwidthManager::registerUploadDevice(UploadDevice *p)
+void BandwidthBucket::setLimit(qint64 limit)
 {
-    _absoluteUploadDeviceList.append(p);
-    _relativeUploadDeviceList.append(p);
-    QObject::connect(p, &QObject::destroyed, this, &BandwidthManager::unregisterUploadDevice);
-
-    if (usingAbsoluteUploadLimit()) {
-        p->setBandwidthLimited(true);
-        p->setChoked(false);
-    } else if (usingRelativeUploadLimit()) {
-        p->setBandwidthLimited(true);
-        p->setChoked(true);
+    if (limit == _limit)
+        return;
+    qCInfo(lcBandwidthManager) << (this == upload() ? "Upload" : "Download")
+                               << "bandwidth limit changed" << _limit << limit;
+    _limit = limit;
+
+    _relativeTimer.stop();
+    _measuring = false;
+    if (_limit > 0) {
+        setRate(_limit);
+    } else if (_limit < 0) {
+        // Starts measuring
+        relativeTimerExpired();
     } else {
-        p->setBandwidthLimited(false);
-        p->setChoked(false);
+        setRate(0);
     }
 }
 
-void BandwidthManager::unregisterUploadDevice(QObject *o)
+void BandwidthBucket::setClock(const std::function<qint64()> &clock)
 {
-    auto p = reinterpret_cast<UploadDevice *>(o); // note, we might already be in the ~QObject
-    _absoluteUploadDeviceList.removeAll(p);
-    _relativeUploadDeviceList.removeAll(p);
-    if (p == _relativeLimitCurrentMeasuredDevice) {
-        _relativeLimitCurrentMeasuredDevice = 0;
-        _relativeUploadLimitProgressAtMeasuringRestart = 0;
-    }
+    _clock = clock;
+    _lastRefill = _clock();
 }
 
-void BandwidthManager::registerDownloadJob(GETFileJob *j)
+void BandwidthBucket::setRate(qint64 rate)
 {
-    _downloadJobList.append(j);
-    QObject::connect(j, &QObject::destroyed, this, &BandwidthManager::unregisterDownloadJob);
-
-    if (usingAbsoluteDownloadLimit()) {
-        j->setBandwidthLimited(true);
-        j->setChoked(false);
-    } else if (usingRelativeDownloadLimit()) {
-        j->setBandwidthLimited(true);
-        j->setChoked(true);
+    _rate = rate;
+    _tokens = qMin(_tokens, capacity());
+    if (_rate == 0) {
+        // Nothing is throttled anymore
+        wakeWaiting();
+    }
+    if (_rate > 0 && !_consumers.isEmpty()) {
+        if (!_refillTimer.isActive()) {
+            _lastRefill = _clock();
+            _refillTimer.start();
+        }
     } else {
-        j->setBandwidthLimited(false);
-        j->setChoked(false);
+        _refillTimer.stop();
     }
 }
 
-void BandwidthManager::unregisterDownloadJob(QObject *o)
+qint64 BandwidthBucket::capacity() const
 {
-    GETFileJob *j = reinterpret_cast<GETFileJob *>(o); // note, we might already be in the ~QObject
-    _downloadJobList.removeAll(j);
-    if (_relativeLimitCurrentMeasuredJob == j) {
-        _relativeLimitCurrentMeasuredJob = 0;
-        _relativeDownloadLimitProgressAtMeasuringRestart = 0;
-    }
+    // A quarter of a second worth of data
+    return qMax(_rate / 4, 4 * minimumGrant);
 }
 
-void BandwidthManager::relativeUploadMeasuringTimerExpired()
+void BandwidthBucket::registerConsumer(QObject *consumer, const char *wakeMethod)
 {
-    if (!usingRelativeUploadLimit() || _relativeUploadDeviceList.count() == 0) {
-        // Not in this limiting mode, just wait 1 sec to continue the cycle
-        _relativeUploadDelayTimer.setInterval(1000);
-        _relativeUploadDelayTimer.start();
-        return;
-    }
-    if (_relativeLimitCurrentMeasuredDevice == 0) {
-        qCDebug(lcBandwidthManager) << "No device set, just waiting 1 sec";
-        _relativeUploadDelayTimer.setInterval(1000);
-        _relativeUploadDelayTimer.start();
+    if (_consumers.contains(consumer))
         return;
-    }
-
-    qCDebug(lcBandwidthManager) << _relativeUploadDeviceList.count() << "Starting Delay";
-
-    qint64 relativeLimitProgressMeasured = (_relativeLimitCurrentMeasuredDevice->_readWithProgress
-                                               + _relativeLimitCurrentMeasuredDevice->_read)
-        / 2;
-    qint64 relativeLimitProgressDifference = relativeLimitProgressMeasured - _relativeUploadLimitProgressAtMeasuringRestart;
-    qCDebug(lcBandwidthManager) << _relativeUploadLimitProgressAtMeasuringRestart
-                                << relativeLimitProgressMeasured << relativeLimitProgressDifference;
-
-    qint64 speedkBPerSec = (relativeLimitProgressDifference / relativeLimitMeasuringTimerIntervalMsec * 1000.0) / 1024.0;
-    qCDebug(lcBandwidthManager) << relativeLimitProgressDifference / 1024 << "kB =>" << speedkBPerSec << "kB/sec on full speed ("
-                                << _relativeLimitCurrentMeasuredDevice->_readWithProgress << _relativeLimitCurrentMeasuredDevice->_read
-                                << qAbs(_relativeLimitCurrentMeasuredDevice->_readWithProgress
-                                       - _relativeLimitCurrentMeasuredDevice->_read)
-                                << ")";
-
-    qint64 uploadLimitPercent = -_currentUploadLimit;
-    // don't use too extreme values
-    uploadLimitPercent = qMin(uploadLimitPercent, qint64(90));
-    uploadLimitPercent = qMax(qint64(10), uploadLimitPercent);
-    qint64 wholeTimeMsec = (100.0 / uploadLimitPercent) * relativeLimitMeasuringTimerIntervalMsec;
-    qint64 waitTimeMsec = wholeTimeMsec - relativeLimitMeasuringTimerIntervalMsec;
-    qint64 realWaitTimeMsec = waitTimeMsec + wholeTimeMsec;
-    qCDebug(lcBandwidthManager) << waitTimeMsec << " - " << realWaitTimeMsec << " msec for " << uploadLimitPercent << "%";
-
-    // We want to wait twice as long since we want to give all
-    // devices the same quota we used now since we don't want
-    // any upload to timeout
-    _relativeUploadDelayTimer.setInterval(realWaitTimeMsec);
-    _relativeUploadDelayTimer.start();
-
-    int deviceCount = _relativeUploadDeviceList.count();
-    qint64 quotaPerDevice = relativeLimitProgressDifference * (uploadLimitPercent / 100.0) / deviceCount + 1.0;
-    Q_FOREACH (UploadDevice *ud, _relativeUploadDeviceList) {
-        ud->setBandwidthLimited(true);
-        ud->setChoked(false);
-        ud->giveBandwidthQuota(quotaPerDevice);
-        qCDebug(lcBandwidthManager) << "Gave" << quotaPerDevice / 1024.0 << "kB to" << ud;
-    }
-    _relativeLimitCurrentMeasuredDevice = 0;
+    Consumer c;
+    c.wakeMethod = wakeMethod;
+    _consumers.insert(consumer, c);
+    connect(consumer, &QObject::destroyed, this, &BandwidthBucket::unregisterConsumer);
+    setRate(_rate);
 }
 
-void BandwidthManager::relativeUploadDelayTimerExpired()
+void BandwidthBucket::unregisterConsumer(QObject *consumer)
 {
-    // Switch to measuring state
-    _relativeUploadMeasuringTimer.start(); // always start to continue the cycle
+    // note, we might already be in the ~QObject
+    if (!_consumers.remove(consumer))
+        return;
+    _waiting.removeAll(consumer);
+    disconnect(consumer, &QObject::destroyed, this, &BandwidthBucket::unregisterConsumer);
+    if (_consumers.isEmpty())
+        _refillTimer.stop();
+}
 
-    if (!usingRelativeUploadLimit()) {
-        return; // oh, not actually needed
+qint64 BandwidthBucket::take(QObject *consumer, qint64 maxlen)
+{
+    if (_rate == 0) {
+        if (_measuring)
+            _measuredBytes += maxlen;
+        return maxlen;
     }
 
-    if (_relativeUploadDeviceList.isEmpty()) {
-        return;
+    auto it = _consumers.find(consumer);
+    if (it == _consumers.end()) {
+        ASSERT(false, "take() from an unregistered consumer");
+        return maxlen;
+    }
+    Consumer &c = it.value();
+    if (c.round != _round) {
+        c.round = _round;
+        c.taken = 0;
     }
 
-    qCDebug(lcBandwidthManager) << _relativeUploadDeviceList.count() << "Starting measuring";
-
-    // Take first device and then append it again (= we round robin all devices)
-    _relativeLimitCurrentMeasuredDevice = _relativeUploadDeviceList.takeFirst();
-    _relativeUploadDeviceList.append(_relativeLimitCurrentMeasuredDevice);
-
-    _relativeUploadLimitProgressAtMeasuringRestart = (_relativeLimitCurrentMeasuredDevice->_readWithProgress
-                                                         + _relativeLimitCurrentMeasuredDevice->_read)
-        / 2;
-    _relativeLimitCurrentMeasuredDevice->setBandwidthLimited(false);
-    _relativeLimitCurrentMeasuredDevice->setChoked(false);
-
-    // choke all other UploadDevices
-    Q_FOREACH (UploadDevice *ud, _relativeUploadDeviceList) {
-        if (ud != _relativeLimitCurrentMeasuredDevice) {
-            ud->setBandwidthLimited(true);
-            ud->setChoked(true);
+    qint64 granted = qMin(maxlen, _tokens);
+    if (_shared) {
+        // Several consumers waited for this refill, each gets its part
+        granted = qMin(granted, _share - c.taken);
+    }
+    if (granted <= 0) {
+        if (!c.waiting) {
+            c.waiting = true;
+            _waiting.append(consumer);
         }
+        return 0;
     }
-
-    // now we're in measuring state
+    _tokens -= granted;
+    c.taken += granted;
+    return granted;
 }
 
-// for downloads:
-void BandwidthManager::relativeDownloadMeasuringTimerExpired()
+void BandwidthBucket::refill()
 {
-    if (!usingRelativeDownloadLimit() || _downloadJobList.count() == 0) {
-        // Not in this limiting mode, just wait 1 sec to continue the cycle
-        _relativeDownloadDelayTimer.setInterval(1000);
-        _relativeDownloadDelayTimer.start();
-        return;
-    }
-    if (_relativeLimitCurrentMeasuredJob == 0) {
-        qCDebug(lcBandwidthManager) << "No job set, just waiting 1 sec";
-        _relativeDownloadDelayTimer.setInterval(1000);
-        _relativeDownloadDelayTimer.start();
-        return;
-    }
-
-    qCDebug(lcBandwidthManager) << _downloadJobList.count() << "Starting Delay";
-
-    qint64 relativeLimitProgressMeasured = _relativeLimitCurrentMeasuredJob->currentDownloadPosition();
-    qint64 relativeLimitProgressDifference = relativeLimitProgressMeasured - _relativeDownloadLimitProgressAtMeasuringRestart;
-    qCDebug(lcBandwidthManager) << _relativeDownloadLimitProgressAtMeasuringRestart
-                                << relativeLimitProgressMeasured << relativeLimitProgressDifference;
-
-    qint64 speedkBPerSec = (relativeLimitProgressDifference / relativeLimitMeasuringTimerIntervalMsec * 1000.0) / 1024.0;
-    qCDebug(lcBandwidthManager) << relativeLimitProgressDifference / 1024 << "kB =>" << speedkBPerSec << "kB/sec on full speed ("
-                                << _relativeLimitCurrentMeasuredJob->currentDownloadPosition();
+    const qint64 now = _clock();
+    const qint64 elapsed = now - _lastRefill;
+    _lastRefill = now;
+    _tokens = qMin(_tokens + _rate * elapsed / 1000, capacity());
+    ++_round;
+
+    _shared = _waiting.size() > 1;
+    _share = _shared ? qMax(minimumGrant, _tokens / _waiting.size()) : _tokens;
+    wakeWaiting();
+}
 
-    qint64 downloadLimitPercent = -_currentDownloadLimit;
-    // don't use too extreme values
-    downloadLimitPercent = qMin(downloadLimitPercent, qint64(90));
-    downloadLimitPercent = qMax(qint64(10), downloadLimitPercent);
-    qint64 wholeTimeMsec = (100.0 / downloadLimitPercent) * relativeLimitMeasuringTimerIntervalMsec;
-    qint64 waitTimeMsec = wholeTimeMsec - relativeLimitMeasuringTimerIntervalMsec;
-    qint64 realWaitTimeMsec = waitTimeMsec + wholeTimeMsec;
-    qCDebug(lcBandwidthManager) << waitTimeMsec << " - " << realWaitTimeMsec << " msec for " << downloadLimitPercent << "%";
-
-    // We want to wait twice as long since we want to give all
-    // devices the same quota we used now since we don't want
-    // any download to timeout
-    _relativeDownloadDelayTimer.setInterval(realWaitTimeMsec);
-    _relativeDownloadDelayTimer.start();
-
-    int jobCount = _downloadJobList.count();
-    qint64 quota = relativeLimitProgressDifference * (downloadLimitPercent / 100.0);
-    if (quota > 20 * 1024) {
-        qCInfo(lcBandwidthManager) << "ADJUSTING QUOTA FROM " << quota << " TO " << quota - 20 * 1024;
-        quota -= 20 * 1024;
-    }
-    qint64 quotaPerJob = quota / jobCount + 1.0;
-    Q_FOREACH (GETFileJob *gfj, _downloadJobList) {
-        gfj->setBandwidthLimited(true);
-        gfj->setChoked(false);
-        gfj->giveBandwidthQuota(quotaPerJob);
-        qCDebug(lcBandwidthManager) << "Gave" << quotaPerJob / 1024.0 << "kB to" << gfj;
+void BandwidthBucket::wakeWaiting()
+{
+    // In the order in which they ran out of tokens
+    foreach (QObject *consumer, _waiting) {
+        auto &c = _consumers[consumer];
+        c.waiting = false;
+        QMetaObject::invokeMethod(consumer, c.wakeMethod.constData(), Qt::QueuedConnection);
     }
-    _relativeLimitCurrentMeasuredDevice = 0;
+    _waiting.clear();
 }
 
-void BandwidthManager::relativeDownloadDelayTimerExpired()
+void BandwidthBucket::relativeTimerExpired()
 {
-    // Switch to measuring state
-    _relativeDownloadMeasuringTimer.start(); // always start to continue the cycle
-
-    if (!usingRelativeDownloadLimit()) {
-        return; // oh, not actually needed
-    }
+    if (_limit >= 0)
+        return;
 
-    if (_downloadJobList.isEmpty()) {
-        qCDebug(lcBandwidthManager) << _downloadJobList.count() << "No jobs?";
+    if (!_measuring || _measuredBytes < relativeLimitMinimumMeasuredBytes) {
+        // Let everything run at full speed and see how much gets through.
+        // If too little was transferred to tell, keep measuring.
+        _measuring = true;
+        _measuringStart = _clock();
+        _measuredBytes = 0;
+        setRate(0);
+        _relativeTimer.start(relativeLimitMeasuringIntervalMsec);
         return;
     }
 
-    qCDebug(lcBandwidthManager) << _downloadJobList.count() << "Starting measuring";
+    // don't use too extreme values
+    const qint64 percent = qBound(qint64(10), -_limit, qint64(90));
+    const qint64 measuringMsec = qMax(qint64(1), _clock() - _measuringStart);
+    const qint64 measuredRate = _measuredBytes * 1000 / measuringMsec;
+
+    // The measurement ran at 100%. Throttling to half the percentage for long
+    // enough makes the whole cycle average to the percentage:
+    // (100 * measuring + percent / 2 * throttling) = percent * (measuring + throttling)
+    const qint64 throttlingMsec = measuringMsec * 2 * (100 - percent) / percent;
+    qCDebug(lcBandwidthManager) << "Measured" << measuredRate / 1024 << "kB/sec at full speed, limiting to"
+                                << percent / 2. << "% for" << throttlingMsec << "ms";
+
+    _measuring = false;
+    setRate(qMax(minimumGrant, measuredRate * percent / 200));
+    _relativeTimer.start(throttlingMsec);
+}
 
-    // Take first device and then append it again (= we round robin all devices)
-    _relativeLimitCurrentMeasuredJob = _downloadJobList.takeFirst();
-    _downloadJobList.append(_relativeLimitCurrentMeasuredJob);
+BandwidthManager::BandwidthManager(OwncloudPropagator *p)
+    : QObject()
+    , _propagator(p)
+{
+    QObject::connect(&_switchingTimer, &QTimer::timeout, this, &BandwidthManager::switchingTimerExpired);
+    _switchingTimer.setInterval(10 * 1000);
+    _switchingTimer.start();
+    QMetaObject::invokeMethod(this, "switchingTimerExpired", Qt::QueuedConnection);
+}
 
-    _relativeDownloadLimitProgressAtMeasuringRestart = _relativeLimitCurrentMeasuredJob->currentDownloadPosition();
-    _relativeLimitCurrentMeasuredJob->setBandwidthLimited(false);
-    _relativeLimitCurrentMeasuredJob->setChoked(false);
+BandwidthManager::~BandwidthManager()
+{
+}
 
-    // choke all other download jobs
-    Q_FOREACH (GETFileJob *gfj, _downloadJobList) {
-        if (gfj != _relativeLimitCurrentMeasuredJob) {
-            gfj->setBandwidthLimited(true);
-            gfj->setChoked(true);
-        }
-    }
+void BandwidthManager::registerUploadDevice(UploadDevice *p)
+{
+    // Tell QNAM that it can read again
+    uploadBucket()->registerConsumer(p, "readyRead");
+}
 
-    // now we're in measuring state
+void BandwidthManager::unregisterUploadDevice(QObject *o)
+{
+    uploadBucket()->unregisterConsumer(o);
 }
 
-// end downloads
+void BandwidthManager::registerDownloadJob(GETFileJob *j)
+{
+    downloadBucket()->registerConsumer(j, "slotReadyRead");
+}
 
-void BandwidthManager::switchingTimerExpired()
+void BandwidthManager::unregisterDownloadJob(QObject *o)
 {
-    qint64 newUploadLimit = _propagator->_uploadLimit.fetchAndAddAcquire(0);
-    if (newUploadLimit != _currentUploadLimit) {
-        qCInfo(lcBandwidthManager) << "Upload Bandwidth limit changed" << _currentUploadLimit << newUploadLimit;
-        _currentUploadLimit = newUploadLimit;
-        Q_FOREACH (UploadDevice *ud, _relativeUploadDeviceList) {
-            if (newUploadLimit == 0) {
-                ud->setBandwidthLimited(false);
-                ud->setChoked(false);
-            } else if (newUploadLimit > 0) {
-                ud->setBandwidthLimited(true);
-                ud->setChoked(false);
-            } else if (newUploadLimit < 0) {
-                ud->setBandwidthLimited(true);
-                ud->setChoked(true);
-            }
-        }
-    }
-    qint64 newDownloadLimit = _propagator->_downloadLimit.fetchAndAddAcquire(0);
-    if (newDownloadLimit != _currentDownloadLimit) {
-        qCInfo(lcBandwidthManager) << "Download Bandwidth limit changed" << _currentDownloadLimit << newDownloadLimit;
-        _currentDownloadLimit = newDownloadLimit;
-        Q_FOREACH (GETFileJob *j, _downloadJobList) {
-            if (usingAbsoluteDownloadLimit()) {
-                j->setBandwidthLimited(true);
-                j->setChoked(false);
-            } else if (usingRelativeDownloadLimit()) {
-                j->setBandwidthLimited(true);
-                j->setChoked(true);
-            } else {
-                j->setBandwidthLimited(false);
-                j->setChoked(false);
-            }
-        }
-    }
+    downloadBucket()->unregisterConsumer(o);
 }
 
-void BandwidthManager::absoluteLimitTimerExpired()
+void BandwidthManager::switchingTimerExpired()
 {
-    if (usingAbsoluteUploadLimit() && _absoluteUploadDeviceList.count() > 0) {
-        qint64 quotaPerDevice = _currentUploadLimit / qMax(1, _absoluteUploadDeviceList.count());
-        qCDebug(lcBandwidthManager) << quotaPerDevice << _absoluteUploadDeviceList.count() << _currentUploadLimit;
-        Q_FOREACH (UploadDevice *device, _absoluteUploadDeviceList) {
-            device->giveBandwidthQuota(quotaPerDevice);
-            qCDebug(lcBandwidthManager) << "Gave " << quotaPerDevice / 1024.0 << " kB to" << device;
-        }
-    }
-    if (usingAbsoluteDownloadLimit() && _downloadJobList.count() > 0) {
-        qint64 quotaPerJob = _currentDownloadLimit / qMax(1, _downloadJobList.count());
-        qCDebug(lcBandwidthManager) << quotaPerJob << _downloadJobList.count() << _currentDownloadLimit;
-        Q_FOREACH (GETFileJob *j, _downloadJobList) {
-            j->giveBandwidthQuota(quotaPerJob);
-            qCDebug(lcBandwidthManager) << "Gave " << quotaPerJob / 1024.0 << " kB to" << j;
-        }
-    }
+    // The buckets are shared, the last propagator to apply its limits wins.
+    // They all get them from the same configuration.
+    uploadBucket()->setLimit(_propagator->_uploadLimit.fetchAndAddAcquire(0));
+    downloadBucket()->setLimit(_propagator->_downloadLimit.fetchAndAddAcquire(0));
 }
 }
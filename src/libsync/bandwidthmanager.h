@@ -16,9 +16,12 @@
 #define BANDWIDTHMANAGER_H
 
 #include <QObject>
-#include <QLinkedList>
+#include <QHash>
+#include <QList>
 #include <QTimer>
-#include <QIODevice>
+#include <QElapsedTimer>
+
+#include <functional>
 
 namespace OCC {
 
@@ -26,8 +29,101 @@ class UploadDevice;
 class GETFileJob;
 class OwncloudPropagator;
 
+/**
+ * @brief A token bucket shared by all the transfers in one direction
+ *
+ * There is one bucket for the uploads and one for the downloads of the whole
+ * process, so that the limit applies to all the folders and accounts together.
+ * The transfers call take() before sending or receiving data. When the bucket
+ * is empty they are put in a queue and woken up in order once it is refilled;
+ * while others are waiting a transfer gets no more than its fair share of each
+ * refill.
+ *
+ * A limit does not need to reduce the number of parallel transfers.
+ *
+ * @ingroup libsync
+ */
+class BandwidthBucket : public QObject
+{
+    Q_OBJECT
+public:
+    static BandwidthBucket *upload();
+    static BandwidthBucket *download();
+
+    /**
+     * 0 means no limit, a positive value is in bytes per second and a negative
+     * value is a percentage of the measured bandwidth.
+     */
+    void setLimit(qint64 limit);
+    qint64 limit() const { return _limit; }
+
+    /** The current refill rate in bytes per second, 0 if nothing is throttled */
+    qint64 rate() const { return _rate; }
+
+    /** Replaces the monotonic clock in milliseconds that the refills are based on, for tests */
+    void setClock(const std::function<qint64()> &clock);
+
+    /**
+     * Register a transfer that draws from the bucket.
+     *
+     * When take() returned 0 the method \a wakeMethod of \a consumer is invoked
+     * (queued) as soon as there are tokens again.
+     */
+    void registerConsumer(QObject *consumer, const char *wakeMethod);
+    void unregisterConsumer(QObject *consumer);
+
+    /**
+     * Returns how many of the \a maxlen bytes the consumer may transfer now.
+     *
+     * If that is 0, the consumer will be woken up later.
+     */
+    qint64 take(QObject *consumer, qint64 maxlen);
+
+private slots:
+    void refill();
+    void relativeTimerExpired();
+
+private:
+    BandwidthBucket();
+
+    void setRate(qint64 rate);
+    qint64 capacity() const;
+    void wakeWaiting();
+
+    struct Consumer
+    {
+        QByteArray wakeMethod;
+        quint64 round = 0;
+        qint64 taken = 0; // during round
+        bool waiting = false;
+    };
+    QHash<QObject *, Consumer> _consumers;
+    QList<QObject *> _waiting;
+
+    qint64 _limit = 0;
+    qint64 _rate = 0; // bytes per second, 0 means no throttling
+    qint64 _tokens = 0;
+    bool _shared = false; // if the consumers only get their share during this round
+    qint64 _share = 0;
+    quint64 _round = 0; // incremented at each refill
+    QTimer _refillTimer;
+    std::function<qint64()> _clock;
+    qint64 _lastRefill = 0;
+
+    // for relative limits: measure the bandwidth without throttling, then
+    // throttle below the percentage for long enough that the average matches
+    QTimer _relativeTimer;
+    bool _measuring = false;
+    qint64 _measuringStart = 0;
+    qint64 _measuredBytes = 0;
+};
+
 /**
  * @brief The BandwidthManager class
+ *
+ * Applies the limits of a propagator to the shared buckets and registers its
+ * transfers with them.
+ *
  * @ingroup libsync
  */
 class BandwidthManager : public QObject
@@ -37,11 +133,8 @@ public:
     BandwidthManager(OwncloudPropagator *p);
     ~BandwidthManager();
 
-    bool usingAbsoluteUploadLimit() { return _currentUploadLimit > 0; }
-    bool usingRelativeUploadLimit() { return _currentUploadLimit < 0; }
-    bool usingAbsoluteDownloadLimit() { return _currentDownloadLimit > 0; }
-    bool usingRelativeDownloadLimit() { return _currentDownloadLimit < 0; }
-
+    BandwidthBucket *uploadBucket() const { return BandwidthBucket::upload(); }
+    BandwidthBucket *downloadBucket() const { return BandwidthBucket::download(); }
 
 public slots:
     void registerUploadDevice(UploadDevice *);
@@ -50,55 +143,14 @@ public slots:
     void registerDownloadJob(GETFileJob *);
     void unregisterDownloadJob(QObject *);
 
-    void absoluteLimitTimerExpired();
     void switchingTimerExpired();
 
-    void relativeUploadMeasuringTimerExpired();
-    void relativeUploadDelayTimerExpired();
-
-    void relativeDownloadMeasuringTimerExpired();
-    void relativeDownloadDelayTimerExpired();
-
 private:
-    // for switching between absolute and relative bw limiting
     QTimer _switchingTimer;
 
     // FIXME this timer and this variable should be replaced
     // by the propagator emitting the changed limit values to us as signal
     OwncloudPropagator *_propagator;
-
-    // for absolute up/down bw limiting
-    QTimer _absoluteLimitTimer;
-
-    // FIXME merge these two lists
-    QLinkedList<UploadDevice *> _absoluteUploadDeviceList;
-    QLinkedList<UploadDevice *> _relativeUploadDeviceList;
-
-    QTimer _relativeUploadMeasuringTimer;
-
-    // for relative bw limiting, we need to wait this amount before measuring again
-    QTimer _relativeUploadDelayTimer;
-
-    // the device measured
-    UploadDevice *_relativeLimitCurrentMeasuredDevice;
-
-    // for measuring how much progress we made at start
-    qint64 _relativeUploadLimitProgressAtMeasuringRestart;
-    qint64 _currentUploadLimit;
-
-    QLinkedList<GETFileJob *> _downloadJobList;
-    QTimer _relativeDownloadMeasuringTimer;
-
-    // for relative bw limiting, we need to wait this amount before measuring again
-    QTimer _relativeDownloadDelayTimer;
-
-    // the device measured
-    GETFileJob *_relativeLimitCurrentMeasuredJob;
-
-    // for measuring how much progress we made at start
-    qint64 _relativeDownloadLimitProgressAtMeasuringRestart;
-
-    qint64 _currentDownloadLimit;
 };
 }
 
@@ -15,6 +15,7 @@
 #include "capabilities.h"
 
 #include "configfile.h"
+#include "common/checksums.h"
 
 #include <QVariantMap>
 
@@ -117,6 +118,16 @@ QByteArray Capabilities::uploadChecksumType() const
     return QByteArray();
 }
 
+QByteArray Capabilities::fastTransmissionChecksumType() const
+{
+    QList<QByteArray> supported = supportedChecksumTypes();
+    for (const char *type : { checkSumCrc32cC, checkSumAdlerC }) {
+        if (supported.contains(type))
+            return type;
+    }
+    return QByteArray();
+}
+
 bool Capabilities::chunkingNg() const
 {
     static const auto chunkng = qgetenv("OWNCLOUD_CHUNKING_NG");
@@ -127,6 +138,26 @@ bool Capabilities::chunkingNg() const
     return _capabilities["dav"].toMap()["chunking"].toByteArray() >= "1.0";
 }
 
+bool Capabilities::bulkUpload() const
+{
+    static const auto bulkupload = qgetenv("OWNCLOUD_BULK_UPLOAD");
+    if (bulkupload == "0")
+        return false;
+    if (bulkupload == "1")
+        return true;
+    return _capabilities["dav"].toMap()["bulkupload"].toByteArray() >= "1.0";
+}
+
+bool Capabilities::deltaSync() const
+{
+    static const auto deltasync = qgetenv("OWNCLOUD_DELTA_SYNC");
+    if (deltasync == "0")
+        return false;
+    if (deltasync == "1")
+        return true;
+    return _capabilities["dav"].toMap()["deltasync"].toByteArray() >= "1.0";
+}
+
 bool Capabilities::chunkingParallelUploadDisabled() const
 {
     return _capabilities["dav"].toMap()["chunkingParallelUploadDisabled"].toBool();
@@ -44,6 +44,25 @@ public:
     bool shareResharing() const;
     bool chunkingNg() const;
 
+    /**
+     * Whether the server accepts several small files in one multipart request.
+     *
+     * Path: dav/bulkupload
+     * Default: empty, meaning "not supported"
+     * Possible values: "1.0"
+     */
+    bool bulkUpload() const;
+
+    /**
+     * Whether a chunked upload may contain only the changed parts of a file,
+     * the server takes the rest from the current version (OC-Delta-Base-ETag).
+     *
+     * Path: dav/deltasync
+     * Default: empty, meaning "not supported"
+     * Possible values: "1.0"
+     */
+    bool deltaSync() const;
+
     /// disable parallel upload in chunking
     bool chunkingParallelUploadDisabled() const;
 
@@ -65,7 +84,7 @@ public:
      *
      * Path: checksums/supportedTypes
      * Default: []
-     * Possible entries: "Adler32", "MD5", "SHA1"
+     * Possible entries: "Adler32", "CRC32C", "MD5", "SHA1"
      */
     QList<QByteArray> supportedChecksumTypes() const;
 
@@ -86,6 +105,15 @@ public:
      */
     QByteArray uploadChecksumType() const;
 
+    /**
+     * The cheapest of the supportedChecksumTypes() to compute, CRC32C or
+     * Adler32, or empty if the server accepts neither.
+     *
+     * Only used to check the transmission of single chunks: the server
+     * stores the checksum of the file, which must stay collision safe.
+     */
+    QByteArray fastTransmissionChecksumType() const;
+
     /**
      * List of HTTP error codes should be guaranteed to eventually reset
      * failing chunked uploads.
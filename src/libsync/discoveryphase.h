@@ -37,6 +37,17 @@ class Account;
 
 struct SyncOptions
 {
+    /** The order in which the propagator starts the transfers of a directory.
+     *
+     * Removals and moves always keep their place in front of the transfers,
+     * and directories are still created before their contents.
+     */
+    enum class SchedulingPolicy {
+        PathOrder, ///< in the order of the paths, as discovered
+        SmallestFirst, ///< small files first, gets many files done early
+        RecentlyModifiedFirst ///< files the user worked on recently first
+    };
+
     SyncOptions()
         : _newBigFolderSizeLimit(-1)
         , _confirmExternalStorage(false)
@@ -45,6 +56,9 @@ struct SyncOptions
         , _maxChunkSize(100 * 1000 * 1000) // 100 MB
         , _targetChunkUploadDuration(60 * 1000) // 1 minute
         , _parallelNetworkJobs(true)
+        , _schedulingPolicy(SchedulingPolicy::PathOrder)
+        , _smallFileLane(false)
+        , _interactive(false)
     {
     }
 
@@ -78,6 +92,24 @@ struct SyncOptions
 
     /** Whether parallel network jobs are allowed. */
     bool _parallelNetworkJobs;
+
+    /** The order in which transfers are started */
+    SchedulingPolicy _schedulingPolicy;
+
+    /** Whether the slots above maximumActiveTransferJob() are reserved for small files.
+     *
+     * Large transfers are then limited to maximumActiveTransferJob() while the
+     * small ones may use up to hardMaximumActiveJob(), so that a few huge files
+     * cannot hold back the many small ones.
+     */
+    bool _smallFileLane;
+
+    /** Whether the user is waiting for this sync, e.g. because they just edited a file.
+     *
+     * Interactive syncs get a larger share of the account's parallel network
+     * jobs than background ones, see TransferScheduler.
+     */
+    bool _interactive;
 };
 
 
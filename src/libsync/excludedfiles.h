@@ -45,6 +45,9 @@ public:
      */
     void addExcludeFilePath(const QString &path);
 
+    /** The files the patterns are loaded from */
+    QSet<QString> excludeFilePaths() const { return _excludeFiles; }
+
     /**
      * Checks whether a file or directory should be excluded.
      *
@@ -18,6 +18,20 @@
 #include <QFile>
 #include <QFileInfo>
 
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/falloc.h>
+#include <linux/fs.h>
+#endif
+#ifdef Q_OS_MAC
+#include <copyfile.h>
+#endif
+
 // We use some internals of csync:
 extern "C" int c_utimes(const char *, const struct timeval *);
 
@@ -114,6 +128,118 @@ bool FileSystem::verifyFileUnchanged(const QString &fileName,
     return true;
 }
 
+bool FileSystem::cloneFile(const QString &source, const QString &destination,
+    QString *errorString)
+{
+#if defined(Q_OS_MAC) && defined(COPYFILE_CLONE)
+    // Clones on APFS and copies elsewhere, it wants to create the destination itself
+    QFile::remove(destination);
+    if (copyfile(QFile::encodeName(source).constData(), QFile::encodeName(destination).constData(),
+            nullptr, COPYFILE_CLONE)
+        == 0) {
+        return true;
+    }
+    qCInfo(lcFileSystem) << "copyfile failed for" << source << "errno:" << errno;
+#endif
+
+    QFile in(source);
+    if (!openAndSeekFileSharedRead(&in, errorString, 0)) {
+        return false;
+    }
+    QFile out(destination);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        *errorString = out.errorString();
+        return false;
+    }
+
+#if defined(Q_OS_LINUX) && defined(FICLONE)
+    // Shares the data on btrfs, XFS and others
+    if (ioctl(out.handle(), FICLONE, in.handle()) == 0) {
+        return true;
+    }
+#endif
+
+#if defined(Q_OS_LINUX) && defined(SYS_copy_file_range)
+    // Not the same file system or no reflinks: let the kernel copy the data
+    // without passing it through user space. On network file systems this
+    // may even happen on the server.
+    {
+        const qint64 size = in.size();
+        loff_t inOffset = 0;
+        loff_t outOffset = 0;
+        while (outOffset < size) {
+            const auto r = syscall(SYS_copy_file_range, in.handle(), &inOffset,
+                out.handle(), &outOffset, size_t(size - outOffset), 0u);
+            if (r <= 0)
+                break;
+        }
+        if (outOffset == size) {
+            return true;
+        }
+        // Not supported here (EXDEV, ENOSYS, ...), copy the data ourselves
+        if (outOffset > 0) {
+            out.resize(0);
+        }
+    }
+#endif
+
+    QByteArray buffer(64 * 1024, Qt::Uninitialized);
+    while (true) {
+        const qint64 r = in.read(buffer.data(), buffer.size());
+        if (r < 0) {
+            *errorString = in.errorString();
+            return false;
+        }
+        if (r == 0) {
+            return true;
+        }
+        if (out.write(buffer.constData(), r) != r) {
+            *errorString = out.errorString();
+            return false;
+        }
+    }
+}
+
+bool FileSystem::preallocate(QFile *file, qint64 offset, qint64 length)
+{
+#if defined(Q_OS_LINUX) && defined(FALLOC_FL_KEEP_SIZE)
+    // Keep the size: the size of a partial download tells where to resume
+    return fallocate(file->handle(), FALLOC_FL_KEEP_SIZE, offset, length) == 0;
+#elif defined(Q_OS_MAC) && defined(F_PREALLOCATE)
+    // Allocates after the end of the file, that is all we need
+    Q_UNUSED(offset);
+    fstore_t store = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, length, 0 };
+    if (fcntl(file->handle(), F_PREALLOCATE, &store) == 0)
+        return true;
+    store.fst_flags = F_ALLOCATEALL;
+    return fcntl(file->handle(), F_PREALLOCATE, &store) == 0;
+#else
+    Q_UNUSED(file);
+    Q_UNUSED(offset);
+    Q_UNUSED(length);
+    return false;
+#endif
+}
+
+void FileSystem::dropWrittenData(QFile *file, qint64 offset, qint64 length)
+{
+#if defined(Q_OS_LINUX) && defined(SYNC_FILE_RANGE_WRITE)
+    // Dirty pages can't be dropped: start the write back of this range now,
+    // by the time the next one is written it is usually done.
+    sync_file_range(file->handle(), offset, length, SYNC_FILE_RANGE_WRITE);
+#endif
+#ifdef POSIX_FADV_DONTNEED
+    const qint64 previous = qMax(qint64(0), offset - length);
+    if (offset > previous) {
+        posix_fadvise(file->handle(), previous, offset - previous, POSIX_FADV_DONTNEED);
+    }
+#else
+    Q_UNUSED(file);
+    Q_UNUSED(offset);
+    Q_UNUSED(length);
+#endif
+}
+
 #ifdef Q_OS_WIN
 static qint64 getSizeWithCsync(const QString &filename)
 {
@@ -40,7 +40,7 @@ namespace FileSystem {
     /**
  * @brief compare two files with given filename and return true if they have the same content
  */
-    bool fileEquals(const QString &fn1, const QString &fn2);
+    bool OWNCLOUDSYNC_EXPORT fileEquals(const QString &fn1, const QString &fn2);
 
     /**
  * @brief Get the mtime for a filepath
@@ -77,6 +77,33 @@ namespace FileSystem {
     bool verifyFileUnchanged(const QString &fileName,
         qint64 previousSize,
         time_t previousMtime);
+
+    /**
+ * @brief Copies \a source to \a destination, replacing its content
+ *
+ * Uses the fastest mechanism available: a reflink that shares the data
+ * with the source (FICLONE on Linux, clonefile on macOS), a copy done by the
+ * kernel (copy_file_range) and finally a copy through a buffer.
+ */
+    bool OWNCLOUDSYNC_EXPORT cloneFile(const QString &source, const QString &destination,
+        QString *errorString);
+
+    /**
+ * @brief Reserves disk space for \a length bytes starting at \a offset
+ *
+ * The size of the file does not change. Reserving the space up front keeps
+ * the file from being fragmented and makes a full disk fail early. Returns
+ * false if the platform or the file system can't do it, which is not an error.
+ */
+    bool preallocate(QFile *file, qint64 offset, qint64 length);
+
+    /**
+ * @brief Tells the kernel that a range that was just written won't be read again
+ *
+ * Starts writing the range back to disk and drops the pages of the range
+ * before it that were written already from the page cache.
+ */
+    void dropWrittenData(QFile *file, qint64 offset, qint64 length);
 }
 
 /** @} */
@@ -14,6 +14,7 @@
  */
 
 #include "owncloudpropagator.h"
+#include "transferscheduler.h"
 #include "common/syncjournaldb.h"
 #include "common/syncjournalfilerecord.h"
 #include "propagatedownload.h"
@@ -39,7 +40,9 @@
 #include <QTimer>
 #include <QObject>
 #include <QTimerEvent>
+#include <QThread>
 #include <qmath.h>
+#include <algorithm>
 
 namespace OCC {
 
@@ -75,15 +78,22 @@ qint64 freeSpaceLimit()
 
 OwncloudPropagator::~OwncloudPropagator()
 {
+    _account->transferScheduler()->unregisterPropagator(this);
 }
 
+void OwncloudPropagator::emitFinished(SyncFileItem::Status status)
+{
+    _account->transferScheduler()->unregisterPropagator(this);
+    if (!_finishedEmited)
+        emit finished(status == SyncFileItem::Success);
+    _finishedEmited = true;
+}
 
 int OwncloudPropagator::maximumActiveTransferJob()
 {
-    if (_downloadLimit.fetchAndAddAcquire(0) != 0
-        || _uploadLimit.fetchAndAddAcquire(0) != 0
-        || !_syncOptions._parallelNetworkJobs) {
-        // disable parallelism when there is a network limit.
+    // The bandwidth limits are shared fairly between the transfers by the
+    // BandwidthManager, they don't need to reduce the parallelism.
+    if (!_syncOptions._parallelNetworkJobs) {
         return 1;
     }
     return qMin(3, qCeil(hardMaximumActiveJob() / 2.));
@@ -94,22 +104,19 @@ int OwncloudPropagator::hardMaximumActiveJob()
 {
     if (!_syncOptions._parallelNetworkJobs)
         return 1;
-    static int max = qgetenv("OWNCLOUD_MAX_PARALLEL").toUInt();
-    if (max)
-        return max;
-    if (_account->isHttp2Supported())
-        return 20;
-    return 6; // (Qt cannot do more anyway)
+    return _account->transferScheduler()->slotLimit(this);
 }
 
-PropagateItemJob::~PropagateItemJob()
+int OwncloudPropagator::maximumIoThreadCount()
 {
-    if (auto p = propagator()) {
-        // Normally, every job should clean itself from the _activeJobList. So this should not be
-        // needed. But if a job has a bug or is deleted before the network jobs signal get received,
-        // we might risk end up with dangling pointer in the list which may cause crashes.
-        p->_activeJobList.removeAll(this);
-    }
+    static int max = [] {
+        int env = qgetenv("OWNCLOUD_MAX_IO_THREADS").toInt();
+        if (env > 0)
+            return env;
+        // More threads than that mostly compete for the same disk
+        return qBound(2, QThread::idealThreadCount(), 4);
+    }();
+    return max;
 }
 
 static qint64 getMinBlacklistTime()
@@ -391,6 +398,9 @@ PropagateItemJob *OwncloudPropagator::createJob(const SyncFileItemPtr &item)
             if (item->_size > syncOptions()._initialChunkSize && account()->capabilities().chunkingNg()) {
                 // Item is above _initialChunkSize, thus will be classified as to be chunked
                 job = new PropagateUploadFileNG(this, item);
+            } else if (item->_size < smallFileSize() && account()->capabilities().bulkUpload()) {
+                // Small files are sent together with other small files
+                job = new PropagateUploadFileBulk(this, item);
             } else {
                 job = new PropagateUploadFileV1(this, item);
             }
@@ -427,6 +437,7 @@ void OwncloudPropagator::start(const SyncFileItemVector &items)
      * In order to do that we loop over the items. (which are sorted by destination)
      * When we enter a directory, we can create the directory job and push it on the stack. */
 
+    _account->transferScheduler()->registerPropagator(this, _syncOptions._interactive);
     _rootJob.reset(new PropagateDirectory(this));
     QStack<QPair<QString /* directory name */, PropagateDirectory * /* job */>> directories;
     directories.push(qMakePair(QString(), _rootJob.data()));
@@ -654,38 +665,156 @@ QString OwncloudPropagator::getFilePath(const QString &tmp_file_name) const
 
 void OwncloudPropagator::scheduleNextJob()
 {
+    // Many jobs finish in the same event loop iteration, one pass is enough for all of them
+    if (_jobScheduled)
+        return;
+    _jobScheduled = true;
     QTimer::singleShot(0, this, &OwncloudPropagator::scheduleNextJobImpl);
 }
 
 void OwncloudPropagator::scheduleNextJobImpl()
+{
+    _jobScheduled = false;
+
+    // Fill all the free slots at once. Jobs that finish right away don't take a slot,
+    // so stop after as many jobs as there are slots to give the event loop a chance.
+    for (int i = 0; i < hardMaximumActiveJob(); ++i) {
+        if (!scheduleJobIfSlotFree()) {
+            // Only keep our unused share reserved if we could use it
+            _account->transferScheduler()->setWaiting(this, _activeJobCount >= hardMaximumActiveJob());
+            return;
+        }
+    }
+    _account->transferScheduler()->setWaiting(this, true);
+    scheduleNextJob();
+}
+
+bool OwncloudPropagator::scheduleJobIfSlotFree()
 {
     // TODO: If we see that the automatic up-scaling has a bad impact we
     // need to check how to avoid this.
     // Down-scaling on slow networks? https://github.com/owncloud/client/issues/3382
     // Making sure we do up/down at same time? https://github.com/owncloud/client/issues/1633
 
-    if (_activeJobList.count() < maximumActiveTransferJob()) {
-        if (_rootJob->scheduleSelfOrChild()) {
-            scheduleNextJob();
+    if (_activeJobCount < maximumActiveTransferJob()) {
+        return _rootJob->scheduleSelfOrChild();
+    } else if (_activeJobCount < hardMaximumActiveJob()) {
+        if (_syncOptions._smallFileLane) {
+            // The remaining slots are reserved for small files, large ones have to wait
+            // until one of the first maximumActiveTransferJob() slots is free.
+            _scheduleSmallFilesOnly = true;
+            bool scheduled = _rootJob->scheduleSelfOrChild();
+            _scheduleSmallFilesOnly = false;
+            return scheduled;
         }
-    } else if (_activeJobList.count() < hardMaximumActiveJob()) {
+
         int likelyFinishedQuicklyCount = 0;
-        // NOTE: Only counts the first 3 jobs! Then for each
+        // NOTE: Only counts the first 3 slots! Then for each
         // one that is likely finished quickly, we can launch another one.
         // When a job finishes another one will "move up" to be one of the first 3 and then
         // be counted too.
-        for (int i = 0; i < maximumActiveTransferJob() && i < _activeJobList.count(); i++) {
-            if (_activeJobList.at(i)->isLikelyFinishedQuickly()) {
-                likelyFinishedQuicklyCount++;
+        int counted = 0;
+        for (auto job = _firstActiveJob; job && counted < maximumActiveTransferJob(); job = job->_activeNext) {
+            const int slots = qMin(job->_activeSlots, maximumActiveTransferJob() - counted);
+            if (job->isLikelyFinishedQuickly()) {
+                likelyFinishedQuicklyCount += slots;
             }
+            counted += slots;
         }
-        if (_activeJobList.count() < maximumActiveTransferJob() + likelyFinishedQuicklyCount) {
-            qCDebug(lcPropagator) << "Can pump in another request! activeJobs =" << _activeJobList.count();
-            if (_rootJob->scheduleSelfOrChild()) {
-                scheduleNextJob();
-            }
+        if (_activeJobCount < maximumActiveTransferJob() + likelyFinishedQuicklyCount) {
+            qCDebug(lcPropagator) << "Can pump in another request! activeJobs =" << _activeJobCount;
+            return _rootJob->scheduleSelfOrChild();
         }
     }
+    return false;
+}
+
+void OwncloudPropagator::addActiveJob(PropagatorJob *job)
+{
+    ++_activeJobCount;
+    _account->transferScheduler()->activeJobsChanged(this, false);
+    if (job->_activeSlots++ > 0)
+        return; // already in the list
+
+    job->_activePrev = _lastActiveJob;
+    job->_activeNext = 0;
+    if (_lastActiveJob) {
+        _lastActiveJob->_activeNext = job;
+    } else {
+        _firstActiveJob = job;
+    }
+    _lastActiveJob = job;
+}
+
+void OwncloudPropagator::removeActiveJob(PropagatorJob *job)
+{
+    if (job->_activeSlots == 0)
+        return;
+    --_activeJobCount;
+    _account->transferScheduler()->activeJobsChanged(this, true);
+    if (--job->_activeSlots > 0)
+        return;
+
+    if (job->_activePrev) {
+        job->_activePrev->_activeNext = job->_activeNext;
+    } else {
+        _firstActiveJob = job->_activeNext;
+    }
+    if (job->_activeNext) {
+        job->_activeNext->_activePrev = job->_activePrev;
+    } else {
+        _lastActiveJob = job->_activePrev;
+    }
+    job->_activePrev = job->_activeNext = 0;
+}
+
+void OwncloudPropagator::removeActiveJobSlots(PropagatorJob *job)
+{
+    while (job->_activeSlots > 0) {
+        removeActiveJob(job);
+    }
+}
+
+/** Whether the item is an upload or a download of a file */
+static bool isFileTransfer(const SyncFileItem &item)
+{
+    if (item.isDirectory())
+        return false;
+    switch (item._instruction) {
+    case CSYNC_INSTRUCTION_NEW:
+    case CSYNC_INSTRUCTION_SYNC:
+    case CSYNC_INSTRUCTION_CONFLICT:
+    case CSYNC_INSTRUCTION_TYPE_CHANGE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void OwncloudPropagator::prioritizeTasks(SyncFileItemVector &tasks)
+{
+    const auto policy = _syncOptions._schedulingPolicy;
+    if (policy == SyncOptions::SchedulingPolicy::PathOrder)
+        return;
+
+    // The other tasks stay in front: a transfer may depend on them, for example
+    // an upload to the path that a move is about to free up.
+    std::stable_sort(tasks.begin(), tasks.end(), [policy](const SyncFileItemPtr &a, const SyncFileItemPtr &b) {
+        const bool aIsTransfer = isFileTransfer(*a);
+        const bool bIsTransfer = isFileTransfer(*b);
+        if (aIsTransfer != bIsTransfer)
+            return bIsTransfer;
+        if (!aIsTransfer)
+            return false;
+        if (policy == SyncOptions::SchedulingPolicy::SmallestFirst)
+            return a->_size < b->_size;
+        return a->_modtime > b->_modtime;
+    });
+}
+
+bool OwncloudPropagator::isLargeTransfer(const SyncFileItem &item)
+{
+    return isFileTransfer(item) && item._size >= smallFileSize();
 }
 
 void OwncloudPropagator::reportProgress(const SyncFileItem &item, quint64 bytes)
@@ -698,6 +827,13 @@ AccountPtr OwncloudPropagator::account() const
     return _account;
 }
 
+BulkUploadQueue *OwncloudPropagator::bulkUploadQueue()
+{
+    if (!_bulkUploadQueue)
+        _bulkUploadQueue = new BulkUploadQueue(this);
+    return _bulkUploadQueue;
+}
+
 OwncloudPropagator::DiskSpaceResult OwncloudPropagator::diskSpaceCheck() const
 {
     const qint64 freeBytes = Utility::freeDiskSpace(_localDir);
@@ -724,6 +860,16 @@ PropagatorJob::PropagatorJob(OwncloudPropagator *propagator)
 {
 }
 
+PropagatorJob::~PropagatorJob()
+{
+    if (auto p = propagator()) {
+        // Normally, every job should clean itself from the active jobs. So this should not be
+        // needed. But if a job has a bug or is deleted before the network jobs signal get received,
+        // we might risk end up with dangling pointer in the list which may cause crashes.
+        p->removeActiveJobSlots(this);
+    }
+}
+
 OwncloudPropagator *PropagatorJob::propagator() const
 {
     return qobject_cast<OwncloudPropagator *>(parent());
@@ -762,6 +908,11 @@ bool PropagatorCompositeJob::scheduleSelfOrChild()
     // Start the composite job
     if (_state == NotYetStarted) {
         _state = Running;
+        propagator()->prioritizeTasks(_tasksToDo);
+        foreach (const auto &task, _tasksToDo) {
+            queueTask(task);
+        }
+        _tasksToDo.clear();
     }
 
     // Ask all the running composite jobs if they have something new to schedule.
@@ -787,9 +938,16 @@ bool PropagatorCompositeJob::scheduleSelfOrChild()
         _runningJobs.append(nextJob);
         return possiblyRunNextJob(nextJob);
     }
-    while (!_tasksToDo.isEmpty()) {
-        SyncFileItemPtr nextTask = _tasksToDo.first();
-        _tasksToDo.remove(0);
+    for (;;) {
+        // The first task in order, but no large transfer while filling the small file lane
+        QQueue<QPair<int, SyncFileItemPtr>> *queue = _smallTasks.isEmpty() ? 0 : &_smallTasks;
+        if (!_largeTasks.isEmpty() && !propagator()->schedulingSmallFilesOnly()
+            && (!queue || _largeTasks.head().first < queue->head().first)) {
+            queue = &_largeTasks;
+        }
+        if (!queue)
+            break;
+        SyncFileItemPtr nextTask = queue->dequeue().second;
         PropagatorJob *job = propagator()->createJob(nextTask);
         if (!job) {
             qCWarning(lcDirectory) << "Useless task found for file" << nextTask->destination() << "instruction" << nextTask->_instruction;
@@ -802,7 +960,7 @@ bool PropagatorCompositeJob::scheduleSelfOrChild()
 
     // If neither us or our children had stuff left to do we could hang. Make sure
     // we mark this job as finished so that the propagator can schedule a new one.
-    if (_jobsToDo.isEmpty() && _tasksToDo.isEmpty() && _runningJobs.isEmpty()) {
+    if (_jobsToDo.isEmpty() && !hasTasksToDo() && _runningJobs.isEmpty()) {
         // Our parent jobs are already iterating over their running jobs, post to the event loop
         // to avoid removing ourself from that list while they iterate.
         QMetaObject::invokeMethod(this, "finalize", Qt::QueuedConnection);
@@ -810,6 +968,12 @@ bool PropagatorCompositeJob::scheduleSelfOrChild()
     return false;
 }
 
+void PropagatorCompositeJob::queueTask(const SyncFileItemPtr &item)
+{
+    auto &queue = propagator()->isLargeTransfer(*item) ? _largeTasks : _smallTasks;
+    queue.enqueue(qMakePair(_queuedTaskCount++, item));
+}
+
 void PropagatorCompositeJob::slotSubJobFinished(SyncFileItem::Status status)
 {
     PropagatorJob *subJob = static_cast<PropagatorJob *>(sender());
@@ -828,7 +992,7 @@ void PropagatorCompositeJob::slotSubJobFinished(SyncFileItem::Status status)
         _hasError = status;
     }
 
-    if (_jobsToDo.isEmpty() && _tasksToDo.isEmpty() && _runningJobs.isEmpty()) {
+    if (_jobsToDo.isEmpty() && !hasTasksToDo() && _runningJobs.isEmpty()) {
         finalize();
     } else {
         propagator()->scheduleNextJob();
@@ -24,6 +24,8 @@
 #include <QPointer>
 #include <QIODevice>
 #include <QMutex>
+#include <QThreadPool>
+#include <QQueue>
 
 #include "csync_util.h"
 #include "syncfileitem.h"
@@ -49,6 +51,7 @@ qint64 freeSpaceLimit();
 
 class SyncJournalDb;
 class OwncloudPropagator;
+class BulkUploadQueue;
 
 /**
  * @brief the base class of propagator jobs
@@ -64,6 +67,7 @@ class PropagatorJob : public QObject
 
 public:
     explicit PropagatorJob(OwncloudPropagator *propagator);
+    ~PropagatorJob();
 
     enum AbortType {
         Synchronous,
@@ -102,6 +106,9 @@ public:
      */
     virtual qint64 committedDiskSpace() const { return 0; }
 
+    /** The number of active job slots this job currently occupies */
+    int activeSlots() const { return _activeSlots; }
+
 public slots:
     /*
      * Asynchronous abort requires emit of abortFinished() signal,
@@ -128,6 +135,13 @@ signals:
     void abortFinished(SyncFileItem::Status status = SyncFileItem::NormalError);
 protected:
     OwncloudPropagator *propagator() const;
+
+private:
+    // Links and slot count for the propagator's list of active jobs, see OwncloudPropagator::addActiveJob()
+    friend class OwncloudPropagator;
+    PropagatorJob *_activePrev = 0;
+    PropagatorJob *_activeNext = 0;
+    int _activeSlots = 0;
 };
 
 /*
@@ -167,8 +181,6 @@ public:
         , _item(item)
     {
     }
-    ~PropagateItemJob();
-
     bool scheduleSelfOrChild() Q_DECL_OVERRIDE
     {
         if (_state != NotYetStarted) {
@@ -197,7 +209,7 @@ class PropagatorCompositeJob : public PropagatorJob
     Q_OBJECT
 public:
     QVector<PropagatorJob *> _jobsToDo;
-    SyncFileItemVector _tasksToDo;
+    SyncFileItemVector _tasksToDo; // until the job starts, then they are queued below
     QVector<PropagatorJob *> _runningJobs;
     SyncFileItem::Status _hasError; // NoStatus,  or NormalError / SoftError if there was an error
     quint64 _abortsCount;
@@ -220,7 +232,16 @@ public:
     }
     void appendTask(const SyncFileItemPtr &item)
     {
-        _tasksToDo.append(item);
+        if (_state == NotYetStarted) {
+            _tasksToDo.append(item);
+        } else {
+            queueTask(item);
+        }
+    }
+
+    bool hasTasksToDo() const
+    {
+        return !_tasksToDo.isEmpty() || !_smallTasks.isEmpty() || !_largeTasks.isEmpty();
     }
 
     virtual bool scheduleSelfOrChild() Q_DECL_OVERRIDE;
@@ -249,6 +270,16 @@ public:
 
     qint64 committedDiskSpace() const Q_DECL_OVERRIDE;
 
+private:
+    void queueTask(const SyncFileItemPtr &item);
+
+    // The started tasks in the order they are started, with their position in
+    // that order. The large transfers are kept apart, so that filling the
+    // small file lane doesn't need to look through them.
+    QQueue<QPair<int, SyncFileItemPtr>> _smallTasks;
+    QQueue<QPair<int, SyncFileItemPtr>> _largeTasks;
+    int _queuedTaskCount = 0;
+
 private slots:
     void slotSubJobAbortFinished();
     bool possiblyRunNextJob(PropagatorJob *next)
@@ -365,6 +396,7 @@ public:
         , _account(account)
     {
         qRegisterMetaType<PropagatorJob::AbortType>("PropagatorJob::AbortType");
+        _ioThreadPool.setMaxThreadCount(maximumIoThreadCount());
     }
 
     ~OwncloudPropagator();
@@ -380,13 +412,34 @@ public:
 
     QAtomicInt _abortRequested; // boolean set by the main thread to abort.
 
-    /** The list of currently active jobs.
-        This list contains the jobs that are currently using ressources and is used purely to
-        know how many jobs there is currently running for the scheduler.
-        Jobs add themself to the list when they do an assynchronous operation.
-        Jobs can be several time on the list (example, when several chunks are uploaded in parallel)
+    /** Thread pool for the blocking local file system work of the jobs
+     *
+     * Jobs run their removals, renames and similar operations there and
+     * process the result in the main thread, so the UI and the network jobs
+     * are not blocked meanwhile.
+     */
+    QThreadPool *ioThreadPool() { return &_ioThreadPool; }
+
+    /** The number of threads of ioThreadPool() (env OWNCLOUD_MAX_IO_THREADS) */
+    static int maximumIoThreadCount();
+
+    /** Accounting of the currently active jobs.
+     *
+     * Active jobs are the jobs that are currently using ressources; this is used purely
+     * to know how many jobs there is currently running for the scheduler.
+     * Jobs add themself when they do an assynchronous operation and remove themself when
+     * it is done. A job can take several slots (example, when several chunks are uploaded
+     * in parallel), removeActiveJob() releases one of them.
+     *
+     * The jobs are kept in an intrusive list in the order they became active, so
+     * adding and removing is O(1).
      */
-    QList<PropagateItemJob *> _activeJobList;
+    void addActiveJob(PropagatorJob *job);
+    void removeActiveJob(PropagatorJob *job);
+    /** Releases all the slots of the job, e.g. when it is destroyed */
+    void removeActiveJobSlots(PropagatorJob *job);
+    /** The number of slots taken by all active jobs */
+    int activeJobCount() const { return _activeJobCount; }
 
     /** We detected that another sync is required after this one */
     bool _anotherSyncNeeded;
@@ -416,7 +469,11 @@ public:
     quint64 _chunkSize;
     quint64 smallFileSize();
 
-    /* The maximum number of active jobs in parallel  */
+    /* The maximum number of active jobs in parallel
+     *
+     * The propagators of concurrent syncs of the account share the budget,
+     * see TransferScheduler.
+     */
     int hardMaximumActiveJob();
 
     bool isInSharedDirectory(const QString &file);
@@ -441,8 +498,28 @@ public:
 
     PropagateItemJob *createJob(const SyncFileItemPtr &item);
     void scheduleNextJob();
+
+    /** Orders the tasks of a directory according to SyncOptions::_schedulingPolicy.
+     *
+     * Called once when the directory job starts. Tasks that are not transfers
+     * (removals, moves, metadata updates) keep their order and stay in front.
+     */
+    void prioritizeTasks(SyncFileItemVector &tasks);
+
+    /** Whether the item is a transfer that may not use the small file lane */
+    bool isLargeTransfer(const SyncFileItem &item);
+
+    /** Whether only the tasks that aren't large transfers may be started right now,
+     * set while the small file lane is being filled */
+    bool schedulingSmallFilesOnly() const { return _scheduleSmallFilesOnly; }
     void reportProgress(const SyncFileItem &, quint64 bytes);
 
+    /** The queue collecting small uploads that are sent in multi-file requests.
+     *
+     * Created on first use.
+     */
+    BulkUploadQueue *bulkUploadQueue();
+
     void abort()
     {
         bool alreadyAborting = _abortRequested.fetchAndStoreOrdered(true);
@@ -490,12 +567,7 @@ private slots:
     }
 
     /** Emit the finished signal and make sure it is only emitted once */
-    void emitFinished(SyncFileItem::Status status)
-    {
-        if (!_finishedEmited)
-            emit finished(status == SyncFileItem::Success);
-        _finishedEmited = true;
-    }
+    void emitFinished(SyncFileItem::Status status);
 
     void scheduleNextJobImpl();
 
@@ -521,6 +593,17 @@ private:
     AccountPtr _account;
     QScopedPointer<PropagateDirectory> _rootJob;
     SyncOptions _syncOptions;
+    QThreadPool _ioThreadPool;
+    QPointer<BulkUploadQueue> _bulkUploadQueue;
+    bool _scheduleSmallFilesOnly = false; // set while filling the small file lane
+    bool _jobScheduled = false; // a call to scheduleNextJobImpl() is pending
+
+    PropagatorJob *_firstActiveJob = 0;
+    PropagatorJob *_lastActiveJob = 0;
+    int _activeJobCount = 0;
+
+    /** Starts the next job if there is a free slot, returns whether one was started */
+    bool scheduleJobIfSlotFree();
 };
 
 
@@ -128,6 +128,11 @@ void ProgressDispatcher::setProgressInfo(const QString &folder, const ProgressIn
     emit progressInfo(folder, progress);
 }
 
+void ProgressDispatcher::setTransferShares(Account *account, const QVector<TransferShare> &shares)
+{
+    emit transferSharesChanged(account, shares);
+}
+
 ProgressInfo::ProgressInfo()
 {
     connect(&_updateEstimatesTimer, &QTimer::timeout, this, &ProgressInfo::updateEstimates);
@@ -22,11 +22,14 @@
 #include <QQueue>
 #include <QElapsedTimer>
 #include <QTimer>
+#include <QVector>
 
 #include "syncfileitem.h"
 
 namespace OCC {
 
+class Account;
+
 /**
  * @brief The ProgressInfo class
  * @ingroup libsync
@@ -258,6 +261,19 @@ enum class ErrorCategory {
     InsufficientRemoteStorage,
 };
 
+/**
+ * @brief The part of the parallel network jobs of an account used by one sync
+ *
+ * See TransferScheduler and ProgressDispatcher::transferSharesChanged.
+ */
+struct TransferShare
+{
+    QString _localPath; // the local directory of the syncing folder
+    bool _interactive = false;
+    int _activeJobs = 0;
+    int _slotLimit = 0;
+};
+
 /**
  * @file progressdispatcher.h
  * @brief A singleton class to provide sync progress information to other gui classes.
@@ -272,6 +288,7 @@ class OWNCLOUDSYNC_EXPORT ProgressDispatcher : public QObject
     Q_OBJECT
 
     friend class Folder; // only allow Folder class to access the setting slots.
+    friend class TransferScheduler;
 public:
     static ProgressDispatcher *instance();
     ~ProgressDispatcher();
@@ -295,8 +312,16 @@ signals:
      */
     void syncError(const QString &folder, const QString &message, ErrorCategory category);
 
+    /**
+     * @brief How the syncs of the account currently share its network jobs.
+     *
+     * Emitted at most once per event loop iteration while the shares change.
+     */
+    void transferSharesChanged(Account *account, const QVector<TransferShare> &shares);
+
 protected:
     void setProgressInfo(const QString &folder, const ProgressInfo &progress);
+    void setTransferShares(Account *account, const QVector<TransferShare> &shares);
 
 private:
     ProgressDispatcher(QObject *parent = 0);
@@ -305,4 +330,6 @@ private:
     static ProgressDispatcher *_instance;
 };
 }
+Q_DECLARE_METATYPE(OCC::TransferShare)
+
 #endif // PROGRESSDISPATCHER_H
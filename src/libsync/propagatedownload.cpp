@@ -29,6 +29,7 @@
 #include <QNetworkAccessManager>
 #include <QFileInfo>
 #include <QDir>
+#include <QtConcurrent>
 #include <cmath>
 
 #ifdef Q_OS_UNIX
@@ -40,6 +41,10 @@ namespace OCC {
 Q_LOGGING_CATEGORY(lcGetJob, "sync.networkjob.get", QtInfoMsg)
 Q_LOGGING_CATEGORY(lcPropagateDownload, "sync.propagator.download", QtInfoMsg)
 
+// The body is written in blocks of this size, aligned to it within the file.
+// These are the blocks of the block checksums, computed as they are written.
+static const qint64 writeBlockSize = blockChecksumSize;
+
 // Always coming in with forward slashes.
 // In csync_excluded_no_ctx we ignore all files with longer than 254 chars
 // This function also adds a dot at the beginning of the filename to hide the file on OS X and Linux
@@ -75,9 +80,6 @@ GETFileJob::GETFileJob(AccountPtr account, const QString &path, QFile *device,
     , _expectedEtagForResume(expectedEtagForResume)
     , _resumeStart(resumeStart)
     , _errorStatus(SyncFileItem::NoStatus)
-    , _bandwidthLimited(false)
-    , _bandwidthChoked(false)
-    , _bandwidthQuota(0)
     , _bandwidthManager(0)
     , _hasEmittedFinishedSignal(false)
     , _lastModified()
@@ -95,9 +97,6 @@ GETFileJob::GETFileJob(AccountPtr account, const QUrl &url, QFile *device,
     , _resumeStart(resumeStart)
     , _errorStatus(SyncFileItem::NoStatus)
     , _directDownloadUrl(url)
-    , _bandwidthLimited(false)
-    , _bandwidthChoked(false)
-    , _bandwidthQuota(0)
     , _bandwidthManager(0)
     , _hasEmittedFinishedSignal(false)
     , _lastModified()
@@ -107,8 +106,12 @@ GETFileJob::GETFileJob(AccountPtr account, const QUrl &url, QFile *device,
 
 void GETFileJob::start()
 {
-    if (_resumeStart > 0) {
-        _headers["Range"] = "bytes=" + QByteArray::number(_resumeStart) + '-';
+    if (_resumeStart > 0 || _rangeEnd >= 0) {
+        QByteArray range = "bytes=" + QByteArray::number(_resumeStart) + '-';
+        if (_rangeEnd >= 0) {
+            range += QByteArray::number(_rangeEnd);
+        }
+        _headers["Range"] = range;
         _headers["Accept-Ranges"] = "bytes";
         qCDebug(lcGetJob) << "Retry with range " << _headers["Range"];
     }
@@ -127,7 +130,6 @@ void GETFileJob::start()
         sendRequest("GET", _directDownloadUrl, req);
     }
 
-    qCDebug(lcGetJob) << _bandwidthManager << _bandwidthChoked << _bandwidthLimited;
     if (_bandwidthManager) {
         _bandwidthManager->registerDownloadJob(this);
     }
@@ -141,6 +143,24 @@ void GETFileJob::start()
     AbstractNetworkJob::start();
 }
 
+bool GETFileJob::finished()
+{
+    if (reply()->bytesAvailable()) {
+        return false;
+    } else {
+        if (_bandwidthManager) {
+            _bandwidthManager->unregisterDownloadJob(this);
+        }
+        if (!_hasEmittedFinishedSignal) {
+            // Also after errors: what was received is kept for resuming
+            flushWriteBuffer();
+            emit finishedSignal();
+        }
+        _hasEmittedFinishedSignal = true;
+        return true; // discard
+    }
+}
+
 void GETFileJob::newReplyHook(QNetworkReply *reply)
 {
     reply->setReadBufferSize(16 * 1024); // keep low so we can easier limit the bandwidth
@@ -201,6 +221,14 @@ void GETFileJob::slotMetaDataChanged()
             start = rx.cap(1).toULongLong();
         }
     }
+    if (ranges.isEmpty() && _rangeEnd >= 0) {
+        // The whole body would overwrite the rest of the file
+        qCWarning(lcGetJob) << "No content-range for the range" << _resumeStart << _rangeEnd;
+        _errorString = tr("Server does not support partial downloads");
+        _errorStatus = SyncFileItem::NormalError;
+        reply()->abort();
+        return;
+    }
     if (start != _resumeStart) {
         qCWarning(lcGetJob) << "Wrong content-range: " << ranges << " while expecting start was" << _resumeStart;
         if (ranges.isEmpty()) {
@@ -227,6 +255,32 @@ void GETFileJob::slotMetaDataChanged()
     }
 
     _saveBodyToFile = true;
+
+    // Reserve the space for the body, it is written in large blocks (see slotReadyRead())
+    const qint64 contentLength = reply()->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+    if (contentLength > 0 && !FileSystem::preallocate(_device, _resumeStart, contentLength)) {
+        qCDebug(lcGetJob) << "Could not preallocate" << contentLength << "bytes for" << _device->fileName();
+    }
+    _writeBuffer.resize(contentLength > 0 ? qBound(16 * 1024ll, contentLength, writeBlockSize) : writeBlockSize);
+    _writeBufferUsed = 0;
+    _writeBufferOffset = _resumeStart;
+
+    static bool dropWrittenData = [] {
+        return qgetenv("OWNCLOUD_DOWNLOAD_DROP_CACHE").toInt() != 0;
+    }();
+    _dropWrittenData = dropWrittenData;
+
+    // The checksums are only meaningful for the whole file
+    _checksum.reset();
+    _blockChecksums.clear();
+    _blockChecksumsValid = _computeBlockChecksums && _resumeStart == 0 && _rangeEnd < 0;
+    if (_resumeStart == 0 && _rangeEnd < 0) {
+        if (_checksumType == checkSumSHA1C) {
+            _checksum.reset(new QCryptographicHash(QCryptographicHash::Sha1));
+        } else if (_checksumType == checkSumMD5C) {
+            _checksum.reset(new QCryptographicHash(QCryptographicHash::Md5));
+        }
+    }
 }
 
 void GETFileJob::setBandwidthManager(BandwidthManager *bwm)
@@ -234,56 +288,86 @@ void GETFileJob::setBandwidthManager(BandwidthManager *bwm)
     _bandwidthManager = bwm;
 }
 
-void GETFileJob::setChoked(bool c)
+QByteArray GETFileJob::checksumHeader() const
 {
-    _bandwidthChoked = c;
-    QMetaObject::invokeMethod(this, "slotReadyRead", Qt::QueuedConnection);
+    if (!_checksum)
+        return QByteArray();
+    return makeChecksumHeader(_checksumType, _checksum->result().toHex());
 }
 
-void GETFileJob::setBandwidthLimited(bool b)
+QByteArray GETFileJob::blockChecksums() const
 {
-    _bandwidthLimited = b;
-    QMetaObject::invokeMethod(this, "slotReadyRead", Qt::QueuedConnection);
+    if (!_blockChecksumsValid)
+        return QByteArray();
+    return _blockChecksums;
 }
 
-void GETFileJob::giveBandwidthQuota(qint64 q)
+qint64 GETFileJob::currentDownloadPosition()
 {
-    _bandwidthQuota = q;
-    qCDebug(lcGetJob) << "Got" << q << "bytes";
-    QMetaObject::invokeMethod(this, "slotReadyRead", Qt::QueuedConnection);
+    if (_saveBodyToFile) {
+        return _writeBufferOffset + _writeBufferUsed;
+    }
+    return _resumeStart;
 }
 
-qint64 GETFileJob::currentDownloadPosition()
+bool GETFileJob::flushWriteBuffer()
 {
-    if (_device && _device->pos() > 0 && _device->pos() > qint64(_resumeStart)) {
-        return _device->pos();
+    if (_writeBufferUsed == 0 || !_device->isOpen()) {
+        _writeBufferUsed = 0;
+        return true;
     }
-    return _resumeStart;
+    qint64 w = _device->write(_writeBuffer.constData(), _writeBufferUsed);
+    if (w != _writeBufferUsed) {
+        _errorString = _device->errorString();
+        _errorStatus = SyncFileItem::NormalError;
+        qCWarning(lcGetJob) << "Error while writing to file" << w << _writeBufferUsed << _errorString;
+        _writeBufferUsed = 0;
+        return false;
+    }
+    if (_blockChecksumsValid) {
+        // Each flush is one whole block, except for the last one of the file
+        if (_writeBufferOffset == _blockChecksums.size() / 16 * blockChecksumSize) {
+            _blockChecksums += QCryptographicHash::hash(
+                QByteArray::fromRawData(_writeBuffer.constData(), _writeBufferUsed), QCryptographicHash::Md5);
+        } else {
+            _blockChecksumsValid = false;
+        }
+    }
+    if (_dropWrittenData) {
+        FileSystem::dropWrittenData(_device, _writeBufferOffset, _writeBufferUsed);
+    }
+    _writeBufferOffset += _writeBufferUsed;
+    _writeBufferUsed = 0;
+    return true;
 }
 
 void GETFileJob::slotReadyRead()
 {
     if (!reply())
         return;
-    int bufferSize = qMin(1024 * 8ll, reply()->bytesAvailable());
-    QByteArray buffer(bufferSize, Qt::Uninitialized);
+    const bool saveBody = _device->isOpen() && _saveBodyToFile;
+    if (_writeBuffer.isEmpty()) {
+        // A body that is not saved is read and dropped
+        _writeBuffer.resize(16 * 1024);
+    }
 
+    // The data goes into _writeBuffer which is written to the file
+    // whenever it reaches a multiple of writeBlockSize: few large writes
+    // instead of many small ones.
     while (reply()->bytesAvailable() > 0) {
-        if (_bandwidthChoked) {
-            qCWarning(lcGetJob) << "Download choked";
-            break;
-        }
-        qint64 toRead = bufferSize;
-        if (_bandwidthLimited) {
-            toRead = qMin(qint64(bufferSize), _bandwidthQuota);
+        const qint64 blockEnd = qMin<qint64>(_writeBuffer.size(),
+            writeBlockSize - _writeBufferOffset % writeBlockSize);
+        qint64 toRead = qMin(blockEnd - _writeBufferUsed, reply()->bytesAvailable());
+        if (_bandwidthManager) {
+            toRead = _bandwidthManager->downloadBucket()->take(this, toRead);
             if (toRead == 0) {
-                qCWarning(lcGetJob) << "Out of quota";
+                // Out of quota, the bucket calls us again once it is refilled
                 break;
             }
-            _bandwidthQuota -= toRead;
         }
 
-        qint64 r = reply()->read(buffer.data(), toRead);
+        char *data = _writeBuffer.data() + _writeBufferUsed;
+        qint64 r = reply()->read(data, toRead);
         if (r < 0) {
             _errorString = networkReplyErrorString(*reply());
             _errorStatus = SyncFileItem::NormalError;
@@ -292,12 +376,12 @@ void GETFileJob::slotReadyRead()
             return;
         }
 
-        if (_device->isOpen() && _saveBodyToFile) {
-            qint64 w = _device->write(buffer.constData(), r);
-            if (w != r) {
-                _errorString = _device->errorString();
-                _errorStatus = SyncFileItem::NormalError;
-                qCWarning(lcGetJob) << "Error while writing to file" << w << r << _errorString;
+        if (saveBody) {
+            if (_checksum) {
+                _checksum->addData(data, r);
+            }
+            _writeBufferUsed += r;
+            if (_writeBufferUsed == blockEnd && !flushWriteBuffer()) {
                 reply()->abort();
                 return;
             }
@@ -315,6 +399,7 @@ void GETFileJob::slotReadyRead()
                              << (reply()->error() == QNetworkReply::NoError ? QLatin1String("") : errorString())
                              << reply()->rawHeader("Content-Range") << reply()->rawHeader("Content-Length");
 
+            flushWriteBuffer();
             emit finishedSignal();
         }
         _hasEmittedFinishedSignal = true;
@@ -345,7 +430,7 @@ void PropagateDownloadFile::start()
     if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
         return;
 
-    qCDebug(lcPropagateDownload) << _item->_file << propagator()->_activeJobList.count();
+    qCDebug(lcPropagateDownload) << _item->_file << propagator()->activeJobCount();
     _stopwatch.start();
 
     if (_deleteExisting) {
@@ -370,6 +455,7 @@ void PropagateDownloadFile::start()
         qCDebug(lcPropagateDownload) << _item->_file << "may not need download, computing checksum";
         auto computeChecksum = new ComputeChecksum(this);
         computeChecksum->setChecksumType(parseChecksumHeaderType(_item->_checksumHeader));
+        computeChecksum->setJournal(propagator()->_journal);
         connect(computeChecksum, &ComputeChecksum::done,
             this, &PropagateDownloadFile::conflictChecksumComputed);
         computeChecksum->start(propagator()->getFilePath(_item->_file));
@@ -381,7 +467,8 @@ void PropagateDownloadFile::start()
 
 void PropagateDownloadFile::conflictChecksumComputed(const QByteArray &checksumType, const QByteArray &checksum)
 {
-    if (makeChecksumHeader(checksumType, checksum) == _item->_checksumHeader) {
+    _localChecksumHeader = makeChecksumHeader(checksumType, checksum);
+    if (_localChecksumHeader == _item->_checksumHeader) {
         // No download necessary, just update fs and journal metadata
         qCDebug(lcPropagateDownload) << _item->_file << "remote and local checksum match";
 
@@ -480,6 +567,16 @@ void PropagateDownloadFile::startDownload()
         propagator()->_journal->commit("download file start");
     }
 
+    // Maybe the content is already here, e.g. after a copy on the server
+    if (_resumeStart == 0 && startLocalCopy()) {
+        return;
+    }
+
+    // Maybe most of the content is here already, in the previous version of the file
+    if (_resumeStart == 0 && startDeltaDownload()) {
+        return;
+    }
+
     QMap<QByteArray, QByteArray> headers;
 
     if (_item->_directDownloadUrl.isEmpty()) {
@@ -501,12 +598,322 @@ void PropagateDownloadFile::startDownload()
             &_tmpFile, headers, expectedEtagForResume, _resumeStart, this);
     }
     _job->setBandwidthManager(&propagator()->_bandwidthManager);
+    _job->setChecksumType(contentChecksumType());
+    _job->setComputeBlockChecksums(useBlockChecksums());
     connect(_job.data(), &GETFileJob::finishedSignal, this, &PropagateDownloadFile::slotGetFinished);
     connect(_job.data(), &GETFileJob::downloadProgress, this, &PropagateDownloadFile::slotDownloadProgress);
-    propagator()->_activeJobList.append(this);
+    propagator()->addActiveJob(this);
+    _job->start();
+}
+
+bool PropagateDownloadFile::startLocalCopy()
+{
+    if (_triedLocalCopy)
+        return false;
+    _triedLocalCopy = true;
+
+    // Weak checksums are not good enough to tell that the content is identical
+    if (_item->_size == 0 || _item->_checksumHeader.isEmpty()
+        || !csync_is_collision_safe_hash(_item->_checksumHeader)) {
+        return false;
+    }
+
+    QVector<LocalCopySource> sources;
+    const QByteArray file = _item->_file.toUtf8();
+    propagator()->_journal->getFileRecordsByChecksum(_item->_checksumHeader, [&](const SyncJournalFileRecord &rec) {
+        if (rec._type != SyncFileItem::File || rec._path == file || quint64(rec._fileSize) != _item->_size)
+            return;
+        LocalCopySource source;
+        source.path = propagator()->getFilePath(QString::fromUtf8(rec._path));
+        source.size = rec._fileSize;
+        source.modtime = rec._modtime;
+        sources.append(source);
+    });
+    if (sources.isEmpty())
+        return false;
+
+    qCInfo(lcPropagateDownload) << _item->_file << "has the checksum of" << sources.size()
+                                << "local file(s), trying to copy instead of downloading";
+    _tmpFile.close();
+    const QString tmpFileName = _tmpFile.fileName();
+    const QByteArray checksumHeader = _item->_checksumHeader;
+
+    propagator()->addActiveJob(this);
+    connect(&_localCopyWatcher, &QFutureWatcherBase::finished, this, &PropagateDownloadFile::slotLocalCopyDone);
+    _localCopyWatcher.setFuture(QtConcurrent::run(propagator()->ioThreadPool(), [=] {
+        return localCopyNow(sources, tmpFileName, checksumHeader);
+    }));
+    return true;
+}
+
+QString PropagateDownloadFile::localCopyNow(const QVector<LocalCopySource> &sources,
+    const QString &tmpFileName, const QByteArray &checksumHeader)
+{
+    QByteArray checksumType;
+    QByteArray checksum;
+    parseChecksumHeader(checksumHeader, &checksumType, &checksum);
+
+    foreach (const auto &source, sources) {
+        // The journal only knows the checksum of the content that was synced
+        if (FileSystem::fileChanged(source.path, source.size, source.modtime))
+            continue;
+
+        QString error;
+        if (!FileSystem::cloneFile(source.path, tmpFileName, &error)) {
+            qCInfo(lcPropagateDownload) << "Could not copy" << source.path << error;
+            continue;
+        }
+
+        // The source may have been modified while it was copied
+        if (ComputeChecksum::computeNow(tmpFileName, checksumType) == checksum)
+            return source.path;
+        qCInfo(lcPropagateDownload) << "The copy of" << source.path << "has an unexpected checksum";
+    }
+
+    // Don't leave a partial copy around, it would be resumed
+    FileSystem::remove(tmpFileName);
+    return QString();
+}
+
+void PropagateDownloadFile::slotLocalCopyDone()
+{
+    propagator()->removeActiveJob(this);
+    if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    const QString source = _localCopyWatcher.result();
+    if (source.isEmpty()) {
+        startDownload();
+        return;
+    }
+
+    qCInfo(lcPropagateDownload) << "Copied" << _item->_file << "from" << source;
+    propagator()->reportProgress(*_item, _item->_size);
+    downloadFinished();
+}
+
+bool PropagateDownloadFile::useBlockChecksums() const
+{
+    // Like for uploads, only for files that are large enough to be chunked
+    return propagator()->account()->capabilities().deltaSync()
+        && _item->_size > propagator()->syncOptions()._initialChunkSize;
+}
+
+bool PropagateDownloadFile::startDeltaDownload()
+{
+    if (_triedDeltaDownload)
+        return false;
+    _triedDeltaDownload = true;
+
+    if (!useBlockChecksums() || _item->_instruction != CSYNC_INSTRUCTION_SYNC
+        || !_item->_directDownloadUrl.isEmpty() || _deleteExisting) {
+        return false;
+    }
+
+    // The block checksums must be the ones of the synced local file
+    SyncJournalFileRecord record;
+    if (!propagator()->_journal->getFileRecord(_item->_file, &record) || !record.isValid()
+        || record._type != SyncFileItem::File) {
+        return false;
+    }
+    const auto base = propagator()->_journal->getBlockChecksums(_item->_file);
+    if (!base._valid || base._blockSize != blockChecksumSize || base._etag != record._etag
+        || FileSystem::fileChanged(propagator()->getFilePath(_item->_file), record._fileSize, record._modtime)) {
+        return false;
+    }
+    _deltaBaseChecksums = base._checksums;
+
+    qCInfo(lcPropagateDownload) << _item->_file << "has block checksums, fetching the ones of the new version";
+    auto job = new PropfindJob(propagator()->account(), propagator()->_remoteFolder + _item->_file, this);
+    job->setProperties(QList<QByteArray>() << "getetag"
+                                           << "http://owncloud.org/ns:blockchecksums");
+    connect(job, &PropfindJob::result, this, &PropagateDownloadFile::slotDeltaChecksumsFetched);
+    connect(job, &PropfindJob::finishedWithError, this, &PropagateDownloadFile::slotDeltaChecksumsFetchFailed);
+    propagator()->addActiveJob(this);
+    job->start();
+    return true;
+}
+
+void PropagateDownloadFile::slotDeltaChecksumsFetched(const QVariantMap &values)
+{
+    propagator()->removeActiveJob(this);
+    if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    const QByteArray etag = parseEtag(values.value("getetag").toByteArray().constData());
+    const QByteArray checksums = QByteArray::fromHex(values.value("blockchecksums").toByteArray());
+    const qint64 blockCount = (_item->_size + blockChecksumSize - 1) / blockChecksumSize;
+    if (etag != _item->_etag || checksums.size() != blockCount * 16) {
+        qCInfo(lcPropagateDownload) << "No block checksums for" << _item->_file << etag;
+        startFullDownload();
+        return;
+    }
+    _blockChecksums = checksums;
+    _deltaRanges = changedBlockRanges(checksums, _deltaBaseChecksums, _item->_size);
+    qCInfo(lcPropagateDownload) << "Delta download of" << _item->_file << "changed ranges:" << _deltaRanges;
+
+    // A partly reconstructed file can't be resumed like a partial download.
+    // With an etag that never matches the next attempt removes it.
+    auto pi = propagator()->_journal->getDownloadInfo(_item->_file);
+    pi._etag.clear();
+    propagator()->_journal->setDownloadInfo(_item->_file, pi);
+    propagator()->_journal->commit("delta download start");
+
+    _tmpFile.close();
+    const QString fn = propagator()->getFilePath(_item->_file);
+    const QString tmpFileName = _tmpFile.fileName();
+    const qint64 size = _item->_size;
+
+    propagator()->addActiveJob(this);
+    connect(&_deltaFileWatcher, &QFutureWatcherBase::finished, this, &PropagateDownloadFile::slotDeltaFilePrepared);
+    _deltaFileWatcher.setFuture(QtConcurrent::run(propagator()->ioThreadPool(), [=] {
+        return prepareDeltaFileNow(fn, tmpFileName, size);
+    }));
+}
+
+void PropagateDownloadFile::slotDeltaChecksumsFetchFailed()
+{
+    propagator()->removeActiveJob(this);
+    if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    startFullDownload();
+}
+
+QString PropagateDownloadFile::prepareDeltaFileNow(const QString &fn, const QString &tmpFileName, qint64 size)
+{
+    // The unchanged blocks are at the same offsets in the new version
+    QString error;
+    if (!FileSystem::cloneFile(fn, tmpFileName, &error)) {
+        return error;
+    }
+    QFile tmpFile(tmpFileName);
+    if (!tmpFile.resize(size)) {
+        return tmpFile.errorString();
+    }
+    return QString();
+}
+
+void PropagateDownloadFile::slotDeltaFilePrepared()
+{
+    propagator()->removeActiveJob(this);
+    if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    const QString error = _deltaFileWatcher.result();
+    if (!error.isEmpty() || !_tmpFile.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+        qCInfo(lcPropagateDownload) << "Could not prepare the delta download of" << _item->_file
+                                    << error << _tmpFile.errorString();
+        startFullDownload();
+        return;
+    }
+
+    _deltaProgress = _item->_size;
+    foreach (const auto &range, _deltaRanges) {
+        _deltaProgress -= range.second;
+    }
+    propagator()->reportProgress(*_item, _deltaProgress);
+    startNextDeltaRange();
+}
+
+void PropagateDownloadFile::startNextDeltaRange()
+{
+    if (_deltaRanges.isEmpty()) {
+        // The local file may have changed while it was copied
+        _tmpFile.close();
+        const QString tmpFileName = _tmpFile.fileName();
+        propagator()->addActiveJob(this);
+        connect(&_deltaVerifyWatcher, &QFutureWatcherBase::finished, this, &PropagateDownloadFile::slotDeltaFileVerified);
+        _deltaVerifyWatcher.setFuture(QtConcurrent::run(propagator()->ioThreadPool(), [tmpFileName] {
+            return computeBlockChecksums(tmpFileName);
+        }));
+        return;
+    }
+
+    const auto range = _deltaRanges.first();
+    if (!_tmpFile.seek(range.first)) {
+        startFullDownload();
+        return;
+    }
+    // Resuming with the etag makes sure that all ranges are of the same version
+    _job = new GETFileJob(propagator()->account(),
+        propagator()->_remoteFolder + _item->_file,
+        &_tmpFile, QMap<QByteArray, QByteArray>(), _item->_etag, range.first, this);
+    _job->setRangeEnd(range.first + range.second - 1);
+    _job->setBandwidthManager(&propagator()->_bandwidthManager);
+    connect(_job.data(), &GETFileJob::finishedSignal, this, &PropagateDownloadFile::slotDeltaRangeFinished);
+    connect(_job.data(), &GETFileJob::downloadProgress, this, &PropagateDownloadFile::slotDownloadProgress);
+    propagator()->addActiveJob(this);
     _job->start();
 }
 
+void PropagateDownloadFile::slotDeltaRangeFinished()
+{
+    propagator()->removeActiveJob(this);
+
+    GETFileJob *job = qobject_cast<GETFileJob *>(sender());
+    ASSERT(job);
+
+    const auto range = _deltaRanges.takeFirst();
+    QNetworkReply::NetworkError err = job->reply()->error();
+    if (err != QNetworkReply::NoError || job->errorStatus() != SyncFileItem::NoStatus
+        || job->currentDownloadPosition() != range.first + range.second) {
+        if (propagator()->_abortRequested.fetchAndAddRelaxed(0)) {
+            _tmpFile.close();
+            FileSystem::remove(_tmpFile.fileName());
+            done(SyncFileItem::SoftError, job->errorString());
+            return;
+        }
+        qCInfo(lcPropagateDownload) << "Delta download of" << _item->_file << "failed, downloading the whole file"
+                                    << job->errorString();
+        startFullDownload();
+        return;
+    }
+
+    if (job->lastModified()) {
+        _item->_modtime = job->lastModified();
+    }
+    _item->_responseTimeStamp = job->responseTimestamp();
+    _deltaProgress += range.second;
+    _downloadProgress = 0;
+    startNextDeltaRange();
+}
+
+void PropagateDownloadFile::slotDeltaFileVerified()
+{
+    propagator()->removeActiveJob(this);
+    if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    if (_deltaVerifyWatcher.result() != _blockChecksums) {
+        qCWarning(lcPropagateDownload) << "The delta download of" << _item->_file
+                                       << "has unexpected block checksums, downloading the whole file";
+        startFullDownload();
+        return;
+    }
+    qCInfo(lcPropagateDownload) << "Reconstructed" << _item->_file << "with a delta download";
+    propagator()->reportProgress(*_item, _item->_size);
+
+    // Validated like any other download, with the checksum from the discovery
+    ValidateChecksumHeader *validator = new ValidateChecksumHeader(this);
+    connect(validator, &ValidateChecksumHeader::validated,
+        this, &PropagateDownloadFile::transmissionChecksumValidated);
+    connect(validator, &ValidateChecksumHeader::validationFailed,
+        this, &PropagateDownloadFile::slotChecksumFail);
+    validator->start(_tmpFile.fileName(), _item->_checksumHeader);
+}
+
+void PropagateDownloadFile::startFullDownload()
+{
+    _tmpFile.close();
+    FileSystem::remove(_tmpFile.fileName());
+    _blockChecksums.clear();
+    _deltaRanges.clear();
+    _deltaProgress = 0;
+    _downloadProgress = 0;
+    startDownload();
+}
+
 qint64 PropagateDownloadFile::committedDiskSpace() const
 {
     if (_state == Running) {
@@ -523,7 +930,7 @@ void PropagateDownloadFile::setDeleteExistingFolder(bool enabled)
 const char owncloudCustomSoftErrorStringC[] = "owncloud-custom-soft-error-string";
 void PropagateDownloadFile::slotGetFinished()
 {
-    propagator()->_activeJobList.removeOne(this);
+    propagator()->removeActiveJob(this);
 
     GETFileJob *job = qobject_cast<GETFileJob *>(sender());
     ASSERT(job);
@@ -592,6 +999,11 @@ void PropagateDownloadFile::slotGetFinished()
         done(status, job->errorString());
         return;
     }
+    if (job->errorStatus() != SyncFileItem::NoStatus) {
+        // Writing the last block of the body failed
+        done(job->errorStatus(), job->errorString());
+        return;
+    }
 
     if (!job->etag().isEmpty()) {
         // The etag will be empty if we used a direct download URL.
@@ -608,6 +1020,8 @@ void PropagateDownloadFile::slotGetFinished()
     _tmpFile.close();
     _tmpFile.flush();
 
+    _blockChecksums = job->blockChecksums();
+
     /* Check that the size of the GET reply matches the file size. There have been cases
      * reported that if a server breaks behind a proxy, the GET is still a 200 but is
      * truncated, as described here: https://github.com/owncloud/mirall/issues/2528
@@ -651,12 +1065,31 @@ void PropagateDownloadFile::slotGetFinished()
     auto contentMd5Header = job->reply()->rawHeader(contentMd5HeaderC);
     if (checksumHeader.isEmpty() && !contentMd5Header.isEmpty())
         checksumHeader = "MD5:" + contentMd5Header;
+
+    // With the checksum computed while downloading there is no need to read the file again
+    const QByteArray downloadedChecksumHeader = job->checksumHeader();
+    if (!downloadedChecksumHeader.isEmpty()
+        && (checksumHeader.isEmpty() || parseChecksumHeaderType(checksumHeader) == parseChecksumHeaderType(downloadedChecksumHeader))) {
+        if (!checksumHeader.isEmpty() && checksumHeader != downloadedChecksumHeader) {
+            slotChecksumFail(tr("The downloaded file does not match the checksum, it will be resumed."));
+            return;
+        }
+        QByteArray checksumType;
+        QByteArray checksum;
+        parseChecksumHeader(downloadedChecksumHeader, &checksumType, &checksum);
+        transmissionChecksumValidated(checksumType, checksum);
+        return;
+    }
+
     validator->start(_tmpFile.fileName(), checksumHeader);
 }
 
 void PropagateDownloadFile::slotChecksumFail(const QString &errMsg)
 {
     FileSystem::remove(_tmpFile.fileName());
+    // Maybe it was reconstructed from the local file with bad block checksums:
+    // make sure the next attempt downloads the whole file.
+    propagator()->_journal->setBlockChecksums(_item->_file, SyncJournalDb::BlockChecksums());
     propagator()->_anotherSyncNeeded = true;
     done(SyncFileItem::SoftError, errMsg); // tr("The file downloaded with a broken checksum, will be redownloaded."));
 }
@@ -743,9 +1176,10 @@ namespace { // Anonymous namespace for the recall feature
             QString targetPath = makeRecallFileName(recalledFile);
 
             qCDebug(lcPropagateDownload) << "Copy recall file: " << recalledFile << " -> " << targetPath;
-            // Remove the target first, QFile::copy will not overwrite it.
-            FileSystem::remove(targetPath);
-            QFile::copy(recalledFile, targetPath);
+            QString error;
+            if (!FileSystem::cloneFile(recalledFile, targetPath, &error)) {
+                qCWarning(lcPropagateDownload) << "Could not copy recall file" << recalledFile << error;
+            }
         }
     }
 
@@ -799,64 +1233,156 @@ void PropagateDownloadFile::downloadFinished()
         return;
     }
 
+    // The file will be replaced from the io thread pool
+    emit propagator()->touchedFile(fn);
+
+    const QString tmpFileName = _tmpFile.fileName();
+    const bool checkConflict = _item->_instruction == CSYNC_INSTRUCTION_CONFLICT;
+    QByteArray localChecksumHeader = _localChecksumHeader;
+    const QByteArray downloadedChecksumHeader = _item->_checksumHeader;
+    if (checkConflict) {
+        // The journal is only used from this thread: a checksum of the existing
+        // file from its cache saves reading it in the io thread
+        const QByteArray type = parseChecksumHeaderType(downloadedChecksumHeader);
+        FileSystem::FileIdentity identity;
+        if (!type.isEmpty() && parseChecksumHeaderType(localChecksumHeader) != type
+            && FileSystem::getFileIdentity(fn, &identity)) {
+            const QByteArray cached = propagator()->_journal->getCachedChecksum(identity, type);
+            if (!cached.isEmpty())
+                localChecksumHeader = makeChecksumHeader(type, cached);
+        }
+    }
+    const time_t modtime = _item->_modtime;
+    const qint64 expectedSize = _item->_previousSize;
+    const time_t expectedMtime = _item->_previousModtime;
+    const bool readOnly = !_item->_remotePerm.isNull() && !_item->_remotePerm.hasPermission(RemotePermissions::CanWrite);
+
+    propagator()->addActiveJob(this);
+    connect(&_installWatcher, &QFutureWatcherBase::finished, this, &PropagateDownloadFile::slotInstallDone);
+    _installWatcher.setFuture(QtConcurrent::run(propagator()->ioThreadPool(), [=] {
+        return installNow(fn, tmpFileName, checkConflict, localChecksumHeader, downloadedChecksumHeader,
+            modtime, expectedSize, expectedMtime, readOnly);
+    }));
+}
+
+/**
+ * Whether the existing file has the content of the downloaded one.
+ *
+ * Known checksums avoid reading both files: \a downloadedChecksumHeader is the
+ * checksum of the downloaded file and \a localChecksumHeader may be one of the
+ * existing file. Only if they are of no use the files are compared byte by byte.
+ */
+static bool conflictFilesEqual(const QString &fn, const QString &tmpFileName,
+    const QByteArray &localChecksumHeader, const QByteArray &downloadedChecksumHeader)
+{
+    if (FileSystem::getSize(fn) != FileSystem::getSize(tmpFileName)) {
+        return false;
+    }
+
+    QByteArray type;
+    QByteArray checksum;
+    if (parseChecksumHeader(downloadedChecksumHeader, &type, &checksum) && !checksum.isEmpty()) {
+        if (parseChecksumHeaderType(localChecksumHeader) == type) {
+            // Even weak checksums tell that the content differs
+            if (localChecksumHeader != downloadedChecksumHeader)
+                return false;
+            if (csync_is_collision_safe_hash(downloadedChecksumHeader))
+                return true;
+        } else if (csync_is_collision_safe_hash(downloadedChecksumHeader)) {
+            // Only the existing file needs to be read
+            const QByteArray localChecksum = ComputeChecksum::computeNow(fn, type);
+            if (!localChecksum.isEmpty())
+                return localChecksum == checksum;
+        }
+    }
+    return FileSystem::fileEquals(fn, tmpFileName);
+}
+
+PropagateDownloadFile::InstallResult PropagateDownloadFile::installNow(const QString &fn, const QString &tmpFileName,
+    bool checkConflict, const QByteArray &localChecksumHeader, const QByteArray &downloadedChecksumHeader,
+    time_t modtime, qint64 expectedSize, time_t expectedMtime, bool readOnly)
+{
+    InstallResult result;
+
     // In case of conflict, make a backup of the old file
     // Ignore conflicts where both files are binary equal
-    bool isConflict = _item->_instruction == CSYNC_INSTRUCTION_CONFLICT
-        && !FileSystem::fileEquals(fn, _tmpFile.fileName());
-    if (isConflict) {
+    result.isConflict = checkConflict
+        && !conflictFilesEqual(fn, tmpFileName, localChecksumHeader, downloadedChecksumHeader);
+    if (result.isConflict) {
         QString renameError;
-        QString conflictFileName = FileSystem::makeConflictFileName(
+        result.conflictFileName = FileSystem::makeConflictFileName(
             fn, Utility::qDateTimeFromTime_t(FileSystem::getModTime(fn)));
-        if (!FileSystem::rename(fn, conflictFileName, &renameError)) {
+        if (!FileSystem::rename(fn, result.conflictFileName, &renameError)) {
             // If the rename fails, don't replace it.
-
-            // If the file is locked, we want to retry this sync when it
-            // becomes available again.
-            if (FileSystem::isFileLocked(fn)) {
-                emit propagator()->seenLockedFile(fn);
-            }
-
-            done(SyncFileItem::SoftError, renameError);
-            return;
+            result.status = InstallResult::ConflictRenameFailed;
+            result.error = renameError;
+            result.isLocked = FileSystem::isFileLocked(fn);
+            return result;
         }
-        qCInfo(lcPropagateDownload) << "Created conflict file" << fn << "->" << conflictFileName;
     }
 
-    FileSystem::setModTime(_tmpFile.fileName(), _item->_modtime);
+    FileSystem::setModTime(tmpFileName, modtime);
     // We need to fetch the time again because some file systems such as FAT have worse than a second
     // Accuracy, and we really need the time from the file system. (#3103)
-    _item->_modtime = FileSystem::getModTime(_tmpFile.fileName());
+    result.modtime = FileSystem::getModTime(tmpFileName);
 
     if (FileSystem::fileExists(fn)) {
         // Preserve the existing file permissions.
         QFileInfo existingFile(fn);
-        if (existingFile.permissions() != _tmpFile.permissions()) {
-            _tmpFile.setPermissions(existingFile.permissions());
+        if (existingFile.permissions() != QFile::permissions(tmpFileName)) {
+            QFile::setPermissions(tmpFileName, existingFile.permissions());
         }
-        preserveGroupOwnership(_tmpFile.fileName(), existingFile);
+        preserveGroupOwnership(tmpFileName, existingFile);
 
         // Check whether the existing file has changed since the discovery
         // phase by comparing size and mtime to the previous values. This
         // is necessary to avoid overwriting user changes that happened between
         // the discovery phase and now.
-        const qint64 expectedSize = _item->_previousSize;
-        const time_t expectedMtime = _item->_previousModtime;
         if (!FileSystem::verifyFileUnchanged(fn, expectedSize, expectedMtime)) {
-            propagator()->_anotherSyncNeeded = true;
-            done(SyncFileItem::SoftError, tr("File has changed since discovery"));
-            return;
+            result.status = InstallResult::ChangedSinceDiscovery;
+            result.error = tr("File has changed since discovery");
+            return result;
         }
     }
 
     // Apply the remote permissions
-    FileSystem::setFileReadOnlyWeak(_tmpFile.fileName(), !_item->_remotePerm.isNull() && !_item->_remotePerm.hasPermission(RemotePermissions::CanWrite));
+    FileSystem::setFileReadOnlyWeak(tmpFileName, readOnly);
 
-    QString error;
-    emit propagator()->touchedFile(fn);
     // The fileChanged() check is done above to generate better error messages.
-    if (!FileSystem::uncheckedRenameReplace(_tmpFile.fileName(), fn, &error)) {
-        qCWarning(lcPropagateDownload) << QString("Rename failed: %1 => %2").arg(_tmpFile.fileName()).arg(fn);
+    if (!FileSystem::uncheckedRenameReplace(tmpFileName, fn, &result.error)) {
+        qCWarning(lcPropagateDownload) << QString("Rename failed: %1 => %2").arg(tmpFileName).arg(fn);
+        result.status = InstallResult::RenameFailed;
+        result.isLocked = FileSystem::isFileLocked(fn);
+        return result;
+    }
+    FileSystem::setFileHidden(fn, false);
 
+    // Maybe we downloaded a newer version of the file than we thought we would...
+    // Get up to date information for the journal.
+    result.size = FileSystem::getSize(fn);
+    return result;
+}
+
+void PropagateDownloadFile::slotInstallDone()
+{
+    propagator()->removeActiveJob(this);
+    const InstallResult result = _installWatcher.result();
+    QString fn = propagator()->getFilePath(_item->_file);
+
+    switch (result.status) {
+    case InstallResult::ConflictRenameFailed:
+        // If the file is locked, we want to retry this sync when it
+        // becomes available again.
+        if (result.isLocked) {
+            emit propagator()->seenLockedFile(fn);
+        }
+        done(SyncFileItem::SoftError, result.error);
+        return;
+    case InstallResult::ChangedSinceDiscovery:
+        propagator()->_anotherSyncNeeded = true;
+        done(SyncFileItem::SoftError, result.error);
+        return;
+    case InstallResult::RenameFailed:
         // If we moved away the original file due to a conflict but can't
         // put the downloaded file in its place, we are in a bad spot:
         // If we do nothing the next sync run will assume the user deleted
@@ -864,29 +1390,32 @@ void PropagateDownloadFile::downloadFinished()
         // To avoid that, the file is removed from the metadata table entirely
         // which makes it look like we're just about to initially download
         // it.
-        if (isConflict) {
+        if (result.isConflict) {
             propagator()->_journal->deleteFileRecord(fn);
             propagator()->_journal->commit("download finished");
         }
 
         // If the file is locked, we want to retry this sync when it
         // becomes available again, otherwise try again directly
-        if (FileSystem::isFileLocked(fn)) {
+        if (result.isLocked) {
             emit propagator()->seenLockedFile(fn);
         } else {
             propagator()->_anotherSyncNeeded = true;
         }
 
-        done(SyncFileItem::SoftError, error);
+        done(SyncFileItem::SoftError, result.error);
         return;
+    case InstallResult::Installed:
+        break;
     }
-    FileSystem::setFileHidden(fn, false);
 
-    // Maybe we downloaded a newer version of the file than we thought we would...
-    // Get up to date information for the journal.
-    _item->_size = FileSystem::getSize(fn);
+    if (result.isConflict) {
+        qCInfo(lcPropagateDownload) << "Created conflict file" << fn << "->" << result.conflictFileName;
+    }
+    _item->_modtime = result.modtime;
+    _item->_size = result.size;
 
-    updateMetadata(isConflict);
+    updateMetadata(result.isConflict);
 }
 
 void PropagateDownloadFile::updateMetadata(bool isConflict)
@@ -898,6 +1427,18 @@ void PropagateDownloadFile::updateMetadata(bool isConflict)
         return;
     }
     propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
+    if (useBlockChecksums()) {
+        // With the block checksums of this version the next download or upload can be a delta
+        SyncJournalDb::BlockChecksums blockChecksums;
+        const qint64 blockCount = (_item->_size + blockChecksumSize - 1) / blockChecksumSize;
+        if (_blockChecksums.size() == blockCount * 16) {
+            blockChecksums._etag = _item->_etag;
+            blockChecksums._blockSize = blockChecksumSize;
+            blockChecksums._checksums = _blockChecksums;
+            blockChecksums._valid = true;
+        }
+        propagator()->_journal->setBlockChecksums(_item->_file, blockChecksums);
+    }
     propagator()->_journal->commit("download file start2");
     done(isConflict ? SyncFileItem::Conflict : SyncFileItem::Success);
 
@@ -919,7 +1460,7 @@ void PropagateDownloadFile::slotDownloadProgress(qint64 received, qint64)
     if (!_job)
         return;
     _downloadProgress = received;
-    propagator()->reportProgress(*_item, _resumeStart + received);
+    propagator()->reportProgress(*_item, _resumeStart + _deltaProgress + received);
 }
 
 
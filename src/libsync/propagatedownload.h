@@ -17,7 +17,9 @@
 #include "networkjobs.h"
 
 #include <QBuffer>
+#include <QCryptographicHash>
 #include <QFile>
+#include <QFutureWatcher>
 
 namespace OCC {
 
@@ -36,9 +38,6 @@ class GETFileJob : public AbstractNetworkJob
     SyncFileItem::Status _errorStatus;
     QUrl _directDownloadUrl;
     QByteArray _etag;
-    bool _bandwidthLimited; // if _bandwidthQuota will be used
-    bool _bandwidthChoked; // if download is paused (won't read on readyRead())
-    qint64 _bandwidthQuota;
     QPointer<BandwidthManager> _bandwidthManager;
     bool _hasEmittedFinishedSignal;
     time_t _lastModified;
@@ -46,6 +45,28 @@ class GETFileJob : public AbstractNetworkJob
     /// Will be set to true once we've seen a 2xx response header
     bool _saveBodyToFile = false;
 
+    QByteArray _checksumType;
+    /// Checksum of the body, only if it is saved from the start
+    QScopedPointer<QCryptographicHash> _checksum;
+
+    /// Body data that was not written to the file yet, see slotReadyRead()
+    QByteArray _writeBuffer;
+    qint64 _writeBufferUsed = 0;
+    /// Position in the file of the start of _writeBuffer
+    qint64 _writeBufferOffset = 0;
+    /// Whether the written data is dropped from the page cache
+    bool _dropWrittenData = false;
+
+    /// Last byte of the requested range, -1 for the rest of the file
+    qint64 _rangeEnd = -1;
+
+    bool _computeBlockChecksums = false;
+    /// Block checksums of the body, only if it is saved from the start
+    QByteArray _blockChecksums;
+    bool _blockChecksumsValid = false;
+
+    bool flushWriteBuffer();
+
 public:
     // DOES NOT take ownership of the device.
     explicit GETFileJob(AccountPtr account, const QString &path, QFile *device,
@@ -63,28 +84,27 @@ public:
     }
 
     virtual void start() Q_DECL_OVERRIDE;
-    virtual bool finished() Q_DECL_OVERRIDE
-    {
-        if (reply()->bytesAvailable()) {
-            return false;
-        } else {
-            if (_bandwidthManager) {
-                _bandwidthManager->unregisterDownloadJob(this);
-            }
-            if (!_hasEmittedFinishedSignal) {
-                emit finishedSignal();
-            }
-            _hasEmittedFinishedSignal = true;
-            return true; // discard
-        }
-    }
+    virtual bool finished() Q_DECL_OVERRIDE;
 
     void newReplyHook(QNetworkReply *reply) override;
 
     void setBandwidthManager(BandwidthManager *bwm);
-    void setChoked(bool c);
-    void setBandwidthLimited(bool b);
-    void giveBandwidthQuota(qint64 q);
+
+    /// Computes a checksum of this type (MD5 or SHA1) of the body while downloading
+    void setChecksumType(const QByteArray &type) { _checksumType = type; }
+    /// The checksum header of the downloaded file, empty if it was not computed (e.g. when resuming)
+    QByteArray checksumHeader() const;
+    /// Computes the block checksums (see computeBlockChecksums()) of the body while downloading
+    void setComputeBlockChecksums(bool enabled) { _computeBlockChecksums = enabled; }
+    /// The block checksums of the downloaded file, empty if they were not computed
+    QByteArray blockChecksums() const;
+    /**
+     * Only downloads the range from resumeStart to \a end (inclusive).
+     *
+     * The data is written at the current position of the device. If the server
+     * does not support ranges the job fails instead of writing the whole file.
+     */
+    void setRangeEnd(qint64 end) { _rangeEnd = end; }
     qint64 currentDownloadPosition();
 
     QString errorString() const;
@@ -145,6 +165,18 @@ private slots:
     +-> updateMetadata() <-------------------------+
 
 \endcode
+
+ * If the journal knows an unchanged local file with the same content checksum,
+ * startDownload() copies that file instead of running a GETFileJob. Once the
+ * copy is verified slotLocalCopyDone() continues with downloadFinished(),
+ * otherwise the file is downloaded after all.
+ *
+ * If the server supports delta sync and the journal has the block checksums of
+ * the local file, startDeltaDownload() fetches the ones of the new version. The
+ * temporary file starts as a copy of the local file and only the changed ranges
+ * are downloaded into it. When the reconstructed file has the new block checksums
+ * slotDeltaFileVerified() continues with the usual checksum validation. Whenever
+ * something goes wrong on the way the whole file is downloaded.
  */
 class PropagateDownloadFile : public PropagateItemJob
 {
@@ -155,6 +187,9 @@ public:
         , _resumeStart(0)
         , _downloadProgress(0)
         , _deleteExisting(false)
+        , _triedLocalCopy(false)
+        , _triedDeltaDownload(false)
+        , _deltaProgress(0)
     {
     }
     void start() Q_DECL_OVERRIDE;
@@ -174,6 +209,24 @@ public:
      */
     void setDeleteExistingFolder(bool enabled);
 
+    /** Outcome of moving the downloaded file into place, computed in the io thread pool */
+    struct InstallResult
+    {
+        enum Status {
+            Installed,
+            ConflictRenameFailed, ///< the existing file could not be moved to the conflict file
+            ChangedSinceDiscovery, ///< the existing file was modified meanwhile
+            RenameFailed ///< the temporary file could not be moved into place
+        };
+        Status status = Installed;
+        bool isConflict = false;
+        bool isLocked = false; ///< the existing file is locked, only set on failure
+        QString error;
+        QString conflictFileName;
+        time_t modtime = 0;
+        quint64 size = 0;
+    };
+
 private slots:
     /// Called when ComputeChecksum on the local file finishes,
     /// maybe the local and remote checksums are identical?
@@ -187,6 +240,19 @@ private slots:
     /// Called when the download's checksum computation is done
     void contentChecksumComputed(const QByteArray &checksumType, const QByteArray &checksum);
     void downloadFinished();
+    /// Called when the copy of an identical local file is done
+    void slotLocalCopyDone();
+    /// Called with the block checksums of the new version for a delta download
+    void slotDeltaChecksumsFetched(const QVariantMap &values);
+    void slotDeltaChecksumsFetchFailed();
+    /// Called when the temporary file of a delta download was prepared from the local file
+    void slotDeltaFilePrepared();
+    /// Called when the GETFileJob of a changed range finishes
+    void slotDeltaRangeFinished();
+    /// Called when the block checksums of the reconstructed file were computed
+    void slotDeltaFileVerified();
+    /// Called when the downloaded file was moved into place
+    void slotInstallDone();
     /// Called when it's time to update the db metadata
     void updateMetadata(bool isConflict);
 
@@ -197,12 +263,56 @@ private slots:
 private:
     void deleteExistingFolder();
 
+    /// A synced local file that had the content of the item
+    struct LocalCopySource
+    {
+        QString path;
+        qint64 size;
+        time_t modtime;
+    };
+    /// Starts copying an identical local file into the temporary file, if there is one
+    bool startLocalCopy();
+    /// Returns the path of the source that was copied, or an empty string
+    static QString localCopyNow(const QVector<LocalCopySource> &sources, const QString &tmpFileName,
+        const QByteArray &checksumHeader);
+
+    /// Whether block checksums are kept for this file, for delta downloads and uploads
+    bool useBlockChecksums() const;
+    /// Starts a delta download if the block checksums of the local file are known
+    bool startDeltaDownload();
+    void startNextDeltaRange();
+    /// Gives up on the delta download and downloads the whole file
+    void startFullDownload();
+    /// Returns an error string, empty on success
+    static QString prepareDeltaFileNow(const QString &fn, const QString &tmpFileName, qint64 size);
+
+    static InstallResult installNow(const QString &fn, const QString &tmpFileName, bool checkConflict,
+        const QByteArray &localChecksumHeader, const QByteArray &downloadedChecksumHeader,
+        time_t modtime, qint64 expectedSize, time_t expectedMtime, bool readOnly);
+
     quint64 _resumeStart;
     qint64 _downloadProgress;
     QPointer<GETFileJob> _job;
     QFile _tmpFile;
     bool _deleteExisting;
+    /// Checksum of the existing file, computed for conflicts
+    QByteArray _localChecksumHeader;
+    bool _triedLocalCopy;
+    bool _triedDeltaDownload;
+
+    /// Block checksums of the new version, stored in the journal when done
+    QByteArray _blockChecksums;
+    /// Block checksums of the local file that a delta download starts from
+    QByteArray _deltaBaseChecksums;
+    /// The ranges (offset, length) of a delta download that still need to be fetched
+    QVector<QPair<qint64, qint64>> _deltaRanges;
+    /// Bytes of a delta download that are already in the temporary file
+    qint64 _deltaProgress;
 
     QElapsedTimer _stopwatch;
+    QFutureWatcher<QString> _localCopyWatcher;
+    QFutureWatcher<QString> _deltaFileWatcher;
+    QFutureWatcher<QByteArray> _deltaVerifyWatcher;
+    QFutureWatcher<InstallResult> _installWatcher;
 };
 }
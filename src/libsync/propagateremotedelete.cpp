@@ -71,7 +71,7 @@ void PropagateRemoteDelete::start()
         propagator()->_remoteFolder + _item->_file,
         this);
     connect(_job.data(), &DeleteJob::finishedSignal, this, &PropagateRemoteDelete::slotDeleteJobFinished);
-    propagator()->_activeJobList.append(this);
+    propagator()->addActiveJob(this);
     _job->start();
 }
 
@@ -87,7 +87,7 @@ void PropagateRemoteDelete::abort(PropagatorJob::AbortType abortType)
 
 void PropagateRemoteDelete::slotDeleteJobFinished()
 {
-    propagator()->_activeJobList.removeOne(this);
+    propagator()->removeActiveJob(this);
 
     ASSERT(_job);
 
@@ -33,7 +33,7 @@ void PropagateRemoteMkdir::start()
 
     qCDebug(lcPropagateRemoteMkdir) << _item->_file;
 
-    propagator()->_activeJobList.append(this);
+    propagator()->addActiveJob(this);
 
     if (!_deleteExisting) {
         return slotStartMkcolJob();
@@ -77,7 +77,7 @@ void PropagateRemoteMkdir::setDeleteExisting(bool enabled)
 
 void PropagateRemoteMkdir::slotMkcolJobFinished()
 {
-    propagator()->_activeJobList.removeOne(this);
+    propagator()->removeActiveJob(this);
 
     ASSERT(_job);
 
@@ -111,7 +111,7 @@ void PropagateRemoteMkdir::slotMkcolJobFinished()
         // So we must get the file id using a PROPFIND
         // This is required so that we can detect moves even if the folder is renamed on the server
         // while files are still uploading
-        propagator()->_activeJobList.append(this);
+        propagator()->addActiveJob(this);
         auto propfindJob = new PropfindJob(_job->account(), _job->path(), this);
         propfindJob->setProperties(QList<QByteArray>() << "getetag"
                                                        << "http://owncloud.org/ns:id");
@@ -126,7 +126,7 @@ void PropagateRemoteMkdir::slotMkcolJobFinished()
 
 void PropagateRemoteMkdir::propfindResult(const QVariantMap &result)
 {
-    propagator()->_activeJobList.removeOne(this);
+    propagator()->removeActiveJob(this);
     if (result.contains("getetag")) {
         _item->_etag = result["getetag"].toByteArray();
     }
@@ -139,7 +139,7 @@ void PropagateRemoteMkdir::propfindResult(const QVariantMap &result)
 void PropagateRemoteMkdir::propfindError()
 {
     // ignore the PROPFIND error
-    propagator()->_activeJobList.removeOne(this);
+    propagator()->removeActiveJob(this);
     done(SyncFileItem::Success);
 }
 
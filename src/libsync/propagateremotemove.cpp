@@ -113,7 +113,7 @@ void PropagateRemoteMove::start()
         propagator()->_remoteFolder + _item->_file,
         destination, this);
     connect(_job.data(), &MoveJob::finishedSignal, this, &PropagateRemoteMove::slotMoveJobFinished);
-    propagator()->_activeJobList.append(this);
+    propagator()->addActiveJob(this);
     _job->start();
 }
 
@@ -129,7 +129,7 @@ void PropagateRemoteMove::abort(PropagatorJob::AbortType abortType)
 
 void PropagateRemoteMove::slotMoveJobFinished()
 {
-    propagator()->_activeJobList.removeOne(this);
+    propagator()->removeActiveJob(this);
 
     ASSERT(_job);
 
@@ -187,7 +187,7 @@ void PropagateUploadFileCommon::start()
         return;
     }
 
-    propagator()->_activeJobList.append(this);
+    propagator()->addActiveJob(this);
 
     if (!_deleteExisting) {
         return slotComputeContentChecksum();
@@ -231,6 +231,7 @@ void PropagateUploadFileCommon::slotComputeContentChecksum()
     // Compute the content checksum.
     auto computeChecksum = new ComputeChecksum(this);
     computeChecksum->setChecksumType(checksumType);
+    computeChecksum->setJournal(propagator()->_journal);
 
     connect(computeChecksum, &ComputeChecksum::done,
         this, &PropagateUploadFileCommon::slotComputeTransmissionChecksum);
@@ -263,6 +264,7 @@ void PropagateUploadFileCommon::slotComputeTransmissionChecksum(const QByteArray
     } else {
         computeChecksum->setChecksumType(QByteArray());
     }
+    computeChecksum->setJournal(propagator()->_journal);
 
     connect(computeChecksum, &ComputeChecksum::done,
         this, &PropagateUploadFileCommon::slotStartUpload);
@@ -276,7 +278,7 @@ void PropagateUploadFileCommon::slotStartUpload(const QByteArray &transmissionCh
 {
     // Remove ourselfs from the list of active job, before any posible call to done()
     // When we start chunks, we will add it again, once for every chunks.
-    propagator()->_activeJobList.removeOne(this);
+    propagator()->removeActiveJob(this);
 
     _transmissionChecksumHeader = makeChecksumHeader(transmissionChecksumType, transmissionChecksum);
 
@@ -324,10 +326,6 @@ void PropagateUploadFileCommon::slotStartUpload(const QByteArray &transmissionCh
 UploadDevice::UploadDevice(BandwidthManager *bwm)
     : _read(0)
     , _bandwidthManager(bwm)
-    , _bandwidthQuota(0)
-    , _readWithProgress(0)
-    , _bandwidthLimited(false)
-    , _choked(false)
 {
     _bandwidthManager->registerUploadDevice(this);
 }
@@ -363,6 +361,13 @@ bool UploadDevice::prepareAndOpen(const QString &fileName, qint64 start, qint64
     return QIODevice::open(QIODevice::ReadOnly);
 }
 
+bool UploadDevice::prepareAndOpen(const QByteArray &data)
+{
+    _data = data;
+    _read = 0;
+    return QIODevice::open(QIODevice::ReadOnly);
+}
+
 
 qint64 UploadDevice::writeData(const char *, qint64)
 {
@@ -383,29 +388,17 @@ qint64 UploadDevice::readData(char *data, qint64 maxlen)
     if (maxlen == 0) {
         return 0;
     }
-    if (isChoked()) {
-        return 0;
-    }
-    if (isBandwidthLimited()) {
-        maxlen = qMin(maxlen, _bandwidthQuota);
-        if (maxlen <= 0) { // no quota
+    if (_bandwidthManager) {
+        maxlen = _bandwidthManager->uploadBucket()->take(this, maxlen);
+        if (maxlen == 0) { // no quota, readyRead() is emitted when there is
             return 0;
         }
-        _bandwidthQuota -= maxlen;
     }
     std::memcpy(data, _data.data() + _read, maxlen);
     _read += maxlen;
     return maxlen;
 }
 
-void UploadDevice::slotJobUploadProgress(qint64 sent, qint64 t)
-{
-    if (sent == 0 || t == 0) {
-        return;
-    }
-    _readWithProgress = sent;
-}
-
 bool UploadDevice::atEnd() const
 {
     return _read >= _data.size();
@@ -439,28 +432,6 @@ bool UploadDevice::seek(qint64 pos)
     return true;
 }
 
-void UploadDevice::giveBandwidthQuota(qint64 bwq)
-{
-    if (!atEnd()) {
-        _bandwidthQuota = bwq;
-        QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection); // tell QNAM that we have quota
-    }
-}
-
-void UploadDevice::setBandwidthLimited(bool b)
-{
-    _bandwidthLimited = b;
-    QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection);
-}
-
-void UploadDevice::setChoked(bool b)
-{
-    _choked = b;
-    if (!_choked) {
-        QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection);
-    }
-}
-
 void PropagateUploadFileCommon::startPollJob(const QString &path)
 {
     PollJob *job = new PollJob(propagator()->account(), path, _item,
@@ -472,7 +443,7 @@ void PropagateUploadFileCommon::startPollJob(const QString &path)
     info._modtime = _item->_modtime;
     propagator()->_journal->setPollInfo(info);
     propagator()->_journal->commit("add poll info");
-    propagator()->_activeJobList.append(this);
+    propagator()->addActiveJob(this);
     job->start();
 }
 
@@ -481,7 +452,7 @@ void PropagateUploadFileCommon::slotPollFinished()
     PollJob *job = qobject_cast<PollJob *>(sender());
     ASSERT(job);
 
-    propagator()->_activeJobList.removeOne(this);
+    propagator()->removeActiveJob(this);
 
     if (job->_item->_status != SyncFileItem::Success) {
         _finished = true;
@@ -518,6 +489,11 @@ void PropagateUploadFileCommon::commonErrorHandling(AbstractNetworkJob *job)
     QString errorString = job->errorStringParsingBody(&replyContent);
     qCDebug(lcPropagateUpload) << replyContent; // display the XML error in the debug
 
+    commonErrorHandling(job->reply()->error(), errorString);
+}
+
+void PropagateUploadFileCommon::commonErrorHandling(QNetworkReply::NetworkError error, QString errorString)
+{
     if (_item->_httpErrorCode == 412) {
         // Precondition Failed: Either an etag or a checksum mismatch.
 
@@ -530,7 +506,7 @@ void PropagateUploadFileCommon::commonErrorHandling(AbstractNetworkJob *job)
     // Ensure errors that should eventually reset the chunked upload are tracked.
     checkResettingErrors();
 
-    SyncFileItem::Status status = classifyError(job->reply()->error(), _item->_httpErrorCode,
+    SyncFileItem::Status status = classifyError(error, _item->_httpErrorCode,
         &propagator()->_anotherSyncNeeded);
 
     // Insufficient remote storage.
@@ -579,6 +555,16 @@ void PropagateUploadFileCommon::abortWithError(SyncFileItem::Status status, cons
     done(status, error);
 }
 
+QByteArray PropagateUploadFileCommon::chunkChecksumHeader(const UploadDevice *device)
+{
+    if (!uploadChecksumEnabled())
+        return QByteArray();
+    const QByteArray type = propagator()->account()->capabilities().fastTransmissionChecksumType();
+    if (type.isEmpty())
+        return QByteArray();
+    return makeChecksumHeader(type, calcFastChecksum(type, device->data()));
+}
+
 QMap<QByteArray, QByteArray> PropagateUploadFileCommon::headers()
 {
     QMap<QByteArray, QByteArray> headers;
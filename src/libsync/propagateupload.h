@@ -17,8 +17,12 @@
 #include "networkjobs.h"
 
 #include <QBuffer>
+#include <QCryptographicHash>
 #include <QFile>
 #include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QJsonObject>
+#include <QTimer>
 
 
 namespace OCC {
@@ -41,6 +45,10 @@ public:
 
     /** Reads the data from the file and opens the device */
     bool prepareAndOpen(const QString &fileName, qint64 start, qint64 size);
+    /** Uses the given data as contents and opens the device */
+    bool prepareAndOpen(const QByteArray &data);
+
+    const QByteArray &data() const { return _data; }
 
     qint64 writeData(const char *, qint64) Q_DECL_OVERRIDE;
     qint64 readData(char *data, qint64 maxlen) Q_DECL_OVERRIDE;
@@ -50,14 +58,6 @@ public:
     bool isSequential() const Q_DECL_OVERRIDE;
     bool seek(qint64 pos) Q_DECL_OVERRIDE;
 
-    void setBandwidthLimited(bool);
-    bool isBandwidthLimited() { return _bandwidthLimited; }
-    void setChoked(bool);
-    bool isChoked() { return _choked; }
-    void giveBandwidthQuota(qint64 bwq);
-
-signals:
-
 private:
     // The file data
     QByteArray _data;
@@ -66,13 +66,6 @@ private:
 
     // Bandwidth manager related
     QPointer<BandwidthManager> _bandwidthManager;
-    qint64 _bandwidthQuota;
-    qint64 _readWithProgress;
-    bool _bandwidthLimited; // if _bandwidthQuota will be used
-    bool _choked; // if upload is paused (readData() will return 0)
-    friend class BandwidthManager;
-public slots:
-    void slotJobUploadProgress(qint64 sent, qint64 t);
 };
 
 /**
@@ -150,6 +143,55 @@ signals:
 
 };
 
+/**
+ * @brief Uploads several small files in one multipart POST request
+ *
+ * Every part carries the X-File-Path of the file it contains. The server replies
+ * with a JSON object that maps each of these paths to the result for that file.
+ * @ingroup libsync
+ */
+class PutMultiFileJob : public AbstractNetworkJob
+{
+    Q_OBJECT
+
+public:
+    // Takes ownership of the device
+    explicit PutMultiFileJob(AccountPtr account, const QUrl &url, QIODevice *device,
+        const QByteArray &boundary, QObject *parent = 0)
+        : AbstractNetworkJob(account, QString(), parent)
+        , _device(device)
+        , _boundary(boundary)
+        , _url(url)
+    {
+        _device->setParent(this);
+    }
+    ~PutMultiFileJob();
+
+    void start() Q_DECL_OVERRIDE;
+    bool finished() Q_DECL_OVERRIDE;
+
+    QIODevice *device() { return _device; }
+
+    QString errorString()
+    {
+        return _errorString.isEmpty() ? AbstractNetworkJob::errorString() : _errorString;
+    }
+
+    /** The per-file results keyed by X-File-Path, valid once finishedSignal() was emitted */
+    const QJsonObject &results() const { return _results; }
+
+signals:
+    void finishedSignal();
+    void uploadProgress(qint64, qint64);
+
+private:
+    QIODevice *_device;
+    QByteArray _boundary;
+    QUrl _url;
+    QString _errorString;
+    QJsonObject _results;
+};
+
 /**
  * @brief This job implements the asynchronous PUT
  *
@@ -280,9 +322,14 @@ protected:
      * Error handling functionality that is shared between jobs.
      */
     void commonErrorHandling(AbstractNetworkJob *job);
+    void commonErrorHandling(QNetworkReply::NetworkError error, QString errorString);
 
     // Bases headers that need to be sent with every chunk
     QMap<QByteArray, QByteArray> headers();
+
+    /** The cheap checksum header that lets the server verify a single chunk,
+     * empty if upload checksums are disabled or the server has no cheap type */
+    QByteArray chunkChecksumHeader(const UploadDevice *device);
 };
 
 /**
@@ -337,6 +384,9 @@ private slots:
  *
  * Propagation job, impementing the new chunking agorithm
  *
+ * If the server supports delta sync and the journal has the block checksums
+ * of the version on the server, only the blocks that changed are uploaded.
+ *
  */
 class PropagateUploadFileNG : public PropagateUploadFileCommon
 {
@@ -348,6 +398,18 @@ private:
     quint64 _currentChunkSize = 0; /// current chunk size
     bool _removeJobError = false; /// If not null, there was an error removing the job
 
+    /// Only the changed blocks are sent, the server takes the others from the version at _item->_etag
+    bool _deltaUpload = false;
+    QVector<QPair<qint64, qint64>> _deltaRanges; /// The ranges (offset, length) that still need to be sent
+    QByteArray _blockChecksums; /// Of the uploaded file, stored in the journal when done
+    QByteArray _deltaBaseChecksums; /// Of the version on the server, until the delta ranges are known
+    QFutureWatcher<QByteArray> _blockChecksumsWatcher;
+
+    /// Without a delta upload _blockChecksums are computed from the chunks as they are read
+    bool _collectBlockChecksums = false;
+    quint64 _blockChecksummedSize = 0; /// The size of the start of the file that is in _blockChecksums or _blockHash
+    QCryptographicHash _blockHash{ QCryptographicHash::Md5 }; /// Of the block that is being read
+
     // Map chunk number with its size  from the PROPFIND on resume.
     // (Only used from slotPropfindIterate/slotPropfindFinished because the LsColJob use signals to report data.)
     struct ServerChunkInfo
@@ -374,9 +436,11 @@ public:
 private:
     void startNewUpload();
     void startNextChunk();
+    void addToBlockChecksums(quint64 offset, const QByteArray &data);
 public slots:
     void abort(AbortType abortType) Q_DECL_OVERRIDE;
 private slots:
+    void slotBlockChecksumsComputed();
     void slotPropfindFinished();
     void slotPropfindFinishedWithError();
     void slotPropfindIterate(const QString &name, const QMap<QString, QString> &properties);
@@ -386,4 +450,103 @@ private slots:
     void slotMoveJobFinished();
     void slotUploadProgress(qint64, qint64);
 };
+
+/**
+ * @ingroup libsync
+ *
+ * Propagation job for small files. Instead of sending its own request, the
+ * job hands the file contents to the propagator's BulkUploadQueue which
+ * uploads it together with other small files.
+ *
+ */
+class PropagateUploadFileBulk : public PropagateUploadFileCommon
+{
+    Q_OBJECT
+
+private:
+    QByteArray _data; /// contents of the file, read when the upload starts
+    bool _aborted = false;
+
+    /** Outcome of reading the file, in the io thread pool */
+    struct ReadResult
+    {
+        QByteArray data;
+        QString error;
+    };
+    QFutureWatcher<ReadResult> _readWatcher;
+
+    static ReadResult readNow(const QString &fullFilePath);
+
+public:
+    PropagateUploadFileBulk(OwncloudPropagator *propagator, const SyncFileItemPtr &item)
+        : PropagateUploadFileCommon(propagator, item)
+    {
+    }
+
+    void doStartUpload() Q_DECL_OVERRIDE;
+
+    const QByteArray &data() const { return _data; }
+
+    /** The headers of the part containing this file */
+    QMap<QByteArray, QByteArray> partHeaders();
+
+    /**
+     * Called by the BulkUploadQueue when the request containing this file is finished.
+     * \a result is the entry of the server reply for this file, it may be empty.
+     */
+    void bulkUploadFinished(PutMultiFileJob *job, const QJsonObject &result);
+
+public slots:
+    void abort(PropagatorJob::AbortType abortType) Q_DECL_OVERRIDE;
+
+private slots:
+    void slotReadDone();
+};
+
+/**
+ * @brief Collects PropagateUploadFileBulk jobs and sends them in PutMultiFileJob requests
+ *
+ * A request is sent once enough files or bytes are queued, or shortly after
+ * the first file was queued so that a sync with few small files is not delayed.
+ * Each request in flight occupies one slot in the propagator's active job list.
+ * @ingroup libsync
+ */
+class BulkUploadQueue : public PropagatorJob
+{
+    Q_OBJECT
+
+public:
+    explicit BulkUploadQueue(OwncloudPropagator *propagator);
+
+    /** The queue is not part of the job tree, the files are scheduled by their own jobs */
+    bool scheduleSelfOrChild() Q_DECL_OVERRIDE { return false; }
+
+    void enqueue(PropagateUploadFileBulk *job);
+
+    /** Removes the job from the queue, or from the request it is part of.
+     *
+     * A request in flight is aborted, its other files are queued again unless
+     * the whole propagation is aborting.
+     */
+    void abortJob(PropagateUploadFileBulk *job);
+
+    /** Number of files sent in one request (env OWNCLOUD_BULK_UPLOAD_MAX_FILES) */
+    static int maximumFileCount();
+
+    /** Number of bytes after which the queued files are sent */
+    static qint64 maximumRequestSize() { return 10 * 1000 * 1000; }
+
+private slots:
+    void flush();
+    void slotRequestFinished();
+
+private:
+    OwncloudPropagator *_propagator;
+    QVector<QPointer<PropagateUploadFileBulk>> _queued;
+    qint64 _queuedSize = 0;
+    QTimer _flushTimer;
+
+    // The jobs contained in each request in flight
+    QHash<PutMultiFileJob *, QVector<QPointer<PropagateUploadFileBulk>>> _requests;
+};
 }
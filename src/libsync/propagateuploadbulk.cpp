@@ -0,0 +1,361 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "config.h"
+#include "propagateupload.h"
+#include "owncloudpropagator_p.h"
+#include "networkjobs.h"
+#include "account.h"
+#include "common/syncjournaldb.h"
+#include "common/utility.h"
+#include "filesystem.h"
+#include "propagatorjobs.h"
+#include "common/asserts.h"
+
+#include <QJsonDocument>
+#include <QUuid>
+#include <QtConcurrent>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcPutMultiFileJob, "sync.networkjob.putmulti", QtInfoMsg)
+
+PutMultiFileJob::~PutMultiFileJob()
+{
+    // Make sure that we destroy the QNetworkReply before our _device of which it keeps an internal pointer.
+    setReply(0);
+}
+
+void PutMultiFileJob::start()
+{
+    QNetworkRequest req;
+    req.setRawHeader("Content-Type", "multipart/related; boundary=" + _boundary);
+    req.setPriority(QNetworkRequest::LowPriority); // Long uploads must not block non-propagation jobs.
+
+    sendRequest("POST", _url, req, _device);
+
+    if (reply()->error() != QNetworkReply::NoError) {
+        qCWarning(lcPutMultiFileJob) << " Network error: " << reply()->errorString();
+    }
+
+    connect(reply(), &QNetworkReply::uploadProgress, this, &PutMultiFileJob::uploadProgress);
+    connect(this, &AbstractNetworkJob::networkActivity, account().data(), &Account::propagatorNetworkActivity);
+    AbstractNetworkJob::start();
+}
+
+bool PutMultiFileJob::finished()
+{
+    qCInfo(lcPutMultiFileJob) << "POST of" << reply()->request().url().toString() << "FINISHED WITH STATUS"
+                              << reply()->error()
+                              << (reply()->error() == QNetworkReply::NoError ? QLatin1String("") : errorString())
+                              << reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute)
+                              << reply()->attribute(QNetworkRequest::HttpReasonPhraseAttribute);
+
+    if (reply()->error() != QNetworkReply::NoError) {
+        // Parse it once, the jobs of all files in the request use it
+        _errorString = errorStringParsingBody();
+    } else {
+        QJsonParseError jsonParseError;
+        _results = QJsonDocument::fromJson(reply()->readAll(), &jsonParseError).object();
+        if (jsonParseError.error != QJsonParseError::NoError) {
+            qCWarning(lcPutMultiFileJob) << "Invalid JSON reply:" << jsonParseError.errorString();
+        }
+    }
+
+    emit finishedSignal();
+    return true;
+}
+
+PropagateUploadFileBulk::ReadResult PropagateUploadFileBulk::readNow(const QString &fullFilePath)
+{
+    ReadResult result;
+    QFile file(fullFilePath);
+    if (FileSystem::openAndSeekFileSharedRead(&file, &result.error, 0)) {
+        result.data = file.readAll();
+    }
+    return result;
+}
+
+void PropagateUploadFileBulk::doStartUpload()
+{
+    // The files are small, read them right away so that the queue only
+    // has to deal with data.
+    propagator()->addActiveJob(this);
+    connect(&_readWatcher, &QFutureWatcherBase::finished, this, &PropagateUploadFileBulk::slotReadDone);
+    _readWatcher.setFuture(QtConcurrent::run(propagator()->ioThreadPool(),
+        &PropagateUploadFileBulk::readNow, propagator()->getFilePath(_item->_file)));
+}
+
+void PropagateUploadFileBulk::slotReadDone()
+{
+    propagator()->removeActiveJob(this);
+    if (_aborted || propagator()->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    const ReadResult result = _readWatcher.result();
+    if (!result.error.isEmpty()) {
+        done(SyncFileItem::SoftError, result.error);
+        return;
+    }
+    if (quint64(result.data.size()) != _item->_size) {
+        propagator()->_anotherSyncNeeded = true;
+        done(SyncFileItem::SoftError, tr("Local file changed during sync."));
+        return;
+    }
+    _data = result.data;
+
+    propagator()->reportProgress(*_item, 0);
+    propagator()->bulkUploadQueue()->enqueue(this);
+}
+
+QMap<QByteArray, QByteArray> PropagateUploadFileBulk::partHeaders()
+{
+    auto headers = PropagateUploadFileCommon::headers();
+    // The whole request is synchronous
+    headers.remove("OC-Async");
+    headers["X-File-Path"] = QUrl::toPercentEncoding(propagator()->_remoteFolder + _item->_file, "/");
+    headers["Content-Length"] = QByteArray::number(_data.size());
+    if (!_transmissionChecksumHeader.isEmpty()) {
+        headers[checkSumHeaderC] = _transmissionChecksumHeader;
+    }
+    return headers;
+}
+
+void PropagateUploadFileBulk::bulkUploadFinished(PutMultiFileJob *job, const QJsonObject &result)
+{
+    if (_finished) {
+        // We have sent the finished signal already.
+        return;
+    }
+
+    // The data is no longer needed, the job might stay alive for the whole sync.
+    _data.clear();
+
+    QNetworkReply::NetworkError err = job->reply()->error();
+    if (err != QNetworkReply::NoError) {
+        _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        commonErrorHandling(err, job->errorString());
+        return;
+    }
+
+    if (result.isEmpty()) {
+        abortWithError(SyncFileItem::NormalError, tr("The server did not report a result for this file"));
+        return;
+    }
+
+    if (result["error"].toBool()) {
+        _item->_httpErrorCode = result["status"].toInt();
+        if (checkForProblemsWithShared(_item->_httpErrorCode,
+                tr("The file was edited locally but is part of a read only share. "
+                   "It is restored and your edit is in the conflict file."))) {
+            return;
+        }
+        commonErrorHandling(QNetworkReply::UnknownContentError, result["message"].toString());
+        return;
+    }
+
+    const QByteArray etag = parseEtag(result["etag"].toString().toUtf8().constData());
+    if (etag.isEmpty()) {
+        abortWithError(SyncFileItem::NormalError, tr("The server did not acknowledge the upload. (No e-tag was present)"));
+        return;
+    }
+
+    _finished = true;
+    _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+    // the file id should only be empty for new files up- or downloaded
+    QByteArray fid = result["fileid"].toString().toUtf8();
+    if (!fid.isEmpty()) {
+        if (!_item->_fileId.isEmpty() && _item->_fileId != fid) {
+            qCWarning(lcPropagateUpload) << "File ID changed!" << _item->_fileId << fid;
+        }
+        _item->_fileId = fid;
+    }
+    _item->_etag = etag;
+    _item->_responseTimeStamp = job->responseTimestamp();
+
+    // The upload is done, but if the file was changed in the meantime
+    // the new version will go out with the next sync.
+    const QString fullFilePath(propagator()->getFilePath(_item->_file));
+    if (!FileSystem::fileExists(fullFilePath)
+        || !FileSystem::verifyFileUnchanged(fullFilePath, _item->_size, _item->_modtime)) {
+        propagator()->_anotherSyncNeeded = true;
+    }
+
+    finalize();
+}
+
+void PropagateUploadFileBulk::abort(PropagatorJob::AbortType abortType)
+{
+    _aborted = true;
+    propagator()->bulkUploadQueue()->abortJob(this);
+    PropagateUploadFileCommon::abort(abortType);
+}
+
+BulkUploadQueue::BulkUploadQueue(OwncloudPropagator *propagator)
+    : PropagatorJob(propagator)
+    , _propagator(propagator)
+{
+    // Give the other small files of the sync a chance to join the request
+    _flushTimer.setSingleShot(true);
+    _flushTimer.setInterval(100);
+    connect(&_flushTimer, &QTimer::timeout, this, &BulkUploadQueue::flush);
+}
+
+int BulkUploadQueue::maximumFileCount()
+{
+    static int max = [] {
+        bool ok = false;
+        int env = qgetenv("OWNCLOUD_BULK_UPLOAD_MAX_FILES").toInt(&ok);
+        return ok && env > 0 ? env : 100;
+    }();
+    return max;
+}
+
+void BulkUploadQueue::enqueue(PropagateUploadFileBulk *job)
+{
+    _queued.append(job);
+    _queuedSize += job->data().size();
+
+    if (_queued.size() >= maximumFileCount() || _queuedSize >= maximumRequestSize()) {
+        flush();
+    } else if (!_flushTimer.isActive()) {
+        _flushTimer.start();
+    }
+
+    // The job no longer uses a slot, let the next small files get to this point.
+    _propagator->scheduleNextJob();
+}
+
+void BulkUploadQueue::abortJob(PropagateUploadFileBulk *job)
+{
+    _queued.removeAll(job);
+
+    PutMultiFileJob *request = 0;
+    for (auto it = _requests.begin(); it != _requests.end(); ++it) {
+        if (it.value().contains(job)) {
+            request = it.key();
+            break;
+        }
+    }
+    if (!request)
+        return;
+
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0)) {
+        // All the files of the request are aborting, they get the error of the request
+        _requests[request].removeAll(job);
+        if (request->reply())
+            request->reply()->abort();
+        return;
+    }
+
+    // Only this file is aborted: drop the request and send the others again
+    const auto jobs = _requests.take(request);
+    _propagator->removeActiveJob(this);
+    disconnect(request, &PutMultiFileJob::finishedSignal, this, &BulkUploadQueue::slotRequestFinished);
+    if (request->reply())
+        request->reply()->abort();
+    request->deleteLater();
+
+    qCInfo(lcPutMultiFileJob) << "Sending the other files of the request of" << job->_item->_file << "again";
+    foreach (const auto &other, jobs) {
+        if (other && other != job)
+            enqueue(other);
+    }
+}
+
+/** The bulk endpoint is at the root of the new DAV tree, next to the files/<user>/ tree */
+static QUrl bulkUploadUrl(const AccountPtr &account)
+{
+    QString path = account->davPath();
+    const int filesIndex = path.indexOf(QLatin1String("/dav/files/"));
+    if (filesIndex >= 0) {
+        path = path.left(filesIndex);
+    } else {
+        // The old webdav path (e.g. remote.php/webdav/) is a sibling of the new DAV root
+        path.chop(1);
+        path = path.left(path.lastIndexOf(QLatin1Char('/')));
+    }
+    return Utility::concatUrlPath(account->url(), path + QLatin1String("/dav/bulk"));
+}
+
+void BulkUploadQueue::flush()
+{
+    _flushTimer.stop();
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    QVector<QPointer<PropagateUploadFileBulk>> jobs;
+    foreach (const auto &job, _queued) {
+        if (job)
+            jobs.append(job);
+    }
+    _queued.clear();
+    _queuedSize = 0;
+    if (jobs.isEmpty())
+        return;
+
+    const QByteArray boundary = "ocbulk" + QUuid::createUuid().toRfc4122().toHex();
+    QByteArray body;
+    foreach (const auto &job, jobs) {
+        body += "--" + boundary + "\r\n";
+        const auto headers = job->partHeaders();
+        for (auto it = headers.begin(); it != headers.end(); ++it) {
+            body += it.key() + ": " + it.value() + "\r\n";
+        }
+        body += "\r\n";
+        body += job->data();
+        body += "\r\n";
+    }
+    body += "--" + boundary + "--\r\n";
+
+    auto device = new UploadDevice(&_propagator->_bandwidthManager);
+    if (!device->prepareAndOpen(body)) {
+        qCWarning(lcPutMultiFileJob) << "Could not prepare bulk upload device: " << device->errorString();
+        delete device;
+        foreach (const auto &job, jobs) {
+            job->abortWithError(SyncFileItem::NormalError, tr("Could not prepare the upload"));
+        }
+        return;
+    }
+
+    const QUrl url = bulkUploadUrl(_propagator->account());
+    auto request = new PutMultiFileJob(_propagator->account(), url, device, boundary, this);
+    _requests.insert(request, jobs);
+    connect(request, &PutMultiFileJob::finishedSignal, this, &BulkUploadQueue::slotRequestFinished);
+
+    // The request as a whole counts as one active job
+    _propagator->addActiveJob(this);
+
+    qCInfo(lcPutMultiFileJob) << "Uploading" << jobs.size() << "files in one request," << body.size() << "bytes";
+    request->start();
+}
+
+void BulkUploadQueue::slotRequestFinished()
+{
+    auto request = qobject_cast<PutMultiFileJob *>(sender());
+    ASSERT(request);
+
+    const auto jobs = _requests.take(request);
+    _propagator->removeActiveJob(this);
+
+    foreach (const auto &job, jobs) {
+        if (!job)
+            continue;
+        const QString path = _propagator->_remoteFolder + job->_item->_file;
+        job->bulkUploadFinished(request, request->results().value(path).toObject());
+    }
+
+    request->deleteLater();
+    _propagator->scheduleNextJob();
+}
+}
@@ -26,15 +26,21 @@
 #include "propagateremotemove.h"
 #include "propagateremotedelete.h"
 #include "common/asserts.h"
+#include "common/checksums.h"
 
 #include <QNetworkAccessManager>
 #include <QFileInfo>
 #include <QDir>
+#include <QtConcurrent>
 #include <cmath>
 #include <cstring>
 
 namespace OCC {
 
+// UploadInfo::_chunk is not used by the new chunking, it marks delta uploads
+// which can't be resumed
+static const int deltaUploadChunkMarker = -1;
+
 QUrl PropagateUploadFileNG::chunkUrl(int chunk)
 {
     QString path = QLatin1String("remote.php/dav/uploads/")
@@ -75,15 +81,22 @@ QUrl PropagateUploadFileNG::chunkUrl(int chunk)
     |
     +-> MOVE ------> moveJobFinished() ---> finalize()
 
+  If the server supports delta sync and the journal has the block checksums of the
+  version on the server, the block checksums of the file are computed before
+  startNewUpload() (slotBlockChecksumsComputed()). startNextChunk() then only sends
+  the changed ranges and the MOVE tells the server to take the rest from that version.
+  Otherwise the block checksums are computed from the chunks as they are read, for
+  the next upload.
 
  */
 
 void PropagateUploadFileNG::doStartUpload()
 {
-    propagator()->_activeJobList.append(this);
+    propagator()->addActiveJob(this);
 
     const SyncJournalDb::UploadInfo progressInfo = propagator()->_journal->getUploadInfo(_item->_file);
-    if (progressInfo._valid && progressInfo._modtime == _item->_modtime) {
+    if (progressInfo._valid && progressInfo._modtime == _item->_modtime
+        && progressInfo._chunk != deltaUploadChunkMarker) {
         _transferId = progressInfo._transferid;
         auto url = chunkUrl();
         auto job = new LsColJob(propagator()->account(), url, this);
@@ -106,9 +119,70 @@ void PropagateUploadFileNG::doStartUpload()
         // startNewUpload will reset the _transferId and the UploadInfo in the db.
     }
 
+    if (propagator()->account()->capabilities().deltaSync()) {
+        const auto base = propagator()->_journal->getBlockChecksums(_item->_file);
+        if (base._valid && base._blockSize == blockChecksumSize
+            && !_item->_etag.isEmpty() && base._etag == _item->_etag
+            && _item->_instruction == CSYNC_INSTRUCTION_SYNC && !_deleteExisting) {
+            // Needed for a delta upload now, and stored for the next one once done
+            _deltaBaseChecksums = base._checksums;
+            const QString filePath = propagator()->getFilePath(_item->_file);
+            connect(&_blockChecksumsWatcher, &QFutureWatcherBase::finished,
+                this, &PropagateUploadFileNG::slotBlockChecksumsComputed);
+            _blockChecksumsWatcher.setFuture(QtConcurrent::run(propagator()->ioThreadPool(), [filePath] {
+                return computeBlockChecksums(filePath);
+            }));
+            return;
+        }
+        // No delta upload is possible, the chunks are read anyway
+        _collectBlockChecksums = true;
+    }
+
     startNewUpload();
 }
 
+void PropagateUploadFileNG::slotBlockChecksumsComputed()
+{
+    if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    _blockChecksums = _blockChecksumsWatcher.result();
+    const qint64 blockCount = (_item->_size + blockChecksumSize - 1) / blockChecksumSize;
+    if (_blockChecksums.size() != blockCount * 16) {
+        // Unreadable, or it changed since the discovery: upload it normally
+        _blockChecksums.clear();
+    }
+
+    if (!_blockChecksums.isEmpty()) {
+        _deltaUpload = true;
+        _deltaRanges = changedBlockRanges(_blockChecksums, _deltaBaseChecksums, _item->_size);
+        qCInfo(lcPropagateUpload) << "Delta upload of" << _item->_file << "changed ranges:" << _deltaRanges;
+    }
+    _deltaBaseChecksums.clear();
+    startNewUpload();
+}
+
+void PropagateUploadFileNG::addToBlockChecksums(quint64 offset, const QByteArray &data)
+{
+    if (offset != _blockChecksummedSize) {
+        // Not read in order, the checksums can't be completed
+        _collectBlockChecksums = false;
+        _blockChecksums.clear();
+        return;
+    }
+    int pos = 0;
+    while (pos < data.size()) {
+        const int length = int(qMin<quint64>(blockChecksumSize - _blockChecksummedSize % blockChecksumSize, data.size() - pos));
+        _blockHash.addData(data.constData() + pos, length);
+        pos += length;
+        _blockChecksummedSize += length;
+        if (_blockChecksummedSize % blockChecksumSize == 0 || _blockChecksummedSize == _item->_size) {
+            _blockChecksums += _blockHash.result();
+            _blockHash.reset();
+        }
+    }
+}
+
 void PropagateUploadFileNG::slotPropfindIterate(const QString &name, const QMap<QString, QString> &properties)
 {
     if (name == chunkUrl().path()) {
@@ -127,7 +201,7 @@ void PropagateUploadFileNG::slotPropfindFinished()
 {
     auto job = qobject_cast<LsColJob *>(sender());
     slotJobDestroyed(job); // remove it from the _jobs list
-    propagator()->_activeJobList.removeOne(this);
+    propagator()->removeActiveJob(this);
 
     _currentChunk = 0;
     _sent = 0;
@@ -151,7 +225,7 @@ void PropagateUploadFileNG::slotPropfindFinished()
 
     if (!_serverChunks.isEmpty()) {
         qCInfo(lcPropagateUpload) << "To Delete" << _serverChunks.keys();
-        propagator()->_activeJobList.append(this);
+        propagator()->addActiveJob(this);
         _removeJobError = false;
 
         // Make sure that if there is a "hole" and then a few more chunks, on the server
@@ -178,7 +252,7 @@ void PropagateUploadFileNG::slotPropfindFinishedWithError()
     auto httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
     auto status = classifyError(err, httpErrorCode, &propagator()->_anotherSyncNeeded);
     if (status == SyncFileItem::FatalError) {
-        propagator()->_activeJobList.removeOne(this);
+        propagator()->removeActiveJob(this);
         abortWithError(status, job->errorStringParsingBody());
         return;
     }
@@ -206,7 +280,7 @@ void PropagateUploadFileNG::slotDeleteJobFinished()
     }
 
     if (_jobs.isEmpty()) {
-        propagator()->_activeJobList.removeOne(this);
+        propagator()->removeActiveJob(this);
         if (_removeJobError) {
             // There was an error removing some files, just start over
             startNewUpload();
@@ -219,17 +293,27 @@ void PropagateUploadFileNG::slotDeleteJobFinished()
 
 void PropagateUploadFileNG::startNewUpload()
 {
-    ASSERT(propagator()->_activeJobList.count(this) == 1);
+    ASSERT(activeSlots() == 1);
     _transferId = qrand() ^ _item->_modtime ^ (_item->_size << 16) ^ qHash(_item->_file);
     _sent = 0;
     _currentChunk = 0;
+    if (_deltaUpload) {
+        // The blocks that did not change count as sent
+        _sent = _item->_size;
+        foreach (const auto &range, _deltaRanges) {
+            _sent -= range.second;
+        }
+    }
 
-    propagator()->reportProgress(*_item, 0);
+    propagator()->reportProgress(*_item, _sent);
 
     SyncJournalDb::UploadInfo pi;
     pi._valid = true;
     pi._transferid = _transferId;
     pi._modtime = _item->_modtime;
+    if (_deltaUpload) {
+        pi._chunk = deltaUploadChunkMarker;
+    }
     propagator()->_journal->setUploadInfo(_item->_file, pi);
     propagator()->_journal->commit("Upload info");
     QMap<QByteArray, QByteArray> headers;
@@ -244,7 +328,7 @@ void PropagateUploadFileNG::startNewUpload()
 
 void PropagateUploadFileNG::slotMkColFinished(QNetworkReply::NetworkError)
 {
-    propagator()->_activeJobList.removeOne(this);
+    propagator()->removeActiveJob(this);
     auto job = qobject_cast<MkColJob *>(sender());
     slotJobDestroyed(job); // remove it from the _jobs list
     QNetworkReply::NetworkError err = job->reply()->error();
@@ -288,21 +372,38 @@ void PropagateUploadFileNG::startNextChunk()
             headers[checkSumHeaderC] = _transmissionChecksumHeader;
         }
         headers["OC-Total-Length"] = QByteArray::number(fileSize);
+        if (_deltaUpload) {
+            // The server fills what was not uploaded from this version
+            headers["OC-Delta-Base-ETag"] = '"' + _item->_etag + '"';
+        }
 
         auto job = new MoveJob(propagator()->account(), Utility::concatUrlPath(chunkUrl(), "/.file"),
             destination, headers, this);
         _jobs.append(job);
         connect(job, &MoveJob::finishedSignal, this, &PropagateUploadFileNG::slotMoveJobFinished);
         connect(job, &QObject::destroyed, this, &PropagateUploadFileCommon::slotJobDestroyed);
-        propagator()->_activeJobList.append(this);
+        propagator()->addActiveJob(this);
         job->start();
         return;
     }
 
+    quint64 chunkOffset = _sent;
+    if (_deltaUpload) {
+        // Send the next part of the changed ranges
+        auto &range = _deltaRanges.first();
+        chunkOffset = range.first;
+        _currentChunkSize = qMin<quint64>(_currentChunkSize, range.second);
+        range.first += _currentChunkSize;
+        range.second -= _currentChunkSize;
+        if (range.second == 0) {
+            _deltaRanges.removeFirst();
+        }
+    }
+
     auto device = new UploadDevice(&propagator()->_bandwidthManager);
     const QString fileName = propagator()->getFilePath(_item->_file);
 
-    if (!device->prepareAndOpen(fileName, _sent, _currentChunkSize)) {
+    if (!device->prepareAndOpen(fileName, chunkOffset, _currentChunkSize)) {
         qCWarning(lcPropagateUpload) << "Could not prepare upload device: " << device->errorString();
 
         // If the file is currently locked, we want to retry the sync
@@ -315,8 +416,15 @@ void PropagateUploadFileNG::startNextChunk()
         return;
     }
 
+    if (_collectBlockChecksums) {
+        addToBlockChecksums(chunkOffset, device->data());
+    }
+
     QMap<QByteArray, QByteArray> headers;
-    headers["OC-Chunk-Offset"] = QByteArray::number(_sent);
+    headers["OC-Chunk-Offset"] = QByteArray::number(chunkOffset);
+    const QByteArray chunkChecksum = chunkChecksumHeader(device);
+    if (!chunkChecksum.isEmpty())
+        headers[checkSumHeaderC] = chunkChecksum;
 
     _sent += _currentChunkSize;
     QUrl url = chunkUrl(_currentChunk);
@@ -327,11 +435,9 @@ void PropagateUploadFileNG::startNextChunk()
     connect(job, &PUTFileJob::finishedSignal, this, &PropagateUploadFileNG::slotPutFinished);
     connect(job, &PUTFileJob::uploadProgress,
         this, &PropagateUploadFileNG::slotUploadProgress);
-    connect(job, &PUTFileJob::uploadProgress,
-        device, &UploadDevice::slotJobUploadProgress);
     connect(job, &QObject::destroyed, this, &PropagateUploadFileCommon::slotJobDestroyed);
     job->start();
-    propagator()->_activeJobList.append(this);
+    propagator()->addActiveJob(this);
     _currentChunk++;
 }
 
@@ -342,7 +448,7 @@ void PropagateUploadFileNG::slotPutFinished()
 
     slotJobDestroyed(job); // remove it from the _jobs list
 
-    propagator()->_activeJobList.removeOne(this);
+    propagator()->removeActiveJob(this);
 
     if (_finished) {
         // We have sent the finished signal already. We don't need to handle any remaining jobs
@@ -430,7 +536,7 @@ void PropagateUploadFileNG::slotPutFinished()
 
 void PropagateUploadFileNG::slotMoveJobFinished()
 {
-    propagator()->_activeJobList.removeOne(this);
+    propagator()->removeActiveJob(this);
     auto job = qobject_cast<MoveJob *>(sender());
     slotJobDestroyed(job); // remove it from the _jobs list
     QNetworkReply::NetworkError err = job->reply()->error();
@@ -467,6 +573,18 @@ void PropagateUploadFileNG::slotMoveJobFinished()
     }
     _item->_responseTimeStamp = job->responseTimestamp();
 
+    // With the block checksums of this version the next upload can be a delta upload
+    SyncJournalDb::BlockChecksums blockChecksums;
+    const qint64 blockCount = (_item->_size + blockChecksumSize - 1) / blockChecksumSize;
+    if (!_blockChecksums.isEmpty() && _blockChecksums.size() == blockCount * 16
+        && FileSystem::verifyFileUnchanged(propagator()->getFilePath(_item->_file), _item->_size, _item->_modtime)) {
+        blockChecksums._etag = _item->_etag;
+        blockChecksums._blockSize = blockChecksumSize;
+        blockChecksums._checksums = _blockChecksums;
+        blockChecksums._valid = true;
+    }
+    propagator()->_journal->setBlockChecksums(_item->_file, blockChecksums);
+
 #ifdef WITH_TESTING
     // performance logging
     quint64 duration = _stopWatch.stop();
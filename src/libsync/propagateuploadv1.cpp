@@ -122,16 +122,21 @@ void PropagateUploadFileV1::startNextChunk()
         delete device;
         return;
     }
+    if (!isFinalChunk) {
+        // The final chunk carries the checksum of the whole file
+        const QByteArray chunkChecksum = chunkChecksumHeader(device);
+        if (!chunkChecksum.isEmpty())
+            headers[checkSumHeaderC] = chunkChecksum;
+    }
 
     // job takes ownership of device via a QScopedPointer. Job deletes itself when finishing
     PUTFileJob *job = new PUTFileJob(propagator()->account(), propagator()->_remoteFolder + path, device, headers, _currentChunk, this);
     _jobs.append(job);
     connect(job, &PUTFileJob::finishedSignal, this, &PropagateUploadFileV1::slotPutFinished);
     connect(job, &PUTFileJob::uploadProgress, this, &PropagateUploadFileV1::slotUploadProgress);
-    connect(job, &PUTFileJob::uploadProgress, device, &UploadDevice::slotJobUploadProgress);
     connect(job, &QObject::destroyed, this, &PropagateUploadFileCommon::slotJobDestroyed);
     job->start();
-    propagator()->_activeJobList.append(this);
+    propagator()->addActiveJob(this);
     _currentChunk++;
 
     bool parallelChunkUpload = true;
@@ -160,7 +165,7 @@ void PropagateUploadFileV1::startNextChunk()
         parallelChunkUpload = false;
     }
 
-    if (parallelChunkUpload && (propagator()->_activeJobList.count() < propagator()->maximumActiveTransferJob())
+    if (parallelChunkUpload && (propagator()->activeJobCount() < propagator()->maximumActiveTransferJob())
         && _currentChunk < _chunkCount) {
         startNextChunk();
     }
@@ -176,7 +181,7 @@ void PropagateUploadFileV1::slotPutFinished()
 
     slotJobDestroyed(job); // remove it from the _jobs list
 
-    propagator()->_activeJobList.removeOne(this);
+    propagator()->removeActiveJob(this);
 
     if (_finished) {
         // We have sent the finished signal already. We don't need to handle any remaining jobs
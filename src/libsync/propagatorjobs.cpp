@@ -28,6 +28,7 @@
 #include <QDateTime>
 #include <qstack.h>
 #include <QCoreApplication>
+#include <QtConcurrent>
 
 #include <time.h>
 
@@ -45,17 +46,17 @@ QByteArray localFileIdFromFullId(const QByteArray &id)
 
 /**
  * Code inspired from Qt5's QDir::removeRecursively
- * The code will update the database in case of error.
- * If everything goes well (no error, returns true), the caller is responsible for removing the entries
- * in the database.  But in case of error, we need to remove the entries from the database of the files
- * that were deleted.
+ * Runs in the io thread pool, so it must not touch the journal: in case of error
+ * the entries that were deleted anyway are collected in result->removedOnError and
+ * the job removes them from the database. If everything goes well (returns true),
+ * the whole tree is removed from the database by the job.
  *
- * \a path is relative to propagator()->_localDir + _item->_file and should start with a slash
+ * \a path is relative to \a root and should start with a slash
  */
-bool PropagateLocalRemove::removeRecursively(const QString &path)
+bool PropagateLocalRemove::removeRecursively(const QString &root, const QString &path, RemoveResult *result)
 {
     bool success = true;
-    QString absolute = propagator()->_localDir + _item->_file + path;
+    QString absolute = root + path;
     QDirIterator di(absolute, QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot);
 
     QVector<QPair<QString, bool>> deleted;
@@ -68,20 +69,19 @@ bool PropagateLocalRemove::removeRecursively(const QString &path)
         // we never want to go into this branch for .lnk files
         bool isDir = fi.isDir() && !fi.isSymLink();
         if (isDir) {
-            ok = removeRecursively(path + QLatin1Char('/') + di.fileName()); // recursive
+            ok = removeRecursively(root, path + QLatin1Char('/') + di.fileName(), result); // recursive
         } else {
             QString removeError;
             ok = FileSystem::remove(di.filePath(), &removeError);
             if (!ok) {
-                _error += PropagateLocalRemove::tr("Error removing '%1': %2;").arg(QDir::toNativeSeparators(di.filePath()), removeError) + " ";
+                result->error += PropagateLocalRemove::tr("Error removing '%1': %2;").arg(QDir::toNativeSeparators(di.filePath()), removeError) + " ";
                 qCWarning(lcPropagateLocalRemove) << "Error removing " << di.filePath() << ':' << removeError;
             }
         }
         if (success && !ok) {
-            // We need to delete the entries from the database now from the deleted vector
+            // The entries in the deleted vector need to be deleted from the database now
             foreach (const auto &it, deleted) {
-                propagator()->_journal->deleteFileRecord(_item->_originalFile + path + QLatin1Char('/') + it.first,
-                    it.second);
+                result->removedOnError.append(qMakePair(path + QLatin1Char('/') + it.first, it.second));
             }
             success = false;
             deleted.clear();
@@ -91,15 +91,14 @@ bool PropagateLocalRemove::removeRecursively(const QString &path)
         }
         if (!success && ok) {
             // This succeeded, so we need to delete it from the database now because the caller won't
-            propagator()->_journal->deleteFileRecord(_item->_originalFile + path + QLatin1Char('/') + di.fileName(),
-                isDir);
+            result->removedOnError.append(qMakePair(path + QLatin1Char('/') + di.fileName(), isDir));
         }
     }
     if (success) {
         success = QDir().rmdir(absolute);
         if (!success) {
-            _error += PropagateLocalRemove::tr("Could not remove folder '%1'")
-                          .arg(QDir::toNativeSeparators(absolute))
+            result->error += PropagateLocalRemove::tr("Could not remove folder '%1'")
+                                 .arg(QDir::toNativeSeparators(absolute))
                 + " ";
             qCWarning(lcPropagateLocalRemove) << "Error removing folder" << absolute;
         }
@@ -107,6 +106,21 @@ bool PropagateLocalRemove::removeRecursively(const QString &path)
     return success;
 }
 
+PropagateLocalRemove::RemoveResult PropagateLocalRemove::removeNow(const QString &filename, bool isDirectory)
+{
+    RemoveResult result;
+    if (isDirectory) {
+        if (QDir(filename).exists()) {
+            result.success = removeRecursively(filename, QString(), &result);
+        }
+    } else {
+        if (FileSystem::fileExists(filename)) {
+            result.success = FileSystem::remove(filename, &result.error);
+        }
+    }
+    return result;
+}
+
 void PropagateLocalRemove::start()
 {
     if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
@@ -121,55 +135,88 @@ void PropagateLocalRemove::start()
         return;
     }
 
-    if (_item->isDirectory()) {
-        if (QDir(filename).exists() && !removeRecursively(QString())) {
-            done(SyncFileItem::NormalError, _error);
-            return;
-        }
-    } else {
-        QString removeError;
-        if (FileSystem::fileExists(filename)
-            && !FileSystem::remove(filename, &removeError)) {
-            done(SyncFileItem::NormalError, removeError);
-            return;
-        }
+    propagator()->addActiveJob(this);
+    connect(&_watcher, &QFutureWatcherBase::finished, this, &PropagateLocalRemove::slotRemoveDone);
+    _watcher.setFuture(QtConcurrent::run(propagator()->ioThreadPool(),
+        &PropagateLocalRemove::removeNow, filename, _item->isDirectory()));
+}
+
+void PropagateLocalRemove::slotRemoveDone()
+{
+    propagator()->removeActiveJob(this);
+    const RemoveResult result = _watcher.result();
+
+    foreach (const auto &it, result.removedOnError) {
+        propagator()->_journal->deleteFileRecord(_item->_originalFile + it.first, it.second);
     }
+    if (!result.success) {
+        done(SyncFileItem::NormalError, result.error);
+        return;
+    }
+
     propagator()->reportProgress(*_item, 0);
     propagator()->_journal->deleteFileRecord(_item->_originalFile, _item->isDirectory());
     propagator()->_journal->commit("Local remove");
     done(SyncFileItem::Success);
 }
 
-void PropagateLocalMkdir::start()
+QString PropagateLocalMkdir::mkdirNow(const QString &localDir, const QString &file, bool deleteExistingFile)
 {
-    if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
-        return;
-
-    QDir newDir(propagator()->getFilePath(_item->_file));
-    QString newDirStr = QDir::toNativeSeparators(newDir.path());
+    const QString newDirStr = QDir::toNativeSeparators(localDir + file);
 
     // When turning something that used to be a file into a directory
     // we need to delete the file first.
     QFileInfo fi(newDirStr);
-    if (_deleteExistingFile && fi.exists() && fi.isFile()) {
+    if (deleteExistingFile && fi.exists() && fi.isFile()) {
         QString removeError;
         if (!FileSystem::remove(newDirStr, &removeError)) {
-            done(SyncFileItem::NormalError,
-                tr("could not delete file %1, error: %2")
-                    .arg(newDirStr, removeError));
-            return;
+            return PropagateLocalMkdir::tr("could not delete file %1, error: %2")
+                .arg(newDirStr, removeError);
         }
     }
 
-    if (Utility::fsCasePreserving() && propagator()->localFileNameClash(_item->_file)) {
+    if (!QDir(localDir).mkpath(file)) {
+        return PropagateLocalMkdir::tr("could not create folder %1").arg(newDirStr);
+    }
+    return QString();
+}
+
+void PropagateLocalMkdir::start()
+{
+    if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    QDir newDir(propagator()->getFilePath(_item->_file));
+    QString newDirStr = QDir::toNativeSeparators(newDir.path());
+
+    // If an existing file is going to be deleted the clash check
+    // has to wait until it's gone.
+    if (!_deleteExistingFile && Utility::fsCasePreserving() && propagator()->localFileNameClash(_item->_file)) {
         qCWarning(lcPropagateLocalMkdir) << "New folder to create locally already exists with different case:" << _item->_file;
         done(SyncFileItem::NormalError, tr("Attention, possible case sensitivity clash with %1").arg(newDirStr));
         return;
     }
     emit propagator()->touchedFile(newDirStr);
-    QDir localDir(propagator()->_localDir);
-    if (!localDir.mkpath(_item->_file)) {
-        done(SyncFileItem::NormalError, tr("could not create folder %1").arg(newDirStr));
+
+    propagator()->addActiveJob(this);
+    connect(&_watcher, &QFutureWatcherBase::finished, this, &PropagateLocalMkdir::slotMkdirDone);
+    _watcher.setFuture(QtConcurrent::run(propagator()->ioThreadPool(),
+        &PropagateLocalMkdir::mkdirNow, propagator()->_localDir, _item->_file, _deleteExistingFile));
+}
+
+void PropagateLocalMkdir::slotMkdirDone()
+{
+    propagator()->removeActiveJob(this);
+    const QString error = _watcher.result();
+    if (!error.isEmpty()) {
+        done(SyncFileItem::NormalError, error);
+        return;
+    }
+
+    const QString newDirStr = QDir::toNativeSeparators(propagator()->getFilePath(_item->_file));
+    if (_deleteExistingFile && Utility::fsCasePreserving() && propagator()->localFileNameClash(_item->_file)) {
+        qCWarning(lcPropagateLocalMkdir) << "New folder to create locally already exists with different case:" << _item->_file;
+        done(SyncFileItem::NormalError, tr("Attention, possible case sensitivity clash with %1").arg(newDirStr));
         return;
     }
 
@@ -194,6 +241,16 @@ void PropagateLocalMkdir::setDeleteExistingFile(bool enabled)
     _deleteExistingFile = enabled;
 }
 
+QString PropagateLocalRename::renameNow(const QString &existingFile, const QString &targetFile)
+{
+    QString renameError;
+    if (!FileSystem::rename(existingFile, targetFile, &renameError)) {
+        // An empty error would mean success to the caller
+        return renameError.isEmpty() ? PropagateLocalRename::tr("Could not rename %1").arg(existingFile) : renameError;
+    }
+    return QString();
+}
+
 void PropagateLocalRename::start()
 {
     if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
@@ -204,33 +261,52 @@ void PropagateLocalRename::start()
 
     // if the file is a file underneath a moved dir, the _item->file is equal
     // to _item->renameTarget and the file is not moved as a result.
-    if (_item->_file != _item->_renameTarget) {
-        propagator()->reportProgress(*_item, 0);
-        qCDebug(lcPropagateLocalRename) << "MOVE " << existingFile << " => " << targetFile;
-
-        if (QString::compare(_item->_file, _item->_renameTarget, Qt::CaseInsensitive) != 0
-            && propagator()->localFileNameClash(_item->_renameTarget)) {
-            // Only use localFileNameClash for the destination if we know that the source was not
-            // the one conflicting  (renaming  A.txt -> a.txt is OK)
-
-            // Fixme: the file that is the reason for the clash could be named here,
-            // it would have to come out the localFileNameClash function
-            done(SyncFileItem::NormalError,
-                tr("File %1 can not be renamed to %2 because of a local file name clash")
-                    .arg(QDir::toNativeSeparators(_item->_file))
-                    .arg(QDir::toNativeSeparators(_item->_renameTarget)));
-            return;
-        }
+    if (_item->_file == _item->_renameTarget) {
+        updateMetadata();
+        return;
+    }
 
-        emit propagator()->touchedFile(existingFile);
-        emit propagator()->touchedFile(targetFile);
-        QString renameError;
-        if (!FileSystem::rename(existingFile, targetFile, &renameError)) {
-            done(SyncFileItem::NormalError, renameError);
-            return;
-        }
+    propagator()->reportProgress(*_item, 0);
+    qCDebug(lcPropagateLocalRename) << "MOVE " << existingFile << " => " << targetFile;
+
+    if (QString::compare(_item->_file, _item->_renameTarget, Qt::CaseInsensitive) != 0
+        && propagator()->localFileNameClash(_item->_renameTarget)) {
+        // Only use localFileNameClash for the destination if we know that the source was not
+        // the one conflicting  (renaming  A.txt -> a.txt is OK)
+
+        // Fixme: the file that is the reason for the clash could be named here,
+        // it would have to come out the localFileNameClash function
+        done(SyncFileItem::NormalError,
+            tr("File %1 can not be renamed to %2 because of a local file name clash")
+                .arg(QDir::toNativeSeparators(_item->_file))
+                .arg(QDir::toNativeSeparators(_item->_renameTarget)));
+        return;
     }
 
+    emit propagator()->touchedFile(existingFile);
+    emit propagator()->touchedFile(targetFile);
+
+    propagator()->addActiveJob(this);
+    connect(&_watcher, &QFutureWatcherBase::finished, this, &PropagateLocalRename::slotRenameDone);
+    _watcher.setFuture(QtConcurrent::run(propagator()->ioThreadPool(),
+        &PropagateLocalRename::renameNow, existingFile, targetFile));
+}
+
+void PropagateLocalRename::slotRenameDone()
+{
+    propagator()->removeActiveJob(this);
+    const QString renameError = _watcher.result();
+    if (!renameError.isEmpty()) {
+        done(SyncFileItem::NormalError, renameError);
+        return;
+    }
+    updateMetadata();
+}
+
+void PropagateLocalRename::updateMetadata()
+{
+    QString targetFile = propagator()->getFilePath(_item->_renameTarget);
+
     SyncJournalFileRecord oldRecord;
     propagator()->_journal->getFileRecord(_item->_originalFile, &oldRecord);
     propagator()->_journal->deleteFileRecord(_item->_originalFile);
@@ -17,6 +17,7 @@
 
 #include "owncloudpropagator.h"
 #include <QFile>
+#include <QFutureWatcher>
 
 namespace OCC {
 
@@ -40,10 +41,29 @@ public:
     {
     }
     void start() Q_DECL_OVERRIDE;
+    // The removal runs in the io thread pool, a later rename, mkdir or download
+    // onto the same path must not start before it is done
+    JobParallelism parallelism() Q_DECL_OVERRIDE { return WaitForFinished; }
+    bool isLikelyFinishedQuickly() Q_DECL_OVERRIDE { return !_item->isDirectory(); }
+
+    /** Outcome of the removal, computed in the io thread pool */
+    struct RemoveResult
+    {
+        bool success = true;
+        QString error;
+        /// Entries that were removed although the removal as a whole failed:
+        /// path relative to the item, and whether it was a directory
+        QVector<QPair<QString, bool>> removedOnError;
+    };
+
+private slots:
+    void slotRemoveDone();
 
 private:
-    bool removeRecursively(const QString &path);
-    QString _error;
+    static RemoveResult removeNow(const QString &filename, bool isDirectory);
+    static bool removeRecursively(const QString &root, const QString &path, RemoveResult *result);
+
+    QFutureWatcher<RemoveResult> _watcher;
 };
 
 /**
@@ -69,8 +89,16 @@ public:
      */
     void setDeleteExistingFile(bool enabled);
 
+    bool isLikelyFinishedQuickly() Q_DECL_OVERRIDE { return true; }
+
+private slots:
+    void slotMkdirDone();
+
 private:
+    static QString mkdirNow(const QString &localDir, const QString &file, bool deleteExistingFile);
+
     bool _deleteExistingFile;
+    QFutureWatcher<QString> _watcher;
 };
 
 /**
@@ -86,6 +114,18 @@ public:
     {
     }
     void start() Q_DECL_OVERRIDE;
-    JobParallelism parallelism() Q_DECL_OVERRIDE { return _item->isDirectory() ? WaitForFinished : FullParallelism; }
+    // The removals of directories are scheduled after the moves out of them,
+    // they must not start before those are done
+    JobParallelism parallelism() Q_DECL_OVERRIDE { return WaitForFinished; }
+    bool isLikelyFinishedQuickly() Q_DECL_OVERRIDE { return true; }
+
+private slots:
+    void slotRenameDone();
+
+private:
+    static QString renameNow(const QString &existingFile, const QString &targetFile);
+    void updateMetadata();
+
+    QFutureWatcher<QString> _watcher;
 };
 }
@@ -56,7 +56,7 @@ namespace OCC {
 Q_LOGGING_CATEGORY(lcEngine, "sync.engine", QtInfoMsg)
 
 static const int s_touchedFilesMaxAgeMs = 15 * 1000;
-bool SyncEngine::s_anySyncRunning = false;
+int SyncEngine::s_runningSyncCount = 0;
 
 qint64 SyncEngine::minimumFileAgeForUpload = 2000;
 
@@ -75,7 +75,9 @@ SyncEngine::SyncEngine(AccountPtr account, const QString &localPath,
     , _backInTimeFiles(0)
     , _uploadLimit(0)
     , _downloadLimit(0)
+    , _checksum_hook(journal)
     , _anotherSyncNeeded(NoFollowUpSync)
+    , _touchedFiles(s_touchedFilesMaxAgeMs)
 {
     qRegisterMetaType<SyncFileItem>("SyncFileItem");
     qRegisterMetaType<SyncFileItemPtr>("SyncFileItemPtr");
@@ -743,12 +745,13 @@ void SyncEngine::startSync()
         }
     }
 
-    if (s_anySyncRunning || _syncRunning) {
+    if (_syncRunning) {
         ASSERT(false);
         return;
     }
 
-    s_anySyncRunning = true;
+    s_runningSyncCount++;
+    qCInfo(lcEngine) << "Starting sync," << s_runningSyncCount << "syncs running";
     _syncRunning = true;
     _anotherSyncNeeded = NoFollowUpSync;
     _clearTouchedFilesTimer.stop();
@@ -814,6 +817,9 @@ void SyncEngine::startSync()
 
     _csync_ctx->read_remote_from_db = true;
     _lastLocalDiscoveryStyle = _csync_ctx->local_discovery_style;
+    if (_partialSync) {
+        qCInfo(lcEngine) << "Partial sync of" << _csync_ctx->locally_touched_dirs.size() << "locally touched paths";
+    }
 
     bool ok;
     auto selectiveSyncBlackList = _journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList, &ok);
@@ -894,6 +900,15 @@ void SyncEngine::slotFolderDiscovered(bool /*local*/, const QString &folder)
 
 void SyncEngine::slotRootEtagReceived(const QString &e)
 {
+    if (_partialSync && !_partialSyncRootEtag.isEmpty()) {
+        // The first etag of the discovery is the one of the root
+        if (e != _partialSyncRootEtag) {
+            qCInfo(lcEngine) << "Root etag changed from" << _partialSyncRootEtag << "to" << e
+                             << "the partial sync needs a full follow-up sync";
+            _anotherSyncNeeded = ImmediateFollowUp;
+        }
+        _partialSyncRootEtag.clear();
+    }
     if (_remoteRootEtag.isEmpty()) {
         qCDebug(lcEngine) << "Root etag:" << e;
         _remoteRootEtag = e;
@@ -981,7 +996,8 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
         }
     }
 
-    if (!_hasNoneFiles && _hasRemoveFile) {
+    // A partial sync doesn't see the rest of the folder
+    if (!_hasNoneFiles && _hasRemoveFile && !_partialSync) {
         qCInfo(lcEngine) << "All the files are going to be changed, asking the user";
         bool cancel = false;
         emit aboutToRemoveAllFiles(syncItems.first()->_direction, &cancel);
@@ -1020,6 +1036,13 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     // make sure everything is allowed
     checkForPermission(syncItems);
 
+    // Saved before the propagation, which removes the listings of the
+    // directories it deletes. The ones of the directories it changes no
+    // longer match their modification time.
+    if (!_csync_ctx->new_local_dir_listings.isEmpty()) {
+        _journal->setLocalDirListings(_csync_ctx->new_local_dir_listings);
+    }
+
     // Re-init the csync context to free memory
     _csync_ctx->reinitialize();
 
@@ -1062,10 +1085,13 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     // apply the network limits to the propagator
     setNetworkLimits(_uploadLimit, _downloadLimit);
 
-    deleteStaleDownloadInfos(syncItems);
-    deleteStaleUploadInfos(syncItems);
-    deleteStaleErrorBlacklistEntries(syncItems);
-    _journal->commit("post stale entry removal");
+    // A partial sync doesn't know whether the entries outside of its paths are stale
+    if (!_partialSync) {
+        deleteStaleDownloadInfos(syncItems);
+        deleteStaleUploadInfos(syncItems);
+        deleteStaleErrorBlacklistEntries(syncItems);
+        _journal->commit("post stale entry removal");
+    }
 
     // Emit the started signal only after the propagator has been set up.
     if (_needsUpdate)
@@ -1124,7 +1150,8 @@ void SyncEngine::slotFinished(bool success)
     }
 
     // emit the treewalk results.
-    if (!_journal->postSyncCleanup(_seenFiles, _temporarilyUnavailablePaths)) {
+    // After a partial sync the next full one cleans up, only the synced paths were seen.
+    if (!_partialSync && !_journal->postSyncCleanup(_seenFiles, _temporarilyUnavailablePaths)) {
         qCDebug(lcEngine) << "Cleaning of synced ";
     }
 
@@ -1147,11 +1174,17 @@ void SyncEngine::finalize(bool success)
 
     _csync_ctx->reinitialize();
     _journal->close();
+    _partialSync = false;
+    _partialSyncRootEtag.clear();
 
     qCInfo(lcEngine) << "CSync run took " << _stopWatch.addLapTime(QLatin1String("Sync Finished")) << "ms";
     _stopWatch.stop();
 
-    s_anySyncRunning = false;
+    const auto checksumStats = ChecksumThreadPool::instance()->stats();
+    qCInfo(lcEngine) << "Checksums computed so far:" << checksumStats.files << "files," << checksumStats.bytes
+                     << "bytes in" << checksumStats.msecs << "ms, still queued:" << checksumStats.queued;
+
+    s_runningSyncCount--;
     _syncRunning = false;
     emit finished(success);
 
@@ -1523,25 +1556,7 @@ void SyncEngine::slotAddTouchedFile(const QString &fn)
 {
     QElapsedTimer now;
     now.start();
-    QString file = QDir::cleanPath(fn);
-
-    // Iterate from the oldest and remove anything older than 15 seconds.
-    while (true) {
-        auto first = _touchedFiles.begin();
-        if (first == _touchedFiles.end())
-            break;
-        // Compare to our new QElapsedTimer instead of using elapsed().
-        // This avoids querying the current time from the OS for every loop.
-        if (now.msecsSinceReference() - first.key().msecsSinceReference() <= s_touchedFilesMaxAgeMs) {
-            // We found the first path younger than 15 second, keep the rest.
-            break;
-        }
-
-        _touchedFiles.erase(first);
-    }
-
-    // This should be the largest QElapsedTimer yet, use constEnd() as hint.
-    _touchedFiles.insert(_touchedFiles.constEnd(), now, file);
+    _touchedFiles.insert(QDir::cleanPath(fn), now.msecsSinceReference());
 }
 
 void SyncEngine::slotClearTouchedFiles()
@@ -1551,13 +1566,9 @@ void SyncEngine::slotClearTouchedFiles()
 
 bool SyncEngine::wasFileTouched(const QString &fn) const
 {
-    // Start from the end (most recent) and look for our path. Check the time just in case.
-    auto begin = _touchedFiles.constBegin();
-    for (auto it = _touchedFiles.constEnd(); it != begin; --it) {
-        if ((it-1).value() == fn)
-            return (it-1).key().elapsed() <= s_touchedFilesMaxAgeMs;
-    }
-    return false;
+    QElapsedTimer now;
+    now.start();
+    return _touchedFiles.contains(fn, now.msecsSinceReference());
 }
 
 AccountPtr SyncEngine::account() const
@@ -1565,12 +1576,20 @@ AccountPtr SyncEngine::account() const
     return _account;
 }
 
-void SyncEngine::setLocalDiscoveryOptions(LocalDiscoveryStyle style, std::set<QByteArray> dirs)
+void SyncEngine::setLocalDiscoveryOptions(LocalDiscoveryStyle style, PathTrie dirs)
 {
     _csync_ctx->local_discovery_style = style;
     _csync_ctx->locally_touched_dirs = std::move(dirs);
 }
 
+void SyncEngine::setPartialSync(const QString &expectedRootEtag)
+{
+    ASSERT(!_syncRunning);
+    _partialSync = true;
+    _partialSyncRootEtag = expectedRootEtag;
+    _csync_ctx->partial_discovery = true;
+}
+
 void SyncEngine::abort()
 {
     if (_propagator)
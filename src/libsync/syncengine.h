@@ -40,6 +40,8 @@
 #include "accountfwd.h"
 #include "discoveryphase.h"
 #include "common/checksums.h"
+#include "common/pathtrie.h"
+#include "common/expiringpathset.h"
 
 class QProcess;
 
@@ -104,19 +106,35 @@ public:
     /**
      * Control whether local discovery should read from filesystem or db.
      *
-     * If style is Partial, the paths is a set of file paths relative to
-     * the synced folder. All the parent directories of these paths will not
-     * be read from the db and scanned on the filesystem.
+     * If style is DatabaseAndFilesystem, dirs holds the paths relative to
+     * the synced folder that will not be read from the db but scanned on the
+     * filesystem, together with their parent directories and everything
+     * below them. For directories marked with PathTrie::insertDirectory()
+     * only their direct entries are scanned.
      *
      * Note, the style and paths are only retained for the next sync and
      * revert afterwards. Use _lastLocalDiscoveryStyle to discover the last
      * sync's style.
      */
-    void setLocalDiscoveryOptions(LocalDiscoveryStyle style, std::set<QByteArray> dirs = {});
+    void setLocalDiscoveryOptions(LocalDiscoveryStyle style, PathTrie dirs = {});
 
     /** Access the last sync run's local discovery style */
     LocalDiscoveryStyle lastLocalDiscoveryStyle() const { return _lastLocalDiscoveryStyle; }
 
+    /**
+     * Restricts the next sync to the paths given to setLocalDiscoveryOptions().
+     *
+     * Only these paths, their parent directories and everything below them
+     * are discovered, reconciled and propagated, locally and remotely. This
+     * is only correct if nothing changed elsewhere: the file watcher must have
+     * reported all the local changes and the server's root etag must still be
+     * expectedRootEtag. If the discovery sees another root etag, the paths are
+     * synced anyway and an immediate follow-up sync is requested.
+     *
+     * Like the local discovery options, this only applies to the next sync.
+     */
+    void setPartialSync(const QString &expectedRootEtag);
+
 signals:
     void csyncUnavailable();
 
@@ -171,7 +189,7 @@ private slots:
     /** Records that a file was touched by a job. */
     void slotAddTouchedFile(const QString &fn);
 
-    /** Wipes the _touchedFiles hash */
+    /** Wipes the _touchedFiles set */
     void slotClearTouchedFiles();
 
     /** Emit a summary error, unless it was seen before */
@@ -204,7 +222,7 @@ private:
     // cleanup and emit the finished signal
     void finalize(bool success);
 
-    static bool s_anySyncRunning; //true when one sync is running somewhere (for debugging)
+    static int s_runningSyncCount; // the number of syncs running in parallel (for debugging)
 
     // Must only be acessed during update and reconcile
     QMap<QString, SyncFileItemPtr> _syncItemMap;
@@ -216,6 +234,10 @@ private:
     QString _localPath;
     QString _remotePath;
     QString _remoteRootEtag;
+
+    // See setPartialSync(), reset when the sync is finalized
+    bool _partialSync = false;
+    QString _partialSyncRootEtag; // cleared once the root etag was checked
     SyncJournalDb *_journal;
     QPointer<DiscoveryMainThread> _discoveryMainThread;
     QSharedPointer<OwncloudPropagator> _propagator;
@@ -280,8 +302,8 @@ private:
 
     AnotherSyncNeeded _anotherSyncNeeded;
 
-    /** Stores the time since a job touched a file. */
-    QMultiMap<QElapsedTimer, QString> _touchedFiles;
+    /** The files touched by jobs, each for s_touchedFilesMaxAgeMs. */
+    ExpiringPathSet _touchedFiles;
 
     /** For clearing the _touchedFiles variable after sync finished */
     QTimer _clearTouchedFilesTimer;
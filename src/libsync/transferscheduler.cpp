@@ -0,0 +1,154 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "transferscheduler.h"
+#include "owncloudpropagator.h"
+#include "account.h"
+
+#include <QLoggingCategory>
+#include <QTimer>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcTransferScheduler, "sync.transferscheduler", QtInfoMsg)
+
+TransferScheduler::TransferScheduler(Account *account)
+    : QObject(account)
+    , _account(account)
+{
+}
+
+int TransferScheduler::budget() const
+{
+    static int max = qgetenv("OWNCLOUD_MAX_PARALLEL").toUInt();
+    if (max)
+        return max;
+    if (_account->isHttp2Supported())
+        return 20;
+    return 6; // (Qt cannot do more anyway)
+}
+
+void TransferScheduler::registerPropagator(OwncloudPropagator *propagator, bool interactive)
+{
+    if (find(propagator))
+        return;
+    _entries.append(Entry{ propagator, interactive, true });
+    qCInfo(lcTransferScheduler) << "Sync of" << propagator->_localDir << "joined,"
+                                << (interactive ? "interactive," : "background,")
+                                << _entries.size() << "running, fair share" << fairShare(_entries.last())
+                                << "of" << budget();
+    schedulePublish();
+}
+
+void TransferScheduler::unregisterPropagator(OwncloudPropagator *propagator)
+{
+    for (int i = 0; i < _entries.size(); ++i) {
+        if (_entries[i].propagator == propagator) {
+            _entries.remove(i);
+            break;
+        }
+    }
+    // The others can use the freed share
+    activeJobsChanged(propagator, true);
+}
+
+const TransferScheduler::Entry *TransferScheduler::find(const OwncloudPropagator *propagator) const
+{
+    for (const auto &entry : _entries) {
+        if (entry.propagator == propagator)
+            return &entry;
+    }
+    return 0;
+}
+
+int TransferScheduler::fairShare(const Entry &entry) const
+{
+    int totalWeight = 0;
+    for (const auto &e : _entries)
+        totalWeight += e.interactive ? 2 : 1;
+    const int weight = entry.interactive ? 2 : 1;
+    return qMax(1, budget() * weight / qMax(1, totalWeight));
+}
+
+int TransferScheduler::slotLimit(const OwncloudPropagator *propagator) const
+{
+    const Entry *entry = find(propagator);
+    if (!entry)
+        return budget();
+
+    // The unused shares of the propagators that have nothing to do can be borrowed
+    int used = 0;
+    int reserved = 0;
+    for (const auto &e : _entries) {
+        const int active = e.propagator->activeJobCount();
+        used += active;
+        if (&e != entry && e.waiting)
+            reserved += qMax(0, fairShare(e) - active);
+    }
+    const int spare = qMax(0, budget() - used - reserved);
+    return qMax(fairShare(*entry), propagator->activeJobCount() + spare);
+}
+
+void TransferScheduler::setWaiting(OwncloudPropagator *propagator, bool waiting)
+{
+    for (auto &entry : _entries) {
+        if (entry.propagator == propagator) {
+            entry.waiting = waiting;
+            return;
+        }
+    }
+}
+
+void TransferScheduler::activeJobsChanged(OwncloudPropagator *propagator, bool finished)
+{
+    schedulePublish();
+    if (!finished)
+        return;
+
+    // Wake up the others that wait for a slot, the interactive ones first
+    for (int pass = 0; pass < 2; ++pass) {
+        for (const auto &entry : _entries) {
+            if (entry.propagator != propagator && entry.waiting && entry.interactive == (pass == 0))
+                entry.propagator->scheduleNextJob();
+        }
+    }
+}
+
+QVector<TransferShare> TransferScheduler::shares() const
+{
+    QVector<TransferShare> result;
+    for (const auto &entry : _entries) {
+        TransferShare share;
+        share._localPath = entry.propagator->_localDir;
+        share._interactive = entry.interactive;
+        share._activeJobs = entry.propagator->activeJobCount();
+        share._slotLimit = slotLimit(entry.propagator);
+        result.append(share);
+    }
+    return result;
+}
+
+void TransferScheduler::schedulePublish()
+{
+    // Jobs start and finish in bursts, one update per event loop iteration is enough
+    if (_publishScheduled)
+        return;
+    _publishScheduled = true;
+    QTimer::singleShot(0, this, &TransferScheduler::publishShares);
+}
+
+void TransferScheduler::publishShares()
+{
+    _publishScheduled = false;
+    ProgressDispatcher::instance()->setTransferShares(_account, shares());
+}
+}
@@ -0,0 +1,95 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef TRANSFERSCHEDULER_H
+#define TRANSFERSCHEDULER_H
+
+#include "owncloudlib.h"
+#include "progressdispatcher.h"
+
+#include <QObject>
+#include <QVector>
+
+namespace OCC {
+
+class Account;
+class OwncloudPropagator;
+
+/**
+ * @brief Shares the parallel network jobs of an account between its syncs
+ * @ingroup libsync
+ *
+ * All the folders of an account talk to the same server over the same
+ * connections, so the propagators of concurrent syncs take their job slots
+ * from one budget per account instead of each using the full parallelism.
+ *
+ * Every running propagator is guaranteed its fair share of the budget.
+ * Interactive syncs (the user just changed files or forced the sync) weigh
+ * twice as much as background ones. Slots that a propagator doesn't use
+ * can be borrowed by the others; when it needs them again it gets them as
+ * soon as the borrowed jobs finish, since the borrowers are then limited to
+ * their own share.
+ *
+ * The bandwidth limits need no sharing here: the BandwidthManager token
+ * buckets are already common to all the transfers of the process.
+ */
+class OWNCLOUDSYNC_EXPORT TransferScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TransferScheduler(Account *account);
+
+    /** The number of network jobs the syncs of the account may run in parallel */
+    int budget() const;
+
+    void registerPropagator(OwncloudPropagator *propagator, bool interactive);
+    void unregisterPropagator(OwncloudPropagator *propagator);
+
+    /** The number of jobs the propagator may have active right now */
+    int slotLimit(const OwncloudPropagator *propagator) const;
+
+    /** Whether the propagator has jobs waiting for a slot
+     *
+     * Only waiting propagators keep their unused share reserved.
+     */
+    void setWaiting(OwncloudPropagator *propagator, bool waiting);
+
+    /** To be called when a job of the propagator started or finished
+     *
+     * A finished job may free a slot for another propagator, which is woken up.
+     */
+    void activeJobsChanged(OwncloudPropagator *propagator, bool finished);
+
+    QVector<TransferShare> shares() const;
+
+private slots:
+    void publishShares();
+
+private:
+    struct Entry
+    {
+        OwncloudPropagator *propagator;
+        bool interactive;
+        bool waiting;
+    };
+
+    const Entry *find(const OwncloudPropagator *propagator) const;
+    int fairShare(const Entry &entry) const;
+    void schedulePublish();
+
+    Account *_account;
+    QVector<Entry> _entries;
+    bool _publishScheduled = false;
+};
+}
+
+#endif // TRANSFERSCHEDULER_H
@@ -0,0 +1,61 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "common/checksums.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+
+using namespace OCC;
+
+// Reports the throughput of each checksum type, once over a buffer in memory
+// and once over a file through ComputeChecksum::computeNow().
+// Run with OWNCLOUD_DISABLE_CHECKSUM_SIMD=1 to compare with the portable code.
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    const int dataSize = 256 * 1000 * 1000;
+    QByteArray data(dataSize, Qt::Uninitialized);
+    for (int i = 0; i < dataSize; ++i)
+        data[i] = char(i * 7 + i / 4096);
+
+    auto report = [](const char *what, const QByteArray &type, qint64 elapsed) {
+        elapsed = qMax(qint64(1), elapsed);
+        qDebug() << what << type << elapsed << "ms"
+                 << QByteArray::number(double(dataSize) / elapsed / 1000 / 1000, 'f', 2) << "GB/s";
+    };
+
+    QElapsedTimer timer;
+    timer.start();
+    QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+    report("MEMORY:", checkSumSHA1C, timer.restart());
+    QCryptographicHash::hash(data, QCryptographicHash::Md5);
+    report("MEMORY:", checkSumMD5C, timer.restart());
+    adler32Update(1, data.constData(), data.size());
+    report("MEMORY:", checkSumAdlerC, timer.restart());
+    crc32cUpdate(0, data.constData(), data.size());
+    report("MEMORY:", checkSumCrc32cC, timer.restart());
+
+    QTemporaryDir dir;
+    QFile file(dir.path() + "/data");
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != dataSize)
+        return -1;
+    file.close();
+
+    bool result = true;
+    foreach (const char *type, QList<const char *>() << checkSumSHA1C << checkSumMD5C << checkSumAdlerC << checkSumCrc32cC) {
+        timer.restart();
+        result = result && !ComputeChecksum::computeNow(file.fileName(), type).isEmpty();
+        report("FILE:", type, timer.elapsed());
+    }
+    return result ? 0 : -1;
+}
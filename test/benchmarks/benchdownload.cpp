@@ -0,0 +1,40 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+
+using namespace OCC;
+
+// Downloads a few large files from the fake server and reports the throughput
+// of writing them. Pass --drop-cache to drop the written data from the page cache.
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    if (app.arguments().contains("--drop-cache"))
+        qputenv("OWNCLOUD_DOWNLOAD_DROP_CACHE", "1");
+
+    const int numFiles = 4;
+    const int fileSize = 256 * 1000 * 1000;
+
+    FakeFolder fakeFolder{FileInfo{}};
+    for (int i = 0; i < numFiles; ++i)
+        fakeFolder.remoteModifier().insert(QString("large%1").arg(i), fileSize, 'A' + i);
+
+    QElapsedTimer timer;
+    timer.start();
+    bool result = fakeFolder.syncOnce();
+    const qint64 elapsed = qMax(qint64(1), timer.elapsed());
+    qDebug() << "DOWNLOAD: " << result << elapsed << "ms"
+             << (qint64(numFiles) * fileSize / 1000 / elapsed) << "MB/s";
+
+    for (int i = 0; i < numFiles; ++i) {
+        QFileInfo fi(fakeFolder.localPath() + QString("large%1").arg(i));
+        result = result && fi.size() == fileSize;
+    }
+    return result ? 0 : -1;
+}
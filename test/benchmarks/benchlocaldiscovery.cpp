@@ -0,0 +1,85 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "vio/csync_vio.h"
+#include "vio/csync_vio_local.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+
+#include <unistd.h>
+
+// Walks a local tree the way the local discovery reads it, and reports how
+// long that takes with a cold and with a warm cache.
+//
+// Usage: LocalDiscoveryBench [directory]
+// Without a directory, a tree of 100 directories with 1000 files each is
+// created. Pass a larger tree, like one with 1M files, for real numbers.
+// Run with OWNCLOUD_IO_URING=0 to compare with the stat calls made by threads.
+// The cache is only dropped when running as root.
+
+static qint64 walk(const QByteArray &path)
+{
+    csync_vio_handle_t *dh = csync_vio_local_opendir(path.constData());
+    if (!dh)
+        return 0;
+    qint64 count = 0;
+    while (auto entry = csync_vio_local_readdir(dh)) {
+        ++count;
+        if (entry->type == CSYNC_FTW_TYPE_DIR)
+            count += walk(path + '/' + entry->path);
+    }
+    csync_vio_local_closedir(dh);
+    return count;
+}
+
+static bool dropCaches()
+{
+    sync();
+    QFile dropCaches("/proc/sys/vm/drop_caches");
+    return dropCaches.open(QIODevice::WriteOnly) && dropCaches.write("3\n") == 2;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QTemporaryDir tmp;
+    QString root = app.arguments().value(1);
+    if (root.isEmpty()) {
+        root = tmp.path();
+        for (int dirNum = 0; dirNum < 100; ++dirNum) {
+            QString dir = root + "/dir" + QString::number(dirNum);
+            QDir().mkpath(dir);
+            for (int fileNum = 0; fileNum < 1000; ++fileNum) {
+                QFile file(dir + "/file" + QString::number(fileNum));
+                if (!file.open(QIODevice::WriteOnly))
+                    return -1;
+            }
+        }
+    }
+    QByteArray path = QDir::cleanPath(root).toUtf8();
+
+    QElapsedTimer timer;
+    if (dropCaches()) {
+        timer.start();
+        qint64 count = walk(path);
+        qDebug() << "COLD:" << count << "entries in" << timer.elapsed() << "ms";
+    } else {
+        qDebug() << "COLD: skipped, dropping the caches needs root";
+    }
+
+    walk(path);
+    timer.start();
+    qint64 count = walk(path);
+    qDebug() << "WARM:" << count << "entries in" << timer.elapsed() << "ms";
+    return count > 0 ? 0 : -1;
+}
@@ -14,6 +14,8 @@
 #include "common/syncjournaldb.h"
 
 #include <QDir>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QNetworkReply>
 #include <QMap>
 #include <QtTest>
@@ -27,6 +29,7 @@
 static const QUrl sRootUrl("owncloud://somehost/owncloud/remote.php/webdav/");
 static const QUrl sRootUrl2("owncloud://somehost/owncloud/remote.php/dav/files/admin/");
 static const QUrl sUploadUrl("owncloud://somehost/owncloud/remote.php/dav/uploads/admin/");
+static const QUrl sBulkUrl("owncloud://somehost/owncloud/remote.php/dav/bulk");
 
 inline QString getFilePathFromUrl(const QUrl &url) {
     QString path = url.path();
@@ -296,6 +299,7 @@ public:
     QByteArray extraDavProperties;
     qint64 size = 0;
     char contentChar = 'W';
+    qint64 chunkOffset = -1; // OC-Chunk-Offset of an uploaded chunk
 
     // Sorted by name to be able to compare trees
     QMap<QString, FileInfo> children;
@@ -436,6 +440,8 @@ public:
             abort();
             return;
         }
+        if (request.hasRawHeader("OC-Chunk-Offset"))
+            fileInfo->chunkOffset = request.rawHeader("OC-Chunk-Offset").toLongLong();
         fileInfo->lastModified = OCC::Utility::qDateTimeFromTime_t(request.rawHeader("X-OC-Mtime").toLongLong());
         remoteRootFileInfo.find(fileName, /*invalidate_etags=*/true);
         QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
@@ -455,6 +461,108 @@ public:
     qint64 readData(char *, qint64) override { return 0; }
 };
 
+// Reference implementation of the multi-file upload: a multipart/related body
+// where each part has an X-File-Path, answered with a JSON object keyed by path
+class FakePostMultiReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    QByteArray payload;
+
+    FakePostMultiReply(FileInfo &remoteRootFileInfo, const QHash<QString, int> &errorPaths, QNetworkAccessManager::Operation op,
+        const QNetworkRequest &request, const QByteArray &postPayload, QObject *parent)
+    : QNetworkReply{parent} {
+        setRequest(request);
+        setUrl(request.url());
+        setOperation(op);
+        open(QIODevice::ReadOnly);
+
+        const QByteArray contentType = request.rawHeader("Content-Type");
+        const int boundaryPos = contentType.indexOf("boundary=");
+        Q_ASSERT(contentType.startsWith("multipart/related") && boundaryPos != -1);
+        const QByteArray delimiter = "--" + contentType.mid(boundaryPos + 9);
+
+        QJsonObject results;
+        int pos = postPayload.indexOf(delimiter);
+        while (pos != -1) {
+            pos += delimiter.size();
+            if (postPayload.mid(pos, 2) == "--")
+                break; // final delimiter
+            pos += 2; // \r\n
+
+            QMap<QByteArray, QByteArray> headers;
+            forever {
+                const int lineEnd = postPayload.indexOf("\r\n", pos);
+                Q_ASSERT(lineEnd != -1);
+                const QByteArray line = postPayload.mid(pos, lineEnd - pos);
+                pos = lineEnd + 2;
+                if (line.isEmpty())
+                    break;
+                const int colon = line.indexOf(':');
+                headers[line.left(colon).toLower()] = line.mid(colon + 1).trimmed();
+            }
+            const QByteArray data = postPayload.mid(pos, headers["content-length"].toInt());
+            pos = postPayload.indexOf(delimiter, pos + data.size());
+
+            const QString path = QString::fromUtf8(QByteArray::fromPercentEncoding(headers["x-file-path"]));
+            QString fileName = path;
+            while (fileName.startsWith('/'))
+                fileName.remove(0, 1);
+
+            QJsonObject result;
+            if (errorPaths.contains(fileName)) {
+                result["error"] = true;
+                result["status"] = errorPaths[fileName];
+                result["message"] = QStringLiteral("Fake Error");
+                results[path] = result;
+                continue;
+            }
+
+            const char contentChar = data.isEmpty() ? 'W' : data.at(0);
+            FileInfo *fileInfo = remoteRootFileInfo.find(fileName);
+            if (fileInfo) {
+                fileInfo->size = data.size();
+                fileInfo->contentChar = contentChar;
+            } else {
+                // Assume that the file is filled with the same character
+                fileInfo = remoteRootFileInfo.create(fileName, data.size(), contentChar);
+            }
+            fileInfo->lastModified = OCC::Utility::qDateTimeFromTime_t(headers["x-oc-mtime"].toLongLong());
+            remoteRootFileInfo.find(fileName, /*invalidate_etags=*/true);
+
+            result["error"] = false;
+            result["status"] = 200;
+            result["etag"] = fileInfo->etag;
+            result["fileid"] = QString::fromUtf8(fileInfo->fileId);
+            results[path] = result;
+        }
+        payload = QJsonDocument(results).toJson(QJsonDocument::Compact);
+
+        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+    }
+
+    Q_INVOKABLE void respond() {
+        setHeader(QNetworkRequest::ContentLengthHeader, payload.size());
+        setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+        setFinished(true);
+        emit metaDataChanged();
+        if (bytesAvailable())
+            emit readyRead();
+        emit finished();
+    }
+
+    void abort() override { }
+
+    qint64 bytesAvailable() const override { return payload.size() + QIODevice::bytesAvailable(); }
+    qint64 readData(char *data, qint64 maxlen) override {
+        qint64 len = std::min(qint64{payload.size()}, maxlen);
+        std::copy(payload.cbegin(), payload.cbegin() + len, data);
+        payload.remove(0, len);
+        return len;
+    }
+};
+
 class FakeMkcolReply : public QNetworkReply
 {
     Q_OBJECT
@@ -576,8 +684,18 @@ public:
         }
         payload = fileInfo->contentChar;
         size = fileInfo->size;
+        int httpStatus = 200;
+        QRegExp rx("bytes=(\\d+)-(\\d*)");
+        if (rx.exactMatch(request().rawHeader("Range")) && rx.cap(1).toInt() < size) {
+            const int start = rx.cap(1).toInt();
+            const int end = rx.cap(2).isEmpty() ? size - 1 : qMin(rx.cap(2).toInt(), size - 1);
+            setRawHeader("Content-Range", "bytes " + QByteArray::number(start) + '-' + QByteArray::number(end)
+                    + '/' + QByteArray::number(size));
+            size = end - start + 1;
+            httpStatus = 206;
+        }
         setHeader(QNetworkRequest::ContentLengthHeader, size);
-        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, httpStatus);
         setRawHeader("OC-ETag", fileInfo->etag.toLatin1());
         setRawHeader("ETag", fileInfo->etag.toLatin1());
         setRawHeader("OC-FileId", fileInfo->fileId);
@@ -630,42 +748,73 @@ public:
         auto sourceFolder = uploadsFileInfo.find(source);
         Q_ASSERT(sourceFolder);
         Q_ASSERT(sourceFolder->isDir);
-        int count = 0;
-        int size = 0;
-        char payload = '\0';
-
-        do {
-            QString chunkName = QString::number(count).rightJustified(8, '0');
-            if (!sourceFolder->children.contains(chunkName))
-                break;
-            auto &x = sourceFolder->children[chunkName];
-            Q_ASSERT(!x.isDir);
-            Q_ASSERT(x.size > 0); // There should not be empty chunks
-            size += x.size;
-            Q_ASSERT(!payload || payload == x.contentChar);
-            payload = x.contentChar;
-            ++count;
-        } while(true);
-
-        Q_ASSERT(count > 1); // There should be at least two chunks, otherwise why would we use chunking?
-        QCOMPARE(sourceFolder->children.count(), count); // There should not be holes or extra files
 
         QString fileName = getFilePathFromUrl(QUrl::fromEncoded(request.rawHeader("Destination")));
         Q_ASSERT(!fileName.isEmpty());
 
-        if ((fileInfo = remoteRootFileInfo.find(fileName))) {
-            QVERIFY(request.hasRawHeader("If")); // The client should put this header
-            if (request.rawHeader("If") != QByteArray("<" + request.rawHeader("Destination") +
-                                                "> ([\"" + fileInfo->etag.toLatin1() + "\"])")) {
+        if (request.hasRawHeader("OC-Delta-Base-ETag")) {
+            // Delta upload: the chunks replace parts of the current version,
+            // the rest of the file is taken from it
+            fileInfo = remoteRootFileInfo.find(fileName);
+            QVERIFY(fileInfo);
+            if (request.rawHeader("OC-Delta-Base-ETag") != "\"" + fileInfo->etag.toLatin1() + "\"") {
                 QMetaObject::invokeMethod(this, "respondPreconditionFailed", Qt::QueuedConnection);
                 return;
             }
-            fileInfo->size = size;
+            const qint64 totalLength = request.rawHeader("OC-Total-Length").toLongLong();
+            char payload = fileInfo->contentChar;
+            qint64 filledUpTo = fileInfo->size; // what is after the current end must be uploaded
+            for (const auto &chunk : sourceFolder->children) {
+                Q_ASSERT(chunk.size > 0);
+                QVERIFY(chunk.chunkOffset >= 0);
+                QVERIFY(chunk.chunkOffset + chunk.size <= totalLength);
+                if (chunk.chunkOffset == 0 && chunk.size == totalLength) {
+                    payload = chunk.contentChar;
+                } else {
+                    // We can only represent files filled with the same character
+                    QCOMPARE(chunk.contentChar, payload);
+                }
+                if (chunk.chunkOffset <= filledUpTo)
+                    filledUpTo = qMax(filledUpTo, chunk.chunkOffset + chunk.size);
+            }
+            QVERIFY(filledUpTo >= totalLength);
+            fileInfo->size = totalLength;
             fileInfo->contentChar = payload;
         } else {
-            Q_ASSERT(!request.hasRawHeader("If"));
-            // Assume that the file is filled with the same character
-            fileInfo = remoteRootFileInfo.create(fileName, size, payload);
+            int count = 0;
+            int size = 0;
+            char payload = '\0';
+
+            do {
+                QString chunkName = QString::number(count).rightJustified(8, '0');
+                if (!sourceFolder->children.contains(chunkName))
+                    break;
+                auto &x = sourceFolder->children[chunkName];
+                Q_ASSERT(!x.isDir);
+                Q_ASSERT(x.size > 0); // There should not be empty chunks
+                size += x.size;
+                Q_ASSERT(!payload || payload == x.contentChar);
+                payload = x.contentChar;
+                ++count;
+            } while(true);
+
+            Q_ASSERT(count > 1); // There should be at least two chunks, otherwise why would we use chunking?
+            QCOMPARE(sourceFolder->children.count(), count); // There should not be holes or extra files
+
+            if ((fileInfo = remoteRootFileInfo.find(fileName))) {
+                QVERIFY(request.hasRawHeader("If")); // The client should put this header
+                if (request.rawHeader("If") != QByteArray("<" + request.rawHeader("Destination") +
+                                                    "> ([\"" + fileInfo->etag.toLatin1() + "\"])")) {
+                    QMetaObject::invokeMethod(this, "respondPreconditionFailed", Qt::QueuedConnection);
+                    return;
+                }
+                fileInfo->size = size;
+                fileInfo->contentChar = payload;
+            } else {
+                Q_ASSERT(!request.hasRawHeader("If"));
+                // Assume that the file is filled with the same character
+                fileInfo = remoteRootFileInfo.create(fileName, size, payload);
+            }
         }
 
         if (!fileInfo) {
@@ -740,7 +889,15 @@ public:
         open(QIODevice::ReadOnly);
     }
 
-    void abort() override {}
+    void abort() override
+    {
+        // Follow more or less the implementation of QNetworkReplyImpl::abort
+        close();
+        setError(OperationCanceledError, tr("Operation canceled"));
+        emit error(OperationCanceledError);
+        setFinished(true);
+        emit finished();
+    }
     qint64 readData(char *, qint64) override { return 0; }
 };
 
@@ -773,6 +930,9 @@ protected:
             if (auto reply = _override(op, request))
                 return reply;
         }
+        if (op == QNetworkAccessManager::PostOperation && request.url().path() == sBulkUrl.path())
+            return new FakePostMultiReply{_remoteRootFileInfo, _errorPaths, op, request, outgoingData->readAll(), this};
+
         const QString fileName = getFilePathFromUrl(request.url());
         Q_ASSERT(!fileName.isNull());
         if (_errorPaths.contains(fileName))
@@ -0,0 +1,131 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "bandwidthmanager.h"
+
+using namespace OCC;
+
+class Consumer : public QObject
+{
+    Q_OBJECT
+public:
+    int _woken = 0;
+public slots:
+    void wake() { ++_woken; }
+};
+
+class TestBandwidthManager : public QObject
+{
+    Q_OBJECT
+
+    qint64 _now = 0;
+
+    // Lets the clock advance and the bucket refill, without waiting
+    void advance(BandwidthBucket *bucket, qint64 msecs)
+    {
+        _now += msecs;
+        QMetaObject::invokeMethod(bucket, "refill");
+    }
+
+private slots:
+    void init()
+    {
+        _now = 0;
+        BandwidthBucket::upload()->setClock([this] { return _now; });
+        BandwidthBucket::download()->setClock([this] { return _now; });
+    }
+
+    void cleanup()
+    {
+        BandwidthBucket::upload()->setLimit(0);
+        BandwidthBucket::download()->setLimit(0);
+    }
+
+    void testNoLimit()
+    {
+        auto bucket = BandwidthBucket::download();
+        Consumer a;
+        bucket->registerConsumer(&a, "wake");
+        QCOMPARE(bucket->take(&a, 8192), qint64(8192));
+        QCOMPARE(bucket->take(&a, 1 << 30), qint64(1 << 30));
+    }
+
+    void testAbsoluteLimit()
+    {
+        auto bucket = BandwidthBucket::download();
+        Consumer a;
+        bucket->registerConsumer(&a, "wake");
+        bucket->setLimit(100 * 1000);
+
+        // Nothing before the first refill
+        QCOMPARE(bucket->take(&a, 8192), qint64(0));
+
+        // One second worth of refills
+        qint64 total = 0;
+        for (int i = 0; i < 20; ++i) {
+            advance(bucket, 50);
+            while (qint64 got = bucket->take(&a, 8192))
+                total += got;
+        }
+        QCOMPARE(total, qint64(100 * 1000));
+        QCoreApplication::processEvents();
+        QVERIFY(a._woken > 0);
+
+        // Removing the limit lets everything through again
+        bucket->setLimit(0);
+        QCOMPARE(bucket->take(&a, 8192), qint64(8192));
+    }
+
+    void testFairShare()
+    {
+        auto bucket = BandwidthBucket::upload();
+        Consumer a;
+        Consumer b;
+        bucket->registerConsumer(&a, "wake");
+        bucket->registerConsumer(&b, "wake");
+        bucket->setLimit(200 * 1000);
+        QCOMPARE(bucket->take(&a, 8192), qint64(0));
+        QCOMPARE(bucket->take(&b, 8192), qint64(0));
+
+        // a always asks first, but must not starve b
+        qint64 totalA = 0;
+        qint64 totalB = 0;
+        for (int i = 0; i < 20; ++i) {
+            advance(bucket, 50);
+            while (qint64 got = bucket->take(&a, 8192))
+                totalA += got;
+            while (qint64 got = bucket->take(&b, 8192))
+                totalB += got;
+        }
+        QCOMPARE(totalA + totalB, qint64(200 * 1000));
+        QCOMPARE(totalA, totalB);
+    }
+
+    void testRelativeLimit()
+    {
+        auto bucket = BandwidthBucket::download();
+        Consumer a;
+        bucket->registerConsumer(&a, "wake");
+        bucket->setLimit(-10);
+
+        // Unthrottled while measuring: 1 MB in 2 seconds
+        QCOMPARE(bucket->rate(), qint64(0));
+        QCOMPARE(bucket->take(&a, 1000 * 1000), qint64(1000 * 1000));
+        _now += 2000;
+        QMetaObject::invokeMethod(bucket, "relativeTimerExpired");
+
+        // Throttled below 10% of the 500 kB/s so that the cycle averages to 10%
+        QCOMPARE(bucket->rate(), qint64(25 * 1000));
+        const qint64 throttlingMsec = 2000 * 2 * 90 / 10;
+        const qint64 cycleBytes = 1000 * 1000 + bucket->rate() * throttlingMsec / 1000;
+        QCOMPARE(cycleBytes, 500 * 1000 * (2000 + throttlingMsec) / 1000 / 10);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestBandwidthManager)
+#include "testbandwidthmanager.moc"
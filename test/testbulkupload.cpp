@@ -0,0 +1,133 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+
+using namespace OCC;
+
+static bool itemStatus(const QSignalSpy &spy, const QString &path, SyncFileItem::Status *status)
+{
+    for (const QList<QVariant> &args : spy) {
+        auto item = args[0].value<SyncFileItemPtr>();
+        if (item->destination() == path) {
+            *status = item->_status;
+            return true;
+        }
+    }
+    return false;
+}
+
+class TestBulkUpload : public QObject
+{
+    Q_OBJECT
+
+private slots:
+
+    void testManySmallFiles() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"bulkupload", "1.0"} } } });
+        int nPOST = 0;
+        int nPUT = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PostOperation)
+                ++nPOST;
+            if (op == QNetworkAccessManager::PutOperation)
+                ++nPUT;
+            return nullptr;
+        });
+
+        fakeFolder.localModifier().mkdir("many");
+        for (int i = 0; i < 50; ++i)
+            fakeFolder.localModifier().insert(QString("many/file%1").arg(i), 100 + i);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(nPUT, 0);
+        QVERIFY(nPOST > 0);
+        QVERIFY(nPOST < 10);
+
+        // Modifying the files uses the same mechanism
+        nPOST = 0;
+        for (int i = 0; i < 50; i += 2)
+            fakeFolder.localModifier().appendByte(QString("many/file%1").arg(i));
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(nPUT, 0);
+        QVERIFY(nPOST > 0);
+    }
+
+    void testErrorForOneFile() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"bulkupload", "1.0"} } } });
+
+        fakeFolder.localModifier().insert("A/ok1", 50);
+        fakeFolder.localModifier().insert("A/broken", 50);
+        fakeFolder.localModifier().insert("A/ok2", 50);
+        fakeFolder.serverErrorPaths().append("A/broken");
+
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
+        QVERIFY(!fakeFolder.syncOnce());
+
+        SyncFileItem::Status status;
+        QVERIFY(itemStatus(completeSpy, "A/ok1", &status));
+        QCOMPARE(status, SyncFileItem::Success);
+        QVERIFY(itemStatus(completeSpy, "A/ok2", &status));
+        QCOMPARE(status, SyncFileItem::Success);
+        QVERIFY(itemStatus(completeSpy, "A/broken", &status));
+        QCOMPARE(status, SyncFileItem::NormalError);
+        QVERIFY(fakeFolder.currentRemoteState().find("A/ok1"));
+        QVERIFY(fakeFolder.currentRemoteState().find("A/ok2"));
+        QVERIFY(!fakeFolder.currentRemoteState().find("A/broken"));
+
+        // Once the server accepts the file everything is in sync
+        fakeFolder.serverErrorPaths().clear();
+        fakeFolder.syncJournal().wipeErrorBlacklist();
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testLargeFileUsesPut() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"bulkupload", "1.0"} } } });
+        QStringList posted;
+        QStringList put;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PostOperation)
+                posted.append(request.url().path());
+            if (op == QNetworkAccessManager::PutOperation)
+                put.append(getFilePathFromUrl(request.url()));
+            return nullptr;
+        });
+
+        fakeFolder.localModifier().insert("A/small", 1000);
+        fakeFolder.localModifier().insert("A/large", 1000 * 1000);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(posted.size(), 1);
+        QCOMPARE(put, QStringList{ "A/large" });
+    }
+
+    void testNoCapability() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        int nPOST = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PostOperation)
+                ++nPOST;
+            return nullptr;
+        });
+
+        for (int i = 0; i < 10; ++i)
+            fakeFolder.localModifier().insert(QString("A/file%1").arg(i), 100);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(nPOST, 0);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestBulkUpload)
+#include "testbulkupload.moc"
@@ -10,6 +10,7 @@
 #include <QString>
 
 #include "common/checksums.h"
+#include "common/syncjournaldb.h"
 #include "networkjobs.h"
 #include "common/utility.h"
 #include "filesystem.h"
@@ -60,16 +61,13 @@ using namespace OCC;
     }
 
     void testUploadChecksummingAdler() {
-#ifndef ZLIB_FOUND
-        QSKIP("ZLIB not found.", SkipSingle);
-#else
         ComputeChecksum *vali = new ComputeChecksum(this);
         _expectedType = "Adler32";
         vali->setChecksumType(_expectedType);
 
         connect(vali, SIGNAL(done(QByteArray,QByteArray)), SLOT(slotUpValidated(QByteArray,QByteArray)));
 
-        _expected = FileSystem::calcAdler32( _testfile );
+        _expected = calcAdler32( _testfile );
         qDebug() << "XX Expected Checksum: " << _expected;
         vali->start(_testfile);
 
@@ -78,7 +76,6 @@ using namespace OCC;
         loop.exec();
 
         delete vali;
-#endif
     }
 
     void testUploadChecksummingMd5() {
@@ -117,12 +114,9 @@ using namespace OCC;
     }
 
     void testDownloadChecksummingAdler() {
-#ifndef ZLIB_FOUND
-        QSKIP("ZLIB not found.", SkipSingle);
-#else
         QByteArray adler =  checkSumAdlerC;
         adler.append(":");
-        adler.append(FileSystem::calcAdler32( _testfile ));
+        adler.append(calcAdler32( _testfile ));
         _successDown = false;
 
         ValidateChecksumHeader *vali = new ValidateChecksumHeader(this);
@@ -143,9 +137,108 @@ using namespace OCC;
         QTRY_VERIFY(_errorSeen);
 
         delete vali;
-#endif
     }
 
+    void testFastChecksums() {
+        QCOMPARE(adler32Update(1, "Wikipedia", 9), quint32(0x11e60398));
+        QCOMPARE(crc32cUpdate(0, "123456789", 9), quint32(0xe3069283));
+
+        // Long enough for the vectorized code, which must give the same
+        // result for every split of the data
+        QByteArray data(100000, Qt::Uninitialized);
+        for (int i = 0; i < data.size(); ++i)
+            data[i] = char((i * 7) % 251);
+        QCOMPARE(adler32Update(1, data.constData(), data.size()), quint32(0x437bc42e));
+        QCOMPARE(crc32cUpdate(0, data.constData(), data.size()), quint32(0xef3b5935));
+        for (int split : { 1, 31, 33, 5555, 77777 }) {
+            quint32 adler = adler32Update(1, data.constData(), split);
+            QCOMPARE(adler32Update(adler, data.constData() + split, data.size() - split), quint32(0x437bc42e));
+            quint32 crc = crc32cUpdate(0, data.constData() + 1, split);
+            crc = crc32cUpdate(crc, data.constData() + 1 + split, data.size() - 1 - split);
+            QCOMPARE(crc, crc32cUpdate(0, data.constData() + 1, data.size() - 1));
+        }
+
+        QTemporaryDir tempDir;
+        QFile file(tempDir.path() + "/data");
+        QVERIFY(file.open(QFile::WriteOnly));
+        file.write(data);
+        file.close();
+        QCOMPARE(ComputeChecksum::computeNow(file.fileName(), checkSumAdlerC), QByteArray("437bc42e"));
+        QCOMPARE(ComputeChecksum::computeNow(file.fileName(), checkSumCrc32cC), QByteArray("ef3b5935"));
+        QCOMPARE(findBestChecksum("Adler32:437bc42e CRC32C:ef3b5935"), QByteArray("CRC32C:ef3b5935"));
+        QCOMPARE(findBestChecksum("CRC32C:ef3b5935 MD5:abc"), QByteArray("MD5:abc"));
+    }
+
+    void testChecksumCache() {
+        QTemporaryDir tempDir;
+        SyncJournalDb journal(tempDir.path() + "/sync.db");
+        const QString path = tempDir.path() + "/cached";
+        auto writeFile = [&](const QByteArray &content) {
+            QFile file(path);
+            QVERIFY(file.open(QFile::WriteOnly | QFile::Truncate));
+            file.write(content);
+        };
+        writeFile("first content");
+
+        FileSystem::FileIdentity identity;
+        QVERIFY(FileSystem::getFileIdentity(path, &identity));
+        if (identity.ctime % 1000000000 == 0)
+            QSKIP("The file system has no sub-second time stamps, new files are not cached", SkipSingle);
+
+        // Computing it fills the cache
+        const QByteArray checksum = ComputeChecksum::computeNow(path, checkSumSHA1C, &journal);
+        QCOMPARE(checksum, FileSystem::calcSha1(path));
+        QCOMPARE(journal.getCachedChecksum(identity, checkSumSHA1C), checksum);
+        QVERIFY(journal.getCachedChecksum(identity, checkSumMD5C).isEmpty());
+
+        // The cached value is used while the file is unchanged
+        journal.setCachedChecksum(identity, checkSumSHA1C, "cached");
+        QCOMPARE(ComputeChecksum::computeNow(path, checkSumSHA1C, &journal), QByteArray("cached"));
+        QCOMPARE(ComputeChecksum::computeNow(path, checkSumSHA1C), checksum);
+
+        // A change of the content with the same size is noticed
+        writeFile("other content");
+        QCOMPARE(ComputeChecksum::computeNow(path, checkSumSHA1C, &journal), FileSystem::calcSha1(path));
+
+        // ComputeChecksum looks into the cache before it queues the file
+        QVERIFY(FileSystem::getFileIdentity(path, &identity));
+        journal.setCachedChecksum(identity, checkSumSHA1C, "cached");
+        ComputeChecksum computeChecksum;
+        computeChecksum.setChecksumType(checkSumSHA1C);
+        computeChecksum.setJournal(&journal);
+        QByteArray result;
+        connect(&computeChecksum, &ComputeChecksum::done, [&](const QByteArray &, const QByteArray &checksum) {
+            result = checksum;
+        });
+        computeChecksum.start(path);
+        QTRY_COMPARE(result, QByteArray("cached"));
+    }
+
+    void testChecksumThreadPool() {
+        QVERIFY(ChecksumThreadPool::maximumThreadCount() >= 1);
+        const auto before = ChecksumThreadPool::instance()->stats();
+
+        QList<ComputeChecksum *> computations;
+        int done = 0;
+        for (int i = 0; i < 5; ++i) {
+            auto computeChecksum = new ComputeChecksum(this);
+            computeChecksum->setChecksumType(checkSumMD5C);
+            connect(computeChecksum, &ComputeChecksum::done, [&](const QByteArray &, const QByteArray &checksum) {
+                QCOMPARE(checksum, FileSystem::calcMd5(_testfile));
+                ++done;
+            });
+            computeChecksum->start(_testfile);
+            computations.append(computeChecksum);
+        }
+        QTRY_COMPARE(done, 5);
+        qDeleteAll(computations);
+
+        const auto after = ChecksumThreadPool::instance()->stats();
+        QCOMPARE(after.files, before.files + 5);
+        QCOMPARE(after.bytes, before.bytes + 5 * QFileInfo(_testfile).size());
+        QCOMPARE(after.queued, 0);
+        QCOMPARE(after.active, 0);
+    }
 
     void cleanupTestCase() {
     }
@@ -367,6 +367,35 @@ private slots:
         QVERIFY(fakeFolder.uploadState().children.first().name != chunkingId);
     }
 
+    // The chunks carry a cheap checksum, the file keeps the collision safe one
+    void testChunkChecksums()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ { "chunking", "1.0" } } },
+            { "checksums", QVariantMap{ { "supportedTypes", QStringList() << "SHA1" << "CRC32C" } } } });
+        const int size = 30 * 1000 * 1000;
+
+        QByteArray moveChecksumHeader;
+        QList<QByteArray> chunkChecksumHeaders;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) == "MOVE") {
+                moveChecksumHeader = request.rawHeader("OC-Checksum");
+            } else if (op == QNetworkAccessManager::PutOperation) {
+                chunkChecksumHeaders.append(request.rawHeader("OC-Checksum"));
+            }
+            return nullptr;
+        });
+
+        fakeFolder.localModifier().insert("A/a0", size);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(chunkChecksumHeaders.size() > 1);
+        foreach (const auto &header, chunkChecksumHeaders) {
+            QVERIFY(header.startsWith("CRC32C:"));
+        }
+        QVERIFY(moveChecksumHeader.startsWith("SHA1:"));
+    }
+
 };
 
 QTEST_GUILESS_MAIN(TestChunkingNG)
@@ -0,0 +1,216 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+#include "common/checksums.h"
+
+#include <QCryptographicHash>
+
+using namespace OCC;
+
+static const qint64 bigFileSize = 25 * blockChecksumSize + 100;
+
+static void enableDeltaSync(FakeFolder &fakeFolder)
+{
+    fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ { "chunking", "1.0" }, { "deltasync", "1.0" } } } });
+}
+
+// Makes the server report the block checksums of the file, which is one repeated character
+static void setRemoteBlockChecksums(FakeFolder &fakeFolder, const QString &path)
+{
+    FileInfo *fileInfo = fakeFolder.remoteModifier().find(path);
+    QByteArray checksums;
+    for (qint64 offset = 0; offset < fileInfo->size; offset += blockChecksumSize) {
+        const QByteArray block(qMin(blockChecksumSize, fileInfo->size - offset), fileInfo->contentChar);
+        checksums += QCryptographicHash::hash(block, QCryptographicHash::Md5);
+    }
+    fileInfo->extraDavProperties = "<oc:blockchecksums>" + checksums.toHex() + "</oc:blockchecksums>";
+}
+
+class TestDeltaSync : public QObject
+{
+    Q_OBJECT
+
+private slots:
+
+    void testDeltaUpload() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableDeltaSync(fakeFolder);
+        QList<qint64> chunkOffsets;
+        QByteArray deltaBase;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation)
+                chunkOffsets.append(request.rawHeader("OC-Chunk-Offset").toLongLong());
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) == "MOVE")
+                deltaBase = request.rawHeader("OC-Delta-Base-ETag");
+            return nullptr;
+        });
+
+        // The first upload sends everything and stores the block checksums
+        fakeFolder.localModifier().insert("A/big", bigFileSize);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(chunkOffsets.first(), qint64(0));
+        QVERIFY(deltaBase.isEmpty());
+        auto blockChecksums = fakeFolder.syncJournal().getBlockChecksums("A/big");
+        QVERIFY(blockChecksums._valid);
+        QCOMPARE(blockChecksums._etag, fakeFolder.currentRemoteState().find("A/big")->etag.toLatin1());
+        QCOMPARE(blockChecksums._checksums.size(), 26 * 16);
+        // They were computed from the chunks as they were sent
+        QCOMPARE(blockChecksums._checksums, computeBlockChecksums(fakeFolder.localPath() + "A/big"));
+
+        // Appending only sends the last block
+        chunkOffsets.clear();
+        auto previousEtag = blockChecksums._etag;
+        fakeFolder.localModifier().appendByte("A/big");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(chunkOffsets, QList<qint64>{ 25 * blockChecksumSize });
+        QCOMPARE(deltaBase, "\"" + previousEtag + "\"");
+        blockChecksums = fakeFolder.syncJournal().getBlockChecksums("A/big");
+        QCOMPARE(blockChecksums._etag, fakeFolder.currentRemoteState().find("A/big")->etag.toLatin1());
+
+        // Truncating sends the new last block
+        chunkOffsets.clear();
+        QFile file(fakeFolder.localPath() + "A/big");
+        QVERIFY(file.resize(20 * blockChecksumSize + 5));
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(chunkOffsets, QList<qint64>{ 20 * blockChecksumSize });
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/big")->size, 20 * blockChecksumSize + 5);
+    }
+
+    void testNoDeltaUploadWithoutBlockChecksums() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableDeltaSync(fakeFolder);
+        fakeFolder.localModifier().insert("A/big", bigFileSize);
+        QVERIFY(fakeFolder.syncOnce());
+
+        QList<qint64> chunkOffsets;
+        QByteArray deltaBase;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation)
+                chunkOffsets.append(request.rawHeader("OC-Chunk-Offset").toLongLong());
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) == "MOVE")
+                deltaBase = request.rawHeader("OC-Delta-Base-ETag");
+            return nullptr;
+        });
+
+        // Without the checksums of the version on the server everything is sent
+        fakeFolder.syncJournal().setBlockChecksums("A/big", SyncJournalDb::BlockChecksums());
+        fakeFolder.localModifier().appendByte("A/big");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(chunkOffsets.first(), qint64(0));
+        QVERIFY(deltaBase.isEmpty());
+
+        // But they are stored again for the next time
+        QVERIFY(fakeFolder.syncJournal().getBlockChecksums("A/big")._valid);
+        chunkOffsets.clear();
+        fakeFolder.localModifier().appendByte("A/big");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(chunkOffsets, QList<qint64>{ 25 * blockChecksumSize });
+    }
+
+    void testNoDeltaUploadWithoutCapability() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ { "chunking", "1.0" } } } });
+        QList<qint64> chunkOffsets;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation)
+                chunkOffsets.append(request.rawHeader("OC-Chunk-Offset").toLongLong());
+            return nullptr;
+        });
+
+        fakeFolder.localModifier().insert("A/big", bigFileSize);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.syncJournal().getBlockChecksums("A/big")._valid);
+
+        chunkOffsets.clear();
+        fakeFolder.localModifier().appendByte("A/big");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(chunkOffsets.first(), qint64(0));
+    }
+
+    void testDeltaDownload() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableDeltaSync(fakeFolder);
+        QList<QByteArray> ranges;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation)
+                ranges.append(request.rawHeader("Range"));
+            return nullptr;
+        });
+
+        // The first download gets everything and stores the block checksums
+        fakeFolder.remoteModifier().insert("A/big", bigFileSize);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(ranges, QList<QByteArray>{ QByteArray() });
+        auto blockChecksums = fakeFolder.syncJournal().getBlockChecksums("A/big");
+        QVERIFY(blockChecksums._valid);
+        QCOMPARE(blockChecksums._etag, fakeFolder.currentRemoteState().find("A/big")->etag.toLatin1());
+        QCOMPARE(blockChecksums._checksums.size(), 26 * 16);
+
+        // Appending on the server only fetches the last block
+        ranges.clear();
+        fakeFolder.remoteModifier().appendByte("A/big");
+        setRemoteBlockChecksums(fakeFolder, "A/big");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(ranges, QList<QByteArray>{ "bytes=" + QByteArray::number(25 * blockChecksumSize) + '-' + QByteArray::number(bigFileSize) });
+        blockChecksums = fakeFolder.syncJournal().getBlockChecksums("A/big");
+        QCOMPARE(blockChecksums._etag, fakeFolder.currentRemoteState().find("A/big")->etag.toLatin1());
+
+        // A different version of the whole content fetches everything in one range
+        ranges.clear();
+        fakeFolder.remoteModifier().appendByte("A/big");
+        fakeFolder.remoteModifier().find("A/big")->contentChar = 'X';
+        setRemoteBlockChecksums(fakeFolder, "A/big");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(ranges, QList<QByteArray>{ "bytes=0-" + QByteArray::number(bigFileSize + 1) });
+    }
+
+    void testNoDeltaDownloadWithoutRemoteBlockChecksums() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableDeltaSync(fakeFolder);
+        fakeFolder.remoteModifier().insert("A/big", bigFileSize);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.syncJournal().getBlockChecksums("A/big")._valid);
+
+        QList<QByteArray> ranges;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation)
+                ranges.append(request.rawHeader("Range"));
+            return nullptr;
+        });
+
+        // The server does not know the block checksums of the new version
+        fakeFolder.remoteModifier().appendByte("A/big");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(ranges, QList<QByteArray>{ QByteArray() });
+
+        // Wrong block checksums are detected before the file is replaced
+        ranges.clear();
+        fakeFolder.remoteModifier().appendByte("A/big");
+        setRemoteBlockChecksums(fakeFolder, "A/big");
+        fakeFolder.remoteModifier().find("A/big")->contentChar = 'Y';
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(ranges.size(), 2);
+        QCOMPARE(ranges.last(), QByteArray());
+    }
+};
+
+QTEST_GUILESS_MAIN(TestDeltaSync)
+#include "testdeltasync.moc"
@@ -0,0 +1,66 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+
+#include "common/expiringpathset.h"
+
+using namespace OCC;
+
+class TestExpiringPathSet : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testExpiry()
+    {
+        ExpiringPathSet set(15000, 16);
+        QCOMPARE(set.maxAge(), qint64(15000));
+        QVERIFY(!set.contains("A/a1", 0));
+
+        set.insert("A/a1", 1000);
+        set.insert("A/a2", 5000);
+        QVERIFY(set.contains("A/a1", 1000));
+        QVERIFY(set.contains("A/a1", 16000));
+        QVERIFY(!set.contains("A/a1", 16001));
+        QVERIFY(set.contains("A/a2", 20000));
+        QVERIFY(!set.contains("B", 5000));
+
+        // Inserting again restarts the time
+        set.insert("A/a1", 10000);
+        QVERIFY(set.contains("A/a1", 25000));
+        QVERIFY(!set.contains("A/a1", 25001));
+
+        // Expired paths are dropped as the time goes on
+        set.insert("B", 60000);
+        QCOMPARE(set.size(), 1);
+        QVERIFY(!set.contains("A/a1", 60000));
+        QVERIFY(set.contains("B", 60000));
+
+        set.clear();
+        QCOMPARE(set.size(), 0);
+        QVERIFY(!set.contains("B", 60000));
+    }
+
+    void testNoLeaks()
+    {
+        // Paths touched over and over and paths touched once, for a long time
+        ExpiringPathSet set(1000, 8);
+        for (qint64 now = 0; now < 100000; now += 7) {
+            set.insert(QString("hot%1").arg(now % 5), now);
+            set.insert(QString("cold%1").arg(now), now);
+            QVERIFY(set.contains(QString("hot%1").arg(now % 5), now));
+        }
+        // Only what was inserted in about the last maxAge remains
+        QVERIFY(set.size() <= 5 + 2 * 1000 / 7);
+        QVERIFY(set.contains("cold99995", 100994));
+        QVERIFY(!set.contains("cold98000", 100000));
+    }
+};
+
+QTEST_APPLESS_MAIN(TestExpiringPathSet)
+#include "testexpiringpathset.moc"
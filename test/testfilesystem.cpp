@@ -70,6 +70,51 @@ private slots:
         QCOMPARE(sSum, sum);
     }
 
+    void testReadFileBlocks()
+    {
+        // Larger than the blocks of large files, and not a multiple of them
+        QByteArray content(20 * 1024 * 1024 + 7, Qt::Uninitialized);
+        for (int i = 0; i < content.size(); ++i)
+            content[i] = char(i / 1000);
+        QString file(_root.path() + "/file_large.bin");
+        QFile f(file);
+        QVERIFY(f.open(QFile::WriteOnly));
+        QCOMPARE(f.write(content), qint64(content.size()));
+        f.close();
+
+        QByteArray read;
+        QVERIFY(readFileBlocks(file, [&](const char *data, qint64 size) { read.append(data, int(size)); }));
+        QVERIFY(read == content);
+        QCOMPARE(calcMd5(file), QCryptographicHash::hash(content, QCryptographicHash::Md5).toHex());
+
+        QString error;
+        QVERIFY(!readFileBlocks(_root.path() + "/missing", [](const char *, qint64) {}, &error));
+        QVERIFY(!error.isEmpty());
+    }
+
+    void testCloneFile()
+    {
+        QString source(_root.path() + "/file_c.bin");
+        QVERIFY(writeRandomFile(source));
+        QString destination(_root.path() + "/file_c.copy");
+
+        QString error;
+        QVERIFY(cloneFile(source, destination, &error));
+        QVERIFY(fileEquals(source, destination));
+
+        // The content of an existing, larger destination is replaced
+        QFile big(destination);
+        QVERIFY(big.open(QIODevice::Append));
+        big.write(QByteArray(100 * 1024, 'x'));
+        big.close();
+        QVERIFY(cloneFile(source, destination, &error));
+        QCOMPARE(getSize(destination), getSize(source));
+        QVERIFY(fileEquals(source, destination));
+
+        QVERIFY(!cloneFile(_root.path() + "/does_not_exist", destination, &error));
+        QVERIFY(!error.isEmpty());
+    }
+
 };
 
 QTEST_APPLESS_MAIN(TestFileSystem)
@@ -8,6 +8,9 @@
 #include <QtTest>
 
 #include "folderwatcher.h"
+#include "syncengine.h"
+#include "account.h"
+#include "common/syncjournaldb.h"
 #include "common/utility.h"
 
 void touch(const QString &file)
@@ -118,6 +121,12 @@ public:
     }
 
 private slots:
+    void initTestCase()
+    {
+        // The folders are registered in the background
+        QTRY_VERIFY_WITH_TIMEOUT(_watcher->isReliable(), 10000);
+    }
+
     void init()
     {
         _pathChangedSpy->clear();
@@ -181,6 +190,62 @@ private slots:
         QVERIFY(waitForPathChanged(old_file));
         QVERIFY(waitForPathChanged(new_file));
     }
+
+    void testManyFolders() {
+        // Wide and deep enough to take a while to register
+        QTemporaryDir root;
+        const QString rootPath = QDir(root.path()).canonicalPath();
+        QString deepest = rootPath;
+        for (int i = 0; i < 30; ++i) {
+            for (int j = 0; j < 30; ++j)
+                QVERIFY(QDir(deepest).mkpath(QString("w%1").arg(j)));
+            deepest += QString("/w%1").arg(i);
+        }
+
+        FolderWatcher watcher(rootPath);
+        QSignalSpy spy(&watcher, SIGNAL(pathChanged(QString)));
+        QTRY_VERIFY_WITH_TIMEOUT(watcher.isReliable(), 10000);
+
+        const QString file = deepest + "/file.txt";
+        touch(file);
+        QTRY_VERIFY_WITH_TIMEOUT(!spy.isEmpty(), 5000);
+        QCOMPARE(spy.first().first().toString(), file);
+    }
+
+    void testFloodOfTouchedFiles() {
+        // The notifications for the files the sync wrote are filtered with
+        // SyncEngine::wasFileTouched, that must keep up with a flood of them
+        QTemporaryDir dbDir;
+        SyncJournalDb journal(dbDir.path() + "/.sync_test.db");
+        SyncEngine engine(Account::create(), _rootPath + "/", "", &journal);
+
+        QStringList touched;
+        for (int i = 0; i < 100000; ++i) {
+            touched.append(QString("%1/flood/d%2/f%3").arg(_rootPath).arg(i / 1000).arg(i));
+            QMetaObject::invokeMethod(&engine, "slotAddTouchedFile", Q_ARG(QString, touched.last()));
+        }
+
+        QStringList untouched;
+        connect(_watcher.data(), &FolderWatcher::pathChanged, &engine, [&](const QString &path) {
+            if (!engine.wasFileTouched(path))
+                untouched.append(path);
+        });
+
+        // Don't log every path
+        QLoggingCategory::setFilterRules("gui.folderwatcher.info=false");
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < touched.size(); i += 1000) {
+            QStringList paths = touched.mid(i, 1000);
+            paths.append(QString("%1/flood/user%2").arg(_rootPath).arg(i));
+            QMetaObject::invokeMethod(_watcher.data(), "changeDetected", Q_ARG(QStringList, paths));
+        }
+        qDebug() << "Filtered" << touched.size() << "notifications in" << timer.elapsed() << "ms";
+        QLoggingCategory::setFilterRules(QString());
+
+        QCOMPARE(untouched.size(), touched.size() / 1000);
+        QVERIFY(untouched.first().startsWith(_rootPath + "/flood/user"));
+    }
 };
 
 #ifdef Q_OS_MAC
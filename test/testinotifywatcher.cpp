@@ -34,32 +34,23 @@ private slots:
 
     }
 
-    // Test the recursive path listing function findFoldersBelow
-    void testDirsBelowPath() {
-        QStringList dirs;
-
-        bool ok = findFoldersBelow(QDir(_root), dirs);
-        QVERIFY( dirs.indexOf(_root + "/a1")>-1);
-        QVERIFY( dirs.indexOf(_root + "/a1/b1")>-1);
-        QVERIFY( dirs.indexOf(_root + "/a1/b1/c1")>-1);
-        QVERIFY( dirs.indexOf(_root + "/a1/b1/c2")>-1);
+    // Test the path listing function subfolders used for the registration
+    void testSubfolders() {
+        QStringList dirs = subfolders(QDir(_root));
+        dirs.sort();
+        QCOMPARE(dirs, QStringList({ _root + "/a1", _root + "/a2" }));
 
         QVERIFY(Utility::writeRandomFile(_root+"/a1/rand1.dat"));
-        QVERIFY(Utility::writeRandomFile(_root+"/a1/b1/rand2.dat"));
-        QVERIFY(Utility::writeRandomFile(_root+"/a1/b1/c1/rand3.dat"));
-
-        QVERIFY( dirs.indexOf(_root + "/a1/b2")>-1);
-        QVERIFY( dirs.indexOf(_root + "/a1/b2/c1")>-1);
-        QVERIFY( dirs.indexOf(_root + "/a1/b3")>-1);
-        QVERIFY( dirs.indexOf(_root + "/a1/b3/c3")>-1);
-
-        QVERIFY( dirs.indexOf(_root + "/a2"));
-        QVERIFY( dirs.indexOf(_root + "/a2/b3"));
-        QVERIFY( dirs.indexOf(_root + "/a2/b3/c3"));
+        QVERIFY(QFile::link(_root + "/a2", _root + "/a1/link"));
+        QDir(_root).mkpath(_root + "/a1/.hidden");
 
-        QVERIFY2(dirs.count() == 11, "Directory count wrong.");
+        // Neither files nor symlinks, but hidden folders
+        dirs = subfolders(QDir(_root + "/a1"));
+        dirs.sort();
+        QCOMPARE(dirs, QStringList({ _root + "/a1/.hidden", _root + "/a1/b1", _root + "/a1/b2", _root + "/a1/b3" }));
 
-        QVERIFY2(ok, "findFoldersBelow failed.");
+        QVERIFY(subfolders(QDir(_root + "/a1/b1/c1")).isEmpty());
+        QVERIFY(subfolders(QDir(_root + "/nonexistent")).isEmpty());
     }
 
     void cleanupTestCase() {
@@ -0,0 +1,190 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+
+#include "common/pathtrie.h"
+
+using namespace OCC;
+
+class TestPathTrie : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testInsert()
+    {
+        PathTrie trie;
+        QVERIFY(trie.isEmpty());
+        QVERIFY(!trie.intersects(""));
+
+        QVERIFY(trie.insert("A/X/x1"));
+        QVERIFY(trie.insert("A/X/x2"));
+        QVERIFY(trie.insert("B/b1"));
+        QCOMPARE(trie.size(), 3);
+        QCOMPARE(trie.nodeCount(), 6);
+
+        // A parent absorbs its children, and whatever comes below it later
+        QVERIFY(trie.insert("A/X"));
+        QCOMPARE(trie.size(), 2);
+        QCOMPARE(trie.nodeCount(), 4);
+        QVERIFY(!trie.insert("A/X/x3"));
+        QVERIFY(!trie.insert("A/X/Y/y1"));
+        QVERIFY(!trie.insert("A//X/"));
+        QCOMPARE(trie.paths(), QList<QByteArray>({ "A/X", "B/b1" }));
+        QCOMPARE(trie.paths("A"), QList<QByteArray>({ "A/X" }));
+        QCOMPARE(trie.paths("A/X"), QList<QByteArray>({ "A/X" }));
+        QVERIFY(trie.paths("A/X/Y").isEmpty());
+        QVERIFY(trie.paths("C").isEmpty());
+
+        // Only marked paths can be removed, and unused nodes go with them
+        QVERIFY(!trie.remove("A/X/x1"));
+        QVERIFY(!trie.remove("A"));
+        QVERIFY(trie.remove("A/X"));
+        QCOMPARE(trie.paths(), QList<QByteArray>({ "B/b1" }));
+        QCOMPARE(trie.nodeCount(), 2);
+
+        PathTrie other{ "C/c1", "B" };
+        trie.merge(other);
+        QCOMPARE(trie.paths(), QList<QByteArray>({ "B", "C/c1" }));
+        QCOMPARE(other.size(), 2);
+
+        trie.clear();
+        QVERIFY(trie.isEmpty());
+        QCOMPARE(trie.nodeCount(), 0);
+    }
+
+    void testLookup()
+    {
+        PathTrie trie{ "d/foo a", "e/f" };
+
+        // "d/foo" sorts before "d/foo a", that must not be mistaken for a parent
+        QVERIFY(!trie.contains("d/foo"));
+        QVERIFY(!trie.intersects("d/foo"));
+        QVERIFY(!trie.intersects("d/foo/bar"));
+        QVERIFY(trie.intersects("d/foo a"));
+
+        QVERIFY(trie.contains("e/f"));
+        QVERIFY(trie.contains("e/f/g/h"));
+        QVERIFY(!trie.contains("e"));
+        QVERIFY(!trie.contains("e/fg"));
+        QVERIFY(trie.intersects(""));
+        QVERIFY(trie.intersects("e"));
+        QVERIFY(trie.intersects("e/f/g"));
+        QVERIFY(!trie.intersects("e/fg"));
+        QVERIFY(!trie.intersects("x"));
+    }
+
+    void testMaximumNodeCount()
+    {
+        PathTrie trie;
+        trie.setMaximumNodeCount(10);
+        for (int i = 0; i < 6; ++i)
+            QVERIFY(trie.insert("node_modules/pkg/file" + QByteArray::number(i)));
+        QCOMPARE(trie.nodeCount(), 8);
+        QVERIFY(trie.insert("src/main.c"));
+        QCOMPARE(trie.nodeCount(), 10);
+
+        // Too many nodes: the parent directory is looked at instead
+        QVERIFY(trie.insert("node_modules/pkg/file6"));
+        QCOMPARE(trie.paths(), QList<QByteArray>({ "node_modules/pkg", "src/main.c" }));
+        QVERIFY(!trie.isFullRescan());
+
+        // Until only a full rescan is left
+        trie.setMaximumNodeCount(1);
+        QVERIFY(trie.insert("src/util.c"));
+        QVERIFY(trie.isFullRescan());
+        QCOMPARE(trie.nodeCount(), 0);
+        QCOMPARE(trie.paths(), QList<QByteArray>({ "" }));
+        QVERIFY(trie.contains("anything/at/all"));
+        QVERIFY(!trie.insert("src/other.c"));
+    }
+
+    void testInsertDirectory()
+    {
+        PathTrie trie;
+        QVERIFY(trie.insertDirectory("A"));
+        QVERIFY(trie.insertDirectory("A/X/Y"));
+        QVERIFY(!trie.insertDirectory("A"));
+        QCOMPARE(trie.size(), 2);
+        QCOMPARE(trie.paths(), QList<QByteArray>({ "A", "A/X/Y" }));
+
+        // The entries of A are looked at, the directories below it are not
+        QVERIFY(!trie.contains("A"));
+        QVERIFY(trie.intersects("A"));
+        QVERIFY(trie.intersects("A/X"));
+        QVERIFY(trie.intersects("A/X/Y"));
+        QVERIFY(trie.intersects("A/Z"));
+        QVERIFY(!trie.intersects("A/Z/z1"));
+        QVERIFY(trie.intersects("A/X/Y/Z"));
+        QVERIFY(!trie.intersects("A/X/Z"));
+
+        // Marking a subtree replaces the directory marks within it
+        QVERIFY(trie.insert("A/X"));
+        QCOMPARE(trie.paths(), QList<QByteArray>({ "A", "A/X" }));
+        QVERIFY(!trie.insertDirectory("A/X/Y"));
+        QVERIFY(trie.insert("A"));
+        QCOMPARE(trie.size(), 1);
+        QCOMPARE(trie.nodeCount(), 1);
+        QVERIFY(trie.intersects("A/Z"));
+
+        PathTrie other;
+        QVERIFY(other.insertDirectory(""));
+        QVERIFY(other.insertDirectory("B"));
+        QVERIFY(other.insert("B/b1"));
+        trie.merge(other);
+        QCOMPARE(trie.paths(), QList<QByteArray>({ "", "A", "B", "B/b1" }));
+        QVERIFY(!trie.isFullRescan());
+        QVERIFY(trie.intersects("C"));
+        QVERIFY(!trie.intersects("C/c1"));
+
+        QVERIFY(trie.remove("B"));
+        QVERIFY(trie.intersects("B"));
+        QVERIFY(trie.remove("B/b1"));
+        QVERIFY(!trie.intersects("B/b1"));
+        QCOMPARE(trie.size(), 2);
+    }
+
+    void testIntersectsListedEntries()
+    {
+        // Partial discovery goes through the files directly inside a listed directory
+        PathTrie trie;
+        QVERIFY(trie.insertDirectory("A"));
+        QVERIFY(trie.intersects("A/file"));
+        QVERIFY(trie.intersects("A/sub"));
+        QVERIFY(!trie.intersects("A/sub/file"));
+        QVERIFY(!trie.intersects("B/file"));
+        QVERIFY(!trie.contains("A/file"));
+        QVERIFY(trie.needsEntriesOf("A"));
+        QVERIFY(!trie.needsEntriesOf("A/sub"));
+
+        // Also when something else below it is marked
+        QVERIFY(trie.insert("A/sub/file"));
+        QVERIFY(trie.intersects("A/file"));
+        QVERIFY(trie.intersects("A/sub/file"));
+        QVERIFY(!trie.intersects("A/sub/other"));
+        QVERIFY(trie.needsEntriesOf("A/sub"));
+    }
+
+    void testCopy()
+    {
+        PathTrie trie{ "A/a1", "B" };
+        PathTrie copy = trie;
+        QVERIFY(copy.remove("B"));
+        QCOMPARE(trie.paths(), QList<QByteArray>({ "A/a1", "B" }));
+        QCOMPARE(copy.paths(), QList<QByteArray>({ "A/a1" }));
+
+        PathTrie moved = std::move(trie);
+        QCOMPARE(moved.size(), 2);
+        QVERIFY(trie.isEmpty());
+        QVERIFY(!trie.isFullRescan());
+        QVERIFY(trie.insert("C"));
+    }
+};
+
+QTEST_APPLESS_MAIN(TestPathTrie)
+#include "testpathtrie.moc"
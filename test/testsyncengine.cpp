@@ -8,6 +8,8 @@
 #include <QtTest>
 #include "syncenginetestutils.h"
 #include <syncengine.h>
+#include "common/checksums.h"
+#include "owncloudpropagator.h"
 
 using namespace OCC;
 
@@ -251,6 +253,46 @@ private slots:
         }
     }
 
+    // Files that the server reports with the checksum of a synced local file are copied
+    void testLocalCopyInsteadOfDownload()
+    {
+        FakeFolder fakeFolder{ FileInfo{} };
+        int nGET = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &) {
+            if (op == QNetworkAccessManager::GetOperation)
+                ++nGET;
+            return nullptr;
+        });
+
+        // printf 'A%.0s' {1..64} | sha1sum -
+        const QByteArray checksum("SHA1:30b86e44e6001403827a62c58b08893e77cf121f");
+        fakeFolder.localModifier().insert("a1", 64, 'A');
+        QVERIFY(fakeFolder.syncOnce());
+
+        // For directly editing the remote checksum
+        FileInfo &remoteInfo = dynamic_cast<FileInfo &>(fakeFolder.remoteModifier());
+
+        // E.g. a copy on the server
+        fakeFolder.remoteModifier().insert("copy", 64, 'A');
+        remoteInfo.find("copy")->checksums = checksum;
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nGET, 0);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        SyncJournalFileRecord record;
+        fakeFolder.syncJournal().getFileRecord(QByteArray("copy"), &record);
+        QCOMPARE(record._checksumHeader, checksum);
+
+        // A local file that changed since it was synced can't be used
+        fakeFolder.localModifier().setContents("a1", 'B');
+        fakeFolder.localModifier().setContents("copy", 'B');
+        fakeFolder.remoteModifier().insert("copy2", 64, 'A');
+        remoteInfo.find("copy2")->checksums = checksum;
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nGET, 1);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
     void testFakeConflict_data()
     {
         QTest::addColumn<bool>("sameMtime");
@@ -335,6 +377,65 @@ private slots:
         QCOMPARE(nGET, expectedGET);
     }
 
+    void testConflictContentComparison_data()
+    {
+        QTest::addColumn<char>("remoteContent");
+        QTest::addColumn<QByteArray>("checksums");
+        QTest::addColumn<bool>("expectConflict");
+
+        QTest::newRow("identical, no server checksum -> no conflict")
+            << 'C' << QByteArray() << false;
+        QTest::newRow("different, no server checksum -> conflict")
+            << 'D' << QByteArray() << true;
+        QTest::newRow("identical, weak server checksum -> no conflict")
+            << 'C' << QByteArray("Adler32:2a2010d") << false;
+        QTest::newRow("different, strong server checksum -> conflict")
+            << 'D' << QByteArray("SHA1:bad") << true;
+    }
+
+    // Once the file was downloaded for a conflict, checksums decide whether it really is one
+    void testConflictContentComparison()
+    {
+        QFETCH(char, remoteContent);
+        QFETCH(QByteArray, checksums);
+        QFETCH(bool, expectConflict);
+
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        int nGET = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &) {
+            if (op == QNetworkAccessManager::GetOperation)
+                ++nGET;
+            return nullptr;
+        });
+
+        // For directly editing the remote checksum
+        FileInfo &remoteInfo = dynamic_cast<FileInfo &>(fakeFolder.remoteModifier());
+
+        // Different mtimes, so the file is downloaded even with a matching weak checksum
+        auto mtime = QDateTime::currentDateTimeUtc().addDays(-4);
+        mtime.setMSecsSinceEpoch(mtime.toMSecsSinceEpoch() / 1000 * 1000);
+        fakeFolder.localModifier().setContents("A/a1", 'C');
+        fakeFolder.localModifier().setModTime("A/a1", mtime);
+        fakeFolder.remoteModifier().setContents("A/a1", remoteContent);
+        fakeFolder.remoteModifier().setModTime("A/a1", mtime.addDays(1));
+        remoteInfo.find("A/a1")->checksums = checksums;
+
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nGET, 1);
+        QCOMPARE(itemDidCompleteSuccessfully(completeSpy, "A/a1"), !expectConflict);
+
+        bool hasConflictFile = false;
+        for (const auto &name : QDir(fakeFolder.localPath() + "A").entryList(QDir::Files))
+            hasConflictFile |= name.contains("_conflict-");
+        QCOMPARE(hasConflictFile, expectConflict);
+
+        // The journal has the checksum of the downloaded content
+        SyncJournalFileRecord a1record;
+        fakeFolder.syncJournal().getFileRecord(QByteArray("A/a1"), &a1record);
+        QCOMPARE(parseChecksumHeaderType(a1record._checksumHeader), contentChecksumType());
+    }
+
     /**
      * Checks whether SyncFileItems have the expected properties before start
      * of propagation.
@@ -595,6 +696,114 @@ private slots:
         QCOMPARE(fakeFolder.syncEngine().lastLocalDiscoveryStyle(), LocalDiscoveryStyle::FilesystemOnly);
     }
 
+    // Check that a partial sync only looks at the touched paths
+    void testPartialSync()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.syncEngine().account()->setServerVersion("10.0.0");
+        fakeFolder.localModifier().mkdir("A/X");
+        fakeFolder.localModifier().insert("A/X/x1");
+        QVERIFY(fakeFolder.syncOnce());
+
+        QStringList propfinds;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation, const QNetworkRequest &request) -> QNetworkReply * {
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) == "PROPFIND")
+                propfinds.append(getFilePathFromUrl(request.url()));
+            return nullptr;
+        });
+
+        fakeFolder.localModifier().insert("A/X/x2");
+        fakeFolder.localModifier().remove("C/c1");
+        // Not touched, so not synced
+        fakeFolder.localModifier().insert("B/b3");
+        fakeFolder.localModifier().remove("A/a1");
+
+        fakeFolder.syncEngine().setLocalDiscoveryOptions(LocalDiscoveryStyle::DatabaseAndFilesystem, { "A/X/x2", "C/c1" });
+        fakeFolder.syncEngine().setPartialSync(fakeFolder.currentRemoteState().etag);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.currentRemoteState().find("A/X/x2"));
+        QVERIFY(!fakeFolder.currentRemoteState().find("C/c1"));
+        QVERIFY(!fakeFolder.currentRemoteState().find("B/b3"));
+        QVERIFY(fakeFolder.currentRemoteState().find("A/a1"));
+        QCOMPARE(propfinds.size(), 1); // only the root, the rest is read from the db
+        QCOMPARE(fakeFolder.syncEngine().isAnotherSyncNeeded(), NoFollowUpSync);
+        // The journal entries that were not looked at are kept
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArray("A/a1"), &record) && record.isValid());
+
+        // A full sync takes care of the rest
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // If the server changed elsewhere, the touched paths are synced and a full sync is requested
+        const QString rootEtag = fakeFolder.currentRemoteState().etag;
+        fakeFolder.remoteModifier().insert("B/remote");
+        fakeFolder.localModifier().insert("A/X/x3");
+        fakeFolder.syncEngine().setLocalDiscoveryOptions(LocalDiscoveryStyle::DatabaseAndFilesystem, { "A/X/x3" });
+        fakeFolder.syncEngine().setPartialSync(rootEtag);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.currentRemoteState().find("A/X/x3"));
+        QVERIFY(!fakeFolder.currentLocalState().find("B/remote"));
+        QCOMPARE(fakeFolder.syncEngine().isAnotherSyncNeeded(), ImmediateFollowUp);
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    // Check that the directories that didn't change aren't read, and that their files are still looked at
+    void testDirectoryModtimesDiscovery()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        auto &journal = fakeFolder.syncJournal();
+        auto syncDirectoryModtimes = [&]() {
+            fakeFolder.syncEngine().setLocalDiscoveryOptions(LocalDiscoveryStyle::DirectoryModtimes);
+            return fakeFolder.syncOnce();
+        };
+        QDateTime oldModtime = QDateTime::currentDateTimeUtc().addSecs(-60);
+
+        // A directory that changed within the last seconds may change again unnoticed
+        QVERIFY(syncDirectoryModtimes());
+        QVERIFY(!journal.getLocalDirListings().contains("A"));
+
+        fakeFolder.localModifier().setModTime("A", oldModtime);
+        QVERIFY(syncDirectoryModtimes());
+        QCOMPARE(fakeFolder.syncEngine().lastLocalDiscoveryStyle(), LocalDiscoveryStyle::DirectoryModtimes);
+        auto listing = journal.getLocalDirListings().value("A");
+        QCOMPARE(listing._entryCount, 2);
+        QCOMPARE(listing._modtime, qint64(Utility::qDateTimeToTime_t(oldModtime)));
+
+        // Edits of the files are found without reading the directory
+        fakeFolder.localModifier().appendByte("A/a1");
+        QVERIFY(syncDirectoryModtimes());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(journal.getLocalDirListings().contains("A"));
+
+        // A new entry changes the modification time, the outdated listing goes away
+        fakeFolder.localModifier().insert("A/a3");
+        QVERIFY(syncDirectoryModtimes());
+        QVERIFY(fakeFolder.currentRemoteState().find("A/a3"));
+        QVERIFY(!journal.getLocalDirListings().contains("A"));
+
+        // Tools like rsync set the modification time back, not the change time
+        fakeFolder.localModifier().setModTime("A", oldModtime);
+        QVERIFY(syncDirectoryModtimes());
+        QVERIFY(journal.getLocalDirListings().value("A")._ctime != 0);
+        fakeFolder.localModifier().insert("A/a4");
+        fakeFolder.localModifier().setModTime("A", oldModtime);
+        QVERIFY(syncDirectoryModtimes());
+        QVERIFY(fakeFolder.currentRemoteState().find("A/a4"));
+
+        // And so does the one of a removed directory
+        fakeFolder.localModifier().setModTime("B", oldModtime);
+        QVERIFY(syncDirectoryModtimes());
+        QVERIFY(journal.getLocalDirListings().contains("B"));
+        fakeFolder.remoteModifier().remove("B");
+        QVERIFY(syncDirectoryModtimes());
+        QVERIFY(!fakeFolder.currentLocalState().find("B"));
+        QVERIFY(!journal.getLocalDirListings().contains("B"));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
     void testDiscoveryHiddenFile()
     {
         FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
@@ -620,6 +829,112 @@ private slots:
         QVERIFY(localFileExists("A/.hidden"));
         QVERIFY(fakeFolder.currentRemoteState().find("B/.hidden"));
     }
+
+    // With the smallest-first policy the transfers of a directory start in order of size
+    void testSchedulingSmallestFirst()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+
+        // Disable parallel uploads to see the order in which the jobs start
+        SyncOptions syncOptions;
+        syncOptions._parallelNetworkJobs = false;
+        syncOptions._schedulingPolicy = SyncOptions::SchedulingPolicy::SmallestFirst;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        QStringList putOrder;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation)
+                putOrder.append(getFilePathFromUrl(request.url()));
+            return nullptr;
+        });
+
+        fakeFolder.localModifier().insert("A/big", 3000);
+        fakeFolder.localModifier().insert("A/medium", 2000);
+        fakeFolder.localModifier().insert("A/small", 1000);
+        fakeFolder.localModifier().remove("A/a1");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(putOrder, QStringList({ "A/small", "A/medium", "A/big" }));
+    }
+
+    void testSmallFileLane()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+
+        SyncOptions syncOptions;
+        syncOptions._smallFileLane = true;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        // The large files come first and their uploads never finish
+        const int largeCount = 6;
+        const int smallCount = 10;
+        for (int i = 0; i < largeCount; ++i)
+            fakeFolder.localModifier().insert(QString("A/big%1").arg(i), 200 * 1024);
+        for (int i = 0; i < smallCount; ++i)
+            fakeFolder.localModifier().insert(QString("A/small%1").arg(i), 100);
+
+        int largePuts = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation && getFilePathFromUrl(request.url()).startsWith("A/big")) {
+                ++largePuts;
+                return new FakeHangingReply(op, request, &fakeFolder.syncEngine());
+            }
+            return nullptr;
+        });
+
+        // Once all small files are uploaded, only the large ones are left hanging
+        int smallDone = 0;
+        connect(&fakeFolder.syncEngine(), &SyncEngine::itemCompleted, [&](const SyncFileItemPtr &item) {
+            if (item->_file.startsWith("A/small") && ++smallDone == smallCount)
+                QTimer::singleShot(0, &fakeFolder.syncEngine(), &SyncEngine::abort);
+        });
+
+        QVERIFY(!fakeFolder.syncOnce());
+        QCOMPARE(smallDone, smallCount);
+        // The large uploads took no more than the regular transfer slots
+        QCOMPARE(largePuts, 3);
+        for (int i = 0; i < smallCount; ++i)
+            QVERIFY(fakeFolder.currentRemoteState().find(QString("A/small%1").arg(i)));
+        QVERIFY(!fakeFolder.currentRemoteState().find("A/big0"));
+
+        // Without the hanging replies the large files are uploaded too
+        fakeFolder.setServerOverride(FakeQNAM::Override());
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testConcurrentSyncs()
+    {
+        FakeFolder fakeFolder1{FileInfo::A12_B12_C12_S12()};
+        FakeFolder fakeFolder2{FileInfo::A12_B12_C12_S12()};
+        fakeFolder1.remoteModifier().insert("A/a0");
+        fakeFolder2.remoteModifier().insert("B/b0");
+
+        bool firstRunning = false;
+        fakeFolder2.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation)
+                firstRunning = fakeFolder1.syncEngine().isSyncRunning();
+            return nullptr;
+        });
+
+        // The second folder syncs completely while the first one propagates
+        bool secondStarted = false;
+        bool secondResult = false;
+        fakeFolder1.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation && !secondStarted) {
+                secondStarted = true;
+                secondResult = fakeFolder2.syncOnce();
+            }
+            return nullptr;
+        });
+
+        QVERIFY(fakeFolder1.syncOnce());
+        QVERIFY(secondStarted);
+        QVERIFY(secondResult);
+        QVERIFY(firstRunning);
+        QCOMPARE(fakeFolder1.currentLocalState(), fakeFolder1.currentRemoteState());
+        QCOMPARE(fakeFolder2.currentLocalState(), fakeFolder2.currentRemoteState());
+    }
 };
 
 QTEST_GUILESS_MAIN(TestSyncEngine)
@@ -167,6 +167,73 @@ private slots:
         QVERIFY(!wipedRecord._valid);
     }
 
+    void testLocalDirStates()
+    {
+        SyncJournalFileRecord record;
+        record._path = "dirstates";
+        record._type = 2; // directory
+        record._inode = 42;
+        record._etag = "abc";
+        record._fileId = "abcd";
+        QVERIFY(_db.setFileRecord(record));
+        record._path = "dirstates/file";
+        record._type = 0;
+        record._inode = 43;
+        QVERIFY(_db.setFileRecord(record));
+        QVERIFY(_db.getDirectoryPaths().contains("dirstates"));
+        QVERIFY(!_db.getDirectoryPaths().contains("dirstates/file"));
+
+        typedef SyncJournalDb::LocalDirState State;
+        State dir;
+        dir._path = "dirstates";
+        dir._inode = 42;
+        dir._modtime = 1500000000123456789LL;
+        State touched;
+        touched._path = "dirstates/file";
+        _db.setLocalDirStates({ dir, touched });
+
+        // They can only be used once
+        auto stored = _db.getAndDeleteLocalDirStates();
+        QCOMPARE(stored.size(), 2);
+        QVERIFY(_db.getAndDeleteLocalDirStates().isEmpty());
+        std::sort(stored.begin(), stored.end(), [](const State &a, const State &b) { return a._path < b._path; });
+        QCOMPARE(stored[0]._path, dir._path);
+        QCOMPARE(stored[0]._inode, dir._inode);
+        QCOMPARE(stored[0]._modtime, dir._modtime);
+        QCOMPARE(stored[1]._path, touched._path);
+        QCOMPARE(stored[1]._inode, quint64(0));
+
+        QVERIFY(_db.deleteFileRecord("dirstates", true));
+    }
+
+    void testDirectoryEntryNames()
+    {
+        SyncJournalFileRecord record;
+        record._etag = "abc";
+        record._fileId = "abcd";
+        for (const char *path : { "entries", "entries/a", "entries/sub", "entries/sub/b", "entries-2", "entries-2/c" }) {
+            record._path = path;
+            QVERIFY(_db.setFileRecord(record));
+        }
+
+        auto names = [&](const QByteArray &path) {
+            std::vector<QByteArray> res;
+            [&] { QVERIFY(_db.getDirectoryEntryNames(path, &res)); }();
+            std::sort(res.begin(), res.end());
+            return res;
+        };
+        QCOMPARE(names("entries"), std::vector<QByteArray>({ "a", "sub" }));
+        QCOMPARE(names("entries/sub"), std::vector<QByteArray>({ "b" }));
+        QCOMPARE(names("entries/a"), std::vector<QByteArray>());
+        const auto root = names("");
+        QVERIFY(std::find(root.begin(), root.end(), "entries") != root.end());
+        QVERIFY(std::find(root.begin(), root.end(), "entries-2") != root.end());
+        QVERIFY(std::find(root.begin(), root.end(), "entries/a") == root.end());
+
+        QVERIFY(_db.deleteFileRecord("entries", true));
+        QVERIFY(_db.deleteFileRecord("entries-2", true));
+    }
+
     void testNumericId()
     {
         SyncJournalFileRecord record;
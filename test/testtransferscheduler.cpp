@@ -0,0 +1,108 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+
+#include "account.h"
+#include "owncloudpropagator.h"
+#include "progressdispatcher.h"
+#include "transferscheduler.h"
+
+using namespace OCC;
+
+class TestTransferScheduler : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase()
+    {
+        qputenv("OWNCLOUD_MAX_PARALLEL", "6");
+        qRegisterMetaType<QVector<TransferShare>>();
+    }
+
+    void testFairShares()
+    {
+        auto account = Account::create();
+        auto scheduler = account->transferScheduler();
+        QCOMPARE(scheduler->budget(), 6);
+        OwncloudPropagator p1(account, "/tmp/p1", "", nullptr);
+        OwncloudPropagator p2(account, "/tmp/p2", "", nullptr);
+        OwncloudPropagator p3(account, "/tmp/p3", "", nullptr);
+
+        // Alone a sync gets everything
+        scheduler->registerPropagator(&p1, false);
+        QCOMPARE(scheduler->slotLimit(&p1), 6);
+
+        // Two background syncs share equally
+        scheduler->registerPropagator(&p2, false);
+        QCOMPARE(scheduler->slotLimit(&p1), 3);
+        QCOMPARE(scheduler->slotLimit(&p2), 3);
+
+        // The unused share of a sync that has nothing to do can be borrowed
+        scheduler->setWaiting(&p2, false);
+        QCOMPARE(scheduler->slotLimit(&p1), 6);
+        QCOMPARE(scheduler->slotLimit(&p2), 3);
+
+        // An interactive sync weighs twice as much: the fair shares are 3, 1 and 1,
+        // and as long as nothing is active each may take the one slot nobody reserved
+        scheduler->setWaiting(&p2, true);
+        scheduler->registerPropagator(&p3, true);
+        QCOMPARE(scheduler->slotLimit(&p3), 4);
+        QCOMPARE(scheduler->slotLimit(&p1), 2);
+        QCOMPARE(scheduler->slotLimit(&p2), 2);
+
+        scheduler->unregisterPropagator(&p3);
+        scheduler->unregisterPropagator(&p2);
+        QCOMPARE(scheduler->slotLimit(&p1), 6);
+        scheduler->unregisterPropagator(&p1);
+    }
+
+    void testBorrowedSlots()
+    {
+        auto account = Account::create();
+        auto scheduler = account->transferScheduler();
+        OwncloudPropagator p1(account, "/tmp/p1", "", nullptr);
+        OwncloudPropagator p2(account, "/tmp/p2", "", nullptr);
+        scheduler->registerPropagator(&p1, false);
+        scheduler->registerPropagator(&p2, false);
+        scheduler->setWaiting(&p2, false);
+
+        QVector<PropagateIgnoreJob *> jobs; // owned by the propagator
+        for (int i = 0; i < 5; ++i) {
+            jobs.append(new PropagateIgnoreJob(&p1, SyncFileItemPtr(new SyncFileItem)));
+            p1.addActiveJob(jobs.last());
+        }
+        QCOMPARE(p1.activeJobCount(), 5);
+        QCOMPARE(scheduler->slotLimit(&p1), 6);
+
+        // Once the other sync wants its share, no more slots are borrowed
+        scheduler->setWaiting(&p2, true);
+        QCOMPARE(scheduler->slotLimit(&p1), 5);
+        QCOMPARE(scheduler->slotLimit(&p2), 3);
+
+        // The shares are published through the progress dispatcher
+        scheduler->setWaiting(&p2, false);
+        QSignalSpy spy(ProgressDispatcher::instance(), &ProgressDispatcher::transferSharesChanged);
+        p1.removeActiveJob(jobs.last());
+        QVERIFY(spy.wait());
+        QCOMPARE(spy.count(), 1);
+        QCOMPARE(spy[0][0].value<Account *>(), account.data());
+        auto shares = spy[0][1].value<QVector<TransferShare>>();
+        QCOMPARE(shares.size(), 2);
+        QCOMPARE(shares[0]._localPath, QString("/tmp/p1/"));
+        QCOMPARE(shares[0]._activeJobs, 4);
+        QCOMPARE(shares[0]._slotLimit, 6);
+        QCOMPARE(shares[1]._activeJobs, 0);
+
+        scheduler->unregisterPropagator(&p1);
+        scheduler->unregisterPropagator(&p2);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestTransferScheduler)
+#include "testtransferscheduler.moc"